@@ -0,0 +1,1423 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <stutils/st_opt.h>
+#include <stutils/st_log.h>
+#include <stutils/st_io.h>
+#include <stutils/st_rand.h>
+#include <stutils/st_string.h>
+#include <stutils/st_mem.h>
+
+#include <connlm/utils.h>
+#include <connlm/vecmath.h>
+#include <connlm/connlm.h>
+#include <connlm/reader.h>
+#include <connlm/driver.h>
+#include <connlm/updaters/wt_updater.h>
+
+#define BENCH_MAX_THREADS 64
+
+/**
+ * Topology presets, selected by name in the topology strings.
+ * The argument after ':' (or def_arg, if not given) substitutes
+ * every '%s' in fmt. A NULL def_arg means HIDDEN_SIZE.
+ */
+typedef struct _bench_topo_preset_t_ {
+    const char *name;
+    const char *def_arg;
+    const char *fmt;
+} bench_topo_preset_t;
+
+static bench_topo_preset_t BENCH_TOPO_PRESETS[] = {
+    {"maxent", "2M",
+        "<component>\n"
+        "property name=maxent\n"
+        "input context=-3,-2,-1\n"
+        "glue name=direct type=direct size=%s in=input out=output\n"
+        "</component>\n"},
+    {"rnn", NULL,
+        "<component>\n"
+        "property name=rnn\n"
+        "input context=-1\n"
+        "layer name=hidden size=%s type=sigmoid\n"
+        "glue name=emb type=emb in=input out=hidden\n"
+        "glue name=recur type=fc in=hidden out=hidden\n"
+        "glue name=out type=out in=hidden out=output\n"
+        "</component>\n"},
+    {"ffnn", NULL,
+        "<component>\n"
+        "property name=ffnn\n"
+        "input context=-2,-1\n"
+        "layer name=emb size=%s type=linear\n"
+        "layer name=hidden size=%s type=tanh\n"
+        "glue name=emb type=emb in=input out=emb combine=concat\n"
+        "glue name=fc type=fc in=emb out=hidden\n"
+        "glue name=out type=out in=hidden out=output\n"
+        "</component>\n"},
+    {"cbow", NULL,
+        "<component>\n"
+        "property name=cbow\n"
+        "input context=-2,-1,1,2\n"
+        "layer name=emb size=%s type=tanh\n"
+        "glue name=emb type=emb in=input out=emb combine=sum\n"
+        "glue name=out type=out in=emb out=output\n"
+        "</component>\n"},
+};
+
+#define BENCH_NUM_PRESETS \
+    (int)(sizeof(BENCH_TOPO_PRESETS) / sizeof(BENCH_TOPO_PRESETS[0]))
+
+char g_topologies[MAX_ST_CONF_LEN];
+int g_threads[BENCH_MAX_THREADS];
+int g_num_threads;
+int g_vocab_size;
+int g_corpus_words;
+int g_sent_len;
+unsigned int g_corpus_seed;
+char g_corpus[MAX_DIR_LEN];
+char g_work_dir[MAX_DIR_LEN];
+int g_hidden_size;
+int g_kernel_batch;
+int g_kernel_out_size;
+int g_step_words;
+double g_min_time;
+bool g_skip_kernels;
+bool g_skip_models;
+
+st_opt_t *g_cmd_opt;
+
+vocab_opt_t g_vocab_opt;
+vocab_learn_opt_t g_lr_opt;
+output_opt_t g_output_opt;
+reader_opt_t g_reader_opt;
+driver_train_opt_t g_train_opt;
+driver_eval_opt_t g_eval_opt;
+param_t g_param;
+
+static int bench_parse_threads(const char *str)
+{
+    const char *p;
+    char *end;
+    long n;
+
+    g_num_threads = 0;
+    p = str;
+    while (*p != '\0') {
+        n = strtol(p, &end, 10);
+        if (end == p || n <= 0 || (*end != ',' && *end != '\0')) {
+            ST_ERROR("Invalid thread list[%s].", str);
+            return -1;
+        }
+        if (g_num_threads >= BENCH_MAX_THREADS) {
+            ST_ERROR("Too many thread counts, at most %d.",
+                    BENCH_MAX_THREADS);
+            return -1;
+        }
+        g_threads[g_num_threads++] = (int)n;
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (g_num_threads == 0) {
+        ST_ERROR("Empty thread list.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int connlm_bench_parse_opt(int *argc, const char *argv[])
+{
+    st_log_opt_t log_opt;
+    char str[MAX_ST_CONF_LEN];
+    bool b;
+
+    g_cmd_opt = st_opt_create();
+    if (g_cmd_opt == NULL) {
+        ST_ERROR("Failed to st_opt_create.");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_opt_parse(g_cmd_opt, argc, argv) < 0) {
+        ST_ERROR("Failed to st_opt_parse.");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_log_load_opt(&log_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to st_log_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_log_open_mt(&log_opt) != 0) {
+        ST_ERROR("Failed to open log");
+        goto ST_OPT_ERR;
+    }
+
+    if (vocab_load_opt(&g_vocab_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to vocab_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (vocab_load_learn_opt(&g_lr_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to vocab_load_learn_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (output_load_opt(&g_output_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to output_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (reader_load_opt(&g_reader_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to reader_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (driver_load_train_opt(&g_train_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to driver_load_train_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (driver_load_eval_opt(&g_eval_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to driver_load_eval_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (param_load(&g_param, g_cmd_opt, NULL, NULL) < 0) {
+        ST_ERROR("Failed to param_load");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_STR(g_cmd_opt, "TOPOLOGIES", g_topologies, MAX_ST_CONF_LEN,
+            "maxent,rnn,ffnn", "Comma separated topologies to be "
+            "benchmarked. Each one is a preset(maxent[:hash-size], "
+            "rnn[:hidden], ffnn[:hidden], cbow[:hidden]) or a topo file");
+
+    ST_OPT_GET_STR(g_cmd_opt, "THREADS", str, MAX_ST_CONF_LEN, "1,2,4",
+            "Comma separated numbers of threads for end-to-end runs");
+    if (bench_parse_threads(str) < 0) {
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_STR(g_cmd_opt, "CORPUS", g_corpus, MAX_DIR_LEN, "",
+            "Text file used for benchmarking. "
+            "A synthetic corpus is generated, if empty");
+
+    ST_OPT_GET_INT(g_cmd_opt, "VOCAB_SIZE", g_vocab_size, 10000,
+            "Number of distinct words in synthetic corpus");
+    if (g_vocab_size <= 0) {
+        ST_ERROR("VOCAB_SIZE must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_INT(g_cmd_opt, "CORPUS_WORDS", g_corpus_words, 200000,
+            "Number of words in synthetic corpus");
+    if (g_corpus_words <= 0) {
+        ST_ERROR("CORPUS_WORDS must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_INT(g_cmd_opt, "SENT_LEN", g_sent_len, 20,
+            "Average sentence length in synthetic corpus");
+    if (g_sent_len <= 0) {
+        ST_ERROR("SENT_LEN must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_UINT(g_cmd_opt, "CORPUS_SEED", g_corpus_seed, 1,
+            "Random seed for synthetic corpus");
+
+    ST_OPT_GET_STR(g_cmd_opt, "WORK_DIR", g_work_dir, MAX_DIR_LEN, "/tmp",
+            "Directory for the synthetic corpus");
+
+    ST_OPT_GET_INT(g_cmd_opt, "HIDDEN_SIZE", g_hidden_size, 128,
+            "Hidden size for kernels and presets");
+    if (g_hidden_size <= 0) {
+        ST_ERROR("HIDDEN_SIZE must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_INT(g_cmd_opt, "KERNEL_BATCH", g_kernel_batch, 32,
+            "Batch size for kernels");
+    if (g_kernel_batch <= 0) {
+        ST_ERROR("KERNEL_BATCH must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_INT(g_cmd_opt, "KERNEL_OUT_SIZE", g_kernel_out_size, 1000,
+            "Output size of matrix kernels");
+    if (g_kernel_out_size <= 0) {
+        ST_ERROR("KERNEL_OUT_SIZE must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_INT(g_cmd_opt, "STEP_WORDS", g_step_words, 50000,
+            "Number of words used in single thread step runs");
+    if (g_step_words <= 0) {
+        ST_ERROR("STEP_WORDS must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_DOUBLE(g_cmd_opt, "MIN_TIME", g_min_time, 0.5,
+            "Minimum seconds spent on each kernel");
+
+    ST_OPT_GET_STR(g_cmd_opt, "ISA", str, MAX_ST_CONF_LEN, "",
+            "Instruction set for vecmath(avx512/avx2/sse2/scalar). "
+            "Selected automatically, if empty");
+    if (str[0] != '\0') {
+        if (vm_set_isa(str) < 0) {
+            ST_ERROR("Failed to vm_set_isa[%s].", str);
+            goto ST_OPT_ERR;
+        }
+    }
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "SKIP_KERNELS", g_skip_kernels, false,
+            "Do not run kernel benchmarks");
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "SKIP_MODELS", g_skip_models, false,
+            "Do not run model benchmarks");
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "help", b, false, "Print help");
+
+    return (b ? 1 : 0);
+
+ST_OPT_ERR:
+    return -1;
+}
+
+void show_usage(const char *module_name)
+{
+    connlm_show_usage(module_name,
+            "Benchmark",
+            "<json-out>",
+            "--topologies=maxent,rnn:256 --threads=1,2,4 exp/bench.json",
+            g_cmd_opt, "Results are written in JSON, "
+            "use '-' as <json-out> for stdout.");
+}
+
+static double bench_now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void bench_json_str(FILE *fp, const char *str)
+{
+    const char *p;
+
+    fputc('"', fp);
+    for (p = str; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+            fputc(*p, fp);
+        } else if ((unsigned char)*p < 0x20) {
+            fprintf(fp, "\\u%04x", (unsigned char)*p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/**
+ * Generate a synthetic corpus, with words drawn from a Zipf distribution
+ * and sentence lengths uniformly drawn in [1, 2 * SENT_LEN - 1].
+ */
+static int bench_gen_corpus(FILE *fp)
+{
+    double *cdf = NULL;
+    double u;
+    int w, lo, hi, mid;
+    int n, len, i;
+
+    cdf = (double *)st_malloc(sizeof(double) * g_vocab_size);
+    if (cdf == NULL) {
+        ST_ERROR("Failed to st_malloc cdf.");
+        goto ERR;
+    }
+
+    cdf[0] = 1.0;
+    for (w = 1; w < g_vocab_size; w++) {
+        cdf[w] = cdf[w - 1] + 1.0 / (w + 1);
+    }
+
+    st_srand(g_corpus_seed);
+    n = 0;
+    while (n < g_corpus_words) {
+        len = 1 + (int)st_random(0, 2 * g_sent_len - 1);
+        len = min(len, 2 * g_sent_len - 1);
+        for (i = 0; i < len; i++) {
+            u = st_random(0, cdf[g_vocab_size - 1]);
+            lo = 0;
+            hi = g_vocab_size - 1;
+            while (lo < hi) {
+                mid = (lo + hi) / 2;
+                if (cdf[mid] < u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (fprintf(fp, i == 0 ? "w%d" : " w%d", lo) < 0) {
+                ST_ERROR("Failed to write corpus.");
+                goto ERR;
+            }
+        }
+        if (fprintf(fp, "\n") < 0) {
+            ST_ERROR("Failed to write corpus.");
+            goto ERR;
+        }
+        n += len;
+    }
+
+    safe_st_free(cdf);
+    return 0;
+
+ERR:
+    safe_st_free(cdf);
+    return -1;
+}
+
+static FILE* bench_open_topo(const char *topo)
+{
+    char name[MAX_ST_CONF_LEN];
+    const char *arg;
+    char hidden[MAX_ST_CONF_LEN];
+    FILE *fp = NULL;
+    int i;
+
+    arg = strchr(topo, ':');
+    if (arg == NULL) {
+        snprintf(name, MAX_ST_CONF_LEN, "%s", topo);
+    } else {
+        snprintf(name, min(MAX_ST_CONF_LEN, (int)(arg - topo) + 1),
+                "%s", topo);
+        arg++;
+    }
+
+    for (i = 0; i < BENCH_NUM_PRESETS; i++) {
+        if (strcasecmp(name, BENCH_TOPO_PRESETS[i].name) != 0) {
+            continue;
+        }
+
+        if (arg == NULL) {
+            if (BENCH_TOPO_PRESETS[i].def_arg == NULL) {
+                snprintf(hidden, MAX_ST_CONF_LEN, "%d", g_hidden_size);
+                arg = hidden;
+            } else {
+                arg = BENCH_TOPO_PRESETS[i].def_arg;
+            }
+        }
+
+        fp = tmpfile();
+        if (fp == NULL) {
+            ST_ERROR("Failed to tmpfile.");
+            return NULL;
+        }
+        fprintf(fp, BENCH_TOPO_PRESETS[i].fmt, arg, arg);
+        rewind(fp);
+
+        return fp;
+    }
+
+    fp = st_fopen(topo, "rb");
+    if (fp == NULL) {
+        ST_ERROR("Neither a preset nor a topo file[%s].", topo);
+        return NULL;
+    }
+
+    return fp;
+}
+
+static connlm_t* bench_build_model(connlm_t *base, const char *topo)
+{
+    connlm_t *connlm = NULL;
+    FILE *fp = NULL;
+
+    fp = bench_open_topo(topo);
+    if (fp == NULL) {
+        ST_ERROR("Failed to bench_open_topo.");
+        goto ERR;
+    }
+
+    connlm = connlm_new(base->vocab, base->output, NULL, -1);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to connlm_new.");
+        goto ERR;
+    }
+
+    if (connlm_init(connlm, fp) < 0) {
+        ST_ERROR("Failed to connlm_init.");
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+
+    if (connlm_load_train_opt(connlm, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to connlm_load_train_opt");
+        goto ERR;
+    }
+
+    return connlm;
+
+ERR:
+    safe_st_fclose(fp);
+    safe_connlm_destroy(connlm);
+    return NULL;
+}
+
+/**
+ * Buffers shared by kernels.
+ * Denote KERNEL_BATCH by B, HIDDEN_SIZE by H and KERNEL_OUT_SIZE by O.
+ */
+typedef struct _bench_data_t_ {
+    mat_t in; /**< input, [B x H]. */
+    mat_t wt; /**< weight, [O x H]. */
+    vec_t bias; /**< bias, [O]. */
+    mat_t out; /**< output, [B x O]. */
+    mat_t ac; /**< activation, [B x H]. */
+    bmat_t keep_mask; /**< dropout mask, [B x H]. */
+    unsigned int rand_seed; /**< seed for dropout mask. */
+    wt_updater_t *wt_updater; /**< updater of wt. */
+
+    output_t *output; /**< output tree. */
+    int *words; /**< words walked through the output tree. */
+    int num_words; /**< number of words. */
+
+    FILE *text_fp; /**< corpus to be parsed. */
+    vocab_t *vocab; /**< vocab. */
+    word_pool_t wp; /**< word pool for parsing. */
+    count_t num_parsed; /**< number of words parsed in last run. */
+
+    count_t sink; /**< keeps results alive from the optimizer. */
+} bench_data_t;
+
+typedef int (*bench_kernel_t)(bench_data_t *data);
+
+static int bench_add_mat_mat_fwd(bench_data_t *data)
+{
+    return add_mat_mat(1.0, &data->in, MT_NoTrans,
+            &data->wt, MT_Trans, 0.0, &data->out);
+}
+
+static int bench_add_mat_mat_bwd(bench_data_t *data)
+{
+    return add_mat_mat(1e-6, &data->out, MT_Trans,
+            &data->in, MT_NoTrans, 1.0, &data->wt);
+}
+
+static int bench_matXvec(bench_data_t *data)
+{
+    matXvec(data->out.vals, data->wt.vals, data->in.vals,
+            data->wt.num_rows, data->wt.num_cols, 1e-6);
+    return 0;
+}
+
+/* activations are in-place, so the input is restored before each call. */
+static int bench_restore_ac(bench_data_t *data)
+{
+    return mat_cpy(&data->ac, &data->in);
+}
+
+static int bench_sigmoid(bench_data_t *data)
+{
+    if (bench_restore_ac(data) < 0) {
+        return -1;
+    }
+    vm_sigmoid(data->ac.vals, data->ac.num_rows * data->ac.stride);
+    return 0;
+}
+
+static int bench_tanh(bench_data_t *data)
+{
+    if (bench_restore_ac(data) < 0) {
+        return -1;
+    }
+    vm_tanh(data->ac.vals, data->ac.num_rows * data->ac.stride);
+    return 0;
+}
+
+static int bench_exp(bench_data_t *data)
+{
+    if (bench_restore_ac(data) < 0) {
+        return -1;
+    }
+    vm_exp(data->ac.vals, data->ac.num_rows * data->ac.stride);
+    return 0;
+}
+
+static int bench_softmax(bench_data_t *data)
+{
+    size_t i;
+
+    if (bench_restore_ac(data) < 0) {
+        return -1;
+    }
+    for (i = 0; i < data->ac.num_rows; i++) {
+        vm_softmax(MAT_VALP(&data->ac, i, 0), data->ac.num_cols);
+    }
+    return 0;
+}
+
+static int bench_dropout(bench_data_t *data)
+{
+    if (bmat_rand(&data->keep_mask, 0.5, &data->rand_seed) < 0) {
+        return -1;
+    }
+    return mat_mask_scale(&data->in, &data->keep_mask, 2.0, &data->ac);
+}
+
+static int bench_wt_update(bench_data_t *data)
+{
+    return wt_update(data->wt_updater, &data->out, 1e-6,
+            &data->in, 1.0, NULL, NULL);
+}
+
+static int bench_tree_walk(bench_data_t *data)
+{
+    output_step_t *step;
+    int i;
+
+    for (i = 0; i < data->num_words; i++) {
+        output_path_for_each_step(data->output, data->words[i], step) {
+            data->sink += step->child_e - step->child_s;
+        }
+    }
+
+    return 0;
+}
+
+static int bench_parse(bench_data_t *data)
+{
+    rewind(data->text_fp);
+    data->num_parsed = 0;
+    while (true) {
+        if (word_pool_read(&data->wp, g_reader_opt.epoch_size,
+                    data->text_fp, data->vocab, NULL,
+                    g_reader_opt.drop_empty_line) < 0) {
+            ST_ERROR("Failed to word_pool_read.");
+            return -1;
+        }
+        if (data->wp.sent_ends.size == 0) {
+            break;
+        }
+        if (word_pool_build_mini_batch(&data->wp,
+                    g_reader_opt.mini_batch) < 0) {
+            ST_ERROR("Failed to word_pool_build_mini_batch.");
+            return -1;
+        }
+        data->num_parsed += data->wp.words.size;
+    }
+
+    return 0;
+}
+
+static int bench_kernel(FILE *fp, int *n_out, const char *name,
+        bench_kernel_t kernel, bench_data_t *data,
+        double flops, double items)
+{
+    double start, secs;
+    long iters, n, i;
+
+    ST_CHECK_PARAM(fp == NULL || n_out == NULL || kernel == NULL, -1);
+
+    /* warm up */
+    if (kernel(data) < 0) {
+        ST_ERROR("Failed to run kernel[%s].", name);
+        return -1;
+    }
+
+    iters = 0;
+    n = 1;
+    start = bench_now();
+    do {
+        for (i = 0; i < n; i++) {
+            if (kernel(data) < 0) {
+                ST_ERROR("Failed to run kernel[%s].", name);
+                return -1;
+            }
+        }
+        iters += n;
+        n *= 2;
+        secs = bench_now() - start;
+    } while (secs < g_min_time);
+
+    ST_NOTICE("Kernel[%s]: %ld iters in %.3fs, %.3f us/iter",
+            name, iters, secs, secs / iters * 1000000.0);
+
+    fprintf(fp, "%s\n    {\"name\": ", (*n_out)++ > 0 ? "," : "");
+    bench_json_str(fp, name);
+    fprintf(fp, ", \"iters\": %ld, \"secs\": %.6f, \"usec_per_iter\": %.3f",
+            iters, secs, secs / iters * 1000000.0);
+    if (flops > 0) {
+        fprintf(fp, ", \"gflops\": %.3f", flops * iters / secs / 1e9);
+    }
+    if (items > 0) {
+        fprintf(fp, ", \"items_per_sec\": %.1f", items * iters / secs);
+    }
+    fprintf(fp, "}");
+
+    return 0;
+}
+
+static void bench_rand_mat(mat_t *mat, real_t scale)
+{
+    size_t i, j;
+
+    for (i = 0; i < mat->num_rows; i++) {
+        for (j = 0; j < mat->num_cols; j++) {
+            MAT_VAL(mat, i, j) = st_random(-scale, scale);
+        }
+    }
+}
+
+static int bench_kernels(FILE *fp, connlm_t *base, word_pool_t *wps,
+        int num_wps, const char *corpus)
+{
+    bench_data_t data;
+    double B, H, O;
+    int n_out = 0;
+    int i, j;
+
+    memset(&data, 0, sizeof(bench_data_t));
+
+    B = g_kernel_batch;
+    H = g_hidden_size;
+    O = g_kernel_out_size;
+
+    if (mat_resize(&data.in, g_kernel_batch, g_hidden_size, 0.0) < 0
+            || mat_resize(&data.ac, g_kernel_batch, g_hidden_size, 0.0) < 0
+            || mat_resize(&data.wt, g_kernel_out_size,
+                g_hidden_size, 0.0) < 0
+            || mat_resize(&data.out, g_kernel_batch,
+                g_kernel_out_size, 0.0) < 0
+            || vec_resize(&data.bias, g_kernel_out_size, 0.0) < 0
+            || bmat_resize(&data.keep_mask, g_kernel_batch,
+                g_hidden_size) < 0) {
+        ST_ERROR("Failed to resize kernel buffers.");
+        goto ERR;
+    }
+    st_srand(g_corpus_seed);
+    data.rand_seed = g_corpus_seed;
+    bench_rand_mat(&data.in, 4.0);
+    bench_rand_mat(&data.wt, 0.1);
+    bench_rand_mat(&data.out, 0.1);
+
+    data.wt_updater = wt_updater_create(&g_param, &data.wt, &data.bias,
+            WT_UT_FULL);
+    if (data.wt_updater == NULL) {
+        ST_ERROR("Failed to wt_updater_create.");
+        goto ERR;
+    }
+
+    data.output = base->output;
+    for (i = 0; i < num_wps; i++) {
+        data.num_words += wps[i].words.size;
+    }
+    data.words = (int *)st_malloc(sizeof(int) * (data.num_words + 1));
+    if (data.words == NULL) {
+        ST_ERROR("Failed to st_malloc words.");
+        goto ERR;
+    }
+    data.num_words = 0;
+    for (i = 0; i < num_wps; i++) {
+        for (j = 0; j < wps[i].words.size; j++) {
+            if (VEC_VAL(&wps[i].words, j) >= 0 && VEC_VAL(&wps[i].words, j)
+                    < base->output->output_size) {
+                data.words[data.num_words++] = VEC_VAL(&wps[i].words, j);
+            }
+        }
+    }
+
+    data.vocab = base->vocab;
+    data.text_fp = st_fopen(corpus, "rb");
+    if (data.text_fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", corpus);
+        goto ERR;
+    }
+
+    /* count the words to be parsed. */
+    if (bench_parse(&data) < 0) {
+        ST_ERROR("Failed to bench_parse.");
+        goto ERR;
+    }
+
+    fprintf(fp, "  \"kernels\": [");
+
+    if (bench_kernel(fp, &n_out, "add_mat_mat_fwd", bench_add_mat_mat_fwd,
+                &data, 2 * B * H * O, 0) < 0
+            || bench_kernel(fp, &n_out, "add_mat_mat_bwd",
+                bench_add_mat_mat_bwd, &data, 2 * B * H * O, 0) < 0
+            || bench_kernel(fp, &n_out, "matXvec", bench_matXvec,
+                &data, 2 * H * O, 0) < 0
+            || bench_kernel(fp, &n_out, "vm_sigmoid", bench_sigmoid,
+                &data, 0, B * H) < 0
+            || bench_kernel(fp, &n_out, "vm_tanh", bench_tanh,
+                &data, 0, B * H) < 0
+            || bench_kernel(fp, &n_out, "vm_exp", bench_exp,
+                &data, 0, B * H) < 0
+            || bench_kernel(fp, &n_out, "vm_softmax", bench_softmax,
+                &data, 0, B * H) < 0
+            || bench_kernel(fp, &n_out, "dropout", bench_dropout,
+                &data, 0, B * H) < 0
+            || bench_kernel(fp, &n_out, "wt_update", bench_wt_update,
+                &data, 2 * B * H * O, 0) < 0
+            || bench_kernel(fp, &n_out, "output_tree_walk", bench_tree_walk,
+                &data, 0, data.num_words) < 0
+            || bench_kernel(fp, &n_out, "reader_parse", bench_parse,
+                &data, 0, data.num_parsed) < 0) {
+        goto ERR;
+    }
+
+    fprintf(fp, "\n  ],\n");
+
+    safe_st_fclose(data.text_fp);
+    word_pool_destroy(&data.wp);
+    safe_st_free(data.words);
+    safe_wt_updater_destroy(data.wt_updater);
+    mat_destroy(&data.in);
+    mat_destroy(&data.ac);
+    bmat_destroy(&data.keep_mask);
+    mat_destroy(&data.wt);
+    mat_destroy(&data.out);
+    vec_destroy(&data.bias);
+
+    return 0;
+
+ERR:
+    safe_st_fclose(data.text_fp);
+    word_pool_destroy(&data.wp);
+    safe_st_free(data.words);
+    safe_wt_updater_destroy(data.wt_updater);
+    mat_destroy(&data.in);
+    mat_destroy(&data.ac);
+    bmat_destroy(&data.keep_mask);
+    mat_destroy(&data.wt);
+    mat_destroy(&data.out);
+    vec_destroy(&data.bias);
+
+    return -1;
+}
+
+static int bench_read_pools(const char *corpus, vocab_t *vocab,
+        word_pool_t **wps, int *num_wps)
+{
+    FILE *fp = NULL;
+    word_pool_t *wp;
+    int n;
+
+    ST_CHECK_PARAM(corpus == NULL || vocab == NULL || wps == NULL
+            || num_wps == NULL, -1);
+
+    fp = st_fopen(corpus, "rb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", corpus);
+        goto ERR;
+    }
+
+    n = 0;
+    while (n < g_step_words) {
+        *wps = (word_pool_t *)st_realloc(*wps,
+                sizeof(word_pool_t) * (*num_wps + 1));
+        if (*wps == NULL) {
+            ST_ERROR("Failed to st_realloc wps.");
+            goto ERR;
+        }
+        wp = *wps + *num_wps;
+        memset(wp, 0, sizeof(word_pool_t));
+        (*num_wps)++;
+
+        if (word_pool_read(wp, g_reader_opt.epoch_size, fp, vocab,
+                    NULL, g_reader_opt.drop_empty_line) < 0) {
+            ST_ERROR("Failed to word_pool_read.");
+            goto ERR;
+        }
+        if (wp->sent_ends.size == 0) {
+            word_pool_destroy(wp);
+            (*num_wps)--;
+            break;
+        }
+        if (word_pool_build_mini_batch(wp, g_reader_opt.mini_batch) < 0) {
+            ST_ERROR("Failed to word_pool_build_mini_batch.");
+            goto ERR;
+        }
+        n += wp->words.size;
+    }
+
+    safe_st_fclose(fp);
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    return -1;
+}
+
+static int bench_updater_steps(updater_t *updater, count_t *num_words)
+{
+    int i;
+
+    while (updater_steppable(updater)) {
+        if (updater_step(updater) < 0) {
+            ST_ERROR("Failed to updater_step.");
+            return -1;
+        }
+
+        for (i = 0; i < updater->targets.size; i++) {
+            if (VEC_VAL(&updater->targets, i) != PADDING_ID) {
+                ++(*num_words);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void bench_json_rate(FILE *fp, count_t num_words, double secs)
+{
+    fprintf(fp, "\"words\": " COUNT_FMT ", \"secs\": %.6f, "
+            "\"words_per_sec\": %.1f", num_words, secs, num_words / secs);
+}
+
+/**
+ * Run a model through pre-read word pools in a single thread,
+ * without the reader and driver, i.e. the cost of computation only.
+ */
+static int bench_step(FILE *fp, connlm_t *base, const char *topo,
+        word_pool_t *wps, int num_wps, bool backprop)
+{
+    connlm_t *connlm = NULL;
+    updater_t *updater = NULL;
+    count_t num_words;
+    double start, secs;
+    int i;
+
+    connlm = bench_build_model(base, topo);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to bench_build_model.");
+        goto ERR;
+    }
+
+    if (connlm_setup(connlm) < 0) {
+        ST_ERROR("Failed to connlm_setup.");
+        goto ERR;
+    }
+
+    updater = updater_create(connlm);
+    if (updater == NULL) {
+        ST_ERROR("Failed to updater_create.");
+        goto ERR;
+    }
+
+    if (backprop) {
+        if (updater_set_rand_seed(updater, g_train_opt.rand_seed) < 0) {
+            ST_ERROR("Failed to updater_set_rand_seed.");
+            goto ERR;
+        }
+        if (updater_set_nce(updater, g_train_opt.nce_samples, false) < 0) {
+            ST_ERROR("Failed to updater_set_nce.");
+            goto ERR;
+        }
+    } else {
+        if (updater_set_nce(updater, 0, g_eval_opt.self_norm) < 0) {
+            ST_ERROR("Failed to updater_set_nce.");
+            goto ERR;
+        }
+    }
+
+    if (updater_setup(updater, backprop) < 0) {
+        ST_ERROR("Failed to updater_setup.");
+        goto ERR;
+    }
+
+    num_words = 0;
+    start = bench_now();
+    for (i = 0; i < num_wps; i++) {
+        if (updater_feed(updater, wps + i) < 0) {
+            ST_ERROR("Failed to updater_feed.");
+            goto ERR;
+        }
+        if (bench_updater_steps(updater, &num_words) < 0) {
+            ST_ERROR("Failed to bench_updater_steps.");
+            goto ERR;
+        }
+    }
+
+    if (updater_finalize(updater) < 0) {
+        ST_ERROR("Failed to updater_finalize.");
+        goto ERR;
+    }
+    if (bench_updater_steps(updater, &num_words) < 0) {
+        ST_ERROR("Failed to bench_updater_steps.");
+        goto ERR;
+    }
+    if (backprop) {
+        if (updater_finish(updater) < 0) {
+            ST_ERROR("Failed to updater_finish.");
+            goto ERR;
+        }
+    }
+    secs = bench_now() - start;
+
+    ST_NOTICE("Step[%s/%s]: " COUNT_FMT " words in %.3fs, words/sec: %.1f",
+            topo, backprop ? "backprop" : "forward", num_words, secs,
+            num_words / secs);
+
+    fprintf(fp, "\"%s\": {", backprop ? "backprop" : "forward");
+    bench_json_rate(fp, num_words, secs);
+    fprintf(fp, "}");
+
+    safe_updater_destroy(updater);
+    safe_connlm_destroy(connlm);
+
+    return 0;
+
+ERR:
+    safe_updater_destroy(updater);
+    safe_connlm_destroy(connlm);
+
+    return -1;
+}
+
+/**
+ * Run a model end-to-end through reader and driver, as connlm-train
+ * and connlm-eval do.
+ */
+static int bench_driver(FILE *fp, connlm_t *base, const char *topo,
+        const char *corpus, int n_thr, driver_mode_t mode)
+{
+    connlm_t *connlm = NULL;
+    reader_t *reader = NULL;
+    driver_t *driver = NULL;
+    count_t num_words;
+    double start, secs;
+
+    connlm = bench_build_model(base, topo);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to bench_build_model.");
+        goto ERR;
+    }
+
+    reader = reader_create(&g_reader_opt, n_thr, connlm->vocab, corpus);
+    if (reader == NULL) {
+        ST_ERROR("Failed to reader_create.");
+        goto ERR;
+    }
+
+    driver = driver_create(connlm, reader, n_thr);
+    if (driver == NULL) {
+        ST_ERROR("Failed to driver_create.");
+        goto ERR;
+    }
+
+    if (mode == DRIVER_TRAIN) {
+        if (driver_set_train(driver, &g_train_opt) < 0) {
+            ST_ERROR("Failed to driver_set_train.");
+            goto ERR;
+        }
+    } else {
+        if (driver_set_eval(driver, &g_eval_opt, NULL) < 0) {
+            ST_ERROR("Failed to driver_set_eval.");
+            goto ERR;
+        }
+    }
+
+    if (driver_setup(driver, mode) < 0) {
+        ST_ERROR("Failed to driver_setup.");
+        goto ERR;
+    }
+
+    start = bench_now();
+    if (driver_run(driver) < 0) {
+        ST_ERROR("Failed to driver_run.");
+        goto ERR;
+    }
+    secs = bench_now() - start;
+    num_words = reader->num_words;
+
+    ST_NOTICE("Driver[%s/%s/%d]: " COUNT_FMT " words in %.3fs, "
+            "words/sec: %.1f", topo, mode == DRIVER_TRAIN ? "train" : "eval",
+            n_thr, num_words, secs, num_words / secs);
+
+    fprintf(fp, "{\"threads\": %d, ", n_thr);
+    bench_json_rate(fp, num_words, secs);
+    fprintf(fp, "}");
+
+    safe_driver_destroy(driver);
+    safe_reader_destroy(reader);
+    safe_connlm_destroy(connlm);
+
+    return 0;
+
+ERR:
+    safe_driver_destroy(driver);
+    safe_reader_destroy(reader);
+    safe_connlm_destroy(connlm);
+
+    return -1;
+}
+
+static int bench_model(FILE *fp, connlm_t *base, const char *topo,
+        word_pool_t *wps, int num_wps, const char *corpus)
+{
+    driver_mode_t modes[] = {DRIVER_TRAIN, DRIVER_EVAL};
+    int m, t;
+
+    fprintf(fp, "    {\"topology\": ");
+    bench_json_str(fp, topo);
+
+    fprintf(fp, ",\n     \"step\": {");
+    if (bench_step(fp, base, topo, wps, num_wps, false) < 0) {
+        ST_ERROR("Failed to bench_step forward.");
+        return -1;
+    }
+    fprintf(fp, ", ");
+    if (bench_step(fp, base, topo, wps, num_wps, true) < 0) {
+        ST_ERROR("Failed to bench_step backprop.");
+        return -1;
+    }
+    fprintf(fp, "}");
+
+    for (m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        fprintf(fp, ",\n     \"%s\": [",
+                modes[m] == DRIVER_TRAIN ? "train" : "eval");
+        for (t = 0; t < g_num_threads; t++) {
+            if (t > 0) {
+                fprintf(fp, ", ");
+            }
+            if (bench_driver(fp, base, topo, corpus, g_threads[t],
+                        modes[m]) < 0) {
+                ST_ERROR("Failed to bench_driver.");
+                return -1;
+            }
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "}");
+
+    return 0;
+}
+
+/**
+ * Call func for every topology in g_topologies.
+ */
+static int bench_for_each_topo(int (*func)(const char *topo, void *args),
+        void *args)
+{
+    char topos[MAX_ST_CONF_LEN];
+    char *topo;
+    char *saveptr = NULL;
+
+    snprintf(topos, MAX_ST_CONF_LEN, "%s", g_topologies);
+    for (topo = strtok_r(topos, ",", &saveptr); topo != NULL;
+            topo = strtok_r(NULL, ",", &saveptr)) {
+        if (func(topo, args) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+typedef struct _bench_models_args_t_ {
+    FILE *fp;
+    connlm_t *base;
+    word_pool_t *wps;
+    int num_wps;
+    const char *corpus;
+    int n_out;
+} bench_models_args_t;
+
+static int bench_check_topo(const char *topo, void *args)
+{
+    connlm_t *connlm;
+
+    connlm = bench_build_model((connlm_t *)args, topo);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to build model for topology[%s].", topo);
+        return -1;
+    }
+    safe_connlm_destroy(connlm);
+
+    return 0;
+}
+
+static int bench_model_topo(const char *topo, void *args)
+{
+    bench_models_args_t *ma = (bench_models_args_t *)args;
+
+    if (ma->n_out++ > 0) {
+        fprintf(ma->fp, ",\n");
+    }
+
+    if (bench_model(ma->fp, ma->base, topo, ma->wps, ma->num_wps,
+                ma->corpus) < 0) {
+        ST_ERROR("Failed to bench_model[%s].", topo);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    char args[1024] = "";
+    char corpus[MAX_DIR_LEN] = "";
+    const char *files[1];
+    bool tmp_corpus = false;
+    FILE *fp = NULL;
+    FILE *fp_json = NULL;
+    int fd;
+
+    vocab_t *vocab = NULL;
+    output_t *output = NULL;
+    connlm_t *base = NULL;
+    word_pool_t *wps = NULL;
+    int num_wps = 0;
+    bench_models_args_t ma;
+
+    int ret;
+    int i;
+
+    if (st_mem_usage_init() < 0) {
+        ST_ERROR("Failed to st_mem_usage_init.");
+        goto ERR;
+    }
+
+    (void)st_escape_args(argc, argv, args, 1024);
+
+    ret = connlm_bench_parse_opt(&argc, argv);
+    if (ret < 0) {
+        goto ERR;
+    } if (ret == 1) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    if (strcmp(connlm_revision(), CONNLM_GIT_COMMIT) != 0) {
+        ST_WARNING("Binary revision[%s] not match with library[%s].",
+                CONNLM_GIT_COMMIT, connlm_revision());
+    }
+
+    if (argc != 2) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    ST_CLEAN("Command-line: %s", args);
+    ST_CLEAN("Json-out: '%s'", argv[1]);
+
+#ifdef _USE_BLAS_
+    if (setup_blas()) {
+        ST_ERROR("Failed to setup_blas.");
+        goto ERR;
+    }
+#endif
+
+    if (g_corpus[0] != '\0') {
+        if (snprintf(corpus, MAX_DIR_LEN, "%s", g_corpus) >= MAX_DIR_LEN) {
+            ST_ERROR("Too long corpus path[%s].", g_corpus);
+            goto ERR;
+        }
+    } else {
+        ST_NOTICE("Generating synthetic corpus...");
+        if (snprintf(corpus, MAX_DIR_LEN, "%s/connlm-bench.XXXXXX",
+                    g_work_dir) >= MAX_DIR_LEN) {
+            ST_ERROR("Too long work dir[%s].", g_work_dir);
+            goto ERR;
+        }
+        fd = mkstemp(corpus);
+        if (fd < 0) {
+            ST_ERROR("Failed to mkstemp. [%s]", corpus);
+            goto ERR;
+        }
+        tmp_corpus = true;
+
+        fp = fdopen(fd, "w");
+        if (fp == NULL) {
+            ST_ERROR("Failed to fdopen. [%s]", corpus);
+            close(fd);
+            goto ERR;
+        }
+
+        if (bench_gen_corpus(fp) < 0) {
+            ST_ERROR("Failed to bench_gen_corpus.");
+            goto ERR;
+        }
+        safe_st_fclose(fp);
+    }
+
+    ST_NOTICE("Learning vocab...");
+    vocab = vocab_create(&g_vocab_opt);
+    if (vocab == NULL) {
+        ST_ERROR("Failed to vocab_create.");
+        goto ERR;
+    }
+
+    files[0] = corpus;
+    if (vocab_learn_files(vocab, files, 1, &g_lr_opt) < 0) {
+        ST_ERROR("Failed to vocab_learn_files.");
+        goto ERR;
+    }
+
+    ST_NOTICE("Generating Output Layer...");
+    output = output_generate(&g_output_opt, vocab->cnts,
+            vocab->vocab_size - 1/* <s> */);
+    if (output == NULL) {
+        ST_ERROR("Failed to output_generate.");
+        goto ERR;
+    }
+
+    base = connlm_new(vocab, output, NULL, -1);
+    if (base == NULL) {
+        ST_ERROR("Failed to connlm_new.");
+        goto ERR;
+    }
+
+    if (connlm_setup(base) < 0) {
+        ST_ERROR("Failed to connlm_setup.");
+        goto ERR;
+    }
+
+    /* build every topology once, so that bad topologies and options
+     * are reported before any benchmark runs. */
+    if (bench_for_each_topo(bench_check_topo, base) < 0) {
+        ST_ERROR("Failed to check topologies.");
+        goto ERR;
+    }
+
+    if (! st_opt_check(g_cmd_opt)) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    st_opt_show(g_cmd_opt, "connLM Bench Options");
+
+    if (bench_read_pools(corpus, base->vocab, &wps, &num_wps) < 0) {
+        ST_ERROR("Failed to bench_read_pools.");
+        goto ERR;
+    }
+
+    if (strcmp(argv[1], "-") == 0) {
+        fp_json = stdout;
+    } else {
+        fp_json = st_fopen(argv[1], "w");
+        if (fp_json == NULL) {
+            ST_ERROR("Failed to st_fopen. [%s]", argv[1]);
+            goto ERR;
+        }
+    }
+
+    fprintf(fp_json, "{\n  \"version\": ");
+    bench_json_str(fp_json, CONNLM_VERSION);
+    fprintf(fp_json, ",\n  \"revision\": ");
+    bench_json_str(fp_json, connlm_revision());
+    fprintf(fp_json, ",\n  \"real_type\": \"%s\"",
+            (sizeof(real_t) == sizeof(double)) ? "double" : "float");
+    fprintf(fp_json, ",\n  \"isa\": ");
+    bench_json_str(fp_json, vm_isa());
+#ifdef _USE_BLAS_
+    fprintf(fp_json, ",\n  \"blas\": true");
+#else
+    fprintf(fp_json, ",\n  \"blas\": false");
+#endif
+    fprintf(fp_json, ",\n  \"cpus\": %ld", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(fp_json, ",\n  \"corpus\": {\"vocab_size\": %d, "
+            "\"output_size\": %d, \"synthetic\": %s},\n",
+            base->vocab->vocab_size, base->output->output_size,
+            tmp_corpus ? "true" : "false");
+
+    if (! g_skip_kernels) {
+        fprintf(fp_json, "  \"shapes\": {\"batch\": %d, \"hidden\": %d, "
+                "\"out\": %d},\n", g_kernel_batch, g_hidden_size,
+                g_kernel_out_size);
+        if (bench_kernels(fp_json, base, wps, num_wps, corpus) < 0) {
+            ST_ERROR("Failed to bench_kernels.");
+            goto ERR;
+        }
+    }
+
+    fprintf(fp_json, "  \"models\": [\n");
+    if (! g_skip_models) {
+        ma.fp = fp_json;
+        ma.base = base;
+        ma.wps = wps;
+        ma.num_wps = num_wps;
+        ma.corpus = corpus;
+        ma.n_out = 0;
+        if (bench_for_each_topo(bench_model_topo, &ma) < 0) {
+            ST_ERROR("Failed to bench models.");
+            goto ERR;
+        }
+        fprintf(fp_json, "\n");
+    }
+    fprintf(fp_json, "  ]\n}\n");
+
+    if (fp_json != stdout) {
+        safe_st_fclose(fp_json);
+    }
+    if (tmp_corpus) {
+        (void)remove(corpus);
+    }
+    for (i = 0; i < num_wps; i++) {
+        word_pool_destroy(wps + i);
+    }
+    safe_st_free(wps);
+    safe_connlm_destroy(base);
+    safe_output_destroy(output);
+    safe_vocab_destroy(vocab);
+    safe_st_opt_destroy(g_cmd_opt);
+
+    st_mem_usage_report();
+    st_mem_usage_destroy();
+    st_log_close(0);
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    if (fp_json != NULL && fp_json != stdout) {
+        safe_st_fclose(fp_json);
+    }
+    if (tmp_corpus) {
+        (void)remove(corpus);
+    }
+    for (i = 0; i < num_wps; i++) {
+        word_pool_destroy(wps + i);
+    }
+    safe_st_free(wps);
+    safe_connlm_destroy(base);
+    safe_output_destroy(output);
+    safe_vocab_destroy(vocab);
+    safe_st_opt_destroy(g_cmd_opt);
+
+    st_mem_usage_destroy();
+    st_log_close(1);
+    return -1;
+}
@@ -0,0 +1,196 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <stutils/st_opt.h>
+#include <stutils/st_log.h>
+#include <stutils/st_io.h>
+#include <stutils/st_string.h>
+#include <stutils/st_mem.h>
+
+#include <connlm/utils.h>
+#include <connlm/connlm.h>
+#include <connlm/corpus.h>
+
+st_opt_t *g_cmd_opt;
+
+bool g_drop_empty_line;
+
+int connlm_compile_corpus_parse_opt(int *argc, const char *argv[])
+{
+    st_log_opt_t log_opt;
+    bool b;
+
+    g_cmd_opt = st_opt_create();
+    if (g_cmd_opt == NULL) {
+        ST_ERROR("Failed to st_opt_create.");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_opt_parse(g_cmd_opt, argc, argv) < 0) {
+        ST_ERROR("Failed to st_opt_parse.");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_log_load_opt(&log_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to st_log_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_log_open(&log_opt) != 0) {
+        ST_ERROR("Failed to open log");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "DROP_EMPTY_LINE", g_drop_empty_line, true,
+            "whether drop empty lines in text");
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "help", b, false, "Print help");
+
+    return (b ? 1 : 0);
+
+ST_OPT_ERR:
+    return -1;
+}
+
+void show_usage(const char *module_name)
+{
+    connlm_show_usage(module_name,
+            "Compile text into binary corpus",
+            "<model> <text-file> <corpus-out>",
+            "exp/vocab.clm data/train data/train.corpus",
+            g_cmd_opt, NULL);
+}
+
+int main(int argc, const char *argv[])
+{
+    char args[1024] = "";
+
+    FILE *fp = NULL;
+    FILE *text_fp = NULL;
+    int ret;
+
+    connlm_t *connlm = NULL;
+    corpus_header_t header;
+
+    if (st_mem_usage_init() < 0) {
+        ST_ERROR("Failed to st_mem_usage_init.");
+        goto ERR;
+    }
+
+    (void)st_escape_args(argc, argv, args, 1024);
+
+    ret = connlm_compile_corpus_parse_opt(&argc, argv);
+    if (ret < 0) {
+        goto ERR;
+    } if (ret == 1) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    if (strcmp(connlm_revision(), CONNLM_GIT_COMMIT) != 0) {
+        ST_WARNING("Binary revision[%s] not match with library[%s].",
+                CONNLM_GIT_COMMIT, connlm_revision());
+    }
+
+    if (argc != 4) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    if (! st_opt_check(g_cmd_opt)) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    ST_CLEAN("Command-line: %s", args);
+    st_opt_show(g_cmd_opt, "connLM Compile Corpus Options");
+    ST_CLEAN("Model: '%s', Text: '%s', Corpus: '%s'",
+            argv[1], argv[2], argv[3]);
+
+    ST_NOTICE("Loading vocab model..");
+    fp = st_fopen(argv[1], "rb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", argv[1]);
+        goto ERR;
+    }
+
+    connlm = connlm_load(fp);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to connlm_load. [%s]", argv[1]);
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+
+    if (connlm->vocab == NULL) {
+        ST_ERROR("No vocab loaded from [%s].", argv[1]);
+        goto ERR;
+    }
+
+    text_fp = st_fopen(argv[2], "rb");
+    if (text_fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", argv[2]);
+        goto ERR;
+    }
+
+    fp = st_fopen(argv[3], "wb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", argv[3]);
+        goto ERR;
+    }
+
+    ST_NOTICE("Compiling Corpus...");
+    if (corpus_compile(text_fp, fp, connlm->vocab,
+                g_drop_empty_line, &header) < 0) {
+        ST_ERROR("Failed to corpus_compile. [%s]", argv[2]);
+        goto ERR;
+    }
+
+    ST_NOTICE("Sentences: %"PRId64", Words: %"PRId64", OOVs: %"PRId64,
+            header.num_sents, header.num_words - 2 * header.num_sents,
+            header.num_oovs);
+
+    safe_st_fclose(fp);
+    safe_st_fclose(text_fp);
+    safe_st_opt_destroy(g_cmd_opt);
+    safe_connlm_destroy(connlm);
+
+    st_mem_usage_report();
+    st_mem_usage_destroy();
+    st_log_close(0);
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    safe_st_fclose(text_fp);
+    safe_st_opt_destroy(g_cmd_opt);
+    safe_connlm_destroy(connlm);
+
+    st_mem_usage_destroy();
+    st_log_close(1);
+    return -1;
+}
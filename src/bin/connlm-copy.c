@@ -65,7 +65,7 @@ int connlm_copy_parse_opt(int *argc, const char *argv[])
     }
 
     ST_OPT_GET_STR(g_cmd_opt, "FORMAT", str, MAX_ST_CONF_LEN, "Bin",
-            "storage format(Txt/Bin/Zeros-Compress/Short-Q)");
+            "storage format(Txt/Bin/Zeros-Compress/Short-Q/Mmap/Checksum)");
     g_fmt = connlm_format_parse(str);
     if (g_fmt == CONN_FMT_UNKNOWN) {
         ST_ERROR("Unknown format[%s]", str);
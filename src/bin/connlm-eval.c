@@ -39,6 +39,7 @@
 #include <connlm/driver.h>
 
 int g_num_thr;
+bool g_quantize;
 
 st_opt_t *g_cmd_opt;
 
@@ -84,6 +85,9 @@ int connlm_eval_parse_opt(int *argc, const char *argv[])
     ST_OPT_GET_INT(g_cmd_opt, "NUM_THREAD", g_num_thr, 1,
             "Number of working threads");
 
+    ST_OPT_GET_BOOL(g_cmd_opt, "QUANTIZE", g_quantize, false,
+            "Quantize weights of output and direct glues to int8");
+
     ST_OPT_GET_BOOL(g_cmd_opt, "help", b, false, "Print help");
 
     return (b ? 1 : 0);
@@ -164,8 +168,20 @@ int main(int argc, const char *argv[])
     }
     safe_st_fclose(fp);
 
+    if (g_quantize) {
+        if (connlm_quantize(connlm) < 0) {
+            ST_ERROR("Failed to connlm_quantize.");
+            goto ERR;
+        }
+    }
+
     g_reader_opt.shuffle = false;
     g_reader_opt.rand_seed = 0;
+    if (argc > 3 && g_reader_opt.shard) {
+        /* probs are printed in input order, which is lost in shards. */
+        ST_WARNING("Printing probs, disable sharded reading.");
+        g_reader_opt.shard = false;
+    }
     reader = reader_create(&g_reader_opt, g_num_thr, connlm->vocab, argv[2]);
     if (reader == NULL) {
         ST_ERROR("Failed to reader_create.");
@@ -0,0 +1,232 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <stutils/st_opt.h>
+#include <stutils/st_log.h>
+#include <stutils/st_io.h>
+#include <stutils/st_string.h>
+#include <stutils/st_mem.h>
+
+#include <connlm/utils.h>
+#include <connlm/connlm.h>
+#include <connlm/server.h>
+
+bool g_quantize;
+
+st_opt_t *g_cmd_opt;
+
+server_opt_t g_server_opt;
+
+server_t *g_server = NULL;
+
+int connlm_server_parse_opt(int *argc, const char *argv[])
+{
+    st_log_opt_t log_opt;
+    bool b;
+
+    g_cmd_opt = st_opt_create();
+    if (g_cmd_opt == NULL) {
+        ST_ERROR("Failed to st_opt_create.");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_opt_parse(g_cmd_opt, argc, argv) < 0) {
+        ST_ERROR("Failed to st_opt_parse.");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_log_load_opt(&log_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to st_log_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (st_log_open_mt(&log_opt) != 0) {
+        ST_ERROR("Failed to open log");
+        goto ST_OPT_ERR;
+    }
+
+    if (server_load_opt(&g_server_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to server_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "QUANTIZE", g_quantize, false,
+            "Quantize weights of output and direct glues to int8");
+
+    ST_OPT_GET_BOOL(g_cmd_opt, "help", b, false, "Print help");
+
+    return (b ? 1 : 0);
+
+ST_OPT_ERR:
+    return -1;
+}
+
+void show_usage(const char *module_name)
+{
+    connlm_show_usage(module_name,
+            "Serve Model over Unix-domain Socket",
+            "<model> <socket-path>",
+            "exp/final.clm /tmp/connlm.sock",
+            g_cmd_opt, NULL);
+}
+
+static void stop_handler(int sig)
+{
+    server_stop(g_server);
+}
+
+static int setup_signals()
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0; // no SA_RESTART, so that accept could be interrupted
+
+    if (sigaction(SIGINT, &sa, NULL) != 0) {
+        ST_ERROR("Failed to sigaction SIGINT.");
+        return -1;
+    }
+
+    if (sigaction(SIGTERM, &sa, NULL) != 0) {
+        ST_ERROR("Failed to sigaction SIGTERM.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    char args[1024] = "";
+    FILE *fp = NULL;
+    connlm_t *connlm = NULL;
+    int ret;
+
+    if (st_mem_usage_init() < 0) {
+        ST_ERROR("Failed to st_mem_usage_init.");
+        goto ERR;
+    }
+
+    (void)st_escape_args(argc, argv, args, 1024);
+
+    ret = connlm_server_parse_opt(&argc, argv);
+    if (ret < 0) {
+        goto ERR;
+    } if (ret == 1) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    if (strcmp(connlm_revision(), CONNLM_GIT_COMMIT) != 0) {
+        ST_WARNING("Binary revision[%s] not match with library[%s].",
+                CONNLM_GIT_COMMIT, connlm_revision());
+    }
+
+    if (argc != 3) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    if (! st_opt_check(g_cmd_opt)) {
+        show_usage(argv[0]);
+        goto ERR;
+    }
+
+    ST_CLEAN("Command-line: %s", args);
+    st_opt_show(g_cmd_opt, "connLM Server Options");
+    ST_CLEAN("Model: '%s', Socket: '%s'", argv[1], argv[2]);
+
+#ifdef _USE_BLAS_
+    if (setup_blas()) {
+        ST_ERROR("Failed to setup_blas.");
+        goto ERR;
+    }
+#endif
+
+    fp = st_fopen(argv[1], "rb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", argv[1]);
+        goto ERR;
+    }
+
+    connlm = connlm_load(fp);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to connlm_load. [%s]", argv[1]);
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+
+    if (g_quantize) {
+        if (connlm_quantize(connlm) < 0) {
+            ST_ERROR("Failed to connlm_quantize.");
+            goto ERR;
+        }
+    }
+
+    g_server = server_create(connlm, &g_server_opt);
+    if (g_server == NULL) {
+        ST_ERROR("Failed to server_create.");
+        goto ERR;
+    }
+
+    if (setup_signals() < 0) {
+        ST_ERROR("Failed to setup_signals.");
+        goto ERR;
+    }
+
+    if (server_run(g_server, argv[2]) < 0) {
+        ST_ERROR("Failed to server_run.");
+        goto ERR;
+    }
+
+    safe_server_destroy(g_server);
+
+    safe_st_opt_destroy(g_cmd_opt);
+    safe_connlm_destroy(connlm);
+
+    st_mem_usage_report();
+    st_mem_usage_destroy();
+    st_log_close(0);
+
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    safe_server_destroy(g_server);
+
+    safe_st_opt_destroy(g_cmd_opt);
+    safe_connlm_destroy(connlm);
+
+    st_mem_usage_destroy();
+    st_log_close(1);
+    return -1;
+}
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <math.h>
+#include <sys/time.h>
 
 #include <stutils/st_opt.h>
 #include <stutils/st_log.h>
@@ -37,15 +39,30 @@
 #include <connlm/connlm.h>
 #include <connlm/reader.h>
 #include <connlm/driver.h>
+#include <connlm/dist.h>
+#include <connlm/ckpt.h>
 
 connlm_fmt_t g_fmt;
 bool g_dry_run;
 int g_num_thr;
 
+char g_valid_file[MAX_DIR_LEN];
+int g_max_epochs;
+int g_min_epochs;
+int g_keep_lr_epochs;
+double g_start_halving_impr;
+double g_end_halving_impr;
+double g_halving_factor;
+
 st_opt_t *g_cmd_opt;
 
 reader_opt_t g_reader_opt;
 driver_train_opt_t g_train_opt;
+dist_opt_t g_dist_opt;
+ckpt_opt_t g_ckpt_opt;
+
+reader_opt_t g_valid_reader_opt;
+driver_eval_opt_t g_valid_eval_opt;
 
 int connlm_train_parse_opt(int *argc, const char *argv[])
 {
@@ -85,11 +102,21 @@ int connlm_train_parse_opt(int *argc, const char *argv[])
         goto ST_OPT_ERR;
     }
 
+    if (dist_load_opt(&g_dist_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to dist_load_opt");
+        goto ST_OPT_ERR;
+    }
+
+    if (ckpt_load_opt(&g_ckpt_opt, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to ckpt_load_opt");
+        goto ST_OPT_ERR;
+    }
+
     ST_OPT_GET_INT(g_cmd_opt, "NUM_THREAD", g_num_thr, 1,
             "Number of working threads");
 
     ST_OPT_GET_STR(g_cmd_opt, "FORMAT", str, MAX_ST_CONF_LEN, "Bin",
-            "storage format(Txt/Bin/Zeros-Compress/Short-Q)");
+            "storage format(Txt/Bin/Zeros-Compress/Short-Q/Mmap/Checksum)");
     g_fmt = connlm_format_parse(str);
     if (g_fmt == CONN_FMT_UNKNOWN) {
         ST_ERROR("Unknown format[%s]", str);
@@ -99,6 +126,61 @@ int connlm_train_parse_opt(int *argc, const char *argv[])
     ST_OPT_GET_BOOL(g_cmd_opt, "DRY_RUN", g_dry_run, false,
             "Read config and exit");
 
+    ST_OPT_GET_INT(g_cmd_opt, "MAX_EPOCHS", g_max_epochs, 1,
+            "Maximum number of epochs trained over the train-file");
+    if (g_max_epochs <= 0) {
+        ST_ERROR("MAX_EPOCHS must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_GET_STR(g_cmd_opt, "VALID_FILE", g_valid_file, MAX_DIR_LEN, "",
+            "Validation text, evaluated after every epoch. Only the model "
+            "with the best validation entropy is written, and the learning "
+            "rate is halved as the improvement gets small (newbob).");
+
+    ST_OPT_GET_INT(g_cmd_opt, "MIN_EPOCHS", g_min_epochs, 0,
+            "Minimum number of epochs, keep training and accept every "
+            "epoch before this");
+
+    ST_OPT_GET_INT(g_cmd_opt, "KEEP_LR_EPOCHS", g_keep_lr_epochs, 0,
+            "Fix learning rate for N initial epochs");
+
+    ST_OPT_GET_DOUBLE(g_cmd_opt, "START_HALVING_IMPR", g_start_halving_impr,
+            0.003, "Relative improvement of validation entropy "
+            "starting halving");
+
+    ST_OPT_GET_DOUBLE(g_cmd_opt, "END_HALVING_IMPR", g_end_halving_impr,
+            0.0003, "Relative improvement of validation entropy "
+            "ending training, after halving started");
+
+    ST_OPT_GET_DOUBLE(g_cmd_opt, "HALVING_FACTOR", g_halving_factor, 0.5,
+            "Factor scaling learning rate for halving");
+
+    if (reader_load_opt(&g_valid_reader_opt, g_cmd_opt, "VALID") < 0) {
+        ST_ERROR("Failed to reader_load_opt for valid");
+        goto ST_OPT_ERR;
+    }
+    g_valid_reader_opt.shuffle = false;
+    g_valid_reader_opt.rand_seed = 0;
+
+    if (driver_load_eval_opt(&g_valid_eval_opt, g_cmd_opt, "VALID") < 0) {
+        ST_ERROR("Failed to driver_load_eval_opt for valid");
+        goto ST_OPT_ERR;
+    }
+
+    if (g_dist_opt.num_workers > 1
+            && (g_max_epochs > 1 || g_valid_file[0] != '\0')) {
+        ST_ERROR("Multiple epochs or validation is not supported "
+                "with distributed training.");
+        goto ST_OPT_ERR;
+    }
+
+    if (g_dist_opt.num_workers > 1 && g_ckpt_opt.file[0] != '\0') {
+        ST_ERROR("Checkpointing is not supported "
+                "with distributed training.");
+        goto ST_OPT_ERR;
+    }
+
     ST_OPT_GET_BOOL(g_cmd_opt, "help", b, false, "Print help");
 
     return (b ? 1 : 0);
@@ -124,15 +206,259 @@ void show_usage(const char *module_name)
             "set param/bptt_opt for a glue.\n");
 }
 
-int main(int argc, const char *argv[])
+static connlm_t* load_model(const char *model_file)
 {
-    char args[1024] = "";
     FILE *fp = NULL;
     connlm_t *connlm = NULL;
+
+    fp = st_fopen(model_file, "rb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", model_file);
+        goto ERR;
+    }
+
+    connlm = connlm_load(fp);
+    if (connlm == NULL) {
+        ST_ERROR("Failed to connlm_load. [%s]", model_file);
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+
+    if (connlm_load_train_opt(connlm, g_cmd_opt, NULL) < 0) {
+        ST_ERROR("Failed to connlm_load_train_opt");
+        goto ERR;
+    }
+
+    return connlm;
+
+ERR:
+    safe_st_fclose(fp);
+    safe_connlm_destroy(connlm);
+    return NULL;
+}
+
+/* write into a temporary file and rename it, so that model_file is always
+ * a complete model, and still valid for whom has it mmap-ed. */
+static int save_model(connlm_t *connlm, const char *model_file)
+{
+    char tmp_file[MAX_DIR_LEN];
+    FILE *fp = NULL;
+
+    snprintf(tmp_file, MAX_DIR_LEN, "%s.tmp", model_file);
+
+    fp = st_fopen(tmp_file, "wb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", tmp_file);
+        goto ERR;
+    }
+
+    if (connlm_save(connlm, fp, g_fmt) < 0) {
+        ST_ERROR("Failed to connlm_save. [%s]", tmp_file);
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+
+    if (rename(tmp_file, model_file) != 0) {
+        ST_ERROR("Failed to rename [%s] to [%s].", tmp_file, model_file);
+        goto ERR;
+    }
+
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    return -1;
+}
+
+/* progress holds the state of training saved with checkpoints,
+ * resume is the state loaded from checkpoint, or NULL. */
+static int train_epoch(connlm_t *connlm, const char *train_file,
+        ckpt_state_t *progress, ckpt_state_t *resume,
+        thr_stat_t *stat, long *ms)
+{
+    reader_opt_t reader_opt;
+    driver_train_opt_t train_opt;
+    reader_t *reader = NULL;
+    driver_t *driver = NULL;
+    dist_t *dist = NULL;
+    ckpt_t *ckpt = NULL;
+    struct timeval tts, tte;
+    int epoch;
+
+    gettimeofday(&tts, NULL);
+
+    epoch = progress->epoch;
+    // different random streams for different epochs
+    reader_opt = g_reader_opt;
+    reader_opt.rand_seed += epoch - 1;
+    train_opt = g_train_opt;
+    train_opt.rand_seed += (epoch - 1) * g_num_thr;
+
+    reader = reader_create(&reader_opt, g_num_thr, connlm->vocab,
+            train_file);
+    if (reader == NULL) {
+        ST_ERROR("Failed to reader_create.");
+        goto ERR;
+    }
+
+    driver = driver_create(connlm, reader, g_num_thr);
+    if (driver == NULL) {
+        ST_ERROR("Failed to driver_create.");
+        goto ERR;
+    }
+
+    if (driver_set_train(driver, &train_opt) < 0) {
+        ST_ERROR("Failed to driver_set_train.");
+        goto ERR;
+    }
+
+    if (g_dist_opt.num_workers > 1) {
+        dist = dist_create(&g_dist_opt, connlm);
+        if (dist == NULL) {
+            ST_ERROR("Failed to dist_create.");
+            goto ERR;
+        }
+
+        if (g_dist_opt.split_text) {
+            if (reader_set_part(reader, g_dist_opt.rank,
+                        g_dist_opt.num_workers) < 0) {
+                ST_ERROR("Failed to reader_set_part.");
+                goto ERR;
+            }
+        }
+
+        if (driver_set_dist(driver, dist) < 0) {
+            ST_ERROR("Failed to driver_set_dist.");
+            goto ERR;
+        }
+    }
+
+    if (g_ckpt_opt.file[0] != '\0') {
+        ckpt = ckpt_create(&g_ckpt_opt, connlm, g_fmt);
+        if (ckpt == NULL) {
+            ST_ERROR("Failed to ckpt_create.");
+            goto ERR;
+        }
+        ckpt->state.epoch = progress->epoch;
+        ckpt->state.lr_scale = progress->lr_scale;
+        ckpt->state.halving = progress->halving;
+        ckpt->state.loss = progress->loss;
+        ckpt->state.accepted = progress->accepted;
+
+        if (resume != NULL) {
+            if (ckpt_set_resume(ckpt, resume) < 0) {
+                ST_ERROR("Failed to ckpt_set_resume.");
+                goto ERR;
+            }
+        }
+
+        if (driver_set_ckpt(driver, ckpt) < 0) {
+            ST_ERROR("Failed to driver_set_ckpt.");
+            goto ERR;
+        }
+    }
+
+    if (driver_setup(driver, DRIVER_TRAIN) < 0) {
+        ST_ERROR("Failed to driver_setup.");
+        goto ERR;
+    }
+
+    if (driver_run(driver) < 0) {
+        ST_ERROR("Failed to driver_run.");
+        goto ERR;
+    }
+    *stat = driver->stat;
+
+    safe_driver_destroy(driver);
+    safe_reader_destroy(reader);
+    safe_dist_destroy(dist);
+    safe_ckpt_destroy(ckpt);
+
+    connlm_sanity_check(connlm);
+
+    gettimeofday(&tte, NULL);
+    *ms = TIMEDIFF(tts, tte);
+
+    return 0;
+
+ERR:
+    safe_driver_destroy(driver);
+    safe_reader_destroy(reader);
+    safe_dist_destroy(dist);
+    safe_ckpt_destroy(ckpt);
+    return -1;
+}
+
+static int eval_valid(connlm_t *connlm, double *entropy)
+{
     reader_t *reader = NULL;
     driver_t *driver = NULL;
+
+    reader = reader_create(&g_valid_reader_opt, g_num_thr, connlm->vocab,
+            g_valid_file);
+    if (reader == NULL) {
+        ST_ERROR("Failed to reader_create.");
+        goto ERR;
+    }
+
+    driver = driver_create(connlm, reader, g_num_thr);
+    if (driver == NULL) {
+        ST_ERROR("Failed to driver_create.");
+        goto ERR;
+    }
+
+    if (driver_set_eval(driver, &g_valid_eval_opt, NULL) < 0) {
+        ST_ERROR("Failed to driver_set_eval.");
+        goto ERR;
+    }
+
+    if (driver_setup(driver, DRIVER_EVAL) < 0) {
+        ST_ERROR("Failed to driver_setup.");
+        goto ERR;
+    }
+
+    if (driver_run(driver) < 0) {
+        ST_ERROR("Failed to driver_run.");
+        goto ERR;
+    }
+
+    if (driver->stat.num_words <= 0) {
+        ST_ERROR("No words in valid file[%s].", g_valid_file);
+        goto ERR;
+    }
+    *entropy = -driver->stat.logp / log(2) / driver->stat.num_words;
+
+    safe_driver_destroy(driver);
+    safe_reader_destroy(reader);
+
+    return 0;
+
+ERR:
+    safe_driver_destroy(driver);
+    safe_reader_destroy(reader);
+    return -1;
+}
+
+int main(int argc, const char *argv[])
+{
+    char args[1024] = "";
+    connlm_t *connlm = NULL;
+    const char *model_file;
+    const char *best_file;
+    ckpt_state_t progress;
+    ckpt_state_t resume;
+    bool resuming = false;
+    thr_stat_t stat;
+    double loss, loss_new, loss_prev, rel_impr;
+    double lr_scale;
+    bool halving;
+    bool accepted;
+    long ms;
+    int epoch;
     int ret;
 
+    memset(&resume, 0, sizeof(ckpt_state_t));
+
     if (st_mem_usage_init() < 0) {
         ST_ERROR("Failed to st_mem_usage_init.");
         goto ERR;
@@ -173,21 +499,23 @@ int main(int argc, const char *argv[])
                 argv[1], argv[2], argv[3]);
     }
 
-    fp = st_fopen(argv[1], "rb");
-    if (fp == NULL) {
-        ST_ERROR("Failed to st_fopen. [%s]", argv[1]);
-        goto ERR;
+    model_file = argv[1];
+    if (! g_dry_run && g_ckpt_opt.file[0] != '\0' && g_ckpt_opt.resume) {
+        ret = ckpt_load_state(&g_ckpt_opt, &resume);
+        if (ret < 0) {
+            ST_ERROR("Failed to ckpt_load_state. [%s]", g_ckpt_opt.file);
+            goto ERR;
+        } else if (ret == 0) {
+            resuming = true;
+            model_file = g_ckpt_opt.file;
+            ST_NOTICE("Resume from checkpoint '%s', epoch %d.",
+                    g_ckpt_opt.file, resume.epoch);
+        }
     }
 
-    connlm = connlm_load(fp);
+    connlm = load_model(model_file);
     if (connlm == NULL) {
-        ST_ERROR("Failed to connlm_load. [%s]", argv[1]);
-        goto ERR;
-    }
-    safe_st_fclose(fp);
-
-    if (connlm_load_train_opt(connlm, g_cmd_opt, NULL) < 0) {
-        ST_ERROR("Failed to connlm_load_train_opt");
+        ST_ERROR("Failed to load_model. [%s]", model_file);
         goto ERR;
     }
 
@@ -209,54 +537,144 @@ int main(int argc, const char *argv[])
     }
 #endif
 
-    reader = reader_create(&g_reader_opt, g_num_thr, connlm->vocab, argv[2]);
-    if (reader == NULL) {
-        ST_ERROR("Failed to reader_create.");
-        goto ERR;
+    if (g_dist_opt.num_workers > 1) {
+        // different random streams for different workers
+        g_train_opt.rand_seed += g_dist_opt.rank * g_num_thr;
+        g_reader_opt.rand_seed += g_dist_opt.rank;
     }
 
-    driver = driver_create(connlm, reader, g_num_thr);
-    if (driver == NULL) {
-        ST_ERROR("Failed to driver_create.");
-        goto ERR;
+    loss = 0.0;
+    best_file = argv[1];
+    lr_scale = 1.0;
+    halving = false;
+    epoch = 1;
+    if (resuming) {
+        epoch = resume.epoch;
+        loss = resume.loss;
+        if (resume.accepted) {
+            best_file = argv[3];
+        }
+        lr_scale = resume.lr_scale;
+        halving = resume.halving;
+        connlm_scale_learn_rate(connlm, lr_scale);
+    } else if (g_valid_file[0] != '\0') {
+        if (eval_valid(connlm, &loss) < 0) {
+            ST_ERROR("Failed to eval_valid.");
+            goto ERR;
+        }
+        ST_NOTICE("Prerun Valid Entropy: %f", loss);
     }
 
-    if (driver_set_train(driver, &g_train_opt) < 0) {
-        ST_ERROR("Failed to driver_set_train.");
-        goto ERR;
-    }
+    memset(&progress, 0, sizeof(ckpt_state_t));
+    for (; epoch <= g_max_epochs; epoch++) {
+        progress.epoch = epoch;
+        progress.lr_scale = lr_scale;
+        progress.halving = halving;
+        progress.loss = loss;
+        progress.accepted = (best_file != argv[1]);
+        if (train_epoch(connlm, argv[2], &progress,
+                    resuming ? &resume : NULL, &stat, &ms) < 0) {
+            ST_ERROR("Failed to train_epoch[%d].", epoch);
+            goto ERR;
+        }
+        if (resuming) {
+            resuming = false;
+            ckpt_state_destroy(&resume);
+        }
 
-    if (driver_setup(driver, DRIVER_TRAIN) < 0) {
-        ST_ERROR("Failed to driver_setup.");
-        goto ERR;
-    }
+        if (g_valid_file[0] == '\0') {
+            ST_NOTICE("Epoch %d: LR scale: %g, TrEnt: %f, words/sec: %.1f",
+                    epoch, lr_scale,
+                    -stat.logp / log(2) / stat.num_words,
+                    stat.num_words / ((double) ms / 1000.0));
+            continue;
+        }
 
-    if (driver_run(driver) < 0) {
-        ST_ERROR("Failed to driver_run.");
-        goto ERR;
-    }
+        if (eval_valid(connlm, &loss_new) < 0) {
+            ST_ERROR("Failed to eval_valid.");
+            goto ERR;
+        }
 
-    safe_driver_destroy(driver);
-    safe_reader_destroy(reader);
+        // accept or reject new parameters (based on objective function)
+        loss_prev = loss;
+        accepted = (loss_new < loss || epoch <= g_keep_lr_epochs
+                || epoch <= g_min_epochs);
+        ST_NOTICE("Epoch %d: LR scale: %g, TrEnt: %f, words/sec: %.1f, "
+                "CVEnt: %f, %s", epoch, lr_scale,
+                -stat.logp / log(2) / stat.num_words,
+                stat.num_words / ((double) ms / 1000.0),
+                loss_new, accepted ? "accepted" : "rejected");
+        if (accepted) {
+            loss = loss_new;
+            if (save_model(connlm, argv[3]) < 0) {
+                ST_ERROR("Failed to save_model. [%s]", argv[3]);
+                goto ERR;
+            }
+            best_file = argv[3];
+        } else {
+            safe_connlm_destroy(connlm);
+            connlm = load_model(best_file);
+            if (connlm == NULL) {
+                ST_ERROR("Failed to load_model. [%s]", best_file);
+                goto ERR;
+            }
+            connlm_scale_learn_rate(connlm, lr_scale);
+        }
 
-    connlm_sanity_check(connlm);
+        // no learn-rate halving yet, if keep_lr_epochs set accordingly
+        if (epoch <= g_keep_lr_epochs) {
+            continue;
+        }
 
-    fp = st_fopen(argv[3], "wb");
-    if (fp == NULL) {
-        ST_ERROR("Failed to st_fopen. [%s]", argv[3]);
-        goto ERR;
+        // stopping criterion
+        rel_impr = (loss_prev - loss) / loss_prev;
+        if (halving && rel_impr < g_end_halving_impr) {
+            if (epoch <= g_min_epochs) {
+                ST_NOTICE("We were supposed to finish, but we continue "
+                        "as min_epochs: %d", g_min_epochs);
+                continue;
+            }
+            ST_NOTICE("Finished, too small rel. improvement %g", rel_impr);
+            break;
+        }
+
+        // start annealing when improvement is low
+        if (rel_impr < g_start_halving_impr) {
+            halving = true;
+        }
+
+        // do annealing
+        if (halving) {
+            connlm_scale_learn_rate(connlm, g_halving_factor);
+            lr_scale *= g_halving_factor;
+        }
     }
 
-    if (connlm_save(connlm, fp, g_fmt) < 0) {
-        ST_ERROR("Failed to connlm_save. [%s]", argv[3]);
+    if (g_valid_file[0] == '\0') {
+        if (save_model(connlm, argv[3]) < 0) {
+            ST_ERROR("Failed to save_model. [%s]", argv[3]);
+            goto ERR;
+        }
+    } else if (best_file == argv[1]) {
+        ST_ERROR("No epoch accepted, model-out not written.");
         goto ERR;
+    } else {
+        ST_NOTICE("Best Valid Entropy: %f, model written to '%s'",
+                loss, argv[3]);
     }
 
-RET:
-    safe_st_fclose(fp);
+    /* the model-out is final, a later run must not resume an old epoch. */
+    if (g_ckpt_opt.file[0] != '\0') {
+        if (ckpt_remove(&g_ckpt_opt) < 0) {
+            ST_ERROR("Failed to ckpt_remove. [%s]", g_ckpt_opt.file);
+            goto ERR;
+        }
+    }
 
+RET:
     safe_st_opt_destroy(g_cmd_opt);
     safe_connlm_destroy(connlm);
+    ckpt_state_destroy(&resume);
 
     st_mem_usage_report();
     st_mem_usage_destroy();
@@ -265,10 +683,8 @@ RET:
 
 ERR:
     safe_st_opt_destroy(g_cmd_opt);
-    safe_st_fclose(fp);
-    safe_driver_destroy(driver);
-    safe_reader_destroy(reader);
     safe_connlm_destroy(connlm);
+    ckpt_state_destroy(&resume);
 
     st_mem_usage_destroy();
     st_log_close(1);
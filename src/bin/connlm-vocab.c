@@ -78,7 +78,7 @@ int connlm_vocab_parse_opt(int *argc, const char *argv[])
     }
 
     ST_OPT_GET_STR(g_cmd_opt, "FORMAT", str, MAX_ST_CONF_LEN, "Bin",
-            "storage format(Txt/Bin/Zeros-Compress/Short-Q)");
+            "storage format(Txt/Bin/Zeros-Compress/Short-Q/Mmap/Checksum)");
     g_fmt = connlm_format_parse(str);
     if (g_fmt == CONN_FMT_UNKNOWN) {
         ST_ERROR("Unknown format[%s]", str);
@@ -97,8 +97,8 @@ void show_usage(const char *module_name)
 {
     connlm_show_usage(module_name,
             "Learn Vocabulary",
-            "<text-file> <model-out>",
-            "data/train exp/vocab.clm",
+            "<text-file>... <model-out>",
+            "data/train data/extra exp/vocab.clm",
             g_cmd_opt, NULL);
 }
 
@@ -108,6 +108,7 @@ int main(int argc, const char *argv[])
 
     FILE *fp = NULL;
     int ret;
+    int i;
 
     connlm_t *connlm = NULL;
     vocab_t *vocab = NULL;
@@ -132,7 +133,7 @@ int main(int argc, const char *argv[])
                 CONNLM_GIT_COMMIT, connlm_revision());
     }
 
-    if (argc != 3) {
+    if (argc < 3) {
         show_usage(argv[0]);
         goto ERR;
     }
@@ -144,7 +145,10 @@ int main(int argc, const char *argv[])
 
     ST_CLEAN("Command-line: %s", args);
     st_opt_show(g_cmd_opt, "connLM Vocab Options");
-    ST_CLEAN("Text: '%s', Model: '%s'", argv[1], argv[2]);
+    for (i = 1; i < argc - 1; i++) {
+        ST_CLEAN("Text: '%s'", argv[i]);
+    }
+    ST_CLEAN("Model: '%s'", argv[argc - 1]);
 
     ST_NOTICE("Learning Vocab...");
     vocab = vocab_create(&g_vocab_opt);
@@ -153,17 +157,10 @@ int main(int argc, const char *argv[])
         goto ERR;
     }
 
-    fp = st_fopen(argv[1], "rb");
-    if (fp == NULL) {
-        ST_ERROR("Failed to st_fopen. [%s]", argv[1]);
-        goto ERR;
-    }
-
-    if (vocab_learn(vocab, fp, &g_lr_opt) < 0) {
-        ST_ERROR("Failed to vocab_learn. [%s]", argv[1]);
+    if (vocab_learn_files(vocab, argv + 1, argc - 2, &g_lr_opt) < 0) {
+        ST_ERROR("Failed to vocab_learn_files.");
         goto ERR;
     }
-    safe_st_fclose(fp);
 
     connlm = connlm_new(vocab, NULL, NULL, -1);
     if (connlm == NULL) {
@@ -171,14 +168,14 @@ int main(int argc, const char *argv[])
         goto ERR;
     }
 
-    fp = st_fopen(argv[2], "wb");
+    fp = st_fopen(argv[argc - 1], "wb");
     if (fp == NULL) {
-        ST_ERROR("Failed to st_fopen. [%s]", argv[2]);
+        ST_ERROR("Failed to st_fopen. [%s]", argv[argc - 1]);
         goto ERR;
     }
 
     if (connlm_save(connlm, fp, g_fmt) < 0) {
-        ST_ERROR("Failed to connlm_save. [%s]", argv[2]);
+        ST_ERROR("Failed to connlm_save. [%s]", argv[argc - 1]);
         goto ERR;
     }
 
@@ -0,0 +1,652 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <stutils/st_macro.h>
+#include <stutils/st_log.h>
+#include <stutils/st_mem.h>
+#include <stutils/st_io.h>
+#include <stutils/st_string.h>
+
+#include "weight.h"
+#include "ckpt.h"
+
+#define CKPT_STATE_HEADER "<CONNLM-CKPT-STATE>"
+#define CKPT_LONGEST_SUFFIX ".state.tmp" /* longest suffix added to FILE. */
+
+int ckpt_load_opt(ckpt_opt_t *ckpt_opt, st_opt_t *opt,
+        const char *sec_name)
+{
+    char name[MAX_ST_CONF_LEN];
+    char str[MAX_ST_CONF_LEN];
+    long long l;
+
+    ST_CHECK_PARAM(ckpt_opt == NULL || opt == NULL, -1);
+
+    if (sec_name == NULL || sec_name[0] == '\0') {
+        snprintf(name, MAX_ST_CONF_LEN, "%s", "CKPT");
+    } else {
+        snprintf(name, MAX_ST_CONF_LEN, "%s/%s", sec_name, "CKPT");
+    }
+
+    ST_OPT_SEC_GET_STR(opt, name, "FILE", ckpt_opt->file, MAX_DIR_LEN,
+            "", "Model file saving checkpoints into, state of training "
+            "is saved into FILE.state. Empty to disable checkpointing.");
+    if (strlen(ckpt_opt->file) + strlen(CKPT_LONGEST_SUFFIX)
+            >= MAX_DIR_LEN) {
+        ST_ERROR("Too long FILE[%s].", ckpt_opt->file);
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_STR(opt, name, "EVERY_WORDS", str, MAX_ST_CONF_LEN,
+            "10M", "Number of words trained between checkpoints "
+            "(can be set to 500k, 10M, etc.)");
+    l = st_str2ll(str);
+    if (l <= 0) {
+        ST_ERROR("Invalid EVERY_WORDS[%s]", str);
+        goto ST_OPT_ERR;
+    }
+    ckpt_opt->every_words = (count_t)l;
+
+    ST_OPT_SEC_GET_BOOL(opt, name, "RESUME", ckpt_opt->resume, false,
+            "Resume training from the checkpoint in FILE, if it exists.");
+
+    return 0;
+
+ST_OPT_ERR:
+    return -1;
+}
+
+void ckpt_state_destroy(ckpt_state_t *state)
+{
+    if (state == NULL) {
+        return;
+    }
+
+    safe_st_free(state->poses);
+    state->num_poses = 0;
+    safe_st_free(state->seeds);
+    state->num_seeds = 0;
+}
+
+int ckpt_state_save(ckpt_state_t *state, FILE *fp)
+{
+    int i;
+
+    ST_CHECK_PARAM(state == NULL || fp == NULL, -1);
+
+    fprintf(fp, "%s\n", CKPT_STATE_HEADER);
+    fprintf(fp, "Epoch: %d\n", state->epoch);
+    fprintf(fp, "LR scale: %.17g\n", state->lr_scale);
+    fprintf(fp, "Halving: %d\n", state->halving ? 1 : 0);
+    fprintf(fp, "Loss: %.17g\n", state->loss);
+    fprintf(fp, "Accepted: %d\n", state->accepted ? 1 : 0);
+
+    fprintf(fp, "Shards: %d\n", state->num_poses);
+    for (i = 0; i < state->num_poses; i++) {
+        fprintf(fp, "%d %lld %u " COUNT_FMT " " COUNT_FMT " " COUNT_FMT "\n",
+                i, (long long)state->poses[i].pos, state->poses[i].random,
+                state->poses[i].num_sents, state->poses[i].num_words,
+                state->poses[i].num_oovs);
+    }
+
+    fprintf(fp, "Threads: %d\n", state->num_seeds);
+    for (i = 0; i < state->num_seeds; i++) {
+        fprintf(fp, "%d %u\n", i, state->seeds[i]);
+    }
+
+    if (fflush(fp) != 0 || ferror(fp)) {
+        ST_ERROR("Failed to write state: %s.", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int ckpt_load_state(ckpt_opt_t *opt, ckpt_state_t *state)
+{
+    char file[MAX_DIR_LEN];
+    char header[MAX_LINE_LEN];
+    FILE *fp = NULL;
+    long long pos;
+    int halving, accepted;
+    int i, n;
+
+    ST_CHECK_PARAM(opt == NULL || state == NULL, -1);
+
+    memset(state, 0, sizeof(ckpt_state_t));
+
+    if (snprintf(file, MAX_DIR_LEN, "%s.state", opt->file)
+            >= MAX_DIR_LEN) {
+        ST_ERROR("Too long file name[%s].", opt->file);
+        return -1;
+    }
+    if (access(file, F_OK) != 0 || access(opt->file, F_OK) != 0) {
+        return 1;
+    }
+
+    fp = st_fopen(file, "r");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", file);
+        goto ERR;
+    }
+
+    if (fgets(header, MAX_LINE_LEN, fp) == NULL
+            || strncmp(header, CKPT_STATE_HEADER,
+                strlen(CKPT_STATE_HEADER)) != 0) {
+        ST_ERROR("Not a checkpoint state file[%s].", file);
+        goto ERR;
+    }
+
+    if (fscanf(fp, "Epoch: %d\n", &state->epoch) != 1
+            || fscanf(fp, "LR scale: %lf\n", &state->lr_scale) != 1
+            || fscanf(fp, "Halving: %d\n", &halving) != 1
+            || fscanf(fp, "Loss: %lf\n", &state->loss) != 1
+            || fscanf(fp, "Accepted: %d\n", &accepted) != 1) {
+        ST_ERROR("Failed to read training state.");
+        goto ERR;
+    }
+    state->halving = (halving != 0);
+    state->accepted = (accepted != 0);
+
+    if (fscanf(fp, "Shards: %d\n", &state->num_poses) != 1
+            || state->num_poses <= 0) {
+        ST_ERROR("Failed to read number of shards.");
+        goto ERR;
+    }
+    state->poses = (reader_pos_t *)st_malloc(sizeof(reader_pos_t)
+            * state->num_poses);
+    if (state->poses == NULL) {
+        ST_ERROR("Failed to st_malloc poses.");
+        goto ERR;
+    }
+    for (i = 0; i < state->num_poses; i++) {
+        if (fscanf(fp, "%d %lld %u " COUNT_FMT " " COUNT_FMT " "
+                    COUNT_FMT "\n", &n, &pos,
+                    &state->poses[i].random, &state->poses[i].num_sents,
+                    &state->poses[i].num_words,
+                    &state->poses[i].num_oovs) != 6 || n != i) {
+            ST_ERROR("Failed to read position of shard[%d].", i);
+            goto ERR;
+        }
+        state->poses[i].pos = (int64_t)pos;
+    }
+
+    if (fscanf(fp, "Threads: %d\n", &state->num_seeds) != 1
+            || state->num_seeds <= 0) {
+        ST_ERROR("Failed to read number of threads.");
+        goto ERR;
+    }
+    state->seeds = (unsigned int *)st_malloc(sizeof(unsigned int)
+            * state->num_seeds);
+    if (state->seeds == NULL) {
+        ST_ERROR("Failed to st_malloc seeds.");
+        goto ERR;
+    }
+    for (i = 0; i < state->num_seeds; i++) {
+        if (fscanf(fp, "%d %u\n", &n, state->seeds + i) != 2 || n != i) {
+            ST_ERROR("Failed to read seed of thread[%d].", i);
+            goto ERR;
+        }
+    }
+
+    safe_st_fclose(fp);
+
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    ckpt_state_destroy(state);
+    return -1;
+}
+
+int ckpt_remove(ckpt_opt_t *opt)
+{
+    /* the state goes first, so that nothing is resumed if interrupted. */
+    const char *suffixes[] = {".state", ".state.tmp", "", ".tmp"};
+    char file[MAX_DIR_LEN];
+    int i;
+
+    ST_CHECK_PARAM(opt == NULL, -1);
+
+    for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        if (snprintf(file, MAX_DIR_LEN, "%s%s", opt->file, suffixes[i])
+                >= MAX_DIR_LEN) {
+            ST_ERROR("Too long file name[%s].", opt->file);
+            return -1;
+        }
+        if (unlink(file) != 0 && errno != ENOENT) {
+            ST_ERROR("Failed to unlink [%s]: %s.", file, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void ckpt_destroy(ckpt_t *ckpt)
+{
+    if (ckpt == NULL) {
+        return;
+    }
+
+    safe_connlm_destroy(ckpt->shadow);
+    ckpt_state_destroy(&ckpt->state);
+    ckpt->connlm = NULL;
+    ckpt->reader = NULL;
+    ckpt->updaters = NULL;
+    ckpt->resume = NULL;
+
+    (void)pthread_mutex_destroy(&ckpt->lock);
+    (void)pthread_cond_destroy(&ckpt->cond);
+}
+
+ckpt_t* ckpt_create(ckpt_opt_t *opt, connlm_t *connlm, connlm_fmt_t fmt)
+{
+    ckpt_t *ckpt = NULL;
+
+    ST_CHECK_PARAM(opt == NULL || connlm == NULL, NULL);
+
+    if (opt->file[0] == '\0') {
+        ST_ERROR("Checkpoint file not set.");
+        return NULL;
+    }
+
+    ckpt = (ckpt_t *)st_malloc(sizeof(ckpt_t));
+    if (ckpt == NULL) {
+        ST_ERROR("Failed to st_malloc ckpt.");
+        return NULL;
+    }
+    memset(ckpt, 0, sizeof(ckpt_t));
+
+    ckpt->opt = *opt;
+    ckpt->fmt = fmt;
+    ckpt->connlm = connlm;
+    ckpt->state.epoch = 1;
+    ckpt->state.lr_scale = 1.0;
+
+    if (pthread_mutex_init(&ckpt->lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init.");
+        goto ERR;
+    }
+
+    if (pthread_cond_init(&ckpt->cond, NULL) != 0) {
+        ST_ERROR("Failed to pthread_cond_init.");
+        goto ERR;
+    }
+
+    ckpt->shadow = connlm_new(connlm->vocab, connlm->output,
+            connlm->comps, connlm->num_comp);
+    if (ckpt->shadow == NULL) {
+        ST_ERROR("Failed to connlm_new shadow.");
+        goto ERR;
+    }
+
+    return ckpt;
+
+ERR:
+    safe_ckpt_destroy(ckpt);
+    return NULL;
+}
+
+int ckpt_set_resume(ckpt_t *ckpt, ckpt_state_t *state)
+{
+    ST_CHECK_PARAM(ckpt == NULL || state == NULL, -1);
+
+    ckpt->resume = state;
+
+    return 0;
+}
+
+int ckpt_copy_weights(connlm_t *dst, connlm_t *src, updater_t **updaters,
+        int num_updaters)
+{
+    glue_t *glue, *dst_glue;
+    glue_updater_t *glue_updater;
+    int c, g, w, i;
+
+    ST_CHECK_PARAM(dst == NULL || src == NULL
+            || (updaters == NULL && num_updaters > 0), -1);
+
+    for (c = 0; c < src->num_comp; c++) {
+        for (g = 0; g < src->comps[c]->num_glue; g++) {
+            glue = src->comps[c]->glues[g];
+            dst_glue = dst->comps[c]->glues[g];
+            for (w = 0; w < glue->num_wts; w++) {
+                if (mat_cpy(&dst_glue->wts[w]->w, &glue->wts[w]->w) < 0) {
+                    ST_ERROR("Failed to mat_cpy weight of glue[%s].",
+                            glue->name);
+                    return -1;
+                }
+                if (vec_cpy(&dst_glue->wts[w]->bias,
+                            &glue->wts[w]->bias) < 0) {
+                    ST_ERROR("Failed to vec_cpy bias of glue[%s].",
+                            glue->name);
+                    return -1;
+                }
+
+                for (i = 0; i < num_updaters; i++) {
+                    glue_updater = updaters[i]->comp_updaters[c]
+                        ->glue_updaters[g];
+                    if (wt_updater_add_pending(
+                                glue_updater->wt_updaters[w],
+                                &dst_glue->wts[w]->w,
+                                &dst_glue->wts[w]->bias) < 0) {
+                        ST_ERROR("Failed to wt_updater_add_pending "
+                                "for glue[%s].", glue->name);
+                        return -1;
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* copy weights of model into shadow, called with worker threads paused. */
+static int ckpt_snapshot(ckpt_t *ckpt)
+{
+    int i;
+
+    if (ckpt_copy_weights(ckpt->shadow, ckpt->connlm, ckpt->updaters,
+                ckpt->state.num_seeds) < 0) {
+        ST_ERROR("Failed to ckpt_copy_weights.");
+        return -1;
+    }
+
+    if (reader_get_poses(ckpt->reader, ckpt->state.poses) < 0) {
+        ST_ERROR("Failed to reader_get_poses.");
+        return -1;
+    }
+
+    for (i = 0; i < ckpt->state.num_seeds; i++) {
+        ckpt->state.seeds[i] = ckpt->updaters[i]->rand_seed;
+    }
+
+    return 0;
+}
+
+/* write into temporary files and rename them, so that a crash while
+ * writing leaves the last checkpoint untouched. */
+static int ckpt_write(ckpt_t *ckpt)
+{
+    char tmp_file[MAX_DIR_LEN];
+    char state_file[MAX_DIR_LEN];
+    FILE *fp = NULL;
+
+    if (snprintf(tmp_file, MAX_DIR_LEN, "%s.tmp", ckpt->opt.file)
+            >= MAX_DIR_LEN) {
+        ST_ERROR("Too long file name[%s].", ckpt->opt.file);
+        goto ERR;
+    }
+    fp = st_fopen(tmp_file, "wb");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", tmp_file);
+        goto ERR;
+    }
+    if (connlm_save(ckpt->shadow, fp, ckpt->fmt) < 0) {
+        ST_ERROR("Failed to connlm_save. [%s]", tmp_file);
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+    if (rename(tmp_file, ckpt->opt.file) != 0) {
+        ST_ERROR("Failed to rename [%s] to [%s].", tmp_file,
+                ckpt->opt.file);
+        goto ERR;
+    }
+
+    if (snprintf(state_file, MAX_DIR_LEN, "%s.state", ckpt->opt.file)
+            >= MAX_DIR_LEN
+            || snprintf(tmp_file, MAX_DIR_LEN, "%s.state.tmp",
+                ckpt->opt.file) >= MAX_DIR_LEN) {
+        ST_ERROR("Too long file name[%s].", ckpt->opt.file);
+        goto ERR;
+    }
+    fp = st_fopen(tmp_file, "w");
+    if (fp == NULL) {
+        ST_ERROR("Failed to st_fopen. [%s]", tmp_file);
+        goto ERR;
+    }
+    if (ckpt_state_save(&ckpt->state, fp) < 0) {
+        ST_ERROR("Failed to ckpt_state_save. [%s]", tmp_file);
+        goto ERR;
+    }
+    safe_st_fclose(fp);
+    if (rename(tmp_file, state_file) != 0) {
+        ST_ERROR("Failed to rename [%s] to [%s].", tmp_file, state_file);
+        goto ERR;
+    }
+
+    return 0;
+
+ERR:
+    safe_st_fclose(fp);
+    return -1;
+}
+
+static void* ckpt_thread(void *args)
+{
+    ckpt_t *ckpt;
+
+    struct timeval tts, tte;
+    long ms_pause;
+
+    ST_CHECK_PARAM(args == NULL, NULL);
+
+    ckpt = (ckpt_t *)args;
+
+    while (true) {
+        (void)pthread_mutex_lock(&ckpt->lock);
+        while (ckpt->num_running > 0
+                && ckpt->num_words < ckpt->opt.every_words) {
+            (void)pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+        }
+        if (ckpt->num_running == 0) {
+            /* model is saved by caller after training finished. */
+            (void)pthread_mutex_unlock(&ckpt->lock);
+            break;
+        }
+        gettimeofday(&tts, NULL);
+        ckpt->pausing = true;
+        while (ckpt->num_busy > 0) {
+            (void)pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+        }
+        (void)pthread_mutex_unlock(&ckpt->lock);
+
+        if (ckpt_snapshot(ckpt) < 0) {
+            ST_ERROR("Failed to ckpt_snapshot.");
+            goto ERR;
+        }
+
+        (void)pthread_mutex_lock(&ckpt->lock);
+        ckpt->num_words = 0;
+        ckpt->pausing = false;
+        (void)pthread_cond_broadcast(&ckpt->cond);
+        (void)pthread_mutex_unlock(&ckpt->lock);
+        gettimeofday(&tte, NULL);
+        ms_pause = TIMEDIFF(tts, tte);
+
+        if (ckpt_write(ckpt) < 0) {
+            ST_ERROR("Failed to ckpt_write.");
+            goto ERR;
+        }
+        gettimeofday(&tte, NULL);
+
+        ckpt->num_ckpts++;
+        ST_TRACE("Checkpoint: %d, Pause: %.3fs, Time: %.3fs",
+                ckpt->num_ckpts, ms_pause / 1000.0,
+                TIMEDIFF(tts, tte) / 1000.0);
+    }
+
+    ST_NOTICE("Finish checkpointing, %d checkpoints saved.",
+            ckpt->num_ckpts);
+
+    return NULL;
+
+ERR:
+    *(ckpt->err) = -1;
+
+    (void)pthread_mutex_lock(&ckpt->lock);
+    ckpt->pausing = false;
+    (void)pthread_cond_broadcast(&ckpt->cond);
+    (void)pthread_mutex_unlock(&ckpt->lock);
+
+    return NULL;
+}
+
+int ckpt_start(ckpt_t *ckpt, reader_t *reader, updater_t **updaters,
+        int num_thrs, int *err)
+{
+    ckpt_state_t *resume;
+    int i;
+
+    ST_CHECK_PARAM(ckpt == NULL || reader == NULL || updaters == NULL
+            || num_thrs <= 0 || err == NULL, -1);
+
+    ckpt->reader = reader;
+    ckpt->updaters = updaters;
+
+    resume = ckpt->resume;
+    ckpt->resume = NULL;
+    if (resume != NULL) {
+        if (resume->num_seeds != num_thrs) {
+            ST_ERROR("Number of threads[%d] not match with checkpoint[%d].",
+                    num_thrs, resume->num_seeds);
+            return -1;
+        }
+        for (i = 0; i < num_thrs; i++) {
+            if (updater_set_rand_seed(updaters[i], resume->seeds[i]) < 0) {
+                ST_ERROR("Failed to updater_set_rand_seed.");
+                return -1;
+            }
+        }
+
+        if (reader_set_resume(reader, resume->poses,
+                    resume->num_poses) < 0) {
+            ST_ERROR("Failed to reader_set_resume.");
+            return -1;
+        }
+    }
+
+    if (reader_keep_poses(reader) < 0) {
+        ST_ERROR("Failed to reader_keep_poses.");
+        return -1;
+    }
+
+    ckpt->state.num_poses = reader->opt.shard ? num_thrs : 1;
+    ckpt->state.poses = (reader_pos_t *)st_realloc(ckpt->state.poses,
+            sizeof(reader_pos_t) * ckpt->state.num_poses);
+    if (ckpt->state.poses == NULL) {
+        ST_ERROR("Failed to st_realloc poses.");
+        return -1;
+    }
+    ckpt->state.num_seeds = num_thrs;
+    ckpt->state.seeds = (unsigned int *)st_realloc(ckpt->state.seeds,
+            sizeof(unsigned int) * num_thrs);
+    if (ckpt->state.seeds == NULL) {
+        ST_ERROR("Failed to st_realloc seeds.");
+        return -1;
+    }
+
+    ckpt->num_running = num_thrs;
+    ckpt->num_busy = 0;
+    ckpt->pausing = false;
+    ckpt->num_words = 0;
+    ckpt->num_ckpts = 0;
+    ckpt->err = err;
+
+    if (pthread_create(&ckpt->tid, NULL, ckpt_thread, (void *)ckpt) != 0) {
+        ST_ERROR("Failed to pthread_create ckpt_thread.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int ckpt_wait(ckpt_t *ckpt)
+{
+    ST_CHECK_PARAM(ckpt == NULL, -1);
+
+    if (pthread_join(ckpt->tid, NULL) != 0) {
+        ST_ERROR("Failed to pthread_join.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int ckpt_enter(ckpt_t *ckpt)
+{
+    ST_CHECK_PARAM(ckpt == NULL, -1);
+
+    if (pthread_mutex_lock(&ckpt->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+    while (ckpt->pausing) {
+        (void)pthread_cond_wait(&ckpt->cond, &ckpt->lock);
+    }
+    ckpt->num_busy++;
+    (void)pthread_mutex_unlock(&ckpt->lock);
+
+    return 0;
+}
+
+int ckpt_leave(ckpt_t *ckpt, count_t num_words)
+{
+    ST_CHECK_PARAM(ckpt == NULL, -1);
+
+    if (pthread_mutex_lock(&ckpt->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+    ckpt->num_busy--;
+    ckpt->num_words += num_words;
+    if (ckpt->num_words >= ckpt->opt.every_words
+            || (ckpt->pausing && ckpt->num_busy == 0)) {
+        (void)pthread_cond_broadcast(&ckpt->cond);
+    }
+    (void)pthread_mutex_unlock(&ckpt->lock);
+
+    return 0;
+}
+
+void ckpt_finish(ckpt_t *ckpt)
+{
+    if (ckpt == NULL) {
+        return;
+    }
+
+    (void)pthread_mutex_lock(&ckpt->lock);
+    ckpt->num_running--;
+    (void)pthread_cond_broadcast(&ckpt->cond);
+    (void)pthread_mutex_unlock(&ckpt->lock);
+}
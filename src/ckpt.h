@@ -0,0 +1,270 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef  _CONNLM_CKPT_H_
+#define  _CONNLM_CKPT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pthread.h>
+
+#include <stutils/st_opt.h>
+
+#include <connlm/config.h>
+
+#include "connlm.h"
+#include "reader.h"
+#include "updaters/updater.h"
+
+/** @defgroup g_ckpt Checkpointing
+ * Save the model periodically while training, so that an interrupted
+ * training can be resumed in the middle of the text.
+ *
+ * Every time EVERY_WORDS words are trained, worker threads are paused
+ * between word pools, and the weights are copied into a shadow model,
+ * with the updates still pending in the updaters applied, together with
+ * the reading positions of the reader and the random seeds of the
+ * updaters. Then worker threads go on, while the shadow model is
+ * written into FILE by the checkpointing thread. So the pause only costs
+ * a memory copy of the weights, at the expense of holding one more model
+ * in memory.
+ *
+ * The state is written into FILE.state. A training resumed from it reads
+ * from the first word pool not finished when the checkpoint was taken,
+ * it must be run with the same number of threads and reader options.
+ */
+
+/**
+ * Options for checkpointing.
+ * @ingroup g_ckpt
+ */
+typedef struct _ckpt_opt_t_ {
+    char file[MAX_DIR_LEN]; /**< model file to save checkpoint into,
+                              empty to disable checkpointing. */
+    count_t every_words; /**< number of words trained between checkpoints. */
+    bool resume; /**< whether resume from the checkpoint, if it exists. */
+} ckpt_opt_t;
+
+/**
+ * Load checkpointing option.
+ * @ingroup g_ckpt
+ * @param[out] ckpt_opt options loaded.
+ * @param[in] opt runtime options passed by caller.
+ * @param[in] sec_name section name of runtime options to be loaded.
+ * @return non-zero value if any error.
+ */
+int ckpt_load_opt(ckpt_opt_t *ckpt_opt, st_opt_t *opt,
+        const char *sec_name);
+
+/**
+ * State of training saved with checkpoint.
+ * @ingroup g_ckpt
+ */
+typedef struct _ckpt_state_t_ {
+    int epoch; /**< epoch being trained, starting from 1. */
+    double lr_scale; /**< scale applied to learning rate. */
+    bool halving; /**< whether learning rate halving started. */
+    double loss; /**< best validation loss before the epoch. */
+    bool accepted; /**< whether any epoch was accepted. */
+
+    reader_pos_t *poses; /**< reading positions, one for each shard. */
+    int num_poses; /**< number of poses. */
+    unsigned int *seeds; /**< random seeds of updaters. */
+    int num_seeds; /**< number of seeds. */
+} ckpt_state_t;
+
+/**
+ * Destroy a checkpoint state.
+ * @ingroup g_ckpt
+ * @param[in] state state to be destroyed.
+ */
+void ckpt_state_destroy(ckpt_state_t *state);
+
+/**
+ * Save state of the checkpoint.
+ * @ingroup g_ckpt
+ * @param[in] state state to be saved.
+ * @param[in] fp file stream saved to.
+ * @return non-zero value if any error.
+ */
+int ckpt_state_save(ckpt_state_t *state, FILE *fp);
+
+/**
+ * Load state of the checkpoint.
+ * @ingroup g_ckpt
+ * @param[in] opt checkpointing options.
+ * @param[out] state state loaded.
+ * @return 1 if no checkpoint exists, 0 if loaded, -1 if any error.
+ */
+int ckpt_load_state(ckpt_opt_t *opt, ckpt_state_t *state);
+
+/**
+ * Remove the checkpoint, i.e. FILE and FILE.state, together with the
+ * temporary files left by an interrupted writing, if any. Called after
+ * the training finished, so that it is not resumed by a later run.
+ * @ingroup g_ckpt
+ * @param[in] opt checkpointing options.
+ * @return non-zero value if any error.
+ */
+int ckpt_remove(ckpt_opt_t *opt);
+
+/**
+ * Checkpointer.
+ * @ingroup g_ckpt
+ */
+typedef struct _ckpt_t_ {
+    ckpt_opt_t opt; /**< options. */
+    connlm_fmt_t fmt; /**< storage format of checkpoint. */
+
+    connlm_t *connlm; /**< the model being trained. */
+    connlm_t *shadow; /**< copy of model, written in background. */
+    ckpt_state_t state; /**< state saved with checkpoint. Fields except
+                          poses and seeds are filled by caller. */
+
+    reader_t *reader; /**< the reader. */
+    updater_t **updaters; /**< updaters of worker threads. */
+    ckpt_state_t *resume; /**< state to be resumed, NULL if not resuming. */
+
+    pthread_mutex_t lock; /**< lock for states below. */
+    pthread_cond_t cond; /**< condition for states below. */
+    int num_running; /**< number of running worker threads. */
+    int num_busy; /**< number of worker threads holding word pool. */
+    bool pausing; /**< whether worker threads should wait. */
+    count_t num_words; /**< words trained since last checkpoint. */
+
+    int num_ckpts; /**< number of checkpoints saved. */
+    pthread_t tid; /**< thread id of checkpointing thread. */
+    int *err; /**< error indicator. */
+} ckpt_t;
+
+/**
+ * Destroy a ckpt and set the pointer to NULL.
+ * @ingroup g_ckpt
+ * @param[in] ptr pointer to ckpt_t.
+ */
+#define safe_ckpt_destroy(ptr) do {\
+    if((ptr) != NULL) {\
+        ckpt_destroy(ptr);\
+        safe_st_free(ptr);\
+        (ptr) = NULL;\
+    }\
+    } while(0)
+/**
+ * Destroy a ckpt.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt to be destroyed.
+ */
+void ckpt_destroy(ckpt_t *ckpt);
+
+/**
+ * Create a ckpt, with a shadow copy of model.
+ * @ingroup g_ckpt
+ * @param[in] opt checkpointing options.
+ * @param[in] connlm the model being trained.
+ * @param[in] fmt storage format of checkpoint.
+ * @return ckpt on success, otherwise NULL.
+ */
+ckpt_t* ckpt_create(ckpt_opt_t *opt, connlm_t *connlm, connlm_fmt_t fmt);
+
+/**
+ * Resume from a state loaded by ckpt_load_state, i.e. the reading
+ * positions and random seeds are restored in ckpt_start.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt.
+ * @param[in] state state to be resumed, must be valid until ckpt_start.
+ * @return non-zero value if any error.
+ */
+int ckpt_set_resume(ckpt_t *ckpt, ckpt_state_t *state);
+
+/**
+ * Copy weights of the model being trained, together with the updates
+ * pending in the updaters, i.e. the ones accumulated locally and the
+ * lazy momentum and penalties not caught up yet. Neither the model
+ * nor the updaters are changed. Worker threads must be paused.
+ * @ingroup g_ckpt
+ * @param[out] dst model copied into, with the same structure as src.
+ * @param[in] src the model being trained.
+ * @param[in] updaters updaters of worker threads.
+ * @param[in] num_updaters number of updaters.
+ * @return non-zero value if any error.
+ */
+int ckpt_copy_weights(connlm_t *dst, connlm_t *src, updater_t **updaters,
+        int num_updaters);
+
+/**
+ * Start checkpointing thread. Must be called after the updaters
+ * setup, and before reader_read.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt.
+ * @param[in] reader the reader.
+ * @param[in] updaters updaters of worker threads.
+ * @param[in] num_thrs number of worker threads.
+ * @param[in] err global err indicator.
+ * @return non-zero value if any error.
+ */
+int ckpt_start(ckpt_t *ckpt, reader_t *reader, updater_t **updaters,
+        int num_thrs, int *err);
+
+/**
+ * Wait checkpointing thread, which finishes after all worker threads
+ * finished, and the pending checkpoint is written.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt.
+ * @return non-zero value if any error.
+ */
+int ckpt_wait(ckpt_t *ckpt);
+
+/**
+ * Enter a step of worker thread, i.e. before holding a word pool.
+ * Blocks while a checkpoint is being taken.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt.
+ * @return non-zero value if any error.
+ */
+int ckpt_enter(ckpt_t *ckpt);
+
+/**
+ * Leave a step of worker thread, i.e. after releasing the word pool.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt.
+ * @param[in] num_words number of words trained in this step.
+ * @return non-zero value if any error.
+ */
+int ckpt_leave(ckpt_t *ckpt, count_t num_words);
+
+/**
+ * Worker thread finished, no more steps would be entered.
+ * Must be called exactly once by every worker thread, even on error.
+ * @ingroup g_ckpt
+ * @param[in] ckpt ckpt.
+ */
+void ckpt_finish(ckpt_t *ckpt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
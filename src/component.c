@@ -1038,6 +1038,17 @@ void comp_sanity_check(component_t *comp)
     }
 }
 
+void comp_scale_learn_rate(component_t *comp, real_t scale)
+{
+    int g;
+
+    ST_CHECK_PARAM_VOID(comp == NULL);
+
+    for (g = 0; g < comp->num_glue; g++) {
+        comp->glues[g]->param.learn_rate *= scale;
+    }
+}
+
 void comp_print_verbose_info(component_t *comp, FILE *fo)
 {
     int i;
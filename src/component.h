@@ -207,6 +207,14 @@ int comp_draw(component_t *comp, FILE *fp, bool verbose);
  */
 void comp_sanity_check(component_t *comp);
 
+/**
+ * Scale learning rate of all glues in a component.
+ * @ingroup g_component
+ * @param[in] comp component
+ * @param[in] scale the scale.
+ */
+void comp_scale_learn_rate(component_t *comp, real_t scale);
+
 /**
  * Print verbose info of a component.
  * @ingroup g_component
@@ -31,7 +31,7 @@ extern "C" {
 
 #define CONNLM_VERSION   "3.0.1"
 
-#define CONNLM_FILE_VERSION   20
+#define CONNLM_FILE_VERSION   21
 
 #define CONNLM_GIT_COMMIT "0"
 
@@ -59,6 +59,7 @@ typedef unsigned long count_t;
 #define COUNT_MAX ((count_t)-1)
 
 #define ALIGN_SIZE 16
+#define MMAP_ALIGN_SIZE 4096 /**< alignment of weights in mmap format. */
 
 #define SENT_END "</s>"
 #define SENT_END_ID 0
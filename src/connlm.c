@@ -71,6 +71,18 @@ static char* fmt2str(connlm_fmt_t fmt, char *str, size_t len)
             }
             strncat(str, "Zeros-Compressed", len - strlen(str));
         }
+        if (fmt & CONN_FMT_MMAP) {
+            if (str[0] != '\0') {
+                strncat(str, "|", len - strlen(str));
+            }
+            strncat(str, "Mmap", len - strlen(str));
+        }
+        if (fmt & CONN_FMT_CHECKSUM) {
+            if (str[0] != '\0') {
+                strncat(str, "|", len - strlen(str));
+            }
+            strncat(str, "Checksum", len - strlen(str));
+        }
     }
 
     return str;
@@ -906,6 +918,26 @@ int connlm_setup(connlm_t *connlm)
     return 0;
 }
 
+int connlm_quantize(connlm_t *connlm)
+{
+    int c, g;
+
+    ST_CHECK_PARAM(connlm == NULL, -1);
+
+    for (c = 0; c < connlm->num_comp; c++) {
+        for (g = 0; g < connlm->comps[c]->num_glue; g++) {
+            if (glue_quantize(connlm->comps[c]->glues[g]) < 0) {
+                ST_ERROR("Failed to glue_quantize[%s/%s].",
+                        connlm->comps[c]->name,
+                        connlm->comps[c]->glues[g]->name);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 int connlm_add_comp(connlm_t *connlm, component_t *comp)
 {
     char name[MAX_NAME_LEN];
@@ -973,6 +1005,17 @@ void connlm_sanity_check(connlm_t *connlm)
     }
 }
 
+void connlm_scale_learn_rate(connlm_t *connlm, real_t scale)
+{
+    int c;
+
+    ST_CHECK_PARAM_VOID(connlm == NULL);
+
+    for (c = 0; c < connlm->num_comp; c++) {
+        comp_scale_learn_rate(connlm->comps[c], scale);
+    }
+}
+
 void connlm_print_verbose_info(connlm_t *connlm, FILE *fo)
 {
     int c;
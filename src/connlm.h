@@ -175,6 +175,17 @@ int connlm_filter(connlm_t *connlm, model_filter_t mf,
  */
 int connlm_setup(connlm_t *connlm);
 
+/**
+ * Quantize weights of a connlm model to int8 for inference.
+ * Weights of output and direct glues are quantized with per-row scales,
+ * and the real-valued copies are released. The model can not be trained
+ * or saved afterwards.
+ * @ingroup g_connlm
+ * @param[in] connlm connlm model.
+ * @return non-zero value if any error.
+ */
+int connlm_quantize(connlm_t *connlm);
+
 /**
  * Add a component to connlm model.
  * @ingroup g_connlm
@@ -191,6 +202,15 @@ int connlm_add_comp(connlm_t *connlm, component_t *comp);
  */
 void connlm_sanity_check(connlm_t *connlm);
 
+/**
+ * Scale learning rate of all components, e.g. halving the learning rate
+ * between epochs. Takes effect on updaters created afterwards.
+ * @ingroup g_connlm
+ * @param[in] connlm connlm model.
+ * @param[in] scale the scale.
+ */
+void connlm_scale_learn_rate(connlm_t *connlm, real_t scale);
+
 /**
  * Print verbose info of a connlm model.
  * @ingroup g_connlm
@@ -0,0 +1,393 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stutils/st_macro.h>
+#include <stutils/st_log.h>
+#include <stutils/st_io.h>
+
+#include "reader.h"
+#include "corpus.h"
+
+static const int CORPUS_MAGIC_NUM = 626140498 + 100;
+static const int CORPUS_FILE_VERSION = 1;
+
+#define CORPUS_COMPILE_EPOCH 10000
+
+void corpus_destroy(corpus_t *corpus)
+{
+    if (corpus == NULL) {
+        return;
+    }
+
+    if (corpus->addr != NULL) {
+        (void)munmap(corpus->addr, corpus->map_size);
+        corpus->addr = NULL;
+    }
+    corpus->map_size = 0;
+    corpus->words = NULL;
+    corpus->sent_ends = NULL;
+}
+
+static int corpus_check_header(corpus_header_t *header, size_t file_size)
+{
+    if (header->magic_num != CORPUS_MAGIC_NUM) {
+        ST_ERROR("magic num wrong.");
+        return -1;
+    }
+
+    if (header->version > CORPUS_FILE_VERSION) {
+        ST_ERROR("Too high file versoin[%d], "
+                "please upgrade connlm toolkit", header->version);
+        return -1;
+    }
+
+    if (header->vocab_size <= 0) {
+        ST_ERROR("Wrong vocab size[%d].", header->vocab_size);
+        return -1;
+    }
+
+    /* bounded by file size first, so that offsets below never overflow. */
+    if (header->num_sents < 0 || header->num_words < header->num_sents
+            || header->num_words > file_size / sizeof(int32_t)
+            || header->words_offset < 0 || header->words_offset > file_size
+            || header->index_offset < 0
+            || header->index_offset > file_size) {
+        ST_ERROR("Wrong size of corpus: sents[%"PRId64"], words[%"PRId64"]",
+                header->num_sents, header->num_words);
+        return -1;
+    }
+
+    if (header->words_offset < sizeof(corpus_header_t)
+            || header->words_offset % sizeof(int32_t) != 0
+            || header->words_offset + sizeof(int32_t) * header->num_words
+                > header->index_offset
+            || header->index_offset % sizeof(int64_t) != 0
+            || header->index_offset + sizeof(int64_t) * header->num_sents
+                > file_size) {
+        ST_ERROR("Corpus file truncated or corrupted.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* sentence index must be non-decreasing and end at num_words, since it
+ * is trusted when slicing the word ids. */
+static int corpus_check_index(corpus_t *corpus)
+{
+    int64_t prev;
+    int64_t i;
+
+    prev = 0;
+    for (i = 0; i < corpus->header.num_sents; i++) {
+        if (corpus->sent_ends[i] < prev) {
+            ST_ERROR("Sentence index not sorted at [%"PRId64"].", i);
+            return -1;
+        }
+        prev = corpus->sent_ends[i];
+    }
+
+    if (prev != corpus->header.num_words) {
+        ST_ERROR("Sentence index ends at [%"PRId64"], "
+                "but words[%"PRId64"].", prev, corpus->header.num_words);
+        return -1;
+    }
+
+    return 0;
+}
+
+corpus_t* corpus_open(const char *corpus_file, vocab_t *vocab)
+{
+    corpus_t *corpus = NULL;
+    struct stat st;
+    int fd = -1;
+
+    ST_CHECK_PARAM(corpus_file == NULL, NULL);
+
+    corpus = (corpus_t *)st_malloc(sizeof(corpus_t));
+    if (corpus == NULL) {
+        ST_ERROR("Failed to st_malloc corpus.");
+        goto ERR;
+    }
+    memset(corpus, 0, sizeof(corpus_t));
+
+    fd = open(corpus_file, O_RDONLY);
+    if (fd < 0) {
+        ST_ERROR("Failed to open corpus[%s].", corpus_file);
+        goto ERR;
+    }
+
+    if (fstat(fd, &st) != 0) {
+        ST_ERROR("Failed to fstat corpus[%s].", corpus_file);
+        goto ERR;
+    }
+
+    if (st.st_size < sizeof(corpus_header_t)) {
+        ST_ERROR("Corpus file too small[%s].", corpus_file);
+        goto ERR;
+    }
+
+    corpus->map_size = st.st_size;
+    corpus->addr = mmap(NULL, corpus->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (corpus->addr == MAP_FAILED) {
+        corpus->addr = NULL;
+        ST_ERROR("Failed to mmap corpus[%s].", corpus_file);
+        goto ERR;
+    }
+    (void)madvise(corpus->addr, corpus->map_size, MADV_SEQUENTIAL);
+    close(fd);
+    fd = -1;
+
+    memcpy(&corpus->header, corpus->addr, sizeof(corpus_header_t));
+    if (corpus_check_header(&corpus->header, corpus->map_size) < 0) {
+        ST_ERROR("Failed to corpus_check_header[%s].", corpus_file);
+        goto ERR;
+    }
+
+    if (vocab != NULL && corpus->header.vocab_size != vocab->vocab_size) {
+        ST_ERROR("Vocab size not match: corpus[%d], vocab[%d]. "
+                "Please recompile the corpus with current vocab.",
+                corpus->header.vocab_size, vocab->vocab_size);
+        goto ERR;
+    }
+
+    corpus->words = (int32_t *)((char *)corpus->addr
+            + corpus->header.words_offset);
+    corpus->sent_ends = (int64_t *)((char *)corpus->addr
+            + corpus->header.index_offset);
+
+    if (corpus_check_index(corpus) < 0) {
+        ST_ERROR("Corpus file corrupted[%s].", corpus_file);
+        goto ERR;
+    }
+
+    return corpus;
+
+ERR:
+    if (fd >= 0) {
+        close(fd);
+    }
+    safe_corpus_destroy(corpus);
+    return NULL;
+}
+
+bool corpus_is_compiled(const char *file)
+{
+    FILE *fp;
+    int magic_num;
+
+    ST_CHECK_PARAM(file == NULL, false);
+
+    fp = fopen(file, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    if (fread(&magic_num, sizeof(int), 1, fp) != 1) {
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+
+    return magic_num == CORPUS_MAGIC_NUM;
+}
+
+int corpus_compile(FILE *text_fp, FILE *corpus_fp, vocab_t *vocab,
+        bool drop_empty_line, corpus_header_t *header)
+{
+    corpus_header_t hdr;
+    word_pool_t wp = WORD_POOL_INITIALIZER;
+
+    int64_t *sent_ends = NULL;
+    int64_t cap_sents;
+    int32_t zero = 0;
+
+    int num_sents;
+    int num_oovs;
+    int i;
+
+    ST_CHECK_PARAM(text_fp == NULL || corpus_fp == NULL
+            || vocab == NULL, -1);
+
+    memset(&hdr, 0, sizeof(corpus_header_t));
+    hdr.magic_num = CORPUS_MAGIC_NUM;
+    hdr.version = CORPUS_FILE_VERSION;
+    hdr.vocab_size = vocab->vocab_size;
+    hdr.words_offset = sizeof(corpus_header_t);
+
+    /* write a placeholder header, which will be rewritten at last. */
+    if (fwrite(&hdr, sizeof(corpus_header_t), 1, corpus_fp) != 1) {
+        ST_ERROR("Failed to write header.");
+        goto ERR;
+    }
+
+    cap_sents = 0;
+    while (!feof(text_fp)) {
+        num_sents = word_pool_read(&wp, CORPUS_COMPILE_EPOCH, text_fp,
+                vocab, &num_oovs, drop_empty_line);
+        if (num_sents < 0) {
+            ST_ERROR("Failed to word_pool_read.");
+            goto ERR;
+        }
+        if (num_sents == 0) {
+            continue;
+        }
+
+        if (fwrite(wp.words.vals, sizeof(int32_t), wp.words.size,
+                    corpus_fp) != wp.words.size) {
+            ST_ERROR("Failed to write words.");
+            goto ERR;
+        }
+
+        if (hdr.num_sents + num_sents > cap_sents) {
+            cap_sents = (hdr.num_sents + num_sents) * 2;
+            sent_ends = (int64_t *)st_realloc(sent_ends,
+                    sizeof(int64_t) * cap_sents);
+            if (sent_ends == NULL) {
+                ST_ERROR("Failed to st_realloc sent_ends.");
+                goto ERR;
+            }
+        }
+        for (i = 0; i < num_sents; i++) {
+            sent_ends[hdr.num_sents + i] = hdr.num_words
+                + VEC_VAL(&wp.sent_ends, i);
+        }
+
+        hdr.num_sents += num_sents;
+        hdr.num_words += wp.words.size;
+        hdr.num_oovs += num_oovs;
+    }
+
+    hdr.index_offset = hdr.words_offset + sizeof(int32_t) * hdr.num_words;
+    if (hdr.index_offset % sizeof(int64_t) != 0) {
+        if (fwrite(&zero, sizeof(int32_t), 1, corpus_fp) != 1) {
+            ST_ERROR("Failed to write padding.");
+            goto ERR;
+        }
+        hdr.index_offset += sizeof(int32_t);
+    }
+
+    if (hdr.num_sents > 0) {
+        if (fwrite(sent_ends, sizeof(int64_t), hdr.num_sents, corpus_fp)
+                != hdr.num_sents) {
+            ST_ERROR("Failed to write sentence index.");
+            goto ERR;
+        }
+    }
+
+    if (fseeko(corpus_fp, 0, SEEK_SET) != 0) {
+        ST_ERROR("Failed to fseeko. Output must be a regular file.");
+        goto ERR;
+    }
+    if (fwrite(&hdr, sizeof(corpus_header_t), 1, corpus_fp) != 1) {
+        ST_ERROR("Failed to write header.");
+        goto ERR;
+    }
+
+    if (header != NULL) {
+        *header = hdr;
+    }
+
+    word_pool_destroy(&wp);
+    safe_st_free(sent_ends);
+
+    return 0;
+
+ERR:
+    word_pool_destroy(&wp);
+    safe_st_free(sent_ends);
+    return -1;
+}
+
+int corpus_read(corpus_t *corpus, int64_t *sent_pos, int max_sents,
+        ivec_t *words, ivec_t *sent_ends, int *num_oovs)
+{
+    int64_t start, end;
+    int num_sents;
+    int this_num_oovs;
+    int i;
+
+    ST_CHECK_PARAM(corpus == NULL || sent_pos == NULL || max_sents <= 0
+            || words == NULL || sent_ends == NULL, -1);
+
+    if (*sent_pos >= corpus->header.num_sents) {
+        words->vals = NULL;
+        words->size = 0;
+        words->capacity = 0;
+        return 0;
+    }
+
+    num_sents = (int)min(corpus->header.num_sents - *sent_pos,
+            (int64_t)max_sents);
+
+    if (*sent_pos == 0) {
+        start = 0;
+    } else {
+        start = corpus->sent_ends[*sent_pos - 1];
+    }
+    end = corpus->sent_ends[*sent_pos + num_sents - 1];
+
+    /* point into the mapped ids, no copying. */
+    words->vals = (int *)(corpus->words + start);
+    words->size = end - start;
+    words->capacity = 0;
+
+    if (ivec_resize(sent_ends, num_sents) < 0) {
+        ST_ERROR("Failed to ivec_resize sent_ends.");
+        return -1;
+    }
+    for (i = 0; i < num_sents; i++) {
+        VEC_VAL(sent_ends, i) = (int)(corpus->sent_ends[*sent_pos + i] - start);
+    }
+
+    /* ids go straight into the weights, check them while counting. */
+    this_num_oovs = 0;
+    for (i = 0; i < words->size; i++) {
+        if (VEC_VAL(words, i) < 0
+                || VEC_VAL(words, i) >= corpus->header.vocab_size) {
+            ST_ERROR("Invalid word id[%d] in sentence[%"PRId64"].",
+                    VEC_VAL(words, i), *sent_pos);
+            return -1;
+        }
+        if (VEC_VAL(words, i) == UNK_ID) {
+            this_num_oovs++;
+        }
+    }
+    if (num_oovs != NULL) {
+        *num_oovs = this_num_oovs;
+    }
+
+    *sent_pos += num_sents;
+
+    return num_sents;
+}
@@ -0,0 +1,148 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef  _CONNLM_CORPUS_H_
+#define  _CONNLM_CORPUS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include <connlm/config.h>
+#include "vector.h"
+#include "vocab.h"
+
+/** @defgroup g_corpus Compiled Corpus
+ * Pre-tokenized binary corpus, which can be mmap-ed by reader.
+ *
+ * Layout of file:
+ * - header (corpus_header_t, 64 bytes);
+ * - word ids (int32, with \<s\> and \</s\> for every sentence);
+ * - sentence index (int64, position of the end of every sentence).
+ */
+
+/**
+ * Header of compiled corpus.
+ * @ingroup g_corpus
+ */
+typedef struct _corpus_header_t_ {
+    int32_t magic_num; /**< magic number. */
+    int32_t version; /**< file version. */
+    int32_t vocab_size; /**< size of vocab used to compile the corpus. */
+    int32_t reserved; /**< reserved for alignment. */
+    int64_t num_sents; /**< number of sentences. */
+    int64_t num_words; /**< number of word ids, including \<s\> and \</s\>. */
+    int64_t num_oovs; /**< number of OOVs. */
+    int64_t words_offset; /**< offset in bytes of word ids. */
+    int64_t index_offset; /**< offset in bytes of sentence index. */
+    int64_t padding; /**< padding the header to 64 bytes. */
+} corpus_header_t;
+
+/**
+ * Compiled corpus mapped into memory.
+ * @ingroup g_corpus
+ */
+typedef struct _corpus_t_ {
+    corpus_header_t header; /**< header. */
+
+    void *addr; /**< start address of mapped file. */
+    size_t map_size; /**< size of mapped file. */
+
+    int32_t *words; /**< word ids. */
+    int64_t *sent_ends; /**< position of the end of every sentence. */
+} corpus_t;
+
+/**
+ * Destroy a corpus and set the pointer to NULL.
+ * @ingroup g_corpus
+ * @param[in] ptr pointer to corpus_t.
+ */
+#define safe_corpus_destroy(ptr) do {\
+    if((ptr) != NULL) {\
+        corpus_destroy(ptr);\
+        safe_st_free(ptr);\
+        (ptr) = NULL;\
+    }\
+    } while(0)
+/**
+ * Destroy a corpus, i.e. unmap the file.
+ * @ingroup g_corpus
+ * @param[in] corpus corpus to be destroyed.
+ */
+void corpus_destroy(corpus_t *corpus);
+
+/**
+ * Open a compiled corpus with mmap.
+ * @ingroup g_corpus
+ * @param[in] corpus_file file name of compiled corpus.
+ * @param[in] vocab vocabulary, used to validate the corpus, can be NULL.
+ * @return corpus on success, otherwise NULL.
+ */
+corpus_t* corpus_open(const char *corpus_file, vocab_t *vocab);
+
+/**
+ * Check whether a file is a compiled corpus.
+ * @ingroup g_corpus
+ * @param[in] file file name.
+ * @return true if the file is a compiled corpus, otherwise false.
+ */
+bool corpus_is_compiled(const char *file);
+
+/**
+ * Compile a text file into binary corpus.
+ * @ingroup g_corpus
+ * @param[in] text_fp text file.
+ * @param[in] corpus_fp output file, must be seekable.
+ * @param[in] vocab vocabulary.
+ * @param[in] drop_empty_line whether drop the empty lines.
+ * @param[out] header header of compiled corpus, if not NULL.
+ * @return non-zero value if any error.
+ */
+int corpus_compile(FILE *text_fp, FILE *corpus_fp, vocab_t *vocab,
+        bool drop_empty_line, corpus_header_t *header);
+
+/**
+ * Read words of sentences from a compiled corpus.
+ * The words vector is set to point into the mapped memory directly,
+ * and MUST NOT be destroyed or modified by caller.
+ * @ingroup g_corpus
+ * @param[in] corpus the corpus.
+ * @param[in, out] sent_pos index of first sentence to be read,
+ *                 will be advanced with number of sentences read.
+ * @param[in] max_sents max number of sentences to be read.
+ * @param[out] words vector points to the word ids.
+ * @param[out] sent_ends position of \</s\> relative to words.
+ * @param[out] num_oovs number of oovs, if not NULL.
+ * @return number of sentences read, -1 if any error.
+ */
+int corpus_read(corpus_t *corpus, int64_t *sent_pos, int max_sents,
+        ivec_t *words, ivec_t *sent_ends, int *num_oovs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
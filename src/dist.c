@@ -0,0 +1,1240 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <stutils/st_macro.h>
+#include <stutils/st_log.h>
+#include <stutils/st_mem.h>
+#include <stutils/st_string.h>
+
+#include "weight.h"
+#include "dist.h"
+
+#define DIST_MAGIC 0x434c4d44
+#define DIST_BUF_SIZE (1 << 20) /* size of read and write buffer. */
+#define DIST_SEG_END UINT64_MAX /* end of segments in a message. */
+#define DIST_FLAG_DONE 0x1 /* all worker threads of sender finished. */
+
+/* first message sent to worker 0 after connected. */
+typedef struct _dist_hello_t_ {
+    uint32_t magic;
+    int32_t rank;
+    uint32_t real_size;
+    uint64_t num_segs;
+} dist_hello_t;
+
+/* header of message in every round, followed by (seg_id, values) pairs
+   and a DIST_SEG_END. workers send the values of segments changed since
+   the last round, worker 0 replies with the averaged values. */
+typedef struct _dist_msg_header_t_ {
+    uint32_t magic;
+    uint32_t flags;
+} dist_msg_header_t;
+
+int dist_load_opt(dist_opt_t *dist_opt, st_opt_t *opt,
+        const char *sec_name)
+{
+    char name[MAX_ST_CONF_LEN];
+    char str[MAX_ST_CONF_LEN];
+    long long l;
+
+    ST_CHECK_PARAM(dist_opt == NULL || opt == NULL, -1);
+
+    if (sec_name == NULL || sec_name[0] == '\0') {
+        snprintf(name, MAX_ST_CONF_LEN, "%s", "DIST");
+    } else {
+        snprintf(name, MAX_ST_CONF_LEN, "%s/%s", sec_name, "DIST");
+    }
+
+    ST_OPT_SEC_GET_INT(opt, name, "NUM_WORKERS", dist_opt->num_workers, 1,
+            "Number of workers(processes) training together, "
+            "1 to disable distributed training.");
+    if (dist_opt->num_workers <= 0) {
+        ST_ERROR("NUM_WORKERS must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_INT(opt, name, "RANK", dist_opt->rank, 0,
+            "Rank of this worker, in [0, NUM_WORKERS). "
+            "Worker 0 collects and averages the parameters.");
+    if (dist_opt->rank < 0 || dist_opt->rank >= dist_opt->num_workers) {
+        ST_ERROR("RANK must be in [0, %d).", dist_opt->num_workers);
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_STR(opt, name, "ADDRESS", dist_opt->addr, MAX_DIR_LEN,
+            "", "Address of worker 0, 'unix:<path>' or '<host>:<port>'.");
+    if (dist_opt->num_workers > 1 && dist_opt->addr[0] == '\0') {
+        ST_ERROR("ADDRESS must be set for distributed training.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_STR(opt, name, "SYNC_WORDS", str, MAX_ST_CONF_LEN, "1M",
+            "Number of words trained locally between averaging "
+            "parameters (can be set to 100k, 1M, etc.)");
+    l = st_str2ll(str);
+    if (l <= 0) {
+        ST_ERROR("Invalid SYNC_WORDS[%s]", str);
+        goto ST_OPT_ERR;
+    }
+    dist_opt->sync_words = (count_t)l;
+
+    ST_OPT_SEC_GET_INT(opt, name, "TIMEOUT", dist_opt->timeout, 60,
+            "Seconds waiting for worker 0 to be ready.");
+
+    ST_OPT_SEC_GET_BOOL(opt, name, "SPLIT_TEXT", dist_opt->split_text, true,
+            "Train only the rank-th part of the text. Disable it, "
+            "if every worker is given its own text.");
+
+    return 0;
+
+ST_OPT_ERR:
+    return -1;
+}
+
+static void dist_conn_destroy(dist_conn_t *conn)
+{
+    if (conn == NULL) {
+        return;
+    }
+
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    safe_st_free(conn->rbuf);
+    safe_st_free(conn->wbuf);
+    conn->rlen = 0;
+    conn->rpos = 0;
+    conn->wlen = 0;
+}
+
+static int dist_conn_init(dist_conn_t *conn, int fd)
+{
+    ST_CHECK_PARAM(conn == NULL || fd < 0, -1);
+
+    conn->fd = fd;
+
+    conn->rbuf = (char *)st_malloc(DIST_BUF_SIZE);
+    if (conn->rbuf == NULL) {
+        ST_ERROR("Failed to st_malloc rbuf.");
+        return -1;
+    }
+    conn->rlen = 0;
+    conn->rpos = 0;
+
+    conn->wbuf = (char *)st_malloc(DIST_BUF_SIZE);
+    if (conn->wbuf == NULL) {
+        ST_ERROR("Failed to st_malloc wbuf.");
+        return -1;
+    }
+    conn->wlen = 0;
+
+    return 0;
+}
+
+static int dist_conn_flush(dist_conn_t *conn)
+{
+    ssize_t n;
+    size_t total;
+
+    total = 0;
+    while (total < conn->wlen) {
+        n = send(conn->fd, conn->wbuf + total, conn->wlen - total,
+                MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ST_ERROR("Failed to send to peer: %s.", strerror(errno));
+            return -1;
+        }
+        total += n;
+    }
+    conn->wlen = 0;
+
+    return 0;
+}
+
+static int dist_conn_write(dist_conn_t *conn, const void *buf, size_t len)
+{
+    const char *p;
+    size_t n;
+
+    p = (const char *)buf;
+    while (len > 0) {
+        if (conn->wlen == DIST_BUF_SIZE) {
+            if (dist_conn_flush(conn) < 0) {
+                return -1;
+            }
+        }
+        n = min(len, DIST_BUF_SIZE - conn->wlen);
+        memcpy(conn->wbuf + conn->wlen, p, n);
+        conn->wlen += n;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int dist_conn_read(dist_conn_t *conn, void *buf, size_t len)
+{
+    char *p;
+    ssize_t r;
+    size_t n;
+
+    p = (char *)buf;
+    while (len > 0) {
+        if (conn->rpos == conn->rlen) {
+            r = read(conn->fd, conn->rbuf, DIST_BUF_SIZE);
+            if (r < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                ST_ERROR("Failed to read from peer: %s.", strerror(errno));
+                return -1;
+            } else if (r == 0) {
+                ST_ERROR("Connection closed by peer.");
+                return -1;
+            }
+            conn->rlen = r;
+            conn->rpos = 0;
+        }
+        n = min(len, conn->rlen - conn->rpos);
+        memcpy(p, conn->rbuf + conn->rpos, n);
+        conn->rpos += n;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+void dist_destroy(dist_t *dist)
+{
+    int i;
+
+    if (dist == NULL) {
+        return;
+    }
+
+    safe_st_free(dist->bufs);
+    dist->num_bufs = 0;
+    dist->num_segs = 0;
+    safe_st_free(dist->seg_dirty);
+    safe_st_free(dist->seg_cnts);
+
+    if (dist->conns != NULL) {
+        for (i = 0; i < dist->num_conns; i++) {
+            dist_conn_destroy(dist->conns + i);
+        }
+        safe_st_free(dist->conns);
+    }
+    dist->num_conns = 0;
+
+    (void)pthread_mutex_destroy(&dist->lock);
+    (void)pthread_cond_destroy(&dist->cond);
+}
+
+static int dist_add_buf(dist_t *dist, real_t *vals,
+        size_t num_rows, size_t num_cols, size_t stride)
+{
+    dist_buf_t *buf;
+
+    if (num_rows * num_cols == 0) {
+        return 0;
+    }
+
+    dist->bufs = (dist_buf_t *)st_realloc(dist->bufs,
+            sizeof(dist_buf_t) * (dist->num_bufs + 1));
+    if (dist->bufs == NULL) {
+        ST_ERROR("Failed to st_realloc bufs.");
+        return -1;
+    }
+    buf = dist->bufs + dist->num_bufs;
+    memset(buf, 0, sizeof(dist_buf_t));
+    dist->num_bufs++;
+
+    buf->vals = vals;
+    buf->num_rows = num_rows;
+    buf->num_cols = num_cols;
+    buf->stride = stride;
+
+    buf->segs_per_row = (num_cols + DIST_SEG_SIZE - 1) / DIST_SEG_SIZE;
+    buf->seg_start = dist->num_segs;
+    dist->num_segs += num_rows * buf->segs_per_row;
+
+    return 0;
+}
+
+static int dist_setup_bufs(dist_t *dist, connlm_t *connlm)
+{
+    glue_t *glue;
+    weight_t *wt;
+    int c, g, w;
+
+    for (c = 0; c < connlm->num_comp; c++) {
+        for (g = 0; g < connlm->comps[c]->num_glue; g++) {
+            glue = connlm->comps[c]->glues[g];
+            for (w = 0; w < glue->num_wts; w++) {
+                wt = glue->wts[w];
+                if (wt_is_quantized(wt)) {
+                    ST_ERROR("Can not train quantized glue[%s].",
+                            glue->name);
+                    return -1;
+                }
+                if (dist_add_buf(dist, wt->w.vals, wt->w.num_rows,
+                            wt->w.num_cols, wt->w.stride) < 0) {
+                    ST_ERROR("Failed to dist_add_buf for weight.");
+                    return -1;
+                }
+                if (dist_add_buf(dist, wt->bias.vals, 1,
+                            wt->bias.size, wt->bias.size) < 0) {
+                    ST_ERROR("Failed to dist_add_buf for bias.");
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Split address into host and port.
+ * Return 1 for Unix-domain socket, with path in host.
+ */
+static int dist_parse_addr(const char *addr, char *host, size_t host_len,
+        char *port, size_t port_len)
+{
+    const char *p;
+    size_t len;
+
+    if (strncmp(addr, "unix:", 5) == 0) {
+        len = strlen(addr + 5);
+        if (len >= min(host_len,
+                    sizeof(((struct sockaddr_un *)0)->sun_path))) {
+            ST_ERROR("Socket path too long[%s].", addr + 5);
+            return -1;
+        }
+        memcpy(host, addr + 5, len + 1);
+        return 1;
+    }
+
+    p = strrchr(addr, ':');
+    if (p == NULL || p[1] == '\0' || (size_t)(p - addr) >= host_len
+            || strlen(p + 1) >= port_len) {
+        ST_ERROR("Invalid address[%s], should be 'unix:<path>' "
+                "or '<host>:<port>'.", addr);
+        return -1;
+    }
+    memcpy(host, addr, p - addr);
+    host[p - addr] = '\0';
+    memcpy(port, p + 1, strlen(p + 1) + 1);
+
+    return 0;
+}
+
+static int dist_listen(const char *addr)
+{
+    char host[MAX_DIR_LEN];
+    char port[MAX_NAME_LEN];
+    struct sockaddr_un un_addr;
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    struct addrinfo *ai;
+    int fd = -1;
+    int on = 1;
+    int ret;
+
+    ret = dist_parse_addr(addr, host, MAX_DIR_LEN, port, MAX_NAME_LEN);
+    if (ret < 0) {
+        ST_ERROR("Failed to dist_parse_addr.");
+        return -1;
+    }
+
+    if (ret == 1) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            ST_ERROR("Failed to socket: %s.", strerror(errno));
+            return -1;
+        }
+        memset(&un_addr, 0, sizeof(un_addr));
+        un_addr.sun_family = AF_UNIX;
+        // length checked by dist_parse_addr
+        memcpy(un_addr.sun_path, host, strlen(host) + 1);
+
+        (void)unlink(host);
+        if (bind(fd, (struct sockaddr *)&un_addr, sizeof(un_addr)) < 0) {
+            ST_ERROR("Failed to bind[%s]: %s.", host, strerror(errno));
+            goto ERR;
+        }
+    } else {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        ret = getaddrinfo(host[0] == '\0' ? NULL : host, port, &hints, &res);
+        if (ret != 0) {
+            ST_ERROR("Failed to getaddrinfo[%s]: %s.", addr,
+                    gai_strerror(ret));
+            return -1;
+        }
+
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                break;
+            }
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+
+        if (fd < 0) {
+            ST_ERROR("Failed to bind[%s]: %s.", addr, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (listen(fd, SOMAXCONN) < 0) {
+        ST_ERROR("Failed to listen[%s]: %s.", addr, strerror(errno));
+        goto ERR;
+    }
+
+    return fd;
+
+ERR:
+    close(fd);
+    return -1;
+}
+
+/*
+ * Connect to address.
+ * Return -2 if peer is not ready yet.
+ */
+static int dist_connect(const char *addr)
+{
+    char host[MAX_DIR_LEN];
+    char port[MAX_NAME_LEN];
+    struct sockaddr_un un_addr;
+    struct addrinfo hints;
+    struct addrinfo *res = NULL;
+    struct addrinfo *ai;
+    int fd = -1;
+    int on = 1;
+    int ret;
+
+    ret = dist_parse_addr(addr, host, MAX_DIR_LEN, port, MAX_NAME_LEN);
+    if (ret < 0) {
+        ST_ERROR("Failed to dist_parse_addr.");
+        return -1;
+    }
+
+    if (ret == 1) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            ST_ERROR("Failed to socket: %s.", strerror(errno));
+            return -1;
+        }
+        memset(&un_addr, 0, sizeof(un_addr));
+        un_addr.sun_family = AF_UNIX;
+        // length checked by dist_parse_addr
+        memcpy(un_addr.sun_path, host, strlen(host) + 1);
+
+        if (connect(fd, (struct sockaddr *)&un_addr, sizeof(un_addr)) < 0) {
+            ret = errno;
+            close(fd);
+            if (ret == ENOENT || ret == ECONNREFUSED) {
+                return -2;
+            }
+            ST_ERROR("Failed to connect[%s]: %s.", addr, strerror(ret));
+            return -1;
+        }
+
+        return fd;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0) {
+        ST_ERROR("Failed to getaddrinfo[%s]: %s.", addr, gai_strerror(ret));
+        return -1;
+    }
+
+    ret = ECONNREFUSED;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            ret = errno;
+            continue;
+        }
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        ret = errno;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        if (ret == ECONNREFUSED || ret == ETIMEDOUT
+                || ret == EHOSTUNREACH || ret == ENETUNREACH) {
+            return -2;
+        }
+        ST_ERROR("Failed to connect[%s]: %s.", addr, strerror(ret));
+        return -1;
+    }
+
+    // messages are flushed explicitly, do not wait for more data
+    (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    return fd;
+}
+
+static int dist_accept_workers(dist_t *dist)
+{
+    dist_hello_t hello;
+    dist_conn_t conn;
+    int listen_fd = -1;
+    int fd;
+    int on = 1;
+    int i;
+
+    listen_fd = dist_listen(dist->opt.addr);
+    if (listen_fd < 0) {
+        ST_ERROR("Failed to dist_listen.");
+        return -1;
+    }
+
+    ST_NOTICE("Waiting for %d workers on [%s]...", dist->num_conns,
+            dist->opt.addr);
+    memset(&conn, 0, sizeof(dist_conn_t));
+    conn.fd = -1;
+    for (i = 0; i < dist->num_conns; i++) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                i--;
+                continue;
+            }
+            ST_ERROR("Failed to accept: %s.", strerror(errno));
+            goto ERR;
+        }
+        (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        if (dist_conn_init(&conn, fd) < 0) {
+            ST_ERROR("Failed to dist_conn_init.");
+            goto ERR;
+        }
+
+        if (dist_conn_read(&conn, &hello, sizeof(hello)) < 0) {
+            ST_ERROR("Failed to read hello.");
+            goto ERR;
+        }
+
+        if (hello.magic != DIST_MAGIC) {
+            ST_ERROR("Wrong magic from worker.");
+            goto ERR;
+        }
+        if (hello.rank <= 0 || hello.rank > dist->num_conns
+                || dist->conns[hello.rank - 1].fd >= 0) {
+            ST_ERROR("Invalid or duplicated rank[%d] of worker.",
+                    hello.rank);
+            goto ERR;
+        }
+        if (hello.real_size != sizeof(real_t)
+                || hello.num_segs != dist->num_segs) {
+            ST_ERROR("Model of worker[%d] not match with worker 0.",
+                    hello.rank);
+            goto ERR;
+        }
+
+        dist->conns[hello.rank - 1] = conn;
+        memset(&conn, 0, sizeof(dist_conn_t));
+        conn.fd = -1;
+
+        ST_NOTICE("Worker[%d] connected.", hello.rank);
+    }
+
+    close(listen_fd);
+    if (strncmp(dist->opt.addr, "unix:", 5) == 0) {
+        (void)unlink(dist->opt.addr + 5);
+    }
+
+    return 0;
+
+ERR:
+    dist_conn_destroy(&conn);
+    close(listen_fd);
+    return -1;
+}
+
+static int dist_connect_worker0(dist_t *dist)
+{
+    dist_hello_t hello;
+    int fd;
+    int n;
+
+    n = 0;
+    while (true) {
+        fd = dist_connect(dist->opt.addr);
+        if (fd >= 0) {
+            break;
+        } else if (fd == -1) {
+            ST_ERROR("Failed to dist_connect.");
+            return -1;
+        }
+
+        if (n >= dist->opt.timeout) {
+            ST_ERROR("Timeout waiting for worker 0 on [%s].",
+                    dist->opt.addr);
+            return -1;
+        }
+        sleep(1);
+        n++;
+    }
+
+    if (dist_conn_init(dist->conns, fd) < 0) {
+        ST_ERROR("Failed to dist_conn_init.");
+        close(fd);
+        return -1;
+    }
+
+    hello.magic = DIST_MAGIC;
+    hello.rank = dist->opt.rank;
+    hello.real_size = sizeof(real_t);
+    hello.num_segs = dist->num_segs;
+    if (dist_conn_write(dist->conns, &hello, sizeof(hello)) < 0
+            || dist_conn_flush(dist->conns) < 0) {
+        ST_ERROR("Failed to send hello.");
+        return -1;
+    }
+
+    ST_NOTICE("Connected to worker 0 on [%s].", dist->opt.addr);
+
+    return 0;
+}
+
+dist_t* dist_create(dist_opt_t *opt, connlm_t *connlm)
+{
+    dist_t *dist = NULL;
+    int i;
+
+    ST_CHECK_PARAM(opt == NULL || connlm == NULL, NULL);
+
+    dist = (dist_t *)st_malloc(sizeof(dist_t));
+    if (dist == NULL) {
+        ST_ERROR("Failed to st_malloc dist.");
+        return NULL;
+    }
+    memset(dist, 0, sizeof(dist_t));
+
+    if (pthread_mutex_init(&dist->lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init lock.");
+        safe_st_free(dist);
+        return NULL;
+    }
+    if (pthread_cond_init(&dist->cond, NULL) != 0) {
+        ST_ERROR("Failed to pthread_cond_init cond.");
+        (void)pthread_mutex_destroy(&dist->lock);
+        safe_st_free(dist);
+        return NULL;
+    }
+
+    dist->opt = *opt;
+
+    if (dist_setup_bufs(dist, connlm) < 0) {
+        ST_ERROR("Failed to dist_setup_bufs.");
+        goto ERR;
+    }
+
+    dist->seg_dirty = (bool *)st_malloc(sizeof(bool) * dist->num_segs);
+    if (dist->seg_dirty == NULL) {
+        ST_ERROR("Failed to st_malloc seg_dirty.");
+        goto ERR;
+    }
+    memset(dist->seg_dirty, 0, sizeof(bool) * dist->num_segs);
+
+    if (opt->rank == 0) {
+        dist->num_conns = opt->num_workers - 1;
+
+        dist->seg_cnts = (int *)st_malloc(sizeof(int) * dist->num_segs);
+        if (dist->seg_cnts == NULL) {
+            ST_ERROR("Failed to st_malloc seg_cnts.");
+            goto ERR;
+        }
+    } else {
+        dist->num_conns = 1;
+    }
+
+    dist->conns = (dist_conn_t *)st_malloc(sizeof(dist_conn_t)
+            * dist->num_conns);
+    if (dist->conns == NULL) {
+        ST_ERROR("Failed to st_malloc conns.");
+        goto ERR;
+    }
+    memset(dist->conns, 0, sizeof(dist_conn_t) * dist->num_conns);
+    for (i = 0; i < dist->num_conns; i++) {
+        dist->conns[i].fd = -1;
+    }
+
+    if (opt->rank == 0) {
+        if (dist_accept_workers(dist) < 0) {
+            ST_ERROR("Failed to dist_accept_workers.");
+            goto ERR;
+        }
+    } else {
+        if (dist_connect_worker0(dist) < 0) {
+            ST_ERROR("Failed to dist_connect_worker0.");
+            goto ERR;
+        }
+    }
+
+    return dist;
+
+ERR:
+    safe_dist_destroy(dist);
+    return NULL;
+}
+
+static dist_buf_t* dist_find_buf(dist_t *dist, real_t *vals)
+{
+    int b;
+
+    for (b = 0; b < dist->num_bufs; b++) {
+        if (dist->bufs[b].vals == vals) {
+            return dist->bufs + b;
+        }
+    }
+
+    return NULL;
+}
+
+static int dist_attach_wt_updater(dist_t *dist, wt_updater_t *wt_updater)
+{
+    dist_buf_t *wt_buf;
+    dist_buf_t *bias_buf;
+    bool *bias_segs;
+
+    if (wt_updater->wt.num_rows * wt_updater->wt.num_cols == 0) {
+        return 0;
+    }
+
+    wt_buf = dist_find_buf(dist, wt_updater->wt.vals);
+    if (wt_buf == NULL || wt_buf->num_rows != wt_updater->wt.num_rows
+            || wt_buf->num_cols != wt_updater->wt.num_cols) {
+        ST_ERROR("Weight of wt_updater not found.");
+        return -1;
+    }
+
+    bias_segs = NULL;
+    if (wt_updater->bias.size > 0) {
+        bias_buf = dist_find_buf(dist, wt_updater->bias.vals);
+        if (bias_buf == NULL || bias_buf->num_cols != wt_updater->bias.size) {
+            ST_ERROR("Bias of wt_updater not found.");
+            return -1;
+        }
+        bias_segs = dist->seg_dirty + bias_buf->seg_start;
+    }
+
+    if (wt_updater_watch_segs(wt_updater,
+                dist->seg_dirty + wt_buf->seg_start,
+                bias_segs, DIST_SEG_SIZE) < 0) {
+        ST_ERROR("Failed to wt_updater_watch_segs.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int dist_attach_updater(dist_t *dist, updater_t *updater)
+{
+    comp_updater_t *comp_updater;
+    glue_updater_t *glue_updater;
+    int c, g, w;
+
+    ST_CHECK_PARAM(dist == NULL || updater == NULL, -1);
+
+    for (c = 0; c < updater->connlm->num_comp; c++) {
+        comp_updater = updater->comp_updaters[c];
+        for (g = 0; g < comp_updater->comp->num_glue; g++) {
+            glue_updater = comp_updater->glue_updaters[g];
+            for (w = 0; w < glue_updater->num_wt_updaters; w++) {
+                if (dist_attach_wt_updater(dist,
+                            glue_updater->wt_updaters[w]) < 0) {
+                    ST_ERROR("Failed to dist_attach_wt_updater[%s].",
+                            glue_updater->glue->name);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int dist_locate_seg(dist_t *dist, uint64_t id,
+        real_t **vals, size_t *n)
+{
+    dist_buf_t *buf;
+    size_t r, c;
+    int lo, hi, mid;
+
+    if (id >= dist->num_segs) {
+        ST_ERROR("Invalid segment[%"PRIu64"].", id);
+        return -1;
+    }
+
+    lo = 0;
+    hi = dist->num_bufs - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (dist->bufs[mid].seg_start <= id) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    buf = dist->bufs + lo;
+
+    id -= buf->seg_start;
+    r = id / buf->segs_per_row;
+    c = (id % buf->segs_per_row) * DIST_SEG_SIZE;
+
+    *vals = buf->vals + r * buf->stride + c;
+    *n = min(buf->num_cols - c, DIST_SEG_SIZE);
+
+    return 0;
+}
+
+static int dist_read_header(dist_conn_t *conn, uint32_t *flags)
+{
+    dist_msg_header_t header;
+
+    if (dist_conn_read(conn, &header, sizeof(header)) < 0) {
+        ST_ERROR("Failed to read header.");
+        return -1;
+    }
+
+    if (header.magic != DIST_MAGIC) {
+        ST_ERROR("Wrong magic.");
+        return -1;
+    }
+    *flags = header.flags;
+
+    return 0;
+}
+
+static int dist_write_header(dist_conn_t *conn, uint32_t flags)
+{
+    dist_msg_header_t header;
+
+    header.magic = DIST_MAGIC;
+    header.flags = flags;
+
+    if (dist_conn_write(conn, &header, sizeof(header)) < 0) {
+        ST_ERROR("Failed to write header.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Send values of changed segments to worker 0, and receive the
+ * averaged values. Return number of segments exchanged.
+ */
+static long dist_worker_sync(dist_t *dist, bool done, bool *all_done)
+{
+    dist_conn_t *conn;
+    dist_buf_t *buf;
+    real_t *vals;
+
+    uint64_t id;
+    uint32_t flags;
+    size_t r, s, c, n;
+    long num_segs;
+    int b;
+
+    conn = dist->conns;
+
+    if (dist_write_header(conn, done ? DIST_FLAG_DONE : 0) < 0) {
+        ST_ERROR("Failed to dist_write_header.");
+        return -1;
+    }
+
+    num_segs = 0;
+    for (b = 0; b < dist->num_bufs; b++) {
+        buf = dist->bufs + b;
+        for (r = 0; r < buf->num_rows; r++) {
+            vals = buf->vals + r * buf->stride;
+            id = buf->seg_start + r * buf->segs_per_row;
+            for (s = 0; s < buf->segs_per_row; s++, id++) {
+                if (!dist->seg_dirty[id]) {
+                    continue;
+                }
+                dist->seg_dirty[id] = false;
+
+                c = s * DIST_SEG_SIZE;
+                n = min(buf->num_cols - c, DIST_SEG_SIZE);
+                if (dist_conn_write(conn, &id, sizeof(id)) < 0
+                        || dist_conn_write(conn, vals + c,
+                            sizeof(real_t) * n) < 0) {
+                    ST_ERROR("Failed to write segment.");
+                    return -1;
+                }
+                num_segs++;
+            }
+        }
+    }
+
+    id = DIST_SEG_END;
+    if (dist_conn_write(conn, &id, sizeof(id)) < 0
+            || dist_conn_flush(conn) < 0) {
+        ST_ERROR("Failed to finish message.");
+        return -1;
+    }
+
+    if (dist_read_header(conn, &flags) < 0) {
+        ST_ERROR("Failed to dist_read_header.");
+        return -1;
+    }
+    *all_done = (flags & DIST_FLAG_DONE) != 0;
+
+    while (true) {
+        if (dist_conn_read(conn, &id, sizeof(id)) < 0) {
+            ST_ERROR("Failed to read segment id.");
+            return -1;
+        }
+        if (id == DIST_SEG_END) {
+            break;
+        }
+        if (dist_locate_seg(dist, id, &vals, &n) < 0) {
+            ST_ERROR("Failed to dist_locate_seg.");
+            return -1;
+        }
+        if (dist_conn_read(conn, vals, sizeof(real_t) * n) < 0) {
+            ST_ERROR("Failed to read segment.");
+            return -1;
+        }
+        num_segs++;
+    }
+
+    return num_segs;
+}
+
+/*
+ * Average every changed segment among the workers touched it, and
+ * send back the averaged values. Segments untouched by a worker equal
+ * to the values after last round, which are the same in all workers.
+ * Return number of segments exchanged.
+ */
+static long dist_root_sync(dist_t *dist, bool done, bool *all_done)
+{
+    dist_buf_t *buf;
+    real_t seg[DIST_SEG_SIZE];
+    real_t *vals;
+
+    uint64_t id;
+    uint32_t flags;
+    size_t r, s, c, n, i;
+    long num_segs;
+    int b, k, cnt;
+
+    /* changes of worker 0 itself. */
+    for (id = 0; id < dist->num_segs; id++) {
+        dist->seg_cnts[id] = dist->seg_dirty[id] ? 1 : 0;
+        dist->seg_dirty[id] = false;
+    }
+
+    *all_done = done;
+    num_segs = 0;
+    for (k = 0; k < dist->num_conns; k++) {
+        if (dist_read_header(dist->conns + k, &flags) < 0) {
+            ST_ERROR("Failed to dist_read_header from worker[%d].", k + 1);
+            return -1;
+        }
+        if (!(flags & DIST_FLAG_DONE)) {
+            *all_done = false;
+        }
+
+        while (true) {
+            if (dist_conn_read(dist->conns + k, &id, sizeof(id)) < 0) {
+                ST_ERROR("Failed to read segment id from worker[%d].",
+                        k + 1);
+                return -1;
+            }
+            if (id == DIST_SEG_END) {
+                break;
+            }
+            if (dist_locate_seg(dist, id, &vals, &n) < 0) {
+                ST_ERROR("Failed to dist_locate_seg.");
+                return -1;
+            }
+            if (dist->seg_cnts[id] == 0) {
+                // the first one touched it
+                if (dist_conn_read(dist->conns + k, vals,
+                            sizeof(real_t) * n) < 0) {
+                    ST_ERROR("Failed to read segment from worker[%d].",
+                            k + 1);
+                    return -1;
+                }
+            } else {
+                if (dist_conn_read(dist->conns + k, seg,
+                            sizeof(real_t) * n) < 0) {
+                    ST_ERROR("Failed to read segment from worker[%d].",
+                            k + 1);
+                    return -1;
+                }
+                for (i = 0; i < n; i++) {
+                    vals[i] += seg[i];
+                }
+            }
+            dist->seg_cnts[id]++;
+            num_segs++;
+        }
+    }
+
+    for (k = 0; k < dist->num_conns; k++) {
+        if (dist_write_header(dist->conns + k,
+                    *all_done ? DIST_FLAG_DONE : 0) < 0) {
+            ST_ERROR("Failed to dist_write_header to worker[%d].", k + 1);
+            return -1;
+        }
+    }
+
+    for (b = 0; b < dist->num_bufs; b++) {
+        buf = dist->bufs + b;
+        for (r = 0; r < buf->num_rows; r++) {
+            vals = buf->vals + r * buf->stride;
+            id = buf->seg_start + r * buf->segs_per_row;
+            for (s = 0; s < buf->segs_per_row; s++, id++) {
+                cnt = dist->seg_cnts[id];
+                if (cnt == 0) {
+                    continue;
+                }
+
+                c = s * DIST_SEG_SIZE;
+                n = min(buf->num_cols - c, DIST_SEG_SIZE);
+                if (cnt > 1) {
+                    for (i = c; i < c + n; i++) {
+                        vals[i] /= cnt;
+                    }
+                }
+
+                for (k = 0; k < dist->num_conns; k++) {
+                    if (dist_conn_write(dist->conns + k, &id,
+                                sizeof(id)) < 0
+                            || dist_conn_write(dist->conns + k, vals + c,
+                                sizeof(real_t) * n) < 0) {
+                        ST_ERROR("Failed to write segment to worker[%d].",
+                                k + 1);
+                        return -1;
+                    }
+                }
+                num_segs++;
+            }
+        }
+    }
+
+    id = DIST_SEG_END;
+    for (k = 0; k < dist->num_conns; k++) {
+        if (dist_conn_write(dist->conns + k, &id, sizeof(id)) < 0
+                || dist_conn_flush(dist->conns + k) < 0) {
+            ST_ERROR("Failed to finish message to worker[%d].", k + 1);
+            return -1;
+        }
+    }
+
+    return num_segs;
+}
+
+static void* dist_thread(void *args)
+{
+    dist_t *dist;
+
+    struct timeval tts, tte;
+    long num_segs;
+    bool done, all_done;
+
+    ST_CHECK_PARAM(args == NULL, NULL);
+
+    dist = (dist_t *)args;
+
+    while (true) {
+        (void)pthread_mutex_lock(&dist->lock);
+        while (dist->num_running > 0
+                && dist->num_words < dist->opt.sync_words) {
+            (void)pthread_cond_wait(&dist->cond, &dist->lock);
+        }
+        dist->pausing = true;
+        while (dist->num_busy > 0) {
+            (void)pthread_cond_wait(&dist->cond, &dist->lock);
+        }
+        done = (dist->num_running == 0);
+        (void)pthread_mutex_unlock(&dist->lock);
+
+        gettimeofday(&tts, NULL);
+        if (dist->opt.rank == 0) {
+            num_segs = dist_root_sync(dist, done, &all_done);
+        } else {
+            num_segs = dist_worker_sync(dist, done, &all_done);
+        }
+        if (num_segs < 0) {
+            ST_ERROR("Failed to sync parameters.");
+            goto ERR;
+        }
+        gettimeofday(&tte, NULL);
+
+        dist->num_rounds++;
+        ST_TRACE("Dist round: %d, Segments: %ld/%zu, Time: %.3fs",
+                dist->num_rounds, num_segs, dist->num_segs,
+                TIMEDIFF(tts, tte) / 1000.0);
+
+        (void)pthread_mutex_lock(&dist->lock);
+        dist->num_words = 0;
+        dist->pausing = false;
+        (void)pthread_cond_broadcast(&dist->cond);
+        (void)pthread_mutex_unlock(&dist->lock);
+
+        if (all_done) {
+            break;
+        }
+    }
+
+    ST_NOTICE("Finish syncing in %d rounds.", dist->num_rounds);
+
+    return NULL;
+
+ERR:
+    *(dist->err) = -1;
+
+    (void)pthread_mutex_lock(&dist->lock);
+    dist->pausing = false;
+    (void)pthread_cond_broadcast(&dist->cond);
+    (void)pthread_mutex_unlock(&dist->lock);
+
+    return NULL;
+}
+
+int dist_start(dist_t *dist, int num_thrs, int *err)
+{
+    ST_CHECK_PARAM(dist == NULL || num_thrs <= 0 || err == NULL, -1);
+
+    dist->num_running = num_thrs;
+    dist->num_busy = 0;
+    dist->pausing = false;
+    dist->num_words = 0;
+    dist->num_rounds = 0;
+    dist->err = err;
+
+    if (pthread_create(&dist->tid, NULL, dist_thread, (void *)dist) != 0) {
+        ST_ERROR("Failed to pthread_create dist_thread.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int dist_wait(dist_t *dist)
+{
+    ST_CHECK_PARAM(dist == NULL, -1);
+
+    if (pthread_join(dist->tid, NULL) != 0) {
+        ST_ERROR("Failed to pthread_join.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int dist_enter(dist_t *dist)
+{
+    ST_CHECK_PARAM(dist == NULL, -1);
+
+    if (pthread_mutex_lock(&dist->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+    while (dist->pausing) {
+        (void)pthread_cond_wait(&dist->cond, &dist->lock);
+    }
+    dist->num_busy++;
+    (void)pthread_mutex_unlock(&dist->lock);
+
+    return 0;
+}
+
+int dist_leave(dist_t *dist, count_t num_words)
+{
+    ST_CHECK_PARAM(dist == NULL, -1);
+
+    if (pthread_mutex_lock(&dist->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+    dist->num_busy--;
+    dist->num_words += num_words;
+    if (dist->num_words >= dist->opt.sync_words
+            || (dist->pausing && dist->num_busy == 0)) {
+        (void)pthread_cond_broadcast(&dist->cond);
+    }
+    (void)pthread_mutex_unlock(&dist->lock);
+
+    return 0;
+}
+
+void dist_finish(dist_t *dist)
+{
+    if (dist == NULL) {
+        return;
+    }
+
+    (void)pthread_mutex_lock(&dist->lock);
+    dist->num_running--;
+    (void)pthread_cond_broadcast(&dist->cond);
+    (void)pthread_mutex_unlock(&dist->lock);
+}
@@ -0,0 +1,235 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef  _CONNLM_DIST_H_
+#define  _CONNLM_DIST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <stutils/st_opt.h>
+
+#include <connlm/config.h>
+
+#include "connlm.h"
+#include "updaters/updater.h"
+
+/** @defgroup g_dist Distributed Training
+ * Train one model with several processes, possibly on different nodes.
+ *
+ * Every worker runs the usual driver on its own part of the text, and
+ * parameters are averaged among workers every time SYNC_WORDS words
+ * are trained locally. Worker 0 listens on ADDRESS, averages the values
+ * sent by the others and sends back the results; the others connect
+ * to it. ADDRESS is either 'unix:<path>' or '<host>:<port>'.
+ *
+ * Parameters are split into segments, i.e. parts of a row no longer
+ * than DIST_SEG_SIZE. The wt_updaters flag the segments they change,
+ * and only the flagged ones are exchanged, so that the sparsely updated
+ * weights, e.g. MaxEnt and embedding, cost only the touched rows.
+ * Parameters are identical among workers after every round, so a
+ * segment is averaged among the workers touching it, without keeping
+ * a copy of the last values. All workers must load the same model, and
+ * use the same precision and byte order.
+ */
+
+#define DIST_SEG_SIZE 256 /**< max number of values in one segment. */
+
+/**
+ * Options for distributed training.
+ * @ingroup g_dist
+ */
+typedef struct _dist_opt_t_ {
+    int num_workers; /**< number of workers, 1 to disable. */
+    int rank; /**< rank of this worker, in [0, num_workers). */
+    char addr[MAX_DIR_LEN]; /**< address of worker 0. */
+    count_t sync_words; /**< number of words trained between syncs. */
+    int timeout; /**< seconds waiting for connecting to worker 0. */
+    bool split_text; /**< read only the rank-th part of text. */
+} dist_opt_t;
+
+/**
+ * Load distributed option.
+ * @ingroup g_dist
+ * @param[out] dist_opt options loaded.
+ * @param[in] opt runtime options passed by caller.
+ * @param[in] sec_name section name of runtime options to be loaded.
+ * @return non-zero value if any error.
+ */
+int dist_load_opt(dist_opt_t *dist_opt, st_opt_t *opt,
+        const char *sec_name);
+
+/**
+ * Parameter buffer exchanged among workers, i.e. a weight or a bias.
+ * @ingroup g_dist
+ */
+typedef struct _dist_buf_t_ {
+    real_t *vals; /**< values, shared with the model. */
+    size_t num_rows; /**< number of rows. */
+    size_t num_cols; /**< number of cols. */
+    size_t stride; /**< stride of rows. */
+
+    size_t segs_per_row; /**< number of segments in a row. */
+    size_t seg_start; /**< global index of the first segment. */
+} dist_buf_t;
+
+/**
+ * Buffered connection to a peer.
+ * @ingroup g_dist
+ */
+typedef struct _dist_conn_t_ {
+    int fd; /**< socket, -1 if not connected. */
+    char *rbuf; /**< read buffer. */
+    size_t rlen; /**< number of bytes in read buffer. */
+    size_t rpos; /**< position of next byte to be read. */
+    char *wbuf; /**< write buffer. */
+    size_t wlen; /**< number of bytes in write buffer. */
+} dist_conn_t;
+
+/**
+ * Distributed trainer.
+ * @ingroup g_dist
+ */
+typedef struct _dist_t_ {
+    dist_opt_t opt; /**< options. */
+
+    dist_buf_t *bufs; /**< parameter buffers. */
+    int num_bufs; /**< number of buffers. */
+    size_t num_segs; /**< total number of segments. */
+    bool *seg_dirty; /**< whether every segment is changed since last
+                          round, set by the attached wt_updaters. */
+    int *seg_cnts; /**< number of workers touched every segment,
+                        only used by worker 0. */
+
+    dist_conn_t *conns; /**< connections, num_workers - 1 for worker 0,
+                             i.e. conns[i] is for rank i + 1; one to
+                             worker 0 for others. */
+    int num_conns; /**< number of connections. */
+
+    pthread_mutex_t lock; /**< lock for states below. */
+    pthread_cond_t cond; /**< condition for states below. */
+    int num_running; /**< number of running worker threads. */
+    int num_busy; /**< number of worker threads in a step. */
+    bool pausing; /**< whether worker threads should wait. */
+    count_t num_words; /**< words trained since last sync. */
+
+    int num_rounds; /**< number of finished rounds. */
+    pthread_t tid; /**< thread id of syncing thread. */
+    int *err; /**< error indicator. */
+} dist_t;
+
+/**
+ * Destroy a dist and set the pointer to NULL.
+ * @ingroup g_dist
+ * @param[in] ptr pointer to dist_t.
+ */
+#define safe_dist_destroy(ptr) do {\
+    if((ptr) != NULL) {\
+        dist_destroy(ptr);\
+        safe_st_free(ptr);\
+        (ptr) = NULL;\
+    }\
+    } while(0)
+/**
+ * Destroy a dist.
+ * @ingroup g_dist
+ * @param[in] dist dist to be destroyed.
+ */
+void dist_destroy(dist_t *dist);
+
+/**
+ * Create a dist and connect to all peers.
+ * Worker 0 blocks until all others connected.
+ * @ingroup g_dist
+ * @param[in] opt dist options.
+ * @param[in] connlm the model, whose parameters are averaged.
+ * @return dist on success, otherwise NULL.
+ */
+dist_t* dist_create(dist_opt_t *opt, connlm_t *connlm);
+
+/**
+ * Attach an updater, so that the changes made by it are exchanged.
+ * Must be called for every updater training the model, since the
+ * changes of others are invisible to dist.
+ * @ingroup g_dist
+ * @param[in] dist dist.
+ * @param[in] updater the updater.
+ * @return non-zero value if any error.
+ */
+int dist_attach_updater(dist_t *dist, updater_t *updater);
+
+/**
+ * Start syncing thread.
+ * @ingroup g_dist
+ * @param[in] dist dist.
+ * @param[in] num_thrs number of worker threads.
+ * @param[in] err global err indicator.
+ * @return non-zero value if any error.
+ */
+int dist_start(dist_t *dist, int num_thrs, int *err);
+
+/**
+ * Wait syncing thread, which finishes after all workers of all
+ * processes finished. Parameters are identical among workers then.
+ * @ingroup g_dist
+ * @param[in] dist dist.
+ * @return non-zero value if any error.
+ */
+int dist_wait(dist_t *dist);
+
+/**
+ * Enter a step of worker thread, i.e. before updating parameters.
+ * Blocks while parameters are being synced.
+ * @ingroup g_dist
+ * @param[in] dist dist.
+ * @return non-zero value if any error.
+ */
+int dist_enter(dist_t *dist);
+
+/**
+ * Leave a step of worker thread.
+ * @ingroup g_dist
+ * @param[in] dist dist.
+ * @param[in] num_words number of words trained in this step.
+ * @return non-zero value if any error.
+ */
+int dist_leave(dist_t *dist, count_t num_words);
+
+/**
+ * Worker thread finished, no more steps would be entered.
+ * Must be called exactly once by every worker thread, even on error.
+ * @ingroup g_dist
+ * @param[in] dist dist.
+ */
+void dist_finish(dist_t *dist);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -26,7 +26,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdarg.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <stutils/st_macro.h>
 #include <stutils/st_log.h>
@@ -44,6 +46,15 @@ int driver_load_train_opt(driver_train_opt_t *train_opt,
             train_opt->rand_seed, (unsigned int)time(NULL),
             "Initial Random seed. Default is value of time(NULl).");
 
+    ST_OPT_SEC_GET_INT(opt, sec_name, "NCE_SAMPLES",
+            train_opt->nce_samples, 25,
+            "Number of noise samples per target word, "
+            "only used for NCE output.");
+    if (train_opt->nce_samples <= 0) {
+        ST_ERROR("NCE_SAMPLES must be positive.");
+        goto ST_OPT_ERR;
+    }
+
     return 0;
 
 ST_OPT_ERR:
@@ -70,6 +81,11 @@ int driver_load_eval_opt(driver_eval_opt_t *eval_opt,
         eval_opt->out_log_base = (real_t)atof(str);
     }
 
+    ST_OPT_SEC_GET_BOOL(opt, sec_name, "SELF_NORMALIZED",
+            eval_opt->self_norm, false,
+            "Use the unnormalized score as logp, only used for NCE output. "
+            "Much faster, but only approximate.");
+
     return 0;
 
 ST_OPT_ERR:
@@ -105,6 +121,8 @@ void driver_destroy(driver_t *driver)
 
     driver->connlm = NULL;
     driver->reader = NULL;
+    driver->dist = NULL;
+    driver->ckpt = NULL;
 
     for(i = 0; i < driver->n_thr; i++) {
         safe_updater_destroy(driver->updaters[i]);
@@ -186,10 +204,31 @@ int driver_setup(driver_t *driver, driver_mode_t mode)
             }
         }
 
+        if (mode == DRIVER_TRAIN) {
+            if (updater_set_nce(driver->updaters[i],
+                        driver->train_opt.nce_samples, false) < 0) {
+                ST_ERROR("Failed to updater_set_nce.");
+                return -1;
+            }
+        } else if (mode == DRIVER_EVAL) {
+            if (updater_set_nce(driver->updaters[i], 0,
+                        driver->eval_opt.self_norm) < 0) {
+                ST_ERROR("Failed to updater_set_nce.");
+                return -1;
+            }
+        }
+
         if (updater_setup(driver->updaters[i], backprop) < 0) {
             ST_ERROR("Failed to updater_setup.");
             return -1;
         }
+
+        if (mode == DRIVER_TRAIN && driver->dist != NULL) {
+            if (dist_attach_updater(driver->dist, driver->updaters[i]) < 0) {
+                ST_ERROR("Failed to dist_attach_updater.");
+                return -1;
+            }
+        }
     }
 
     if (mode == DRIVER_GEN) {
@@ -211,6 +250,24 @@ int driver_set_train(driver_t *driver, driver_train_opt_t *train_opt)
     return 0;
 }
 
+int driver_set_dist(driver_t *driver, dist_t *dist)
+{
+    ST_CHECK_PARAM(driver == NULL || dist == NULL, -1);
+
+    driver->dist = dist;
+
+    return 0;
+}
+
+int driver_set_ckpt(driver_t *driver, ckpt_t *ckpt)
+{
+    ST_CHECK_PARAM(driver == NULL || ckpt == NULL, -1);
+
+    driver->ckpt = ckpt;
+
+    return 0;
+}
+
 int driver_set_eval(driver_t *driver, driver_eval_opt_t *eval_opt, FILE *fp_log)
 {
     ST_CHECK_PARAM(driver == NULL || eval_opt == NULL, -1);
@@ -231,8 +288,443 @@ int driver_set_gen(driver_t *driver, driver_gen_opt_t *gen_opt, int num_sents)
     return 0;
 }
 
-static int driver_steps(driver_t *driver, int tid, double *logp,
-        double *logp_sent, count_t *num_sents, count_t *num_words)
+#define DRIVER_WRITER_BUF_SIZE (1 << 20) /* bytes written in one fwrite. */
+#define DRIVER_WRITER_BATCH 1024 /* max sentences taken in one round. */
+
+/**
+ * Output of a sentence, waiting in the reorder ring.
+ */
+typedef struct _driver_sent_out_t_ {
+    char *buf; /**< text to be written, owned by writer. */
+    size_t len; /**< length of text. */
+    bool ready; /**< whether this slot is filled. */
+} driver_sent_out_t;
+
+/**
+ * Writer of eval log.
+ * Worker threads finish sentences out of order, the writer thread
+ * puts them back into the input order and writes them in large chunks.
+ * Since word pools are taken in order from one shared list, a sentence
+ * can only wait for the ones held by other threads, so the ring stays
+ * within a few word pools.
+ */
+typedef struct _driver_writer_t_ {
+    FILE *fp; /**< output file. */
+
+    driver_sent_out_t *sents; /**< reorder ring, indexed by id % cap. */
+    int cap; /**< capacity of ring. */
+    int next_id; /**< id of the next sentence to be written. */
+    int num_put; /**< number of sentences put. */
+    bool finished; /**< whether all sentences are put. */
+
+    pthread_mutex_t lock; /**< lock for the ring. */
+    pthread_cond_t cond; /**< signaled when next sentence is ready. */
+    pthread_t tid; /**< writer thread. */
+
+    char *out_buf; /**< buffer for writing. */
+    size_t out_len; /**< length of data in out_buf. */
+    int err; /**< error indicator of writer thread. */
+} driver_writer_t;
+
+static void driver_writer_destroy(driver_writer_t *writer)
+{
+    int i;
+
+    if (writer == NULL) {
+        return;
+    }
+
+    if (writer->sents != NULL) {
+        for (i = 0; i < writer->cap; i++) {
+            safe_st_free(writer->sents[i].buf);
+        }
+        safe_st_free(writer->sents);
+    }
+    writer->cap = 0;
+    safe_st_free(writer->out_buf);
+
+    (void)pthread_mutex_destroy(&writer->lock);
+    (void)pthread_cond_destroy(&writer->cond);
+}
+
+static int driver_writer_write(driver_writer_t *writer,
+        const char *buf, size_t len)
+{
+    if (writer->out_len + len > DRIVER_WRITER_BUF_SIZE
+            && writer->out_len > 0) {
+        if (fwrite(writer->out_buf, 1, writer->out_len, writer->fp)
+                != writer->out_len) {
+            ST_ERROR("Failed to fwrite.");
+            return -1;
+        }
+        writer->out_len = 0;
+    }
+
+    if (len > DRIVER_WRITER_BUF_SIZE) {
+        if (fwrite(buf, 1, len, writer->fp) != len) {
+            ST_ERROR("Failed to fwrite.");
+            return -1;
+        }
+        return 0;
+    }
+
+    memcpy(writer->out_buf + writer->out_len, buf, len);
+    writer->out_len += len;
+
+    return 0;
+}
+
+static void* driver_writer_thread(void *args)
+{
+    driver_writer_t *writer;
+    driver_sent_out_t outs[DRIVER_WRITER_BATCH];
+    driver_sent_out_t *sent;
+    int n, i;
+
+    ST_CHECK_PARAM(args == NULL, NULL);
+
+    writer = (driver_writer_t *)args;
+
+    (void)pthread_mutex_lock(&writer->lock);
+    while (true) {
+        sent = writer->sents + writer->next_id % writer->cap;
+        if (! sent->ready) {
+            if (writer->finished) {
+                break;
+            }
+            (void)pthread_cond_wait(&writer->cond, &writer->lock);
+            continue;
+        }
+
+        n = 0;
+        while (sent->ready && n < DRIVER_WRITER_BATCH) {
+            outs[n++] = *sent;
+            sent->buf = NULL;
+            sent->len = 0;
+            sent->ready = false;
+            writer->next_id++;
+            sent = writer->sents + writer->next_id % writer->cap;
+        }
+        (void)pthread_mutex_unlock(&writer->lock);
+
+        for (i = 0; i < n; i++) {
+            if (writer->err == 0 && driver_writer_write(writer,
+                        outs[i].buf, outs[i].len) < 0) {
+                ST_ERROR("Failed to driver_writer_write.");
+                writer->err = -1;
+            }
+            safe_st_free(outs[i].buf);
+        }
+
+        (void)pthread_mutex_lock(&writer->lock);
+    }
+    (void)pthread_mutex_unlock(&writer->lock);
+
+    if (writer->err == 0 && writer->out_len > 0) {
+        if (fwrite(writer->out_buf, 1, writer->out_len, writer->fp)
+                != writer->out_len) {
+            ST_ERROR("Failed to fwrite.");
+            writer->err = -1;
+        }
+        writer->out_len = 0;
+    }
+
+    return NULL;
+}
+
+static int driver_writer_start(driver_writer_t *writer, FILE *fp)
+{
+    ST_CHECK_PARAM(writer == NULL || fp == NULL, -1);
+
+    memset(writer, 0, sizeof(driver_writer_t));
+    writer->fp = fp;
+
+    writer->cap = 1024;
+    writer->sents = (driver_sent_out_t *)st_malloc(
+            sizeof(driver_sent_out_t) * writer->cap);
+    if (writer->sents == NULL) {
+        ST_ERROR("Failed to st_malloc sents.");
+        return -1;
+    }
+    memset(writer->sents, 0, sizeof(driver_sent_out_t) * writer->cap);
+
+    writer->out_buf = (char *)st_malloc(DRIVER_WRITER_BUF_SIZE);
+    if (writer->out_buf == NULL) {
+        ST_ERROR("Failed to st_malloc out_buf.");
+        return -1;
+    }
+
+    if (pthread_mutex_init(&writer->lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init.");
+        return -1;
+    }
+
+    if (pthread_cond_init(&writer->cond, NULL) != 0) {
+        ST_ERROR("Failed to pthread_cond_init.");
+        return -1;
+    }
+
+    if (pthread_create(&writer->tid, NULL, driver_writer_thread,
+                (void *)writer) != 0) {
+        ST_ERROR("Failed to pthread_create driver_writer_thread.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Wait for the writer thread to write out everything.
+ */
+static int driver_writer_finish(driver_writer_t *writer)
+{
+    ST_CHECK_PARAM(writer == NULL, -1);
+
+    (void)pthread_mutex_lock(&writer->lock);
+    writer->finished = true;
+    (void)pthread_cond_signal(&writer->cond);
+    (void)pthread_mutex_unlock(&writer->lock);
+
+    if (pthread_join(writer->tid, NULL) != 0) {
+        ST_ERROR("Failed to pthread_join.");
+        return -1;
+    }
+
+    if (writer->err != 0) {
+        return -1;
+    }
+
+    if (writer->next_id != writer->num_put) {
+        ST_ERROR("Sentence[%d] is missing, only %d of %d written.",
+                writer->next_id, writer->next_id, writer->num_put);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Put the output of a sentence into writer, the writer takes the
+ * ownership of buf.
+ */
+static int driver_writer_put(driver_writer_t *writer, int sent_id,
+        char *buf, size_t len)
+{
+    driver_sent_out_t *sents;
+    int cap, id;
+
+    ST_CHECK_PARAM(writer == NULL || sent_id < 0, -1);
+
+    (void)pthread_mutex_lock(&writer->lock);
+
+    if (sent_id < writer->next_id) {
+        ST_ERROR("Sentence[%d] already written.", sent_id);
+        goto ERR;
+    }
+
+    if (sent_id - writer->next_id >= writer->cap) {
+        cap = max(writer->cap * 2, sent_id - writer->next_id + 1);
+        sents = (driver_sent_out_t *)st_malloc(
+                sizeof(driver_sent_out_t) * cap);
+        if (sents == NULL) {
+            ST_ERROR("Failed to st_malloc sents.");
+            goto ERR;
+        }
+        memset(sents, 0, sizeof(driver_sent_out_t) * cap);
+        for (id = writer->next_id; id < writer->next_id + writer->cap;
+                id++) {
+            sents[id % cap] = writer->sents[id % writer->cap];
+        }
+        safe_st_free(writer->sents);
+        writer->sents = sents;
+        writer->cap = cap;
+    }
+
+    if (writer->sents[sent_id % writer->cap].ready) {
+        ST_ERROR("Duplicated sentence[%d].", sent_id);
+        goto ERR;
+    }
+
+    writer->sents[sent_id % writer->cap].buf = buf;
+    writer->sents[sent_id % writer->cap].len = len;
+    writer->sents[sent_id % writer->cap].ready = true;
+    writer->num_put++;
+
+    if (sent_id == writer->next_id) {
+        (void)pthread_cond_signal(&writer->cond);
+    }
+    (void)pthread_mutex_unlock(&writer->lock);
+
+    return 0;
+
+ERR:
+    (void)pthread_mutex_unlock(&writer->lock);
+    safe_st_free(buf);
+    return -1;
+}
+
+/**
+ * A row of mini-batch in a worker thread, used to map targets back to
+ * the sentences they come from.
+ */
+typedef struct _driver_row_t_ {
+    ivec_t sent_ids; /**< ids of the sentences fed but not finished. */
+    int head; /**< index of current sentence in sent_ids. */
+
+    char *buf; /**< output of current sentence. */
+    size_t len; /**< length of output. */
+    size_t cap; /**< capacity of buf. */
+    double logp; /**< logp of current sentence. */
+} driver_row_t;
+
+static void driver_rows_destroy(driver_row_t *rows, int num_rows)
+{
+    int b;
+
+    if (rows == NULL) {
+        return;
+    }
+
+    for (b = 0; b < num_rows; b++) {
+        ivec_destroy(&rows[b].sent_ids);
+        safe_st_free(rows[b].buf);
+    }
+}
+
+/**
+ * Queue the ids of sentences in word pool to the rows.
+ * Every sentence lies in a single row, and the updater walks
+ * through a row in order, even if the row is carried over to the next
+ * word pool.
+ */
+static int driver_rows_feed(driver_row_t **rows, int *num_rows,
+        word_pool_t *wp)
+{
+    driver_row_t *row;
+    int b, n;
+
+    ST_CHECK_PARAM(rows == NULL || num_rows == NULL || wp == NULL, -1);
+
+    if (wp->sent_ids.size != wp->sent_ends.size) {
+        ST_ERROR("Sentences are not tagged with ids.");
+        return -1;
+    }
+
+    if (*num_rows < wp_batch_size(wp)) {
+        *rows = (driver_row_t *)st_realloc(*rows,
+                sizeof(driver_row_t) * wp_batch_size(wp));
+        if (*rows == NULL) {
+            ST_ERROR("Failed to st_realloc rows.");
+            return -1;
+        }
+        memset(*rows + *num_rows, 0, sizeof(driver_row_t)
+                * (wp_batch_size(wp) - *num_rows));
+        *num_rows = wp_batch_size(wp);
+    }
+
+    n = 0;
+    for (b = 0; b < wp_batch_size(wp); b++) {
+        row = *rows + b;
+        if (row->head > 0) {
+            memmove(row->sent_ids.vals, row->sent_ids.vals + row->head,
+                    sizeof(int) * (row->sent_ids.size - row->head));
+            row->sent_ids.size -= row->head;
+            row->head = 0;
+        }
+
+        while (n < wp->sent_ends.size && VEC_VAL(&wp->sent_ends, n)
+                <= VEC_VAL(&wp->row_starts, b + 1)) {
+            if (ivec_append(&row->sent_ids, VEC_VAL(&wp->sent_ids, n)) < 0) {
+                ST_ERROR("Failed to ivec_append sent_ids.");
+                return -1;
+            }
+            n++;
+        }
+    }
+
+    return 0;
+}
+
+static int driver_row_printf(driver_row_t *row, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    while (true) {
+        va_start(args, fmt);
+        n = vsnprintf(row->buf + row->len, row->cap - row->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            ST_ERROR("Failed to vsnprintf.");
+            return -1;
+        }
+        if (row->len + n < row->cap) {
+            row->len += n;
+            return 0;
+        }
+
+        row->cap = max(row->cap * 2, row->len + n + 1);
+        row->cap = max(row->cap, 256);
+        row->buf = (char *)st_realloc(row->buf, row->cap);
+        if (row->buf == NULL) {
+            ST_ERROR("Failed to st_realloc buf.");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int driver_row_add_word(driver_t *driver, driver_row_t *row,
+        int word, real_t logp)
+{
+    ST_CHECK_PARAM(driver == NULL || row == NULL, -1);
+
+    if (row->head >= row->sent_ids.size) {
+        ST_ERROR("No sentence for word[%d].", word);
+        return -1;
+    }
+
+    if (driver->eval_opt.print_sent_prob) {
+        row->logp += logn(logp, driver->eval_opt.out_log_base);
+    } else {
+        if (driver_row_printf(row, "%d\t%.6f\t%s\n", word,
+                    logn(logp, driver->eval_opt.out_log_base),
+                    vocab_get_word(driver->connlm->vocab, word)) < 0) {
+            ST_ERROR("Failed to driver_row_printf.");
+            return -1;
+        }
+    }
+
+    if (word != SENT_END_ID) {
+        return 0;
+    }
+
+    if (driver->eval_opt.print_sent_prob) {
+        if (driver_row_printf(row, "%.6f\n", row->logp) < 0) {
+            ST_ERROR("Failed to driver_row_printf.");
+            return -1;
+        }
+        row->logp = 0.0;
+    }
+
+    if (driver_writer_put(driver->writer,
+                VEC_VAL(&row->sent_ids, row->head), row->buf, row->len) < 0) {
+        ST_ERROR("Failed to driver_writer_put.");
+        row->buf = NULL;
+        return -1;
+    }
+    row->buf = NULL;
+    row->len = 0;
+    row->cap = 0;
+    row->head++;
+
+    return 0;
+}
+
+static int driver_steps(driver_t *driver, int tid, driver_row_t *rows,
+        double *logp, count_t *num_sents, count_t *num_words,
+        count_t *num_slots)
 {
     updater_t *updater;
 
@@ -241,7 +733,8 @@ static int driver_steps(driver_t *driver, int tid, double *logp,
     int i;
 
     ST_CHECK_PARAM(driver == NULL || tid < 0 || logp == NULL
-            || logp_sent == NULL || num_sents == NULL || num_words == NULL, -1);
+            || num_sents == NULL || num_words == NULL
+            || num_slots == NULL, -1);
 
     updater = driver->updaters[tid];
 
@@ -251,6 +744,7 @@ static int driver_steps(driver_t *driver, int tid, double *logp,
             return -1;
         }
 
+        *num_slots += updater->targets.size;
         for (i = 0; i < updater->targets.size; i++) {
             word = VEC_VAL(&updater->targets, i);
             if (word == PADDING_ID) {
@@ -260,32 +754,21 @@ static int driver_steps(driver_t *driver, int tid, double *logp,
             this_logp = VEC_VAL(&updater->logps, i);
             *logp += this_logp;
 
-            if (driver->fp_log != NULL
-                    && driver->eval_opt.print_sent_prob) {
-                *logp_sent += logn(this_logp, driver->eval_opt.out_log_base);
-            }
-
             if ((*logp != *logp) || (isinf(*logp))) {
                 ST_ERROR("Numerical error. tid[%d], log(p_word(%d)) = %g",
                         tid, word, this_logp);
                 return -1;
             }
 
-            if (driver->fp_log != NULL
-                    && (! driver->eval_opt.print_sent_prob)) {
-                fprintf(driver->fp_log, "%d\t%.6f\t%s", word,
-                        logn(this_logp, driver->eval_opt.out_log_base),
-                        vocab_get_word(updater->connlm->vocab, word));
-
-                fprintf(driver->fp_log, "\n");
+            if (rows != NULL) {
+                if (driver_row_add_word(driver, rows + i,
+                            word, this_logp) < 0) {
+                    ST_ERROR("Failed to driver_row_add_word.");
+                    return -1;
+                }
             }
 
             if (word == SENT_END_ID) {
-                if (driver->fp_log != NULL
-                        && driver->eval_opt.print_sent_prob) {
-                    fprintf(driver->fp_log, "%.6f\n", *logp_sent);
-                    *logp_sent = 0.0;
-                }
                 ++(*num_sents);
             }
             ++(*num_words);
@@ -314,20 +797,28 @@ static void* driver_thread(void *args)
     driver_t *driver;
     updater_t *updater;
     reader_t *reader;
+    dist_t *dist;
+    ckpt_t *ckpt;
     int tid;
 
     word_pool_t *wp = NULL;
+    driver_row_t *rows = NULL;
+    int num_rows = 0;
 
     count_t num_words;
+    count_t last_words;
+    bool entered = false;
+    bool ckpt_entered = false;
     count_t num_sents;
+    count_t num_slots;
     double logp;
-    double logp_sent;
 
     struct timeval tts, tte;
     long ms;
 
     struct timeval tts_wait, tte_wait;
     long ms_wait = 0;
+    int i;
 
     ST_CHECK_PARAM(args == NULL, NULL);
 
@@ -336,47 +827,100 @@ static void* driver_thread(void *args)
     driver = thr->driver;
     updater = driver->updaters[tid];
     reader = driver->reader;
+    dist = (driver->mode == DRIVER_TRAIN) ? driver->dist : NULL;
+    ckpt = (driver->mode == DRIVER_TRAIN) ? driver->ckpt : NULL;
 
     gettimeofday(&tts, NULL);
 
     num_words = 0;
     num_sents = 0;
+    num_slots = 0;
     logp = 0.0;
-    logp_sent = 0.0;
     while (true) {
         if (driver->err != 0) {
             break;
         }
 
+        if (ckpt != NULL) {
+            /* checkpoints are taken while no word pool is held. */
+            if (ckpt_enter(ckpt) < 0) {
+                ST_ERROR("Failed to ckpt_enter.");
+                goto ERR;
+            }
+            ckpt_entered = true;
+        }
+
         gettimeofday(&tts_wait, NULL);
-        wp = reader_hold_word_pool(reader);
+        wp = reader_hold_word_pool(reader, tid);
         gettimeofday(&tte_wait, NULL);
 
+        if (dist != NULL) {
+            if (dist_enter(dist) < 0) {
+                ST_ERROR("Failed to dist_enter.");
+                if (wp != NULL) {
+                    goto RELEASE_WP;
+                }
+                goto ERR;
+            }
+            entered = true;
+        }
+        last_words = num_words;
+
         if (wp == NULL) { // finish
             if (updater_finalize(updater) < 0) {
                 ST_ERROR("Failed to updater_finalize.");
                 goto ERR;
             }
 
-            if (driver_steps(driver, tid, &logp, &logp_sent,
-                        &num_sents, &num_words) < 0) {
+            if (driver_steps(driver, tid, rows, &logp,
+                        &num_sents, &num_words, &num_slots) < 0) {
                 ST_ERROR("Failed to driver_steps.");
                 goto ERR;
             }
+
+            if (entered) {
+                entered = false;
+                if (dist_leave(dist, num_words - last_words) < 0) {
+                    ST_ERROR("Failed to dist_leave.");
+                    goto ERR;
+                }
+            }
+            if (ckpt_entered) {
+                ckpt_entered = false;
+                if (ckpt_leave(ckpt, num_words - last_words) < 0) {
+                    ST_ERROR("Failed to ckpt_leave.");
+                    goto ERR;
+                }
+            }
             break;
         }
 
+        if (driver->writer != NULL) {
+            if (driver_rows_feed(&rows, &num_rows, wp) < 0) {
+                ST_ERROR("Failed to driver_rows_feed.");
+                goto RELEASE_WP;
+            }
+        }
+
         if (updater_feed(updater, wp) < 0) {
             ST_ERROR("Failed to updater_feed.");
             goto RELEASE_WP;
         }
 
-        if (driver_steps(driver, tid, &logp, &logp_sent,
-                    &num_sents, &num_words) < 0) {
+        if (driver_steps(driver, tid, rows, &logp,
+                    &num_sents, &num_words, &num_slots) < 0) {
             ST_ERROR("Failed to driver_steps.");
             goto RELEASE_WP;
         }
 
+        if (entered) {
+            entered = false;
+            if (dist_leave(dist, num_words - last_words) < 0) {
+                ST_ERROR("Failed to dist_leave.");
+                goto RELEASE_WP;
+            }
+        }
+
         gettimeofday(&tte, NULL);
         ms = TIMEDIFF(tts, tte);
         ms_wait += TIMEDIFF(tts_wait, tte_wait);
@@ -392,27 +936,69 @@ static void* driver_thread(void *args)
                 ms_wait / 1000.0, ms_wait / (ms / 100.0),
                 TIMEDIFF(tts_wait, tte_wait) / 1000.0);
 
-        if (reader_release_word_pool(reader, wp) < 0) {
+        if (reader_release_word_pool(reader, tid, wp) < 0) {
             ST_ERROR("Failed to reader_release_word_pool.");
             goto ERR;
         }
+
+        if (ckpt_entered) {
+            ckpt_entered = false;
+            if (ckpt_leave(ckpt, num_words - last_words) < 0) {
+                ST_ERROR("Failed to ckpt_leave.");
+                goto ERR;
+            }
+        }
+    }
+
+    for (i = 0; i < num_rows && driver->err == 0; i++) {
+        if (rows[i].head < rows[i].sent_ids.size) {
+            ST_ERROR("Sentence[%d] not finished.",
+                    VEC_VAL(&rows[i].sent_ids, rows[i].head));
+            goto ERR;
+        }
     }
+    driver_rows_destroy(rows, num_rows);
+    safe_st_free(rows);
 
     thr->stat->num_words = num_words;
     thr->stat->num_sents = num_sents;
+    thr->stat->num_slots = num_slots;
     thr->stat->logp = logp;
 
+    if (dist != NULL) {
+        dist_finish(dist);
+    }
+    if (ckpt != NULL) {
+        ckpt_finish(ckpt);
+    }
+
     return NULL;
 
 RELEASE_WP:
-    if (reader_release_word_pool(reader, wp) < 0) {
+    if (reader_release_word_pool(reader, tid, wp) < 0) {
         ST_ERROR("Failed to reader_release_word_pool.");
         goto ERR;
     }
 
 ERR:
+    driver_rows_destroy(rows, num_rows);
+    safe_st_free(rows);
     driver->err = -1;
 
+    if (dist != NULL) {
+        if (entered) {
+            (void)dist_leave(dist, 0);
+        }
+        dist_finish(dist);
+    }
+
+    if (ckpt != NULL) {
+        if (ckpt_entered) {
+            (void)ckpt_leave(ckpt, 0);
+        }
+        ckpt_finish(ckpt);
+    }
+
     return NULL;
 }
 
@@ -421,28 +1007,41 @@ static int driver_do_run(driver_t *driver)
     driver_thr_t *thrs = NULL;
     pthread_t *pts = NULL;
     thr_stat_t *stats = NULL;
+    driver_writer_t writer;
 
     count_t num_words;
     count_t num_sents;
+    count_t num_slots;
     double logp;
     struct timeval tts, tte;
     long ms;
 
     int n_thr;
+    int n_created = 0;
+    bool ckpt_started = false;
+    int ret;
     int i;
 
     ST_CHECK_PARAM(driver == NULL, -1);
 
-    if (driver->mode == DRIVER_EVAL) {
-        if (driver->fp_log != NULL) {
-            if (! driver->eval_opt.print_sent_prob) {
-                fprintf(driver->fp_log, "Index   logP(NET)          Word\n");
-                fprintf(driver->fp_log, "----------------------------------\n");
-            }
-            ST_NOTICE("Printing Probs, setting num_thread and mini-batch to 1.");
-            driver->n_thr = 1;
-            driver->reader->opt.mini_batch = 1;
+    if (driver->mode == DRIVER_EVAL && driver->fp_log != NULL) {
+        if (driver->reader->opt.shard) {
+            ST_ERROR("Can not print probs with sharded reader, "
+                    "since sentences in shards can not be ordered.");
+            goto ERR;
+        }
+
+        if (! driver->eval_opt.print_sent_prob) {
+            fprintf(driver->fp_log, "Index   logP(NET)          Word\n");
+            fprintf(driver->fp_log, "----------------------------------\n");
+        }
+
+        if (driver_writer_start(&writer, driver->fp_log) < 0) {
+            ST_ERROR("Failed to driver_writer_start.");
+            driver_writer_destroy(&writer);
+            goto ERR;
         }
+        driver->writer = &writer;
     }
 
     gettimeofday(&tts, NULL);
@@ -470,11 +1069,28 @@ static int driver_do_run(driver_t *driver)
     }
     memset(stats, 0, sizeof(thr_stat_t) * n_thr);
 
+    if (driver->ckpt != NULL && driver->mode == DRIVER_TRAIN) {
+        /* resuming positions are set into reader before reading. */
+        if (ckpt_start(driver->ckpt, driver->reader, driver->updaters,
+                    n_thr, &driver->err) < 0) {
+            ST_ERROR("Failed to ckpt_start.");
+            goto ERR;
+        }
+        ckpt_started = true;
+    }
+
     if (reader_read(driver->reader, stats, &driver->err) < 0) {
         ST_ERROR("Failed to reader_read.");
         goto ERR;
     }
 
+    if (driver->dist != NULL && driver->mode == DRIVER_TRAIN) {
+        if (dist_start(driver->dist, n_thr, &driver->err) < 0) {
+            ST_ERROR("Failed to dist_start.");
+            goto ERR;
+        }
+    }
+
     for (i = 0; i < n_thr; i++) {
         thrs[i].driver = driver;
         thrs[i].tid = i;
@@ -484,6 +1100,7 @@ static int driver_do_run(driver_t *driver)
             ST_ERROR("Failed to pthread_create driver_thread.");
             goto ERR;
         }
+        n_created++;
     }
 
     for (i = 0; i < n_thr; i++) {
@@ -498,6 +1115,31 @@ static int driver_do_run(driver_t *driver)
         goto ERR;
     }
 
+    if (driver->dist != NULL && driver->mode == DRIVER_TRAIN) {
+        if (dist_wait(driver->dist) < 0) {
+            ST_ERROR("Failed to dist_wait.");
+            goto ERR;
+        }
+    }
+
+    if (ckpt_started) {
+        ckpt_started = false;
+        if (ckpt_wait(driver->ckpt) < 0) {
+            ST_ERROR("Failed to ckpt_wait.");
+            goto ERR;
+        }
+    }
+
+    if (driver->writer != NULL) {
+        ret = driver_writer_finish(driver->writer);
+        driver_writer_destroy(driver->writer);
+        driver->writer = NULL;
+        if (ret < 0) {
+            ST_ERROR("Failed to driver_writer_finish.");
+            goto ERR;
+        }
+    }
+
     if (driver->err != 0) {
         goto ERR;
     }
@@ -507,12 +1149,18 @@ static int driver_do_run(driver_t *driver)
 
     num_words = 0;
     num_sents = 0;
+    num_slots = 0;
     logp = 0.0;
     for (i = 0; i < n_thr; i++) {
         num_words += stats[i].num_words;
         num_sents += stats[i].num_sents;
+        num_slots += stats[i].num_slots;
         logp += stats[i].logp;
     }
+    driver->stat.num_words = num_words;
+    driver->stat.num_sents = num_sents;
+    driver->stat.num_slots = num_slots;
+    driver->stat.logp = logp;
 
     if (num_words != driver->reader->num_words
             || num_sents != driver->reader->num_sents) {
@@ -528,6 +1176,10 @@ static int driver_do_run(driver_t *driver)
         ST_NOTICE("Words: " COUNT_FMT ", Sentences: " COUNT_FMT
                 ", OOVs: " COUNT_FMT ", words/sec: %.1f", num_words, num_sents,
                 driver->reader->num_oovs, num_words / ((double) ms / 1000.0));
+        if (num_slots > 0) {
+            ST_NOTICE("Batch utilization: %.2f%%",
+                    num_words / (double)num_slots * 100.0);
+        }
         ST_NOTICE("LogP: %f", logp);
         ST_NOTICE("Entropy: %f", -logp / log(2) / num_words);
         ST_NOTICE("PPL: %f", exp(-logp / (double) num_words));
@@ -554,6 +1206,19 @@ static int driver_do_run(driver_t *driver)
     return 0;
 
 ERR:
+    if (ckpt_started) {
+        /* let checkpointing thread quit for threads not running. */
+        for (i = n_created; i < n_thr; i++) {
+            ckpt_finish(driver->ckpt);
+        }
+        (void)ckpt_wait(driver->ckpt);
+    }
+
+    if (driver->writer != NULL) {
+        (void)driver_writer_finish(driver->writer);
+        driver_writer_destroy(driver->writer);
+        driver->writer = NULL;
+    }
 
     safe_st_free(pts);
     safe_st_free(thrs);
@@ -37,6 +37,8 @@ extern "C" {
 
 #include "connlm.h"
 #include "reader.h"
+#include "dist.h"
+#include "ckpt.h"
 #include "updaters/updater.h"
 
 /** @defgroup g_driver connLM Driver
@@ -59,6 +61,7 @@ typedef enum _driver_mode_t_ {
  */
 typedef struct _driver_train_opt_t_ {
     unsigned int rand_seed;   /**< initial seed for random function. */
+    int nce_samples; /**< number of noise samples per target for NCE. */
 } driver_train_opt_t;
 
 /**
@@ -68,6 +71,7 @@ typedef struct _driver_train_opt_t_ {
 typedef struct _driver_eval_opt_t_ {
     bool print_sent_prob; /**< print sentence prob only, if true. */
     real_t out_log_base; /**< log base for printing prob. */
+    bool self_norm; /**< use unnormalized score as prob for NCE model. */
 } driver_eval_opt_t;
 
 /**
@@ -124,6 +128,7 @@ typedef struct _driver_t_ {
     int n_thr; /**< number of working threads. */
 
     int err; /**< error indicator. */
+    thr_stat_t stat; /**< statistics of the last run, over all threads. */
 
     driver_mode_t mode; /**< driver mode. */
     // for trian
@@ -131,10 +136,15 @@ typedef struct _driver_t_ {
     // for eval
     driver_eval_opt_t eval_opt; /**< Eval options. */
     FILE *fp_log;    /**< file pointer to print out log. */
+    struct _driver_writer_t_ *writer; /**< writes log in input order,
+                                        while running eval with fp_log. */
 
     // for gen
     driver_gen_opt_t gen_opt; /**< Gen options. */
     int gen_num_sents;    /**< number of sentences to be generated. */
+
+    dist_t *dist; /**< distributed trainer, NULL if not distributed. */
+    ckpt_t *ckpt; /**< checkpointer, NULL if not checkpointing. */
 } driver_t;
 
 /**
@@ -192,6 +202,25 @@ int driver_run(driver_t *driver);
  */
 int driver_set_train(driver_t *driver, driver_train_opt_t *train_opt);
 
+/**
+ * Set distributed trainer, parameters would be averaged with
+ * other workers while training. Must be called before driver_setup.
+ * @ingroup g_driver
+ * @param[in] driver driver.
+ * @param[in] dist the distributed trainer.
+ * @return non-zero value if any error.
+ */
+int driver_set_dist(driver_t *driver, dist_t *dist);
+
+/**
+ * Set checkpointer, model would be saved periodically while training.
+ * @ingroup g_driver
+ * @param[in] driver driver.
+ * @param[in] ckpt the checkpointer.
+ * @return non-zero value if any error.
+ */
+int driver_set_ckpt(driver_t *driver, ckpt_t *ckpt);
+
 /**
  * Set options for eval.
  * @ingroup g_driver
@@ -48,6 +48,7 @@ static void direct_glue_data_destroy(direct_glue_data_t *data)
     }
 
     data->hash_sz = 0;
+    data->bucket = false;
 }
 
 static direct_glue_data_t* direct_glue_data_init()
@@ -79,6 +80,7 @@ static direct_glue_data_t* direct_glue_data_dup(direct_glue_data_t *src)
         goto ERR;
     }
     dst->hash_sz = ((direct_glue_data_t *)src)->hash_sz;
+    dst->bucket = ((direct_glue_data_t *)src)->bucket;
 
     return (void *)dst;
 ERR:
@@ -174,6 +176,8 @@ int direct_glue_parse_topo(glue_t *glue, const char *line)
                 ST_ERROR("Illegal size[%s]", keyvalue + MAX_LINE_LEN);
                 goto ERR;
             }
+        } else if (strcasecmp("bucket", keyvalue) == 0) {
+            data->bucket = str2bool(keyvalue + MAX_LINE_LEN);
         } else {
             ST_ERROR("Unknown key/value[%s]", token);
         }
@@ -220,6 +224,12 @@ bool direct_glue_check(glue_t *glue, layer_t **layers, int n_layer,
         return false;
     }
 
+    if (data->bucket && data->hash_sz % DIRECT_BUCKET_SIZE != 0) {
+        ST_ERROR("Hash size should be multiple of %d for bucketed layout.",
+                DIRECT_BUCKET_SIZE);
+        return false;
+    }
+
     for (i = 0; i < glue->num_wts; i++) {
         if (glue->wts[i]->init_type != WT_INIT_CONST) {
             glue->wts[i]->init_type = WT_INIT_CONST;
@@ -241,8 +251,9 @@ char* direct_glue_draw_label(glue_t *glue, char *label, size_t label_len)
 
     data = (direct_glue_data_t *)glue->extra;
 
-    snprintf(label, label_len, ",size=%s",
-            st_ll2str(buf, MAX_NAME_LEN, (long long)data->hash_sz, false));
+    snprintf(label, label_len, ",size=%s%s",
+            st_ll2str(buf, MAX_NAME_LEN, (long long)data->hash_sz, false),
+            data->bucket ? ",bucket" : "");
 
     return label;
 }
@@ -258,6 +269,8 @@ int direct_glue_load_header(void **extra, int version,
     } flag;
 
     size_t hash_sz;
+    bool bucket;
+    char sym[MAX_LINE_LEN];
 
     ST_CHECK_PARAM((extra == NULL && fo_info == NULL) || fp == NULL
             || fmt == NULL, -1);
@@ -298,6 +311,14 @@ int direct_glue_load_header(void **extra, int version,
             ST_ERROR("Failed to read hash_sz.");
             return -1;
         }
+
+        bucket = false;
+        if (version >= 21) {
+            if (fread(&bucket, sizeof(bool), 1, fp) != 1) {
+                ST_ERROR("Failed to read bucket.");
+                return -1;
+            }
+        }
     } else {
         if (st_readline(fp, "") != 0) {
             ST_ERROR("tag error.");
@@ -312,6 +333,17 @@ int direct_glue_load_header(void **extra, int version,
             ST_ERROR("Failed to parse hash_sz.");
             goto ERR;
         }
+
+        bucket = false;
+        if (version >= 21) {
+            if (st_readline(fp, "Bucket: %"xSTR(MAX_LINE_LEN)"s",
+                        sym) != 1) {
+                ST_ERROR("Failed to parse bucket.");
+                goto ERR;
+            }
+            sym[MAX_LINE_LEN - 1] = '\0';
+            bucket = str2bool(sym);
+        }
     }
 
     if (extra != NULL) {
@@ -323,11 +355,13 @@ int direct_glue_load_header(void **extra, int version,
 
         *extra = (void *)data;
         data->hash_sz = hash_sz;
+        data->bucket = bucket;
     }
 
     if (fo_info != NULL) {
         fprintf(fo_info, "\n<DIRECT-GLUE>\n");
         fprintf(fo_info, "Hash size: %zu\n", hash_sz);
+        fprintf(fo_info, "Bucket: %s\n", bool2str(bucket));
     }
 
     return 0;
@@ -361,6 +395,10 @@ int direct_glue_save_header(void *extra, FILE *fp, connlm_fmt_t fmt)
             ST_ERROR("Failed to write hash_sz.");
             return -1;
         }
+        if (fwrite(&(data->bucket), sizeof(bool), 1, fp) != 1) {
+            ST_ERROR("Failed to write bucket.");
+            return -1;
+        }
     } else {
         if (fprintf(fp, "    \n<DIRECT-GLUE>\n") < 0) {
             ST_ERROR("Failed to fprintf header.");
@@ -371,6 +409,10 @@ int direct_glue_save_header(void *extra, FILE *fp, connlm_fmt_t fmt)
             ST_ERROR("Failed to fprintf hash_sz.");
             return -1;
         }
+        if (fprintf(fp, "Bucket: %s\n", bool2str(data->bucket)) < 0) {
+            ST_ERROR("Failed to fprintf bucket.");
+            return -1;
+        }
     }
 
     return 0;
@@ -50,8 +50,12 @@ extern "C" {
  */
 typedef struct _direct_glue_data_t_ {
     size_t hash_sz; /**< size of hash wt. */
+    bool bucket; /**< whether to use bucketed layout, i.e. children of
+                   a node for one n-gram start at an aligned bucket. */
 } direct_glue_data_t;
 
+#define DIRECT_BUCKET_SIZE 16 /**< number of weights in one bucket. */
+
 /**
  * Destroy a direct glue.
  * @ingroup g_glue_direct
@@ -968,6 +968,9 @@ wt_updater_t** glue_init_wt_updaters(glue_t *glue, param_t *param,
             ST_ERROR("Failed to wt_updater_create.");
             goto ERR;
         }
+        if (wt_is_quantized(glue->wts[i])) {
+            wt_updaters[i]->qwt = &glue->wts[i]->qw;
+        }
     }
 
     return wt_updaters;
@@ -1031,6 +1034,28 @@ void glue_sanity_check(glue_t *glue)
     }
 }
 
+int glue_quantize(glue_t *glue)
+{
+    int i;
+
+    ST_CHECK_PARAM(glue == NULL, -1);
+
+    // only these glues have quantized forward kernels
+    if (strcasecmp(glue->type, DIRECT_GLUE_NAME) != 0
+            && strcasecmp(glue->type, OUT_GLUE_NAME) != 0) {
+        return 0;
+    }
+
+    for (i = 0; i < glue->num_wts; i++) {
+        if (wt_quantize(glue->wts[i]) < 0) {
+            ST_ERROR("Failed to wt_quantize[%d].", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 void glue_print_verbose_info(glue_t *glue, FILE *fo)
 {
     ST_CHECK_PARAM_VOID(glue == NULL || fo == NULL);
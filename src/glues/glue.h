@@ -322,6 +322,15 @@ int glue_backprop(glue_t *glue, comp_updater_t *comp_updater,
  */
 void glue_sanity_check(glue_t *glue);
 
+/**
+ * Quantize weights of glue for inference.
+ * Only direct and out glues are quantized, others are left untouched.
+ * @ingroup g_glue
+ * @param[in] glue glue
+ * @return non-zero value if any error.
+ */
+int glue_quantize(glue_t *glue);
+
 /**
  * Print verbose info of a glue.
  * @ingroup g_glue
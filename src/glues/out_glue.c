@@ -82,6 +82,7 @@ bool out_glue_check(glue_t *glue, layer_t **layers, int n_layer,
 }
 
 typedef struct _init_wt_args_t_ {
+    output_t *output;
     weight_t **wts;
     int in_len;
 } init_wt_args_t;
@@ -101,7 +102,9 @@ static int output_tree_dfs_trav_init_wt(output_tree_t *tree,
         return 0;
     }
 
-    if (wt_init(iw_args->wts[node], child_e - child_s - 1, iw_args->in_len) < 0) {
+    if (wt_init(iw_args->wts[node],
+                output_num_scores(iw_args->output, child_s, child_e),
+                iw_args->in_len) < 0) {
         ST_ERROR("Failed to wt_init["OUTPUT_NODE_FMT"].", node);
         return -1;
     }
@@ -129,6 +132,7 @@ int out_glue_init_data(glue_t *glue, input_t *input,
         goto ERR;
     }
 
+    iw_args.output = output;
     iw_args.wts = glue->wts;
     iw_args.in_len = glue->in_length;
     if (output_tree_dfs(output->tree, dfs_aux,
@@ -30,6 +30,7 @@
 #include <stutils/st_rand.h>
 
 #include "utils.h"
+#include "vecmath.h"
 #include "sigmoid_layer.h"
 
 static const int SIGMOID_LAYER_MAGIC_NUM = 626140498 + 62;
@@ -372,7 +373,7 @@ int sigmoid_activate(layer_t *layer, mat_t *ac)
     }
 
     for (i = 0; i < ac->num_rows; i++) {
-        sigmoid(MAT_VALP(ac, i, 0), ac->num_cols);
+        vm_sigmoid(MAT_VALP(ac, i, 0), ac->num_cols);
     }
 
     return 0;
@@ -26,6 +26,7 @@
 #include <stutils/st_rand.h>
 
 #include "utils.h"
+#include "vecmath.h"
 #include "tanh_layer.h"
 
 int tanh_activate(layer_t *layer, mat_t *ac)
@@ -35,7 +36,7 @@ int tanh_activate(layer_t *layer, mat_t *ac)
     ST_CHECK_PARAM(layer == NULL || ac == NULL, -1);
 
     for (i = 0; i < ac->num_rows; i++) {
-        tanH(MAT_VALP(ac, i, 0), ac->num_cols);
+        vm_tanh(MAT_VALP(ac, i, 0), ac->num_cols);
     }
 
     return 0;
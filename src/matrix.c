@@ -24,6 +24,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <stutils/st_macro.h>
 #include <stutils/st_log.h>
@@ -41,7 +44,12 @@ void mat_destroy(mat_t *mat)
         return;
     }
 
-    if (! mat->is_const) {
+    if (mat->map_addr != NULL) {
+        (void)munmap(mat->map_addr, mat->map_len);
+        mat->map_addr = NULL;
+        mat->map_len = 0;
+        mat->vals = NULL;
+    } else if (! mat->is_const) {
         safe_st_aligned_free(mat->vals);
     }
 
@@ -69,6 +77,13 @@ int mat_clear(mat_t *mat)
     return 0;
 }
 
+static size_t mat_stride(size_t num_cols)
+{
+    return num_cols + ((ALIGN_SIZE / sizeof(real_t))
+            - num_cols % (ALIGN_SIZE / sizeof(real_t)))
+        % (ALIGN_SIZE / sizeof(real_t));
+}
+
 int mat_resize(mat_t *mat, size_t num_rows, size_t num_cols, real_t init_val)
 {
     size_t stride;
@@ -82,9 +97,7 @@ int mat_resize(mat_t *mat, size_t num_rows, size_t num_cols, real_t init_val)
         }
     }
 
-    stride = num_cols;
-    stride += ((ALIGN_SIZE / sizeof(real_t)) - num_cols % (ALIGN_SIZE / sizeof(real_t)))
-                  % (ALIGN_SIZE / sizeof(real_t));
+    stride = mat_stride(num_cols);
 
     if (num_rows * stride > mat->capacity) {
         mat->vals = (real_t *)st_aligned_realloc(mat->vals,
@@ -193,6 +206,8 @@ void mat_assign(mat_t *dst, mat_t *src)
 
     *dst = *src;
     dst->is_const = true;
+    dst->map_addr = NULL;
+    dst->map_len = 0;
 }
 
 bool mat_eq(mat_t *mat1, mat_t *mat2)
@@ -336,6 +351,8 @@ int mat_submat(mat_t *mat, size_t row_s, size_t num_rows,
     sub->capacity = mat->capacity - (sub->vals - mat->vals);
 
     sub->is_const = true;
+    sub->map_addr = NULL;
+    sub->map_len = 0;
 
     return 0;
 }
@@ -794,7 +811,12 @@ int mat_load_header(mat_t *mat, int version,
     }
 
     if (mat != NULL) {
-        if (mat_resize(mat, num_rows, num_cols, NAN) < 0) {
+        if (connlm_fmt_is_mmap(*fmt)) {
+            // storage will be mapped from file in mat_load_body
+            mat->num_rows = num_rows;
+            mat->num_cols = num_cols;
+            mat->stride = mat_stride(num_cols);
+        } else if (mat_resize(mat, num_rows, num_cols, NAN) < 0) {
             ST_ERROR("Failed to mat_resize.");
             goto ERR;
         }
@@ -815,6 +837,162 @@ ERR:
     return -1;
 }
 
+/*
+ * Layout of matrix body in mmap format:
+ *   stride (size_t), pad (int), pad bytes of zeros,
+ *   num_rows * stride reals, zeros up to a multiple of MMAP_ALIGN_SIZE.
+ * The reals start at an offset aligned to MMAP_ALIGN_SIZE in the file.
+ */
+static const char g_mmap_zeros[MMAP_ALIGN_SIZE];
+
+static size_t mmap_padded_len(size_t len)
+{
+    return len + (MMAP_ALIGN_SIZE - len % MMAP_ALIGN_SIZE) % MMAP_ALIGN_SIZE;
+}
+
+static int mat_load_mmap(mat_t *mat, FILE *fp)
+{
+    char buf[MMAP_ALIGN_SIZE];
+    size_t stride;
+    struct stat st;
+    size_t len;
+    off_t off;
+    off_t base;
+    void *addr;
+    int pad;
+    int fd;
+
+    if (fread(&stride, sizeof(size_t), 1, fp) != 1) {
+        ST_ERROR("Failed to read stride.");
+        return -1;
+    }
+    if (stride != mat->stride) {
+        ST_ERROR("Stride not match[%zu/%zu].", stride, mat->stride);
+        return -1;
+    }
+
+    if (fread(&pad, sizeof(int), 1, fp) != 1) {
+        ST_ERROR("Failed to read pad.");
+        return -1;
+    }
+    if (pad < 0 || pad >= MMAP_ALIGN_SIZE) {
+        ST_ERROR("Wrong pad[%d].", pad);
+        return -1;
+    }
+
+    len = sizeof(real_t) * mat->num_rows * mat->stride;
+
+    fd = fileno(fp);
+    off = ftello(fp);
+    if (fd >= 0 && off >= 0 && mat->vals == NULL
+            && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        off += pad;
+        /* mapping past EOF succeeds, but touching it raises SIGBUS. */
+        if (off + mmap_padded_len(len) > st.st_size) {
+            ST_ERROR("File truncated, matrix ends at [%lld], "
+                    "file size [%lld].",
+                    (long long)(off + mmap_padded_len(len)),
+                    (long long)st.st_size);
+            return -1;
+        }
+        base = off - off % sysconf(_SC_PAGESIZE);
+        addr = mmap(NULL, off - base + len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, base);
+        if (addr != MAP_FAILED) {
+            if (fseeko(fp, off + mmap_padded_len(len), SEEK_SET) != 0) {
+                ST_ERROR("Failed to fseeko.");
+                (void)munmap(addr, off - base + len);
+                return -1;
+            }
+
+            mat->vals = (real_t *)((char *)addr + (off - base));
+            mat->capacity = mat->num_rows * mat->stride;
+            mat->is_const = true;
+            mat->map_addr = addr;
+            mat->map_len = off - base + len;
+
+            return 0;
+        }
+        ST_WARNING("Failed to mmap matrix, fall back to read it.");
+    }
+
+    // not a regular file, read it into memory as usual
+    if (mat_resize(mat, mat->num_rows, mat->num_cols, NAN) < 0) {
+        ST_ERROR("Failed to mat_resize.");
+        return -1;
+    }
+
+    if (fread(buf, 1, pad, fp) != pad) {
+        ST_ERROR("Failed to read pad.");
+        return -1;
+    }
+    if (fread(mat->vals, sizeof(real_t), mat->num_rows * mat->stride, fp)
+            != mat->num_rows * mat->stride) {
+        ST_ERROR("Failed to read vals.");
+        return -1;
+    }
+    if (fread(buf, 1, mmap_padded_len(len) - len, fp)
+            != mmap_padded_len(len) - len) {
+        ST_ERROR("Failed to read padding.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int mat_save_mmap(mat_t *mat, FILE *fp)
+{
+    size_t len;
+    size_t i;
+    off_t off;
+    int pad;
+
+    if (fwrite(&mat->stride, sizeof(size_t), 1, fp) != 1) {
+        ST_ERROR("Failed to write stride.");
+        return -1;
+    }
+
+    off = ftello(fp);
+    if (off < 0) {
+        ST_ERROR("Mmap format can only be written to a regular file.");
+        return -1;
+    }
+    off += sizeof(int);
+    pad = (MMAP_ALIGN_SIZE - off % MMAP_ALIGN_SIZE) % MMAP_ALIGN_SIZE;
+
+    if (fwrite(&pad, sizeof(int), 1, fp) != 1) {
+        ST_ERROR("Failed to write pad.");
+        return -1;
+    }
+    if (fwrite(g_mmap_zeros, 1, pad, fp) != pad) {
+        ST_ERROR("Failed to write pad.");
+        return -1;
+    }
+
+    for (i = 0; i < mat->num_rows; i++) {
+        if (fwrite(MAT_VALP(mat, i, 0), sizeof(real_t),
+                    mat->num_cols, fp) != mat->num_cols) {
+            ST_ERROR("Failed to write row[%zu].", i);
+            return -1;
+        }
+        // elements beyond num_cols may be uninitialized
+        if (fwrite(g_mmap_zeros, sizeof(real_t), mat->stride - mat->num_cols,
+                    fp) != mat->stride - mat->num_cols) {
+            ST_ERROR("Failed to write stride of row[%zu].", i);
+            return -1;
+        }
+    }
+
+    len = sizeof(real_t) * mat->num_rows * mat->stride;
+    if (fwrite(g_mmap_zeros, 1, mmap_padded_len(len) - len, fp)
+            != mmap_padded_len(len) - len) {
+        ST_ERROR("Failed to write padding.");
+        return -1;
+    }
+
+    return 0;
+}
+
 int mat_load_body(mat_t *mat, int version, FILE *fp, connlm_fmt_t fmt)
 {
     char name[MAX_NAME_LEN];
@@ -840,36 +1018,18 @@ int mat_load_body(mat_t *mat, int version, FILE *fp, connlm_fmt_t fmt)
             return -1;
         }
 
-        if (fmt == CONN_FMT_BIN) {
-            for (i = 0; i < mat->num_rows; i++) {
-                if (fread(MAT_VALP(mat, i, 0), sizeof(real_t),
-                            mat->num_cols, fp) != mat->num_cols) {
-                    ST_ERROR("Failed to read row[%zu].", i);
+        if (connlm_fmt_is_mmap(fmt)) {
+            if (mat->num_rows > 0 && mat->num_cols > 0) {
+                if (mat_load_mmap(mat, fp) < 0) {
+                    ST_ERROR("Failed to mat_load_mmap.");
                     return -1;
                 }
             }
-        } else if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
-            if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-                for (i = 0; i < mat->num_rows; i++) {
-                    if (load_sq_zc(MAT_VALP(mat, i, 0), mat->num_cols, fp) < 0) {
-                        ST_ERROR("Failed to load_sq_zc for row[%zu].", i);
-                        return -1;
-                    }
-                }
-            } else {
-                for (i = 0; i < mat->num_rows; i++) {
-                    if (load_sq(MAT_VALP(mat, i, 0), mat->num_cols, fp) < 0) {
-                        ST_ERROR("Failed to load_sq for row[%zu].", i);
-                        return -1;
-                    }
-                }
-            }
-        } else if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-            for (i = 0; i < mat->num_rows; i++) {
-                if (load_zc(MAT_VALP(mat, i, 0), mat->num_cols, fp) < 0) {
-                    ST_ERROR("Failed to load_zc for row[%zu].", i);
-                    return -1;
-                }
+        } else {
+            if (load_rows(mat->vals, mat->num_rows, mat->num_cols,
+                        mat->stride, fmt, fp) < 0) {
+                ST_ERROR("Failed to load_rows.");
+                return -1;
             }
         }
     } else {
@@ -985,36 +1145,16 @@ int mat_save_body(mat_t *mat, FILE *fp, connlm_fmt_t fmt, char *name)
             return 0;
         }
 
-        if (fmt == CONN_FMT_BIN) {
-            for (i = 0; i < mat->num_rows; i++) {
-                if (fwrite(MAT_VALP(mat, i, 0), sizeof(real_t),
-                            mat->num_cols, fp) != mat->num_cols) {
-                    ST_ERROR("Failed to write row[%zu].", i);
-                    return -1;
-                }
-            }
-        } else if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
-            if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-                for (i = 0; i < mat->num_rows; i++) {
-                    if (save_sq_zc(MAT_VALP(mat, i, 0), mat->num_cols, fp) < 0) {
-                        ST_ERROR("Failed to save_sq_zc for row[%zu].", i);
-                        return -1;
-                    }
-                }
-            } else {
-                for (i = 0; i < mat->num_rows; i++) {
-                    if (save_sq(MAT_VALP(mat, i, 0), mat->num_cols, fp) < 0) {
-                        ST_ERROR("Failed to save_sq for row[%zu].", i);
-                        return -1;
-                    }
-                }
+        if (connlm_fmt_is_mmap(fmt)) {
+            if (mat_save_mmap(mat, fp) < 0) {
+                ST_ERROR("Failed to mat_save_mmap.");
+                return -1;
             }
-        } else if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-            for (i = 0; i < mat->num_rows; i++) {
-                if (save_zc(MAT_VALP(mat, i, 0), mat->num_cols, fp) < 0) {
-                    ST_ERROR("Failed to save_zc for row[%zu].", i);
-                    return -1;
-                }
+        } else {
+            if (save_rows(mat->vals, mat->num_rows, mat->num_cols,
+                        mat->stride, fmt, fp) < 0) {
+                ST_ERROR("Failed to save_rows.");
+                return -1;
             }
         }
     } else {
@@ -1209,3 +1349,417 @@ int sp_mat_coo_add(sp_mat_t *sp_mat, size_t row, size_t col, real_t val)
 
     return 0;
 }
+
+#define MAT_PREFETCH_DIST 4 /* number of rows prefetched ahead. */
+
+static inline void prefetch_row(real_t *row, size_t n, int rw)
+{
+    size_t i;
+
+    // one cache line at a time
+    for (i = 0; i < n; i += 64 / sizeof(real_t)) {
+        if (rw) {
+            __builtin_prefetch(row + i, 1);
+        } else {
+            __builtin_prefetch(row + i, 0);
+        }
+    }
+}
+
+static inline void axpy_row(real_t *restrict dst, real_t *restrict src,
+        size_t n, real_t a)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] += a * src[i];
+    }
+}
+
+/* dst[i] += a * src[i] for the i's with bit (bit_s + i) of mask set. */
+static inline void axpy_row_mask(real_t *restrict dst, real_t *restrict src,
+        bmat_word_t *restrict mask, size_t bit_s, size_t n, real_t a)
+{
+    bmat_word_t bits;
+    size_t i, j, m, sh;
+
+    for (i = 0; i < n; i += m) {
+        sh = (bit_s + i) % BMAT_WORD_BITS;
+        bits = mask[(bit_s + i) / BMAT_WORD_BITS] >> sh;
+        m = min(BMAT_WORD_BITS - sh, n - i);
+        for (j = 0; j < m; j++) {
+            dst[i + j] += ((bits >> j) & 1) ? a * src[i + j] : 0.0;
+        }
+    }
+}
+
+void mat_gather_add_rows(mat_t *src, int *rows, real_t *scales, int *offs,
+        int n, real_t scale, bmat_word_t *keep_mask, real_t *dst)
+{
+    real_t a;
+    int k, off;
+
+    for (k = 0; k < MAT_PREFETCH_DIST && k < n; k++) {
+        prefetch_row(MAT_VALP(src, rows[k], 0), src->num_cols, 0);
+    }
+
+    for (k = 0; k < n; k++) {
+        if (k + MAT_PREFETCH_DIST < n) {
+            prefetch_row(MAT_VALP(src, rows[k + MAT_PREFETCH_DIST], 0),
+                    src->num_cols, 0);
+        }
+
+        a = scale;
+        if (scales != NULL) {
+            a *= scales[k];
+        }
+        off = (offs != NULL) ? offs[k] : 0;
+
+        if (keep_mask != NULL) {
+            axpy_row_mask(dst + off, MAT_VALP(src, rows[k], 0),
+                    keep_mask, off, src->num_cols, a);
+        } else {
+            axpy_row(dst + off, MAT_VALP(src, rows[k], 0), src->num_cols, a);
+        }
+    }
+}
+
+void mat_scatter_add_rows(mat_t *dst, size_t *dst_rows, mat_t *src,
+        size_t *src_rows, real_t *scales, size_t n, real_t alpha)
+{
+    real_t a;
+    size_t k;
+
+    for (k = 0; k < MAT_PREFETCH_DIST && k < n; k++) {
+        prefetch_row(MAT_VALP(dst, dst_rows[k], 0), dst->num_cols, 1);
+    }
+
+    for (k = 0; k < n; k++) {
+        if (k + MAT_PREFETCH_DIST < n) {
+            prefetch_row(MAT_VALP(dst, dst_rows[k + MAT_PREFETCH_DIST], 0),
+                    dst->num_cols, 1);
+        }
+
+        a = alpha;
+        if (scales != NULL) {
+            a *= scales[k];
+        }
+        axpy_row(MAT_VALP(dst, dst_rows[k], 0),
+                MAT_VALP(src, src_rows[k], 0), dst->num_cols, a);
+    }
+}
+
+void qmat_destroy(qmat_t *qmat)
+{
+    if (qmat == NULL) {
+        return;
+    }
+
+    safe_st_free(qmat->vals);
+    safe_st_free(qmat->scales);
+    qmat->num_rows = 0;
+    qmat->num_cols = 0;
+    qmat->blks_per_row = 0;
+}
+
+int qmat_quantize(qmat_t *qmat, mat_t *mat)
+{
+    real_t *row;
+    int8_t *qrow;
+    real_t max, scale;
+    size_t i, b, j, j_e;
+
+    ST_CHECK_PARAM(qmat == NULL || mat == NULL, -1);
+
+    qmat_destroy(qmat);
+
+    if (mat->num_rows == 0 || mat->num_cols == 0) {
+        return 0;
+    }
+
+    qmat->num_rows = mat->num_rows;
+    qmat->num_cols = mat->num_cols;
+    qmat->blks_per_row = (mat->num_cols + QMAT_BLOCK_SIZE - 1)
+        / QMAT_BLOCK_SIZE;
+
+    qmat->vals = (int8_t *)st_malloc(sizeof(int8_t)
+            * qmat->num_rows * qmat->num_cols);
+    if (qmat->vals == NULL) {
+        ST_ERROR("Failed to st_malloc vals.");
+        goto ERR;
+    }
+
+    qmat->scales = (real_t *)st_malloc(sizeof(real_t)
+            * qmat->num_rows * qmat->blks_per_row);
+    if (qmat->scales == NULL) {
+        ST_ERROR("Failed to st_malloc scales.");
+        goto ERR;
+    }
+
+    for (i = 0; i < mat->num_rows; i++) {
+        row = MAT_VALP(mat, i, 0);
+        qrow = qmat->vals + i * qmat->num_cols;
+        for (b = 0; b < qmat->blks_per_row; b++) {
+            j_e = min((b + 1) * QMAT_BLOCK_SIZE, mat->num_cols);
+
+            max = 0.0;
+            for (j = b * QMAT_BLOCK_SIZE; j < j_e; j++) {
+                if (fabs(row[j]) > max) {
+                    max = fabs(row[j]);
+                }
+            }
+
+            scale = max / 127.0;
+            qmat->scales[i * qmat->blks_per_row + b] = scale;
+            for (j = b * QMAT_BLOCK_SIZE; j < j_e; j++) {
+                if (scale == 0.0) {
+                    qrow[j] = 0;
+                } else {
+                    qrow[j] = (int8_t)lrint(row[j] / scale);
+                }
+            }
+        }
+    }
+
+    return 0;
+
+ERR:
+    qmat_destroy(qmat);
+    return -1;
+}
+
+double qmat_dot_row(qmat_t *qmat, size_t row, real_t *vec)
+{
+    int8_t *qrow;
+    real_t *scales;
+    double sum;
+    real_t s;
+    size_t b, j, j_e;
+
+    qrow = qmat->vals + row * qmat->num_cols;
+    scales = qmat->scales + row * qmat->blks_per_row;
+
+    sum = 0.0;
+    for (b = 0; b < qmat->blks_per_row; b++) {
+        j_e = min((b + 1) * QMAT_BLOCK_SIZE, qmat->num_cols);
+
+        s = 0.0;
+        for (j = b * QMAT_BLOCK_SIZE; j < j_e; j++) {
+            s += qrow[j] * vec[j];
+        }
+        sum += scales[b] * s;
+    }
+
+    return sum;
+}
+
+void qmat_add_row_seg(qmat_t *qmat, size_t row, size_t col_s, size_t n,
+        real_t scale, real_t *dst)
+{
+    int8_t *qrow;
+    real_t s;
+    size_t j, j_e, col_e;
+
+    qrow = qmat->vals + row * qmat->num_cols;
+    col_e = col_s + n;
+
+    while (col_s < col_e) {
+        j_e = min((col_s / QMAT_BLOCK_SIZE + 1) * QMAT_BLOCK_SIZE, col_e);
+        s = scale * QMAT_SCALE(qmat, row, col_s);
+        for (j = col_s; j < j_e; j++) {
+            dst[j - col_s] += s * qrow[j];
+        }
+        dst += j_e - col_s;
+        col_s = j_e;
+    }
+}
+
+int qmat_add_mat_mat(real_t alpha, mat_t *in, qmat_t *qmat, mat_t *out)
+{
+    size_t i, j;
+
+    ST_CHECK_PARAM(in == NULL || qmat == NULL || out == NULL, -1);
+
+    if (in->num_cols != qmat->num_cols) {
+        ST_ERROR("in and qmat not match");
+        return -1;
+    }
+
+    if (out->num_rows != in->num_rows || out->num_cols != qmat->num_rows) {
+        ST_ERROR("out not match");
+        return -1;
+    }
+
+    for (i = 0; i < in->num_rows; i++) {
+        for (j = 0; j < qmat->num_rows; j++) {
+            MAT_VAL(out, i, j) += alpha
+                * qmat_dot_row(qmat, j, MAT_VALP(in, i, 0));
+        }
+    }
+
+    return 0;
+}
+
+void bmat_destroy(bmat_t *bmat)
+{
+    if (bmat == NULL) {
+        return;
+    }
+
+    safe_st_aligned_free(bmat->vals);
+    bmat->num_rows = 0;
+    bmat->num_cols = 0;
+    bmat->stride = 0;
+    bmat->capacity = 0;
+}
+
+int bmat_resize(bmat_t *bmat, size_t num_rows, size_t num_cols)
+{
+    ST_CHECK_PARAM(bmat == NULL || num_rows <= 0 || num_cols <= 0, -1);
+
+    bmat->num_cols = num_cols;
+    bmat->stride = (num_cols + BMAT_WORD_BITS - 1) / BMAT_WORD_BITS;
+    bmat->num_rows = 0;
+
+    return bmat_resize_row(bmat, num_rows);
+}
+
+int bmat_resize_row(bmat_t *bmat, size_t num_rows)
+{
+    ST_CHECK_PARAM(bmat == NULL || num_rows <= 0, -1);
+
+    if (num_rows * bmat->stride > bmat->capacity) {
+        bmat->vals = (bmat_word_t *)st_aligned_realloc(bmat->vals,
+                sizeof(bmat_word_t) * num_rows * bmat->stride, ALIGN_SIZE);
+        if (bmat->vals == NULL) {
+            ST_ERROR("Failed to st_aligned_realloc bmat->vals.");
+            return -1;
+        }
+        bmat->capacity = num_rows * bmat->stride;
+    }
+    bmat->num_rows = num_rows;
+
+    return 0;
+}
+
+/* integer hash with good avalanche, from the 'lowbias32' of hash-prospector. */
+static inline uint32_t bmat_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+
+    return x;
+}
+
+uint32_t bmat_rand_key(unsigned int *seed)
+{
+    *seed = bmat_hash(*seed + 0x9e3779b9U);
+
+    return (uint32_t)(*seed);
+}
+
+/* bits of a whole word, bit j being hash(counter of j) < thresh.
+ * The lanes are independent, so this can be vectorized. */
+static inline bmat_word_t bmat_rand_word(uint32_t ctr, uint32_t key,
+        uint32_t thresh)
+{
+    bmat_word_t bits = 0;
+    uint32_t j;
+
+    for (j = 0; j < BMAT_WORD_BITS; j++) {
+        bits |= (bmat_word_t)(bmat_hash((ctr + j) * 0x9e3779b9U + key)
+                < thresh) << j;
+    }
+
+    return bits;
+}
+
+void bmat_rand_seg(bmat_t *bmat, size_t row, size_t col_s, size_t n,
+        real_t prob, uint32_t key)
+{
+    bmat_word_t *words;
+    bmat_word_t bits, m;
+    uint32_t ctr, thresh;
+    size_t w, w_s, w_e, col_e;
+    bool all;
+
+    if (n <= 0) {
+        return;
+    }
+
+    words = BMAT_ROWP(bmat, row);
+    ctr = (uint32_t)(row * bmat->num_cols);
+    all = (prob >= 1.0);
+    thresh = (prob <= 0.0) ? 0 : (uint32_t)(prob * 4294967296.0);
+
+    col_e = col_s + n;
+    w_s = col_s / BMAT_WORD_BITS;
+    w_e = (col_e + BMAT_WORD_BITS - 1) / BMAT_WORD_BITS;
+    for (w = w_s; w < w_e; w++) {
+        if (all) {
+            bits = ~(bmat_word_t)0;
+        } else {
+            bits = bmat_rand_word(ctr + (uint32_t)(w * BMAT_WORD_BITS),
+                    key, thresh);
+        }
+
+        m = ~(bmat_word_t)0;
+        if (w == w_s) {
+            m &= m << (col_s % BMAT_WORD_BITS);
+        }
+        if (w == w_e - 1 && col_e % BMAT_WORD_BITS != 0) {
+            m &= ~(~(bmat_word_t)0 << (col_e % BMAT_WORD_BITS));
+        }
+        words[w] = (words[w] & ~m) | (bits & m);
+    }
+}
+
+int bmat_rand(bmat_t *bmat, real_t prob, unsigned int *seed)
+{
+    uint32_t key;
+    size_t r;
+
+    ST_CHECK_PARAM(bmat == NULL || seed == NULL, -1);
+
+    key = bmat_rand_key(seed);
+    for (r = 0; r < bmat->num_rows; r++) {
+        bmat_rand_seg(bmat, r, 0, bmat->num_cols, prob, key);
+    }
+
+    return 0;
+}
+
+int mat_mask_scale(mat_t *mat, bmat_t *mask, real_t scale, mat_t *out)
+{
+    bmat_word_t *words;
+    bmat_word_t bits;
+    real_t *vals, *valso;
+    size_t i, j, c, n;
+
+    ST_CHECK_PARAM(mat == NULL || mask == NULL || out == NULL, -1);
+
+    if (mat->num_rows != mask->num_rows || mat->num_cols != mask->num_cols
+            || mat->num_rows != out->num_rows
+            || mat->num_cols != out->num_cols) {
+        ST_ERROR("Diemension not match.");
+        return -1;
+    }
+
+    for (i = 0; i < mat->num_rows; i++) {
+        vals = MAT_VALP(mat, i, 0);
+        valso = MAT_VALP(out, i, 0);
+        words = BMAT_ROWP(mask, i);
+        for (c = 0; c < mat->num_cols; c += BMAT_WORD_BITS) {
+            bits = words[c / BMAT_WORD_BITS];
+            n = min(BMAT_WORD_BITS, mat->num_cols - c);
+            for (j = 0; j < n; j++) {
+                valso[c + j] = ((bits >> j) & 1) ? scale * vals[c + j] : 0.0;
+            }
+        }
+    }
+
+    return 0;
+}
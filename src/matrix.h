@@ -57,6 +57,9 @@ typedef struct _matrix_t_ {
     size_t stride; /**< true number of columns for the internal matrix. */
     size_t capacity; /**< capacity of vals. */
     bool is_const; /**< whether the diemention of matrix is const. */
+    void *map_addr; /**< start of the mmap-ed region holding vals,
+                      NULL if vals is not mmap-ed. */
+    size_t map_len; /**< length of the mmap-ed region. */
 } mat_t;
 
 #define MAT_VAL(mat, row, col) ((mat)->vals[(row)*((mat)->stride) + (col)])
@@ -459,6 +462,211 @@ int sp_mat_clear(sp_mat_t *sp_mat);
  */
 int sp_mat_coo_add(sp_mat_t *sp_mat, size_t row, size_t col, real_t val);
 
+typedef uint32_t bmat_word_t; /**< word of bit matrix. */
+#define BMAT_WORD_BITS 32 /**< number of bits in a word of bit matrix. */
+
+/**
+ * Bit Matrix, e.g. the keep mask of dropout.
+ * Every row is packed into stride words, bit (col % BMAT_WORD_BITS) of
+ * word (col / BMAT_WORD_BITS) holding the value of col.
+ * @ingroup g_matrix
+ */
+typedef struct _bit_matrix_t_ {
+    bmat_word_t *vals; /**< packed bits. */
+    size_t num_rows; /**< number of rows. */
+    size_t num_cols; /**< number of cols. */
+    size_t stride; /**< number of words for a row. */
+    size_t capacity; /**< capacity of vals, in words. */
+} bmat_t;
+
+#define BMAT_ROWP(bmat, row) ((bmat)->vals + (row) * (bmat)->stride)
+#define BMAT_BIT(words, col) \
+    (((words)[(col) / BMAT_WORD_BITS] >> ((col) % BMAT_WORD_BITS)) & 1)
+#define BMAT_VAL(bmat, row, col) BMAT_BIT(BMAT_ROWP(bmat, row), col)
+
+/**
+ * Destroy a bit matrix.
+ * @ingroup g_matrix
+ * @param[in] bmat bit matrix to be destroyed.
+ */
+void bmat_destroy(bmat_t *bmat);
+
+/**
+ * Resize a bit matrix, bits are not initialized.
+ * @ingroup g_matrix
+ * @param[in] bmat the bit matrix.
+ * @param[in] num_rows new number of rows.
+ * @param[in] num_cols new number of cols.
+ * @return non-zero if any error.
+ */
+int bmat_resize(bmat_t *bmat, size_t num_rows, size_t num_cols);
+
+/**
+ * Resize row of a bit matrix, bits are not initialized.
+ * @ingroup g_matrix
+ * @param[in] bmat the bit matrix.
+ * @param[in] num_rows new number of rows.
+ * @return non-zero if any error.
+ */
+int bmat_resize_row(bmat_t *bmat, size_t num_rows);
+
+/**
+ * Draw a key for bmat_rand_seg, advancing the seed.
+ * @ingroup g_matrix
+ * @param[in] seed the random seed.
+ * @return the key.
+ */
+uint32_t bmat_rand_key(unsigned int *seed);
+
+/**
+ * Fill a segment of row in bit matrix with random bits, each being 1
+ * with probability prob.
+ * The generator is counter-based: bit (row, col) only depends on key and
+ * its position, so segments can be filled on demand and in any order.
+ * @ingroup g_matrix
+ * @param[in] bmat the bit matrix.
+ * @param[in] row the row.
+ * @param[in] col_s start col of segment.
+ * @param[in] n length of segment.
+ * @param[in] prob probability of 1.
+ * @param[in] key key drawn by bmat_rand_key.
+ */
+void bmat_rand_seg(bmat_t *bmat, size_t row, size_t col_s, size_t n,
+        real_t prob, uint32_t key);
+
+/**
+ * Fill a bit matrix with random bits, each being 1 with probability prob.
+ * @ingroup g_matrix
+ * @param[in] bmat the bit matrix.
+ * @param[in] prob probability of 1.
+ * @param[in] seed the random seed.
+ * @return non-zero if any error.
+ */
+int bmat_rand(bmat_t *bmat, real_t prob, unsigned int *seed);
+
+/**
+ * Mask a matrix with a bit matrix, out = scale * mat * mask.
+ * Elements are multiplied by scale where mask is 1, and zeroed otherwise.
+ * out can be the same as mat.
+ * @ingroup g_matrix
+ * @param[in] mat the matrix.
+ * @param[in] mask the mask.
+ * @param[in] scale the scale.
+ * @param[out] out the output matrix.
+ * @return non-zero if any error.
+ */
+int mat_mask_scale(mat_t *mat, bmat_t *mask, real_t scale, mat_t *out);
+
+/**
+ * Gather rows of a matrix and accumulate them (embedding bag).
+ * For k in [0, n),
+ *   dst[offs[k] + i] += scale * scales[k] * src[rows[k]][i]
+ *                       * bit(keep_mask, offs[k] + i),
+ * for i in [0, src->num_cols). Upcoming rows are prefetched.
+ * @ingroup g_matrix
+ * @param[in] src the source matrix.
+ * @param[in] rows row indexes to be gathered.
+ * @param[in] scales scale for every row, NULL means all ones.
+ * @param[in] offs offset in dst for every row, NULL means all zeros.
+ * @param[in] n number of rows.
+ * @param[in] scale scale for all rows.
+ * @param[in] keep_mask packed bits of dropout mask aligned to dst,
+ *                      NULL for no dropout.
+ * @param[out] dst the destination.
+ */
+void mat_gather_add_rows(mat_t *src, int *rows, real_t *scales, int *offs,
+        int n, real_t scale, bmat_word_t *keep_mask, real_t *dst);
+
+/**
+ * Scatter-add rows into a matrix, the transpose of mat_gather_add_rows.
+ * For k in [0, n),
+ *   dst[dst_rows[k]] += alpha * scales[k] * src[src_rows[k]].
+ * @ingroup g_matrix
+ * @param[out] dst the destination matrix.
+ * @param[in] dst_rows row indexes of dst.
+ * @param[in] src the source matrix, with same number of columns as dst.
+ * @param[in] src_rows row indexes of src.
+ * @param[in] scales scale for every row, NULL means all ones.
+ * @param[in] n number of rows.
+ * @param[in] alpha scale for all rows.
+ */
+void mat_scatter_add_rows(mat_t *dst, size_t *dst_rows, mat_t *src,
+        size_t *src_rows, real_t *scales, size_t n, real_t alpha);
+
+#define QMAT_BLOCK_SIZE 1024 /**< number of columns sharing one scale. */
+
+/**
+ * Quantized Matrix.
+ * Values are stored as int8, with one scale for every block of
+ * QMAT_BLOCK_SIZE columns in a row, i.e. a per-row scale for usual rows,
+ * and blocked scales for very wide rows such as the MaxEnt hash table.
+ * @ingroup g_matrix
+ */
+typedef struct _quantized_matrix_t_ {
+    int8_t *vals; /**< quantized values. */
+    real_t *scales; /**< scales, blks_per_row for every row. */
+    size_t num_rows; /**< number of rows. */
+    size_t num_cols; /**< number of cols. */
+    size_t blks_per_row; /**< number of blocks in a row. */
+} qmat_t;
+
+#define QMAT_SCALE(qmat, row, col) \
+    ((qmat)->scales[(row) * (qmat)->blks_per_row + (col) / QMAT_BLOCK_SIZE])
+#define QMAT_VAL(qmat, row, col) \
+    ((qmat)->vals[(row) * (qmat)->num_cols + (col)] \
+     * QMAT_SCALE(qmat, row, col))
+
+/**
+ * Destroy a quantized matrix.
+ * @ingroup g_matrix
+ * @param[in] qmat quantized matrix to be destroyed.
+ */
+void qmat_destroy(qmat_t *qmat);
+
+/**
+ * Quantize a matrix with symmetric int8 quantization.
+ * @ingroup g_matrix
+ * @param[out] qmat the quantized matrix.
+ * @param[in] mat the matrix.
+ * @return non-zero if any error.
+ */
+int qmat_quantize(qmat_t *qmat, mat_t *mat);
+
+/**
+ * Compute dot product of a row in quantized matrix and a vector.
+ * @ingroup g_matrix
+ * @param[in] qmat the quantized matrix.
+ * @param[in] row the row.
+ * @param[in] vec the vector, with size of qmat->num_cols.
+ * @return the dot product.
+ */
+double qmat_dot_row(qmat_t *qmat, size_t row, real_t *vec);
+
+/**
+ * Add a segment of row in quantized matrix to a vector.
+ * dst[i] += scale * qmat[row][col_s + i], for i in [0, n).
+ * @ingroup g_matrix
+ * @param[in] qmat the quantized matrix.
+ * @param[in] row the row.
+ * @param[in] col_s start col of segment.
+ * @param[in] n length of segment.
+ * @param[in] scale scale.
+ * @param[out] dst the vector.
+ */
+void qmat_add_row_seg(qmat_t *qmat, size_t row, size_t col_s, size_t n,
+        real_t scale, real_t *dst);
+
+/**
+ * Compute out = alpha * in * qmat' + out.
+ * @ingroup g_matrix
+ * @param[in] alpha scale of product.
+ * @param[in] in the input matrix.
+ * @param[in] qmat the quantized matrix.
+ * @param[out] out the output matrix.
+ * @return non-zero if any error.
+ */
+int qmat_add_mat_mat(real_t alpha, mat_t *in, qmat_t *qmat, mat_t *out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 #include <stutils/st_macro.h>
@@ -945,20 +947,14 @@ static output_node_id_t huffman_tree_add_node_m(huffman_tree_t *tree,
 
 void output_destroy(output_t *output)
 {
-    int i;
-
     if (output == NULL) {
         return;
     }
 
     safe_tree_destroy(output->tree);
 
-    if (output->paths != NULL) {
-        for (i = 0; i < output->output_size; i++) {
-            safe_st_free(output->paths[i].nodes);
-        }
-        safe_st_free(output->paths);
-    }
+    safe_st_free(output->steps);
+    safe_st_free(output->step_starts);
     safe_st_free(output->param_map);
     output->num_param_map = 0;
 
@@ -970,8 +966,6 @@ output_t* output_dup(output_t *o)
     output_t *output = NULL;
     size_t sz;
 
-    int i;
-
     ST_CHECK_PARAM(o == NULL, NULL);
 
     output = (output_t *)st_malloc(sizeof(output_t));
@@ -983,6 +977,10 @@ output_t* output_dup(output_t *o)
 
     output->output_opt = o->output_opt;
     *output = *o;
+    output->tree = NULL;
+    output->param_map = NULL;
+    output->steps = NULL;
+    output->step_starts = NULL;
 
     if (o->tree != NULL) {
         output->tree = output_tree_dup(o->tree);
@@ -1002,28 +1000,22 @@ output_t* output_dup(output_t *o)
         }
     }
 
-    if (o->paths != NULL) {
-        sz = sizeof(output_path_t) * output->output_size;
-        output->paths = (output_path_t *)st_malloc(sz);
-        if (output->paths == NULL) {
-            ST_ERROR("Failed to st_malloc paths.");
+    if (o->steps != NULL) {
+        sz = sizeof(size_t) * (output->output_size + 1);
+        output->step_starts = (size_t *)st_malloc(sz);
+        if (output->step_starts == NULL) {
+            ST_ERROR("Failed to st_malloc step_starts.");
             goto ERR;
         }
-        for (i = 0; i < output->output_size; i++) {
-            if (o->paths[i].num_node > 0) {
-                output->paths[i].num_node = o->paths[i].num_node;
-                sz = sizeof(output_node_id_t) * output->paths[i].num_node;
-                output->paths[i].nodes = (output_node_id_t *)st_malloc(sz);
-                if (output->paths[i].nodes == NULL) {
-                    ST_ERROR("Failed to st_malloc nodes for path");
-                    goto ERR;
-                }
-                memcpy(output->paths[i].nodes, o->paths[i].nodes, sz);
-            } else {
-                output->paths[i].nodes = NULL;
-                output->paths[i].num_node = 0;
-            }
+        memcpy(output->step_starts, o->step_starts, sz);
+
+        sz = sizeof(output_step_t) * o->step_starts[o->output_size];
+        output->steps = (output_step_t *)st_malloc(sz);
+        if (output->steps == NULL) {
+            ST_ERROR("Failed to st_malloc steps.");
+            goto ERR;
         }
+        memcpy(output->steps, o->steps, sz);
     }
 
     return output;
@@ -1180,8 +1172,9 @@ static huffman_tree_t* output_gen_bu_huffman(output_t *output,
 
     ST_CHECK_PARAM(output == NULL || cnts == NULL, NULL);
 
+    /* every parent except the last two takes max_branch nodes. */
     cap_node = output->output_size;
-    cap_node += iceil(cap_node - 1, output->output_opt.max_branch - 1);
+    cap_node += iceil(cap_node - 1, output->output_opt.max_branch - 1) + 1;
 
     huffman = huffman_tree_init(cap_node);
     if (huffman == NULL) {
@@ -1293,6 +1286,16 @@ static huffman_tree_t* output_gen_bu_huffman(output_t *output,
             ++br;
         }
 
+        if (br == 0) {
+            /* nothing left to be merged, since depth exceeded. */
+            --huffman->num_node;
+            if (pos0 < 0 && pos1 == huffman->num_node - 1) {
+                parent = pos1;
+                ++pos1; /* avoid adding root */
+            }
+            break;
+        }
+
         if (output->output_opt.max_depth > 0
                 && depth + 2 >= output->output_opt.max_depth) {
             exceed_depth = true;
@@ -1340,181 +1343,76 @@ ERR:
     return NULL;
 }
 
-typedef struct _renum_arg_t_ {
-    output_node_id_t *nodemap;
-    output_node_id_t num_node;
-} renum_arg_t;
-
-static int huffman_trav_renumber(huffman_tree_t *huffman,
-        output_node_id_t node, void *args)
-{
-    renum_arg_t *renum;
-
-    ST_CHECK_PARAM(huffman == NULL || args == NULL
-            || node == OUTPUT_NODE_NONE, -1);
-
-    renum = (renum_arg_t *)args;
-
-    if (renum->nodemap[node] != OUTPUT_NODE_NONE) {
-        ST_ERROR("node[" OUTPUT_NODE_FMT "] visited twice.");
-        return -1;
-    }
-
-    renum->nodemap[node] = renum->num_node++;
-
-    return 0;
-}
-
-typedef struct _h2t_arg_t_ {
-    output_node_id_t *nodemap;
-    output_tree_t *tree;
-} h2t_arg_t;
-
-static int huffman_trav_2tree(huffman_tree_t *huffman,
-        output_node_id_t node, void *args)
+/*
+ * Convert the huffman tree into output tree, with nodes numbered in BFS
+ * order. Every node gets its new id when enqueued, so children of a node,
+ * which are enqueued together, get continuous ids.
+ */
+static int output_gen_bu_huffman2tree(output_t *output,
+        huffman_tree_t *huffman)
 {
-    h2t_arg_t *h2t;
-
-    output_node_id_t tnode;
-    output_node_id_t start, end;
-
-    ST_CHECK_PARAM(huffman == NULL || args == NULL
-            || node == OUTPUT_NODE_NONE, -1);
-
-    h2t = (h2t_arg_t *)args;
+    output_node_id_t *nodemap = NULL;
+    output_node_id_t *queue = NULL;
 
-    tnode = output_tree_add_node(h2t->tree);
-    if (tnode == OUTPUT_NODE_NONE) {
-        ST_ERROR("Failed to output_tree_add_node.");
-        return -1;
-    }
-    if (tnode != h2t->nodemap[node]) {
-        ST_ERROR("nodemap not match.");
-        return -1;
-    }
+    size_t sz;
+    output_node_id_t head, tail;
+    output_node_id_t node, child, tnode;
+    int sub;
+    int i;
 
-    start = OUTPUT_NODE_NONE;
-    end = OUTPUT_NODE_NONE;
+    ST_CHECK_PARAM(output == NULL || huffman == NULL, -1);
 
-    if (s_children(huffman, node)[0] < e_children(huffman, node)[0]) {
-        start = h2t->nodemap[s_children(huffman, node)[0]];
-        end = h2t->nodemap[e_children(huffman,node)[0] - 1] + 1;
+    sz = sizeof(output_node_id_t)*huffman->num_node;
+    nodemap = (output_node_id_t *)st_malloc(sz);
+    if (nodemap == NULL) {
+        ST_ERROR("Failed to st_malloc nodemap.");
+        goto ERR;
     }
-
-    if (s_children(huffman, node)[1] < e_children(huffman, node)[1]) {
-        if (start == OUTPUT_NODE_NONE) {
-            start = h2t->nodemap[s_children(huffman,node)[1]];
-        } else {
-            if (end != h2t->nodemap[s_children(huffman, node)[1]]) {
-                ST_ERROR("children not continuous. "
-                        "node["OUTPUT_NODE_FMT"/"OUTPUT_NODE_FMT"], "
-                        "s_children["OUTPUT_NODE_FMT"/"OUTPUT_NODE_FMT"], "
-                        "end["OUTPUT_NODE_FMT"].",
-                        node, h2t->nodemap[node],
-                        s_children(huffman, node)[1],
-                        h2t->nodemap[s_children(huffman, node)[1]],
-                        end);
-                return -1;
-            }
-        }
-        end = h2t->nodemap[e_children(huffman,node)[1] - 1] + 1;
+    for (node = 0; node < huffman->num_node; ++node) {
+        nodemap[node] = OUTPUT_NODE_NONE;
     }
 
-    s_children(h2t->tree, tnode) = start;
-    e_children(h2t->tree, tnode) = end;
-
-    return 0;
-}
-
-static int huffman_traverse(huffman_tree_t *huffman,
-        int (*visitor)(huffman_tree_t *huffman,
-            output_node_id_t node, void *args), void *args)
-{
-    st_queue_t *node_queue = NULL;
-
-    void *tmp;
-    output_node_id_t node, child;
-    int sub;
-
-    ST_CHECK_PARAM(huffman == NULL || visitor == NULL, -1);
-
-    node_queue = st_queue_create(huffman->num_node);
-    if(node_queue == NULL) {
-        ST_ERROR("Failed to create node_queue.");
+    /* queue[i] is the huffman node with new id i. */
+    queue = (output_node_id_t *)st_malloc(sz);
+    if (queue == NULL) {
+        ST_ERROR("Failed to st_malloc queue.");
         goto ERR;
     }
 
-    st_queue_clear(node_queue);
-    if(st_enqueue(node_queue, (void *)(long)huffman->root)
-            != ST_QUEUE_OK) {
-        ST_ERROR("Failed to st_enqueue root");
+    output->tree = output_tree_init(huffman->num_node);
+    if (output->tree == NULL) {
+        ST_ERROR("Failed to output_tree_init.");
         goto ERR;
     }
 
-    while(!st_queue_empty(node_queue)) {
-        if(st_dequeue(node_queue, &tmp) != ST_QUEUE_OK) {
-            ST_ERROR("Failed to st_dequeue.");
-            goto ERR;
-        }
-        node = (output_node_id_t)(long)tmp;
-
-        if(visitor(huffman, node, args) < 0) {
-            ST_ERROR("Failed to visitor.");
-            goto ERR;
-        }
+    head = 0;
+    tail = 0;
+    queue[tail] = huffman->root;
+    nodemap[huffman->root] = tail++;
+    while (head < tail) {
+        node = queue[head];
+        tnode = head++;
 
+        s_children(output->tree, tnode) = tail;
         for (sub = 0; sub <= 1; ++sub) {
             for (child = s_children(huffman, node)[sub];
                     child < e_children(huffman, node)[sub]; ++child) {
-                if(st_enqueue(node_queue, (void *)(long)child)
-                        != ST_QUEUE_OK) {
-                    ST_ERROR("Failed to st_enqueue child");
+                if (nodemap[child] != OUTPUT_NODE_NONE) {
+                    ST_ERROR("node[" OUTPUT_NODE_FMT "] visited twice.",
+                            child);
                     goto ERR;
                 }
+                queue[tail] = child;
+                nodemap[child] = tail++;
             }
         }
+        e_children(output->tree, tnode) = tail;
+        if (s_children(output->tree, tnode) == tail) {
+            s_children(output->tree, tnode) = OUTPUT_NODE_NONE;
+            e_children(output->tree, tnode) = OUTPUT_NODE_NONE;
+        }
     }
-
-    safe_st_queue_destroy(node_queue);
-    return 0;
-
-ERR:
-    safe_st_queue_destroy(node_queue);
-    return -1;
-}
-
-static int output_gen_bu_huffman2tree(output_t *output,
-        huffman_tree_t *huffman)
-{
-    renum_arg_t renum;
-    h2t_arg_t h2t;
-
-    output_node_id_t *nodemap = NULL;
-    output_node_id_t *rnodemap = NULL;
-
-    size_t sz;
-    output_node_id_t n;
-    int i;
-
-    ST_CHECK_PARAM(output == NULL || huffman == NULL, -1);
-
-    sz = sizeof(output_node_id_t)*huffman->num_node;
-    nodemap = (output_node_id_t *)st_malloc(sz);
-    if (nodemap == NULL) {
-        ST_ERROR("Failed to st_malloc nodemap.");
-        goto ERR;
-    }
-    for (n = 0; n < huffman->num_node; ++n) {
-        nodemap[n] = OUTPUT_NODE_NONE;
-    }
-
-    renum.nodemap = nodemap;
-    renum.num_node = 0;
-    if (huffman_traverse(huffman, huffman_trav_renumber, &renum) < 0) {
-        ST_ERROR("Failed to huffman_traverse renumbering.");
-        goto ERR;
-    }
-    if (renum.num_node != huffman->num_node) {
+    if (tail != huffman->num_node) {
         ST_ERROR("some nodes are not renumbered.");
         goto ERR;
     }
@@ -1524,25 +1422,13 @@ static int output_gen_bu_huffman2tree(output_t *output,
         ST_DEBUG("NodeMap: ");
         for (n = 0; n < huffman->num_node; n++) {
             ST_DEBUG(OUTPUT_NODE_FMT" -> "OUTPUT_NODE_FMT,
-                    n, renum.nodemap[n]);
+                    n, nodemap[n]);
         }
     }
 #endif
-
-    output->tree = output_tree_init(huffman->num_node);
-    if (output->tree == NULL) {
-        ST_ERROR("Failed to output_tree_init.");
-        goto ERR;
-    }
+    output->tree->num_node = huffman->num_node;
     output->tree->root = nodemap[huffman->root];
 
-    h2t.nodemap = nodemap;
-    h2t.tree = output->tree;
-    if (huffman_traverse(huffman, huffman_trav_2tree, &h2t) < 0) {
-        ST_ERROR("Failed to huffman_traverse huffman2tree.");
-        goto ERR;
-    }
-
     sz = sizeof(output_node_id_t) * output->output_size;
     output->tree->word2leaf = (output_node_id_t *)st_malloc(sz);
     if (output->tree->word2leaf == NULL) {
@@ -1554,37 +1440,28 @@ static int output_gen_bu_huffman2tree(output_t *output,
         output->tree->word2leaf[i] = nodemap[i];
     }
 
-    sz = sizeof(output_node_id_t)*huffman->num_node;
-    rnodemap = (output_node_id_t *)st_malloc(sz);
-    if (rnodemap == NULL) {
-        ST_ERROR("Failed to st_malloc rnodemap.");
-        goto ERR;
-    }
-    for (n = 0; n < huffman->num_node; n++) {
-        rnodemap[nodemap[n]] = n;
-    }
     sz = sizeof(int) * output->tree->num_node;
     output->tree->leaf2word = (int *)st_malloc(sz);
     if (output->tree->leaf2word == NULL) {
         ST_ERROR("Failed to st_malloc leaf2word.");
         goto ERR;
     }
-    for (n = 0; n < output->tree->num_node; n++) {
-        if (is_leaf(output->tree, n)) {
-            output->tree->leaf2word[n] = rnodemap[n];
+    for (node = 0; node < output->tree->num_node; node++) {
+        if (is_leaf(output->tree, node)) {
+            output->tree->leaf2word[node] = queue[node];
         } else {
-            output->tree->leaf2word[n] = -1;
+            output->tree->leaf2word[node] = -1;
         }
     }
 
     safe_st_free(nodemap);
-    safe_st_free(rnodemap);
+    safe_st_free(queue);
 
     return 0;
 
 ERR:
     safe_st_free(nodemap);
-    safe_st_free(rnodemap);
+    safe_st_free(queue);
     safe_tree_destroy(output->tree);
     return -1;
 }
@@ -1758,9 +1635,10 @@ output_tree_bfs_aux_t* output_tree_bfs_aux_create(output_tree_t *tree)
     }
     memset(bfs_aux, 0, sizeof(output_tree_bfs_aux_t));
 
-    bfs_aux->node_queue = st_queue_create(tree->num_node);
+    bfs_aux->node_queue = (output_node_id_t *)st_malloc(
+            sizeof(output_node_id_t) * tree->num_node);
     if(bfs_aux->node_queue == NULL) {
-        ST_ERROR("Failed to create node_queue.");
+        ST_ERROR("Failed to st_malloc node_queue.");
         goto ERR;
     }
 
@@ -1776,34 +1654,28 @@ void output_tree_bfs_aux_destroy(output_tree_bfs_aux_t* bfs_aux)
         return;
     }
 
-    safe_st_queue_destroy(bfs_aux->node_queue);
+    safe_st_free(bfs_aux->node_queue);
 }
 
 int output_tree_bfs(output_tree_t *tree, output_tree_bfs_aux_t *bfs_aux,
         int (*visitor)(output_tree_t *tree,
             output_node_id_t node, void *args), void *args)
 {
-    st_queue_t *node_queue;
+    output_node_id_t *node_queue;
 
-    void *tmp;
+    output_node_id_t head, tail;
     output_node_id_t node, child;
 
     ST_CHECK_PARAM(tree == NULL || bfs_aux == NULL || visitor == NULL, -1);
 
     node_queue = bfs_aux->node_queue;
-    st_queue_clear(node_queue);
 
-    if(st_enqueue(node_queue, (void *)(long)tree->root) != ST_QUEUE_OK) {
-        ST_ERROR("Failed to st_enqueue root");
-        return -1;
-    }
+    head = 0;
+    tail = 0;
+    node_queue[tail++] = tree->root;
 
-    while(!st_queue_empty(node_queue)) {
-        if(st_dequeue(node_queue, &tmp) != ST_QUEUE_OK) {
-            ST_ERROR("Failed to st_dequeue.");
-            return -1;
-        }
-        node = (output_node_id_t)(long)tmp;
+    while(head < tail) {
+        node = node_queue[head++];
 
         if(visitor(tree, node, args) < 0) {
             ST_ERROR("Failed to visitor.");
@@ -1812,122 +1684,266 @@ int output_tree_bfs(output_tree_t *tree, output_tree_bfs_aux_t *bfs_aux,
 
         for (child = s_children(tree, node);
                 child < e_children(tree, node); ++child) {
-            if(st_enqueue(node_queue, (void *)(long)child) != ST_QUEUE_OK) {
-                ST_ERROR("Failed to st_enqueue child");
+            if (tail >= tree->num_node) {
+                ST_ERROR("Too many nodes in queue, not a tree?");
                 return -1;
             }
+            node_queue[tail++] = child;
         }
     }
 
     return 0;
 }
 
-static int output_tree_dfs_trav_gen_path(output_tree_t *tree,
-        output_node_id_t node, st_stack_t *stack, void *args)
-{
+#define PATH_CHUNK_SIZE (1 << 16) /* number of words in one job. */
+#define PATH_MAX_THREADS 16
+
+typedef struct _path_job_t_ {
     output_t *output;
+    output_node_id_t *parents; /* parent of every node. */
+    int word_s; /* start word of job. */
+    int word_e; /* end word of job. */
+    bool fill; /* count the number of steps, or fill the steps. */
+    int ret;
+} path_job_t;
 
-    void *tmp;
-    st_stack_id_t i, n;
+/*
+ * Walk from leaf to root for words in [word_s, word_e), which could be
+ * done in parallel, since paths of different words do not share storage.
+ * Number of steps of word is stored in step_starts[word + 1] when counting.
+ */
+static int output_gen_path_range(output_t *output,
+        output_node_id_t *parents, int word_s, int word_e, bool fill)
+{
+    output_step_t *steps;
+    output_node_id_t leaf, node, next_node;
+    size_t n, num_steps;
     int word;
 
-    ST_CHECK_PARAM(tree == NULL || stack == NULL || args == NULL, -1);
+    for (word = word_s; word < word_e; word++) {
+        leaf = output_tree_word2leaf(output->tree, word);
+        if (leaf < 0 || leaf >= output->tree->num_node
+                || !is_leaf(output->tree, leaf)) {
+            ST_ERROR("Error leaf node["OUTPUT_NODE_FMT"], word[%d]",
+                    leaf, word);
+            return -1;
+        }
 
-    if (!is_leaf(tree, node)) {
-        return 0;
+        if (!fill) {
+            n = 0;
+            node = leaf;
+            while (node != output->tree->root) {
+                node = parents[node];
+                if (node == OUTPUT_NODE_NONE) {
+                    ST_ERROR("leaf node["OUTPUT_NODE_FMT"] not reached "
+                            "from root", leaf);
+                    return -1;
+                }
+                if (n >= output->tree->num_node) {
+                    ST_ERROR("Loop in path of word[%d]", word);
+                    return -1;
+                }
+                ++n;
+            }
+            output->step_starts[word + 1] = n;
+        } else {
+            steps = output->steps + output->step_starts[word];
+            num_steps = output->step_starts[word + 1]
+                - output->step_starts[word];
+            next_node = leaf;
+            for (n = num_steps; n > 0; n--) {
+                node = parents[next_node];
+                steps[n - 1].node = node;
+                steps[n - 1].next_node = next_node;
+                steps[n - 1].child_s = s_children(output->tree, node);
+                steps[n - 1].child_e = e_children(output->tree, node);
+                next_node = node;
+            }
+        }
     }
 
-    output = (output_t *)args;
-    word = output_tree_leaf2word(tree, node);
-    if (word < 0 || word >= output->output_size) {
-        ST_ERROR("Error leaf node["OUTPUT_NODE_FMT"], word[%d]",
-                node, word);
-        return -1;
+    return 0;
+}
+
+static void* path_job_thread(void *args)
+{
+    path_job_t *job = (path_job_t *)args;
+
+    job->ret = output_gen_path_range(job->output, job->parents,
+            job->word_s, job->word_e, job->fill);
+
+    return NULL;
+}
+
+static int output_gen_path_parallel(output_t *output,
+        output_node_id_t *parents, bool fill, int num_thrs)
+{
+    path_job_t *jobs = NULL;
+    pthread_t *tids = NULL;
+
+    int words_per_job;
+    int b;
+
+    jobs = (path_job_t *)st_malloc(sizeof(path_job_t) * num_thrs);
+    if (jobs == NULL) {
+        ST_ERROR("Failed to st_malloc jobs.");
+        goto ERR;
     }
 
-    if (output->paths[word].num_node > 0) {
-        ST_ERROR("Duplicated leaf node["OUTPUT_NODE_FMT"] during DFS",
-                node);
-        return -1;
+    tids = (pthread_t *)st_malloc(sizeof(pthread_t) * num_thrs);
+    if (tids == NULL) {
+        ST_ERROR("Failed to st_malloc tids.");
+        goto ERR;
+    }
+
+    words_per_job = (output->output_size + num_thrs - 1) / num_thrs;
+    for (b = 0; b < num_thrs; b++) {
+        jobs[b].output = output;
+        jobs[b].parents = parents;
+        jobs[b].word_s = min(b * words_per_job, output->output_size);
+        jobs[b].word_e = min((b + 1) * words_per_job, output->output_size);
+        jobs[b].fill = fill;
+        jobs[b].ret = 0;
     }
 
-    n = st_stack_size(stack);
-    if (n > 1) {
-        output->paths[word].nodes = (output_node_id_t *)st_malloc(
-                sizeof(output_node_id_t)*(n-1));
-        if (output->paths[word].nodes == NULL) {
-            ST_ERROR("Failed to st_malloc nodes for path");
+    for (b = 0; b < num_thrs; b++) {
+        if (pthread_create(tids + b, NULL, path_job_thread,
+                    (void *)(jobs + b)) != 0) {
+            ST_ERROR("Failed to pthread_create.");
+            for (--b; b >= 0; b--) {
+                pthread_join(tids[b], NULL);
+            }
             goto ERR;
         }
-        output->paths[word].num_node = n - 1;
+    }
+    for (b = 0; b < num_thrs; b++) {
+        pthread_join(tids[b], NULL);
     }
 
-    for (i = n - 1; i > 0; i--) { /* exclude *root* */
-        if(st_stack_topn(stack, i, &tmp) != ST_STACK_OK) {
-            ST_ERROR("Failed to st_stack_topn[%d].", i);
+    for (b = 0; b < num_thrs; b++) {
+        if (jobs[b].ret < 0) {
+            ST_ERROR("Failed to generate path for words[%d, %d).",
+                    jobs[b].word_s, jobs[b].word_e);
             goto ERR;
         }
-        output->paths[word].nodes[n-1-i] = (output_node_id_t)(long)tmp;
     }
 
+    safe_st_free(jobs);
+    safe_st_free(tids);
+
     return 0;
-ERR:
-    safe_st_free(output->paths[word].nodes);
-    output->paths[word].num_node = 0;
 
+ERR:
+    safe_st_free(jobs);
+    safe_st_free(tids);
     return -1;
 }
 
 static int output_generate_path(output_t *output)
 {
-    output_tree_dfs_aux_t *dfs_aux = NULL;
+    output_node_id_t *parents = NULL;
     size_t sz;
 
-    output_path_t *path;
-    output_node_id_t n;
+    output_step_t *step;
+    output_node_id_t n, child;
+    long num_cpus;
+    int num_thrs;
+    int i;
 
     ST_CHECK_PARAM(output == NULL || output->tree == NULL, -1);
 
-    sz = sizeof(output_path_t) * output->output_size;
-    output->paths = (output_path_t *)st_malloc(sz);
-    if (output->paths == NULL) {
-        ST_ERROR("Failed to st_malloc paths.");
+    sz = sizeof(size_t) * (output->output_size + 1);
+    output->step_starts = (size_t *)st_malloc(sz);
+    if (output->step_starts == NULL) {
+        ST_ERROR("Failed to st_malloc step_starts.");
         goto ERR;
     }
-    memset(output->paths, 0, sz);
+    memset(output->step_starts, 0, sz);
 
-    dfs_aux = output_tree_dfs_aux_create(output->tree);
-    if (dfs_aux == NULL) {
-        ST_ERROR("Failed to output_tree_dfs_aux_create.");
+    sz = sizeof(output_node_id_t) * output->tree->num_node;
+    parents = (output_node_id_t *)st_malloc(sz);
+    if (parents == NULL) {
+        ST_ERROR("Failed to st_malloc parents.");
         goto ERR;
     }
+    for (n = 0; n < output->tree->num_node; n++) {
+        parents[n] = OUTPUT_NODE_NONE;
+    }
+    for (n = 0; n < output->tree->num_node; n++) {
+        for (child = s_children(output->tree, n);
+                child < e_children(output->tree, n); child++) {
+            if (parents[child] != OUTPUT_NODE_NONE) {
+                ST_ERROR("Duplicated parent of node["OUTPUT_NODE_FMT"]",
+                        child);
+                goto ERR;
+            }
+            parents[child] = n;
+        }
+    }
 
-    if (output_tree_dfs(output->tree, dfs_aux,
-                output_tree_dfs_trav_gen_path,
-                output) < 0) {
-        ST_ERROR("Failed to output_tree_dfs.");
+    num_thrs = 1;
+    if (output->output_size >= 2 * PATH_CHUNK_SIZE) {
+        num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_thrs = (int)min(max(num_cpus, 1), PATH_MAX_THREADS);
+        num_thrs = min(num_thrs, output->output_size / PATH_CHUNK_SIZE);
+    }
+
+    /* two passes: count the number of steps, then fill the steps
+     * into a single buffer. */
+    if (num_thrs > 1) {
+        if (output_gen_path_parallel(output, parents, false, num_thrs) < 0) {
+            ST_ERROR("Failed to output_gen_path_parallel.");
+            goto ERR;
+        }
+    } else {
+        if (output_gen_path_range(output, parents, 0,
+                    output->output_size, false) < 0) {
+            ST_ERROR("Failed to output_gen_path_range.");
+            goto ERR;
+        }
+    }
+
+    for (i = 0; i < output->output_size; i++) {
+        output->step_starts[i + 1] += output->step_starts[i];
+    }
+    sz = sizeof(output_step_t) * output->step_starts[output->output_size];
+    output->steps = (output_step_t *)st_malloc(sz);
+    if (output->steps == NULL) {
+        ST_ERROR("Failed to st_malloc steps.");
         goto ERR;
     }
 
-    safe_output_tree_dfs_aux_destroy(dfs_aux);
+    if (num_thrs > 1) {
+        if (output_gen_path_parallel(output, parents, true, num_thrs) < 0) {
+            ST_ERROR("Failed to output_gen_path_parallel.");
+            goto ERR;
+        }
+    } else {
+        if (output_gen_path_range(output, parents, 0,
+                    output->output_size, true) < 0) {
+            ST_ERROR("Failed to output_gen_path_range.");
+            goto ERR;
+        }
+    }
+
+    safe_st_free(parents);
 
-    // get <unk> root
+    // get <unk> root, skipping the root itself
     output->unk_root = OUTPUT_NODE_NONE;
-    path = output->paths + UNK_ID;
-    if (path->num_node > 0) {
-        for (n = path->num_node - 1; n >= 0; n--) {
-            if (n_children(output->tree, path->nodes[n]) > 1) {
-                break;
-            }
-            output->unk_root = path->nodes[n];
+    for (step = output->steps + output->step_starts[UNK_ID + 1] - 1;
+            step > output->steps + output->step_starts[UNK_ID]; step--) {
+        if (n_children(output->tree, step->node) > 1) {
+            break;
         }
+        output->unk_root = step->node;
     }
 
     return 0;
 
 ERR:
-    safe_st_free(output->paths);
-    safe_output_tree_dfs_aux_destroy(dfs_aux);
+    safe_st_free(parents);
+    safe_st_free(output->steps);
+    safe_st_free(output->step_starts);
     return -1;
 }
 
@@ -2080,7 +2096,7 @@ int output_setup(output_t *output)
 {
     ST_CHECK_PARAM(output == NULL, -1);
 
-    if (output->paths == NULL) {
+    if (output->steps == NULL) {
         if (output_generate_path(output) < 0) {
             ST_ERROR("Failed to output_generate_path.");
             return -1;
@@ -2500,11 +2516,12 @@ int output_draw(output_t *output, FILE *fp, count_t *word_cnts,
     char sym[MAX_SYM_LEN];
     output_tree_dfs_aux_t *dfs_aux = NULL;
     int i;
-    output_node_id_t m, n;
+    output_node_id_t n;
+    size_t s;
 
     ST_CHECK_PARAM(output == NULL || fp == NULL, -1);
 
-    if (output->paths == NULL) {
+    if (output->steps == NULL) {
         if (output_generate_path(output) < 0) {
             ST_ERROR("Failed to output_generate_path.");
             goto ERR;
@@ -2550,12 +2567,14 @@ int output_draw(output_t *output, FILE *fp, count_t *word_cnts,
         }
         fprintf(fp, "|");
 
-        if (output->paths != NULL) {
-            if (output->paths[i].num_node > 0) {
-                for (m = 0; m < output->paths[i].num_node - 1; m++) {
-                    fprintf(fp, OUTPUT_NODE_FMT",", output->paths[i].nodes[m]);
+        if (output->steps != NULL) {
+            /* exclude *root* */
+            for (s = output->step_starts[i] + 1;
+                    s < output->step_starts[i + 1]; s++) {
+                if (s > output->step_starts[i] + 1) {
+                    fprintf(fp, ",");
                 }
-                fprintf(fp, OUTPUT_NODE_FMT, output->paths[i].nodes[m]);
+                fprintf(fp, OUTPUT_NODE_FMT, output->steps[s].node);
             }
         }
         fprintf(fp, "}}\"];\n");
@@ -2661,36 +2680,15 @@ int output_walk_through_path(output_t *output, int word,
             output_node_id_t child_s, output_node_id_t child_e, void *args),
         void *args)
 {
-    output_path_t *path;
-    output_node_id_t node;
-    output_node_id_t next_node;
-    output_node_id_t n;
+    output_step_t *step;
 
     ST_CHECK_PARAM(output == NULL || word < 0, -1);
 
-    path = output->paths + word;
-
-    node = output->tree->root;
-    if (path->num_node > 0) {
-        next_node = path->nodes[0];
-    } else {
-        next_node = output_tree_word2leaf(output->tree, word);
-    }
-    if (walker(output, node, next_node, s_children(output->tree, node),
-                e_children(output->tree, node), args) < 0) {
-        ST_ERROR("Failed to walker. node["OUTPUT_NODE_FMT"]", node);
-        return -1;
-    }
-    for (n = 0; n < path->num_node; n++) {
-        node = path->nodes[n];
-        if (n < path->num_node - 1) {
-            next_node = path->nodes[n + 1];
-        } else {
-            next_node = output_tree_word2leaf(output->tree, word);
-        }
-        if (walker(output, node, next_node, s_children(output->tree, node),
-                    e_children(output->tree, node), args) < 0) {
-            ST_ERROR("Failed to walker. node["OUTPUT_NODE_FMT"]", node);
+    output_path_for_each_step(output, word, step) {
+        if (walker(output, step->node, step->next_node,
+                    step->child_s, step->child_e, args) < 0) {
+            ST_ERROR("Failed to walker. node["OUTPUT_NODE_FMT"]",
+                    step->node);
             return -1;
         }
     }
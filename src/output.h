@@ -32,7 +32,6 @@ extern "C" {
 #include <stutils/st_opt.h>
 #include <stutils/st_int.h>
 #include <stutils/st_alphabet.h>
-#include <stutils/st_queue.h>
 #include <stutils/st_stack.h>
 
 #include <connlm/config.h>
@@ -123,7 +122,8 @@ static inline output_node_id_t output_tree_word2leaf(output_tree_t *tree,
  * @ingroup g_output
  */
 typedef struct _output_tree_bfs_aux_t_ {
-    st_queue_t *node_queue; /**< queue for tree node. */
+    output_node_id_t *node_queue; /**< queue for tree node,
+                                    every node is enqueued only once. */
 } output_tree_bfs_aux_t;
 
 /**
@@ -214,13 +214,15 @@ int output_tree_dfs(output_tree_t *tree, output_tree_dfs_aux_t *dfs_aux,
             st_stack_t* stack, void *args), void *args);
 
 /**
- * Output tree path.
+ * A step on the path from root to a leaf in output tree.
  * @ingroup g_output
  */
-typedef struct _output_tree_path_t_ {
-    output_node_id_t *nodes; /**< nodes on the path. *EXCLUDE* root & leaf. */
-    output_node_id_t num_node; /**< number of nodes in the path. */
-} output_path_t;
+typedef struct _output_step_t_ {
+    output_node_id_t node; /**< the node. */
+    output_node_id_t next_node; /**< child of node on the path. */
+    output_node_id_t child_s; /**< start index of children of node. */
+    output_node_id_t child_e; /**< end index of children of node. */
+} output_step_t;
 
 /**
  * Type of output layer normalization function.
@@ -243,13 +245,34 @@ typedef struct _output_t_ {
     output_norm_t norm; /**< normalization method. */
 
     output_tree_t *tree; /**< output tree. */
-    output_path_t *paths; /**< Store a path for every leaf(word) node. */
+    output_step_t *steps; /**< steps of path for every leaf(word) node,
+                            from root to the parent of leaf. */
+    size_t *step_starts; /**< steps of word i are
+                           [step_starts[i], step_starts[i + 1]). */
     output_node_id_t unk_root; /**< root of subtree with only one path towards \<unk\>. */
 
     output_node_id_t *param_map; /**< map a node to index in param weight(used by Softmax). */
     output_node_id_t num_param_map; /**< number of param maps. */
 } output_t;
 
+/**
+ * Iterate over steps on path from root to word(not including).
+ * @ingroup g_output
+ */
+#define output_path_for_each_step(output, word, step) \
+    for ((step) = (output)->steps + (output)->step_starts[word]; \
+         (step) < (output)->steps + (output)->step_starts[(word) + 1]; \
+         ++(step))
+
+/**
+ * Number of scores computed on a node with children [child_s, child_e).
+ * For Softmax, the last child is implicit, whose score is always zero.
+ * @ingroup g_output
+ */
+#define output_num_scores(output, child_s, child_e) \
+    ((output)->norm == ON_NCE ? (child_e) - (child_s) \
+                              : (child_e) - (child_s) - 1)
+
 /**
  * Load output tree option.
  * @ingroup g_output
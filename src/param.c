@@ -44,6 +44,8 @@ static param_t def_param = {
     .bias_learn_rate_coef = 1.0,
     .momentum_coef = 1.0,
     .bias_momentum_coef = 1.0,
+
+    .sync_size = 0,
 };
 
 void param_show_usage()
@@ -132,6 +134,15 @@ int param_load(param_t *param, st_opt_t *opt, const char *sec_name,
             "Momentum coefficient for bias.");
     param->bias_momentum_coef = (real_t)d;
 
+    ST_OPT_SEC_GET_INT(opt, sec_name, "SYNC_SIZE", param->sync_size,
+            param->sync_size,
+            "Number of mini-batches accumulated in a thread-local buffer "
+            "before merged into the shared weights. "
+            "Zero means updating the shared weights directly (Hogwild).");
+    if (param->sync_size < 0) {
+        ST_ERROR("SYNC_SIZE must not be negative.");
+        goto ST_OPT_ERR;
+    }
 
     return 0;
 ST_OPT_ERR:
@@ -182,6 +193,10 @@ bool param_equal(param_t *param1, param_t *param2)
         return false;
     }
 
+    if (param1->sync_size != param2->sync_size) {
+        return false;
+    }
+
     return true;
 }
 
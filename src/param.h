@@ -53,6 +53,9 @@ typedef struct _param_t_ {
     real_t bias_learn_rate_coef; /**< coefficient of learning rate for bias. */
     real_t momentum_coef; /**< coefficient of momentum for weights. */
     real_t bias_momentum_coef; /**< coefficient of momentum for bias. */
+
+    int sync_size; /**< number of mini-batches accumulated locally in a
+                     thread before merged into the shared weights. */
 } param_t;
 
 /**
@@ -33,15 +33,19 @@
 #include <stutils/st_string.h>
 #include <stutils/st_rand.h>
 #include <stutils/st_io.h>
+#include <stutils/st_utils.h>
 
 #include "utils.h"
 #include "reader.h"
 
+#define READER_RING_SIZE 2 /* number of word pools in ring of a shard. */
+
 void word_pool_destroy(word_pool_t *wp)
 {
     if (wp != NULL) {
         ivec_destroy(&wp->words);
         ivec_destroy(&wp->sent_ends);
+        ivec_destroy(&wp->sent_ids);
         ivec_destroy(&wp->row_starts);
     }
 }
@@ -99,6 +103,11 @@ int word_pool_clear(word_pool_t *wp)
         return -1;
     }
 
+    if (ivec_clear(&wp->sent_ids) < 0) {
+        ST_ERROR("Failed to ivec_clear sent_ids.");
+        return -1;
+    }
+
     if (ivec_clear(&wp->row_starts) < 0) {
         ST_ERROR("Failed to ivec_clear row_starts.");
         return -1;
@@ -154,8 +163,9 @@ int word_pool_build_mini_batch(word_pool_t *wp, int batch_size)
     return 0;
 }
 
-int word_pool_read(word_pool_t *wp, int epoch_size, FILE *text_fp,
-        vocab_t *vocab, int *num_oovs, bool drop_empty_line)
+static int word_pool_read_range(word_pool_t *wp, int epoch_size,
+        FILE *text_fp, off_t end_pos, vocab_t *vocab, int *num_oovs,
+        bool drop_empty_line)
 {
     char *line = NULL;
     size_t line_sz = 0;
@@ -184,7 +194,14 @@ int word_pool_read(word_pool_t *wp, int epoch_size, FILE *text_fp,
     err = false;
     num_sents = 0;
     this_num_oovs = 0;
-    while (st_fgets(&line, &line_sz, text_fp, &err)) {
+    while (true) {
+        if (end_pos >= 0 && ftello(text_fp) >= end_pos) {
+            break;
+        }
+
+        if (! st_fgets(&line, &line_sz, text_fp, &err)) {
+            break;
+        }
         remove_newline(line);
 
         if (line[0] == '\0' && drop_empty_line) {
@@ -278,6 +295,13 @@ ERR:
     return -1;
 }
 
+int word_pool_read(word_pool_t *wp, int epoch_size, FILE *text_fp,
+        vocab_t *vocab, int *num_oovs, bool drop_empty_line)
+{
+    return word_pool_read_range(wp, epoch_size, text_fp, -1, vocab,
+            num_oovs, drop_empty_line);
+}
+
 int word_pool_resize_as(word_pool_t *dst_wp, word_pool_t *src_wp)
 {
     ST_CHECK_PARAM(dst_wp == NULL || src_wp == NULL, -1);
@@ -292,6 +316,11 @@ int word_pool_resize_as(word_pool_t *dst_wp, word_pool_t *src_wp)
         return -1;
     }
 
+    if (ivec_resize(&dst_wp->sent_ids, src_wp->sent_ends.size) < 0) {
+        ST_ERROR("Failed to ivec_resize sent_ids.");
+        return -1;
+    }
+
     if (ivec_resize(&dst_wp->row_starts, src_wp->row_starts.size) < 0) {
         ST_ERROR("Failed to ivec_resize row_starts.");
         return -1;
@@ -316,9 +345,28 @@ int word_pool_copy(word_pool_t *dst_wp, word_pool_t *src_wp)
         }
     }
 
-    if (ivec_cpy(&dst_wp->row_starts, &src_wp->row_starts) < 0) {
-        ST_ERROR("Failed to ivec_cpy row_starts.");
-        return -1;
+    if (src_wp->sent_ids.size > 0) {
+        if (ivec_cpy(&dst_wp->sent_ids, &src_wp->sent_ids) < 0) {
+            ST_ERROR("Failed to ivec_cpy sent_ids.");
+            return -1;
+        }
+    } else {
+        if (ivec_clear(&dst_wp->sent_ids) < 0) {
+            ST_ERROR("Failed to ivec_clear sent_ids.");
+            return -1;
+        }
+    }
+
+    if (src_wp->row_starts.size > 0) {
+        if (ivec_cpy(&dst_wp->row_starts, &src_wp->row_starts) < 0) {
+            ST_ERROR("Failed to ivec_cpy row_starts.");
+            return -1;
+        }
+    } else {
+        if (ivec_clear(&dst_wp->row_starts) < 0) {
+            ST_ERROR("Failed to ivec_clear row_starts.");
+            return -1;
+        }
     }
 
     return 0;
@@ -338,6 +386,11 @@ int word_pool_swap(word_pool_t *wp1, word_pool_t *wp2)
         return -1;
     }
 
+    if (ivec_swap(&wp1->sent_ids, &wp2->sent_ids) < 0) {
+        ST_ERROR("Failed to ivec_swap sent_ids.");
+        return -1;
+    }
+
     if (ivec_swap(&wp1->row_starts, &wp2->row_starts) < 0) {
         ST_ERROR("Failed to ivec_swap row_starts.");
         return -1;
@@ -346,6 +399,207 @@ int word_pool_swap(word_pool_t *wp1, word_pool_t *wp2)
     return 0;
 }
 
+typedef struct _wp_sent_len_t_ {
+    int id; /**< index of sentence in word pool. */
+    int len; /**< number of words in sentence. */
+} wp_sent_len_t;
+
+static int wp_sent_len_comp(const void *elem1, const void *elem2, void *args)
+{
+    wp_sent_len_t *f = (wp_sent_len_t *)elem1;
+    wp_sent_len_t *s = (wp_sent_len_t *)elem2;
+
+    if (f->len < s->len) return  1;
+    if (f->len > s->len) return -1;
+    return f->id - s->id;
+}
+
+/* whether row r1 is less loaded than row r2, break ties with row index. */
+#define wp_row_less(loads, r1, r2) ((loads)[r1] < (loads)[r2] \
+        || ((loads)[r1] == (loads)[r2] && (r1) < (r2)))
+
+static void wp_row_heap_down(int *heap, int *loads, int n, int i)
+{
+    int c, r;
+
+    r = heap[i];
+    while ((c = 2 * i + 1) < n) {
+        if (c + 1 < n && wp_row_less(loads, heap[c + 1], heap[c])) {
+            c++;
+        }
+        if (! wp_row_less(loads, heap[c], r)) {
+            break;
+        }
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = r;
+}
+
+int word_pool_pack_mini_batch(word_pool_t *dst_wp, word_pool_t *src_wp,
+        int batch_size)
+{
+    wp_sent_len_t *sents = NULL;
+    int *rows = NULL;
+    int *loads = NULL;
+    int *heap = NULL;
+    int *order = NULL;
+
+    int num_sents;
+    int i, r, s, start;
+
+    ST_CHECK_PARAM(dst_wp == NULL || src_wp == NULL || batch_size < 1, -1);
+
+    num_sents = src_wp->sent_ends.size;
+    if (num_sents <= batch_size) {
+        /* nothing to balance, keep one sentence per row in order. */
+        if (word_pool_clear(dst_wp) < 0) {
+            ST_ERROR("Failed to word_pool_clear.");
+            goto ERR;
+        }
+        if (word_pool_copy(dst_wp, src_wp) < 0) {
+            ST_ERROR("Failed to word_pool_copy.");
+            goto ERR;
+        }
+        if (word_pool_build_mini_batch(dst_wp, batch_size) < 0) {
+            ST_ERROR("Failed to word_pool_build_mini_batch.");
+            goto ERR;
+        }
+        return 0;
+    }
+
+    sents = (wp_sent_len_t *)st_malloc(sizeof(wp_sent_len_t) * num_sents);
+    if (sents == NULL) {
+        ST_ERROR("Failed to st_malloc sents.");
+        goto ERR;
+    }
+    rows = (int *)st_malloc(sizeof(int) * num_sents);
+    if (rows == NULL) {
+        ST_ERROR("Failed to st_malloc rows.");
+        goto ERR;
+    }
+    order = (int *)st_malloc(sizeof(int) * num_sents);
+    if (order == NULL) {
+        ST_ERROR("Failed to st_malloc order.");
+        goto ERR;
+    }
+    loads = (int *)st_malloc(sizeof(int) * (batch_size + 1));
+    if (loads == NULL) {
+        ST_ERROR("Failed to st_malloc loads.");
+        goto ERR;
+    }
+    heap = (int *)st_malloc(sizeof(int) * batch_size);
+    if (heap == NULL) {
+        ST_ERROR("Failed to st_malloc heap.");
+        goto ERR;
+    }
+
+    start = 0;
+    for (s = 0; s < num_sents; s++) {
+        sents[s].id = s;
+        sents[s].len = VEC_VAL(&src_wp->sent_ends, s) - start;
+        start = VEC_VAL(&src_wp->sent_ends, s);
+    }
+    st_qsort(sents, num_sents, sizeof(wp_sent_len_t),
+            wp_sent_len_comp, NULL);
+
+    /* longest sentence first, each into the least loaded row. */
+    for (r = 0; r < batch_size; r++) {
+        loads[r] = 0;
+        heap[r] = r;
+    }
+    for (i = 0; i < num_sents; i++) {
+        r = heap[0];
+        rows[sents[i].id] = r;
+        loads[r] += sents[i].len;
+        wp_row_heap_down(heap, loads, batch_size, 0);
+    }
+
+    /* group sentences by row, keeping their order inside a row.
+     * reuse loads as the number of sentences before each row. */
+    for (r = 0; r <= batch_size; r++) {
+        loads[r] = 0;
+    }
+    for (s = 0; s < num_sents; s++) {
+        loads[rows[s] + 1]++;
+    }
+    for (r = 0; r < batch_size; r++) {
+        loads[r + 1] += loads[r];
+    }
+    for (s = 0; s < num_sents; s++) {
+        order[loads[rows[s]]++] = s;
+    }
+
+    if (word_pool_clear(dst_wp) < 0) {
+        ST_ERROR("Failed to word_pool_clear.");
+        goto ERR;
+    }
+    if (ivec_reserve(&dst_wp->words, src_wp->words.size) < 0) {
+        ST_ERROR("Failed to ivec_reserve words.");
+        goto ERR;
+    }
+    if (ivec_reserve(&dst_wp->sent_ends, num_sents) < 0) {
+        ST_ERROR("Failed to ivec_reserve sent_ends.");
+        goto ERR;
+    }
+    if (ivec_reserve(&dst_wp->sent_ids, num_sents) < 0) {
+        ST_ERROR("Failed to ivec_reserve sent_ids.");
+        goto ERR;
+    }
+    if (ivec_reserve(&dst_wp->row_starts, batch_size + 1) < 0) {
+        ST_ERROR("Failed to ivec_reserve row_starts.");
+        goto ERR;
+    }
+    if (ivec_append(&dst_wp->row_starts, 0) < 0) {
+        ST_ERROR("Failed to ivec_append first row_start.");
+        goto ERR;
+    }
+
+    for (i = 0; i < num_sents; i++) {
+        s = order[i];
+        start = (s == 0) ? 0 : VEC_VAL(&src_wp->sent_ends, s - 1);
+        if (ivec_extend(&dst_wp->words, &src_wp->words, start,
+                    VEC_VAL(&src_wp->sent_ends, s)) < 0) {
+            ST_ERROR("Failed to ivec_extend words.");
+            goto ERR;
+        }
+        if (ivec_append(&dst_wp->sent_ends, dst_wp->words.size) < 0) {
+            ST_ERROR("Failed to ivec_append sent_ends.");
+            goto ERR;
+        }
+        if (src_wp->sent_ids.size > 0) {
+            if (ivec_append(&dst_wp->sent_ids,
+                        VEC_VAL(&src_wp->sent_ids, s)) < 0) {
+                ST_ERROR("Failed to ivec_append sent_ids.");
+                goto ERR;
+            }
+        }
+        if (i == num_sents - 1 || rows[order[i + 1]] != rows[s]) {
+            if (ivec_append(&dst_wp->row_starts, dst_wp->words.size) < 0) {
+                ST_ERROR("Failed to ivec_append mid row_starts.");
+                goto ERR;
+            }
+        }
+    }
+
+    safe_st_free(sents);
+    safe_st_free(rows);
+    safe_st_free(order);
+    safe_st_free(loads);
+    safe_st_free(heap);
+
+    return 0;
+
+ERR:
+    safe_st_free(sents);
+    safe_st_free(rows);
+    safe_st_free(order);
+    safe_st_free(loads);
+    safe_st_free(heap);
+
+    return -1;
+}
+
 int word_pool_pop(word_pool_t *wp)
 {
     int word;
@@ -404,15 +658,52 @@ int word_pool_append_ivec(word_pool_t *wp, ivec_t *words)
     return 0;
 }
 
+static void reader_shard_destroy(reader_shard_t *shard)
+{
+    int i;
+
+    if (shard == NULL) {
+        return;
+    }
+
+    if (shard->ring != NULL) {
+        for (i = 0; i < shard->ring_size; i++) {
+            word_pool_destroy(shard->ring + i);
+        }
+        safe_st_free(shard->ring);
+        (void)st_sem_destroy(&shard->sem_full);
+        (void)st_sem_destroy(&shard->sem_empty);
+    }
+    shard->ring_size = 0;
+
+    if (shard->pending != NULL) {
+        safe_st_free(shard->pending);
+        (void)pthread_mutex_destroy(&shard->pos_lock);
+    }
+    shard->num_pending = 0;
+    shard->cap_pending = 0;
+}
+
 void reader_destroy(reader_t *reader)
 {
     word_pool_t *p;
     word_pool_t *q;
+    int i;
 
     if (reader == NULL) {
         return;
     }
 
+    if (reader->shards != NULL) {
+        for (i = 0; i < reader->num_shards; i++) {
+            reader_shard_destroy(reader->shards + i);
+        }
+        safe_st_free(reader->shards);
+    }
+    reader->num_shards = 0;
+    safe_st_free(reader->resume_poses);
+    reader->num_resume_poses = 0;
+
     p = reader->full_wp_head;
     while (p != NULL) {
         q = p;
@@ -441,6 +732,8 @@ void reader_destroy(reader_t *reader)
 
     safe_fclose(reader->fp_debug);
     (void)pthread_mutex_destroy(&reader->fp_debug_lock);
+
+    safe_corpus_destroy(reader->corpus);
 }
 
 int reader_load_opt(reader_opt_t *reader_opt,
@@ -478,6 +771,11 @@ int reader_load_opt(reader_opt_t *reader_opt,
         goto ST_OPT_ERR;
     }
 
+    ST_OPT_SEC_GET_BOOL(opt, name, "PACK_MINI_BATCH",
+            reader_opt->pack_mini_batch, false,
+            "Pack sentences into rows of mini-batch with near-equal "
+            "number of words, instead of equal number of sentences.");
+
     ST_OPT_SEC_GET_BOOL(opt, name, "SHUFFLE",
             reader_opt->shuffle, true, "Shuffle after reading");
 
@@ -485,6 +783,11 @@ int reader_load_opt(reader_opt_t *reader_opt,
             reader_opt->drop_empty_line, true,
             "whether drop empty lines in text");
 
+    ST_OPT_SEC_GET_BOOL(opt, name, "SHARD",
+            reader_opt->shard, false,
+            "Split text into shards, one for each thread, and read them "
+            "with separate threads.");
+
     ST_OPT_SEC_GET_STR(opt, name, "DEBUG_FILE",
             reader_opt->debug_file, MAX_DIR_LEN, "",
             "file to print out debug infos.");
@@ -516,11 +819,26 @@ reader_t* reader_create(reader_opt_t *opt, int num_thrs,
 
     reader->opt = *opt;
     reader->num_thrs = num_thrs;
+    reader->part = 0;
+    reader->num_parts = 1;
     reader->vocab = vocab;
     strncpy(reader->text_file, text_file, MAX_DIR_LEN);
     reader->text_file[MAX_DIR_LEN - 1] = '\0';
 
-    pool_size = 2 * num_thrs;
+    if (corpus_is_compiled(text_file)) {
+        reader->corpus = corpus_open(text_file, vocab);
+        if (reader->corpus == NULL) {
+            ST_ERROR("Failed to corpus_open[%s].", text_file);
+            goto ERR;
+        }
+    }
+
+    if (opt->shard) {
+        /* word pools are held in rings of shards. */
+        pool_size = 0;
+    } else {
+        pool_size = 2 * num_thrs;
+    }
     reader->full_wp_head = NULL;
     reader->full_wp_tail = NULL;
     reader->empty_wps = NULL;;
@@ -575,128 +893,377 @@ ERR:
     return NULL;
 }
 
-static void* reader_read_thread(void *args)
+static word_pool_t* reader_acquire_empty_wp(reader_shard_t *shard)
 {
     reader_t *reader;
-    thr_stat_t *stats;
-
-    FILE *text_fp = NULL;
-    int *shuffle_buf = NULL;
-    off_t fsize;
+    word_pool_t *wp;
 
-    word_pool_t wp = WORD_POOL_INITIALIZER;
-    int num_thrs;
-    int epoch_size, mini_batch;
+    reader = shard->reader;
 
-    word_pool_t *wp_in_queue;
-    int num_sents;
-    int num_oovs;
-    int i;
-    int start;
-    int end;
-    int num_reads;
+    if (reader->opt.shard) {
+        if (st_sem_wait(&shard->sem_empty) != 0) {
+            ST_ERROR("Failed to st_sem_wait sem_empty.");
+            return NULL;
+        }
 
-    count_t total_words;
-    count_t total_sents;
-    double logp;
-    struct timeval tts, tte;
-    long ms = 0;
-#ifdef _TIME_PROF_
-    struct timeval tts_io, tte_io;
-    long ms_io = 0;
-    struct timeval tts_shuf, tte_shuf;
-    long ms_shuf = 0;
-    struct timeval tts_lock, tte_lock;
-    long ms_lock = 0;
-    struct timeval tts_fill, tte_fill;
-    long ms_fill = 0;
-#endif
+        /* only producer modifies tail. */
+        wp = shard->ring + shard->tail;
+        shard->tail = (shard->tail + 1) % shard->ring_size;
 
-    ST_CHECK_PARAM(args == NULL, NULL);
+        return wp;
+    }
 
-    reader = (reader_t *)args;
-    stats = reader->stats;
-    num_thrs = reader->num_thrs;
-    epoch_size = reader->opt.epoch_size;
-    mini_batch = reader->opt.mini_batch;
+    if (st_sem_wait(&reader->sem_empty) != 0) {
+        ST_ERROR("Failed to st_sem_wait sem_empty.");
+        return NULL;
+    }
 
-    if (reader->opt.shuffle) {
-        shuffle_buf = (int *)st_malloc(sizeof(int) * epoch_size);
-        if (shuffle_buf == NULL) {
-            ST_ERROR("Failed to st_malloc shuffle_buf");
-            goto ERR;
-        }
+    if (pthread_mutex_lock(&reader->empty_wp_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock empty_wp_lock.");
+        return NULL;
+    }
+    wp = reader->empty_wps;
+    reader->empty_wps = reader->empty_wps->next;
+    if (pthread_mutex_unlock(&reader->empty_wp_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock empty_wp_lock.");
+        return NULL;
     }
 
-    fsize = st_fsize(reader->text_file);
+    return wp;
+}
 
-    text_fp = st_fopen(reader->text_file, "rb");
-    if (text_fp == NULL) {
-        ST_ERROR("Failed to open text file[%s]", reader->text_file);
-        goto ERR;
-    }
+/* start_pos is where wp read from, and next_pos where the next one
+ * would be read from. They are updated together, so that a position got
+ * at any time covers every word pool not released. */
+static int reader_shard_keep_pos(reader_shard_t *shard, word_pool_t *wp,
+        reader_pos_t *start_pos, reader_pos_t *next_pos)
+{
+    int cap;
 
-    num_reads = 0;
-    reader->num_oovs = 0;
-    reader->num_sents = 0;
-    reader->num_words = 0;
-    gettimeofday(&tts, NULL);
-    while (!feof(text_fp)) {
-        if (*(reader->err) != 0) {
-            break;
+    if (pthread_mutex_lock(&shard->pos_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock pos_lock.");
+        return -1;
+    }
+    if (shard->num_pending >= shard->cap_pending) {
+        cap = 2 * shard->cap_pending;
+        shard->pending = (word_pool_t **)st_realloc(shard->pending,
+                sizeof(word_pool_t *) * cap);
+        if (shard->pending == NULL) {
+            (void)pthread_mutex_unlock(&shard->pos_lock);
+            ST_ERROR("Failed to st_realloc pending.");
+            return -1;
         }
+        shard->cap_pending = cap;
+    }
+    wp->start_pos = *start_pos;
+    shard->pending[shard->num_pending] = wp;
+    shard->num_pending++;
+    shard->next_pos = *next_pos;
+    if (pthread_mutex_unlock(&shard->pos_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock pos_lock.");
+        return -1;
+    }
 
-#ifdef _TIME_PROF_
-        gettimeofday(&tts_io, NULL);
-#endif
-        num_sents = word_pool_read(&wp, epoch_size, text_fp,
-                reader->vocab, &num_oovs, reader->opt.drop_empty_line);
-        if (num_sents < 0) {
-            ST_ERROR("Failed to word_pool_read.");
-            goto ERR;
-        }
-#ifdef _TIME_PROF_
-        gettimeofday(&tte_io, NULL);
-#endif
-        if (num_sents == 0) {
-            continue;
-        }
+    return 0;
+}
 
-        reader->num_oovs += num_oovs;
-        reader->num_sents += num_sents;
-        reader->num_words += wp.words.size - num_sents; // Do not accumulate \<s\>
+static int reader_publish_full_wp(reader_shard_t *shard, word_pool_t *wp,
+        reader_pos_t *start_pos, reader_pos_t *next_pos)
+{
+    reader_t *reader;
 
-#ifdef _TIME_PROF_
-        gettimeofday(&tts_shuf, NULL);
-#endif
-        if (shuffle_buf != NULL) {
-            for (i = 0; i < num_sents; i++) {
-                shuffle_buf[i] = i;
-            }
+    reader = shard->reader;
 
-            st_shuffle_r(shuffle_buf, num_sents, &reader->random);
+    if (reader->keep_poses) {
+        if (reader_shard_keep_pos(shard, wp, start_pos, next_pos) < 0) {
+            ST_ERROR("Failed to reader_shard_keep_pos.");
+            return -1;
         }
-#ifdef _TIME_PROF_
-        gettimeofday(&tte_shuf, NULL);
-#endif
-
+    }
 
-#ifdef _TIME_PROF_
-        gettimeofday(&tts_lock, NULL);
-#endif
-        if (st_sem_wait(&reader->sem_empty) != 0) {
-            ST_ERROR("Failed to st_sem_wait sem_empty.");
-            goto ERR;
+    if (reader->opt.shard) {
+        shard->num_filled++;
+        if (st_sem_post(&shard->sem_full) != 0) {
+            ST_ERROR("Failed to st_sem_post sem_full.");
+            return -1;
         }
 
-        if (pthread_mutex_lock(&reader->empty_wp_lock) != 0) {
-            ST_ERROR("Failed to pthread_mutex_lock empty_wp_lock.");
-            goto ERR;
-        }
-        wp_in_queue = reader->empty_wps;
-        reader->empty_wps = reader->empty_wps->next;
-        if (pthread_mutex_unlock(&reader->empty_wp_lock) != 0) {
-            ST_ERROR("Failed to pthread_mutex_unlock empty_wp_lock.");
+        return 0;
+    }
+
+    if (pthread_mutex_lock(&reader->full_wp_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock full_wp_lock.");
+        return -1;
+    }
+    wp->next = NULL;
+    if (reader->full_wp_tail != NULL) {
+        reader->full_wp_tail->next = wp;
+    }
+    reader->full_wp_tail = wp;
+    if (reader->full_wp_head == NULL) {
+        reader->full_wp_head = wp;
+    }
+    if (pthread_mutex_unlock(&reader->full_wp_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock full_wp_lock.");
+        return -1;
+    }
+    if (st_sem_post(&reader->sem_full) != 0) {
+        ST_ERROR("Failed to st_sem_post sem_full.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int reader_finish_shard(reader_shard_t *shard)
+{
+    reader_t *reader;
+    int i;
+
+    reader = shard->reader;
+
+    if (reader->opt.shard) {
+        /* posting semaphore without filling data indicates finish. */
+        if (st_sem_post(&shard->sem_full) != 0) {
+            ST_ERROR("Failed to st_sem_post sem_full.");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    for (i = 0; i < reader->num_thrs; i++) {
+        /* posting semaphore without adding data indicates finish. */
+        if (st_sem_post(&reader->sem_full) != 0) {
+            ST_ERROR("Failed to st_sem_post sem_full.");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static FILE* reader_open_shard(reader_shard_t *shard, off_t start)
+{
+    FILE *text_fp = NULL;
+    int c;
+
+    text_fp = st_fopen(shard->reader->text_file, "rb");
+    if (text_fp == NULL) {
+        ST_ERROR("Failed to open text file[%s]", shard->reader->text_file);
+        return NULL;
+    }
+
+    if (start > 0) {
+        /* align to the beginning of the first line starting at or after
+         * start, the previous line belongs to previous shard. */
+        if (fseeko(text_fp, start - 1, SEEK_SET) != 0) {
+            ST_ERROR("Failed to fseeko to [%lld].", (long long)start);
+            safe_fclose(text_fp);
+            return NULL;
+        }
+
+        while ((c = fgetc(text_fp)) != EOF) {
+            if (c == '\n') {
+                break;
+            }
+        }
+    }
+
+    return text_fp;
+}
+
+static bool reader_shard_eof(reader_shard_t *shard, FILE *text_fp,
+        int64_t sent_pos)
+{
+    if (shard->reader->corpus != NULL) {
+        return sent_pos >= shard->end;
+    }
+
+    if (feof(text_fp)) {
+        return true;
+    }
+
+    return shard->end >= 0 && ftello(text_fp) >= shard->end;
+}
+
+static void reader_shard_get_pos(reader_shard_t *shard, FILE *text_fp,
+        int64_t sent_pos, reader_pos_t *pos)
+{
+    if (shard->reader->corpus != NULL) {
+        pos->pos = sent_pos;
+    } else {
+        pos->pos = (int64_t)ftello(text_fp);
+    }
+    pos->random = shard->random;
+    pos->num_sents = shard->num_sents;
+    pos->num_words = shard->num_words;
+    pos->num_oovs = shard->num_oovs;
+}
+
+static void* reader_read_thread(void *args)
+{
+    reader_shard_t *shard;
+    reader_t *reader;
+    thr_stat_t *stats;
+
+    FILE *text_fp = NULL;
+    int *shuffle_buf = NULL;
+    int64_t sent_pos;
+    double progress;
+
+    word_pool_t wp = WORD_POOL_INITIALIZER;
+    word_pool_t pack_wp = WORD_POOL_INITIALIZER;
+    int num_thrs;
+    int epoch_size, mini_batch;
+    int print_interval;
+
+    word_pool_t *wp_in_queue;
+    reader_pos_t start_pos;
+    reader_pos_t next_pos;
+    int num_sents;
+    int first_id;
+    int num_oovs;
+    int i;
+    int start;
+    int end;
+    int num_reads;
+
+    count_t total_words;
+    count_t total_sents;
+    count_t total_oovs;
+    double logp;
+    struct timeval tts, tte;
+    long ms = 0;
+#ifdef _TIME_PROF_
+    struct timeval tts_io, tte_io;
+    long ms_io = 0;
+    struct timeval tts_shuf, tte_shuf;
+    long ms_shuf = 0;
+    struct timeval tts_lock, tte_lock;
+    long ms_lock = 0;
+    struct timeval tts_fill, tte_fill;
+    long ms_fill = 0;
+#endif
+
+    ST_CHECK_PARAM(args == NULL, NULL);
+
+    shard = (reader_shard_t *)args;
+    reader = shard->reader;
+    stats = reader->stats;
+    num_thrs = reader->num_thrs;
+    epoch_size = reader->opt.epoch_size;
+    mini_batch = reader->opt.mini_batch;
+    /* in sharded mode, shard 0 prints progress every time it read,
+     * since all shards are reading at the same pace. */
+    print_interval = reader->opt.shard ? 1 : num_thrs;
+
+    if (reader->opt.shuffle) {
+        shuffle_buf = (int *)st_malloc(sizeof(int) * epoch_size);
+        if (shuffle_buf == NULL) {
+            ST_ERROR("Failed to st_malloc shuffle_buf");
+            goto ERR;
+        }
+    }
+
+    if (reader->corpus == NULL) {
+        text_fp = reader_open_shard(shard, shard->resume
+                ? (off_t)shard->resume_pos.pos : shard->start);
+        if (text_fp == NULL) {
+            ST_ERROR("Failed to reader_open_shard.");
+            goto ERR;
+        }
+    }
+
+    sent_pos = shard->start;
+    num_reads = 0;
+    shard->num_oovs = 0;
+    shard->num_sents = 0;
+    shard->num_words = 0;
+    if (shard->resume) {
+        if (reader->corpus != NULL) {
+            sent_pos = shard->resume_pos.pos;
+        }
+        shard->random = shard->resume_pos.random;
+        shard->num_oovs = shard->resume_pos.num_oovs;
+        shard->num_sents = shard->resume_pos.num_sents;
+        shard->num_words = shard->resume_pos.num_words;
+    }
+    gettimeofday(&tts, NULL);
+    while (true) {
+        if (*(reader->err) != 0) {
+            break;
+        }
+
+        /* word pools are read in whole lines, and shuffled with the
+         * seed kept here, so that reading from start_pos reproduces
+         * the same word pool. */
+        reader_shard_get_pos(shard, text_fp, sent_pos, &start_pos);
+
+        if (reader_shard_eof(shard, text_fp, sent_pos)) {
+            break;
+        }
+
+#ifdef _TIME_PROF_
+        gettimeofday(&tts_io, NULL);
+#endif
+        if (reader->corpus != NULL) {
+            /* wp.words points into the mapped corpus directly. */
+            num_sents = corpus_read(reader->corpus, &sent_pos,
+                    (int)min((int64_t)epoch_size, shard->end - sent_pos),
+                    &wp.words, &wp.sent_ends, &num_oovs);
+            if (num_sents < 0) {
+                ST_ERROR("Failed to corpus_read.");
+                goto ERR;
+            }
+            if (num_sents > 0) {
+                if (word_pool_build_mini_batch(&wp, 1) < 0) {
+                    ST_ERROR("Failed to word_pool_build_mini_batch.");
+                    goto ERR;
+                }
+            }
+        } else {
+            num_sents = word_pool_read_range(&wp, epoch_size, text_fp,
+                    shard->end, reader->vocab, &num_oovs,
+                    reader->opt.drop_empty_line);
+            if (num_sents < 0) {
+                ST_ERROR("Failed to word_pool_read_range.");
+                goto ERR;
+            }
+        }
+#ifdef _TIME_PROF_
+        gettimeofday(&tte_io, NULL);
+#endif
+        if (num_sents == 0) {
+            continue;
+        }
+
+        first_id = (int)shard->num_sents;
+        shard->num_oovs += num_oovs;
+        shard->num_sents += num_sents;
+        shard->num_words += wp.words.size - num_sents; // Do not accumulate \<s\>
+
+#ifdef _TIME_PROF_
+        gettimeofday(&tts_shuf, NULL);
+#endif
+        if (shuffle_buf != NULL) {
+            for (i = 0; i < num_sents; i++) {
+                shuffle_buf[i] = i;
+            }
+
+            st_shuffle_r(shuffle_buf, num_sents, &shard->random);
+        }
+#ifdef _TIME_PROF_
+        gettimeofday(&tte_shuf, NULL);
+#endif
+
+
+#ifdef _TIME_PROF_
+        gettimeofday(&tts_lock, NULL);
+#endif
+        wp_in_queue = reader_acquire_empty_wp(shard);
+        if (wp_in_queue == NULL) {
+            ST_ERROR("Failed to reader_acquire_empty_wp.");
             goto ERR;
         }
 #ifdef _TIME_PROF_
@@ -733,41 +1300,49 @@ static void* reader_read_thread(void *args)
                     ST_ERROR("Failed to ivec_append wp_in_queue->sent_ends.");
                     goto ERR;
                 }
+                if (ivec_append(&wp_in_queue->sent_ids,
+                            first_id + shuffle_buf[i]) < 0) {
+                    ST_ERROR("Failed to ivec_append wp_in_queue->sent_ids.");
+                    goto ERR;
+                }
             }
         } else {
             if (word_pool_copy(wp_in_queue, &wp) < 0) {
                 ST_ERROR("Failed to word_pool_copy wp into wp_in_queue.");
                 goto ERR;
             }
+            for (i = 0; i < num_sents; i++) {
+                if (ivec_append(&wp_in_queue->sent_ids, first_id + i) < 0) {
+                    ST_ERROR("Failed to ivec_append wp_in_queue->sent_ids.");
+                    goto ERR;
+                }
+            }
         }
 
-        if (word_pool_build_mini_batch(wp_in_queue, mini_batch) < 0) {
-            ST_ERROR("Failed to word_pool_build_mini_batch.");
-            goto ERR;
+        if (reader->opt.pack_mini_batch && mini_batch > 1) {
+            if (word_pool_swap(&pack_wp, wp_in_queue) < 0) {
+                ST_ERROR("Failed to word_pool_swap.");
+                goto ERR;
+            }
+            if (word_pool_pack_mini_batch(wp_in_queue, &pack_wp,
+                        mini_batch) < 0) {
+                ST_ERROR("Failed to word_pool_pack_mini_batch.");
+                goto ERR;
+            }
+        } else {
+            if (word_pool_build_mini_batch(wp_in_queue, mini_batch) < 0) {
+                ST_ERROR("Failed to word_pool_build_mini_batch.");
+                goto ERR;
+            }
         }
 #ifdef _TIME_PROF_
         gettimeofday(&tte_fill, NULL);
 #endif
 
-        if (pthread_mutex_lock(&reader->full_wp_lock) != 0) {
-            ST_ERROR("Failed to pthread_mutex_lock full_wp_lock.");
-            goto ERR;
-        }
-        wp_in_queue->next = NULL;
-        if (reader->full_wp_tail != NULL) {
-            reader->full_wp_tail->next = wp_in_queue;
-        }
-        reader->full_wp_tail = wp_in_queue;
-        if (reader->full_wp_head == NULL) {
-            reader->full_wp_head = wp_in_queue;
-        }
-        //ST_DEBUG("IN: %p, %d", wp_in_queue, wp_in_queue->size);
-        if (pthread_mutex_unlock(&reader->full_wp_lock) != 0) {
-            ST_ERROR("Failed to pthread_mutex_unlock full_wp_lock.");
-            goto ERR;
-        }
-        if (st_sem_post(&reader->sem_full) != 0) {
-            ST_ERROR("Failed to st_sem_post sem_full.");
+        reader_shard_get_pos(shard, text_fp, sent_pos, &next_pos);
+        if (reader_publish_full_wp(shard, wp_in_queue,
+                    &start_pos, &next_pos) < 0) {
+            ST_ERROR("Failed to reader_publish_full_wp.");
             goto ERR;
         }
 
@@ -778,15 +1353,19 @@ static void* reader_read_thread(void *args)
         ms_shuf += TIMEDIFF(tts_shuf, tte_shuf);
         ms_lock += TIMEDIFF(tts_lock, tte_lock);
         ms_fill += TIMEDIFF(tts_fill, tte_fill);
-        ST_TRACE("Time: %.3fs, I/O: %.3f(%.2f%%), Shuf: %.3f(%.2f%%), Lock: %.3f(%.2f%%), Fill: %.3f(%.2f%%)",
-                ms / 1000.0, ms_io / 1000.0, ms_io / (ms / 100.0),
+        ST_TRACE("Shard: %d, Time: %.3fs, I/O: %.3f(%.2f%%), Shuf: %.3f(%.2f%%), Lock: %.3f(%.2f%%), Fill: %.3f(%.2f%%)",
+                shard->id, ms / 1000.0, ms_io / 1000.0, ms_io / (ms / 100.0),
                 ms_shuf / 1000.0, ms_shuf / (ms / 100.0),
                 ms_lock / 1000.0, ms_lock / (ms / 100.0),
                 ms_fill / 1000.0, ms_fill / (ms / 100.0));
 #endif
 
+        if (shard->id != 0) {
+            continue;
+        }
+
         num_reads++;
-        if (num_reads >= num_thrs) {
+        if (num_reads >= print_interval) {
             num_reads = 0;
 
             total_words = 0;
@@ -797,18 +1376,32 @@ static void* reader_read_thread(void *args)
                 total_sents += stats[i].num_sents;
                 logp += stats[i].logp;
             }
+            total_oovs = 0;
+            for (i = 0; i < reader->num_shards; i++) {
+                total_oovs += reader->shards[i].num_oovs;
+            }
 
             if (total_words > 0) {
                 gettimeofday(&tte, NULL);
                 ms = TIMEDIFF(tts, tte);
 
-                if (fsize > 0) {
+                if (reader->corpus != NULL) {
+                    progress = (sent_pos - shard->start)
+                        / ((shard->end - shard->start) / 100.0);
+                } else if (shard->end > shard->start) {
+                    progress = (ftello(text_fp) - shard->start)
+                        / ((shard->end - shard->start) / 100.0);
+                } else {
+                    progress = -1.0;
+                }
+
+                if (progress >= 0.0) {
                     ST_TRACE("Total progress: %.2f%%. "
                             "Words: " COUNT_FMT ", Sentences: " COUNT_FMT
                             ", OOVs: " COUNT_FMT ", words/sec: %.1f, "
                             "LogP: %f, Entropy: %f, PPL: %f, Time: %.3fs",
-                            ftell(text_fp) / (fsize / 100.0),
-                            total_words, total_sents, reader->num_oovs,
+                            progress,
+                            total_words, total_sents, total_oovs,
                             total_words / ((double) ms / 1000.0),
                             logp, -logp / log(2) / total_words,
                             exp(-logp / (double) total_words),
@@ -817,7 +1410,7 @@ static void* reader_read_thread(void *args)
                     ST_TRACE("Words: " COUNT_FMT ", Sentences: " COUNT_FMT
                             ", OOVs: " COUNT_FMT ", words/sec: %.1f, "
                             "LogP: %f, Entropy: %f, PPL: %f, Time: %.3fs",
-                            total_words, total_sents, reader->num_oovs,
+                            total_words, total_sents, total_oovs,
                             total_words / ((double) ms / 1000.0),
                             logp, -logp / log(2) / total_words,
                             exp(-logp / (double) total_words),
@@ -827,15 +1420,17 @@ static void* reader_read_thread(void *args)
         }
     }
 
-    for (i = 0; i < num_thrs; i++) {
-        /* posting semaphore without adding data indicates finish. */
-        if (st_sem_post(&reader->sem_full) != 0) {
-            ST_ERROR("Failed to st_sem_post sem_full.");
-            goto ERR;
-        }
+    if (reader_finish_shard(shard) < 0) {
+        ST_ERROR("Failed to reader_finish_shard.");
+        goto ERR;
     }
 
+    if (reader->corpus != NULL) {
+        /* words point into the mapped corpus, do not free it. */
+        memset(&wp.words, 0, sizeof(ivec_t));
+    }
     word_pool_destroy(&wp);
+    word_pool_destroy(&pack_wp);
     safe_fclose(text_fp);
     safe_st_free(shuffle_buf);
 
@@ -844,80 +1439,275 @@ static void* reader_read_thread(void *args)
 ERR:
     *(reader->err) = -1;
 
+    if (reader->corpus != NULL) {
+        /* words point into the mapped corpus, do not free it. */
+        memset(&wp.words, 0, sizeof(ivec_t));
+    }
     word_pool_destroy(&wp);
+    word_pool_destroy(&pack_wp);
     safe_fclose(text_fp);
     safe_st_free(shuffle_buf);
 
-    for (i = 0; i < num_thrs; i++) {
-        /* posting semaphore without adding data indicates finish. */
-        if (st_sem_post(&reader->sem_full) != 0) {
-            ST_ERROR("Failed to st_sem_post sem_full.");
-            goto ERR;
-        }
+    if (reader_finish_shard(shard) < 0) {
+        ST_ERROR("Failed to reader_finish_shard.");
     }
 
     return NULL;
 }
 
+static int reader_setup_shards(reader_t *reader)
+{
+    reader_shard_t *shard;
+    off_t total;
+    off_t part_start;
+    int num_shards;
+    int i;
+
+    if (reader->corpus != NULL) {
+        total = reader->corpus->header.num_sents;
+    } else {
+        total = st_fsize(reader->text_file);
+    }
+
+    part_start = 0;
+    if (reader->num_parts > 1) {
+        if (total <= 0) {
+            ST_ERROR("Can not split text into parts, size unknown. "
+                    "Please do not read from pipe.");
+            return -1;
+        }
+        part_start = total / reader->num_parts * reader->part;
+        if (reader->part < reader->num_parts - 1) {
+            total = total / reader->num_parts * (reader->part + 1);
+        }
+        total -= part_start;
+    }
+
+    num_shards = 1;
+    if (reader->opt.shard) {
+        if (total <= 0) {
+            ST_ERROR("Can not split text into shards, size unknown. "
+                    "Please disable sharding when reading from pipe.");
+            return -1;
+        }
+        num_shards = reader->num_thrs;
+    }
+
+    if (reader->shards != NULL) {
+        for (i = 0; i < reader->num_shards; i++) {
+            reader_shard_destroy(reader->shards + i);
+        }
+        safe_st_free(reader->shards);
+    }
+
+    reader->shards = (reader_shard_t *)st_malloc(sizeof(reader_shard_t)
+            * num_shards);
+    if (reader->shards == NULL) {
+        ST_ERROR("Failed to st_malloc shards.");
+        return -1;
+    }
+    memset(reader->shards, 0, sizeof(reader_shard_t) * num_shards);
+    reader->num_shards = num_shards;
+
+    for (i = 0; i < num_shards; i++) {
+        shard = reader->shards + i;
+
+        shard->reader = reader;
+        shard->id = i;
+        shard->random = reader->opt.rand_seed + i;
+        if (total > 0) {
+            shard->start = part_start + total / num_shards * i;
+            if (i == num_shards - 1) {
+                shard->end = part_start + total;
+            } else {
+                shard->end = part_start + total / num_shards * (i + 1);
+            }
+        } else {
+            shard->start = 0;
+            shard->end = -1;
+        }
+
+        if (reader->resume_poses != NULL) {
+            shard->resume = true;
+            shard->resume_pos = reader->resume_poses[i];
+            shard->next_pos = shard->resume_pos;
+        } else {
+            /* may be not a line start in text, it is aligned when
+             * opening the shard, the same as resuming from it. */
+            shard->next_pos.pos = shard->start;
+            shard->next_pos.random = shard->random;
+        }
+
+        if (reader->keep_poses) {
+            if (pthread_mutex_init(&shard->pos_lock, NULL) != 0) {
+                ST_ERROR("Failed to pthread_mutex_init pos_lock.");
+                return -1;
+            }
+            /* every word pool in the list or ring could be pending. */
+            if (reader->opt.shard) {
+                shard->cap_pending = READER_RING_SIZE;
+            } else {
+                shard->cap_pending = 2 * reader->num_thrs;
+            }
+            shard->pending = (word_pool_t **)st_malloc(sizeof(word_pool_t *)
+                    * shard->cap_pending);
+            if (shard->pending == NULL) {
+                ST_ERROR("Failed to st_malloc pending.");
+                (void)pthread_mutex_destroy(&shard->pos_lock);
+                return -1;
+            }
+            shard->num_pending = 0;
+        }
+
+        if (! reader->opt.shard) {
+            continue;
+        }
+
+        shard->ring_size = READER_RING_SIZE;
+        shard->ring = (word_pool_t *)st_malloc(sizeof(word_pool_t)
+                * shard->ring_size);
+        if (shard->ring == NULL) {
+            ST_ERROR("Failed to st_malloc ring.");
+            return -1;
+        }
+        memset(shard->ring, 0, sizeof(word_pool_t) * shard->ring_size);
+
+        if (st_sem_init(&shard->sem_empty, shard->ring_size) != 0) {
+            ST_ERROR("Failed to st_sem_init sem_empty.");
+            return -1;
+        }
+
+        if (st_sem_init(&shard->sem_full, 0) != 0) {
+            ST_ERROR("Failed to st_sem_init sem_full.");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int reader_set_part(reader_t *reader, int part, int num_parts)
+{
+    ST_CHECK_PARAM(reader == NULL || num_parts <= 0
+            || part < 0 || part >= num_parts, -1);
+
+    reader->part = part;
+    reader->num_parts = num_parts;
+
+    return 0;
+}
+
 int reader_read(reader_t *reader, thr_stat_t *stats, int *err)
 {
+    int i;
+
     ST_CHECK_PARAM(reader == NULL || stats == NULL
             || err == NULL, -1);
 
-    reader->random = reader->opt.rand_seed;
     reader->stats = stats;
     reader->err = err;
 
-    if (pthread_create(&reader->tid, NULL, reader_read_thread,
-                (void *)reader) != 0) {
-        ST_ERROR("Failed to pthread_create.");
+    if (reader_setup_shards(reader) < 0) {
+        ST_ERROR("Failed to reader_setup_shards.");
         return -1;
     }
 
+    for (i = 0; i < reader->num_shards; i++) {
+        if (pthread_create(&reader->shards[i].tid, NULL, reader_read_thread,
+                    (void *)(reader->shards + i)) != 0) {
+            ST_ERROR("Failed to pthread_create.");
+            return -1;
+        }
+    }
+
     return 0;
 }
 
 int reader_wait(reader_t *reader)
 {
+    int i;
+
     ST_CHECK_PARAM(reader == NULL, -1);
 
-    if (pthread_join(reader->tid, NULL) != 0) {
-        ST_ERROR("Failed to pthread_join.");
-        return -1;
+    reader->num_words = 0;
+    reader->num_sents = 0;
+    reader->num_oovs = 0;
+    for (i = 0; i < reader->num_shards; i++) {
+        if (pthread_join(reader->shards[i].tid, NULL) != 0) {
+            ST_ERROR("Failed to pthread_join.");
+            return -1;
+        }
+
+        reader->num_words += reader->shards[i].num_words;
+        reader->num_sents += reader->shards[i].num_sents;
+        reader->num_oovs += reader->shards[i].num_oovs;
     }
 
     return 0;
 }
 
-word_pool_t* reader_hold_word_pool(reader_t *reader)
+static word_pool_t* reader_hold_shard_word_pool(reader_shard_t *shard)
 {
     word_pool_t *wp;
 
-    ST_CHECK_PARAM(reader == NULL, NULL);
-
-    if (st_sem_wait(&reader->sem_full) != 0) {
+    if (st_sem_wait(&shard->sem_full) != 0) {
         ST_ERROR("Failed to st_sem_wait sem_full.");
         return NULL;
     }
-    if (pthread_mutex_lock(&reader->full_wp_lock) != 0) {
-        ST_ERROR("Failed to pthread_mutex_lock full_wp_lock.");
+
+    if (shard->num_held >= shard->num_filled) {
+        /* finished, keep the semaphore posted for further holding. */
+        if (st_sem_post(&shard->sem_full) != 0) {
+            ST_ERROR("Failed to st_sem_post sem_full.");
+        }
         return NULL;
     }
 
-    wp = reader->full_wp_head;
-    if (wp != NULL) {
-        reader->full_wp_head = wp->next;
-    }
-    if (wp == reader->full_wp_tail) {
-        reader->full_wp_tail = NULL;
-    }
+    /* only consumer modifies head. */
+    wp = shard->ring + shard->head;
+    shard->num_held++;
 
-    if (pthread_mutex_unlock(&reader->full_wp_lock) != 0) {
-        ST_ERROR("Failed to pthread_mutex_unlock full_wp_lock.");
-        return NULL;
+    return wp;
+}
+
+word_pool_t* reader_hold_word_pool(reader_t *reader, int tid)
+{
+    word_pool_t *wp;
+
+    ST_CHECK_PARAM(reader == NULL || tid < 0, NULL);
+
+    if (reader->opt.shard) {
+        if (tid >= reader->num_shards) {
+            ST_ERROR("tid[%d] exceeds num_shards[%d].", tid,
+                    reader->num_shards);
+            return NULL;
+        }
+        wp = reader_hold_shard_word_pool(reader->shards + tid);
+    } else {
+        if (st_sem_wait(&reader->sem_full) != 0) {
+            ST_ERROR("Failed to st_sem_wait sem_full.");
+            return NULL;
+        }
+        if (pthread_mutex_lock(&reader->full_wp_lock) != 0) {
+            ST_ERROR("Failed to pthread_mutex_lock full_wp_lock.");
+            return NULL;
+        }
+
+        wp = reader->full_wp_head;
+        if (wp != NULL) {
+            reader->full_wp_head = wp->next;
+        }
+        if (wp == reader->full_wp_tail) {
+            reader->full_wp_tail = NULL;
+        }
+
+        if (pthread_mutex_unlock(&reader->full_wp_lock) != 0) {
+            ST_ERROR("Failed to pthread_mutex_unlock full_wp_lock.");
+            return NULL;
+        }
     }
 
-    if (reader->fp_debug != NULL) {
+    if (wp != NULL && reader->fp_debug != NULL) {
         if (word_pool_print(reader->fp_debug, &reader->fp_debug_lock,
                     wp, reader->vocab) < 0) {
             ST_ERROR("Failed to word_pool_print.");
@@ -928,9 +1718,64 @@ word_pool_t* reader_hold_word_pool(reader_t *reader)
     return wp;
 }
 
-int reader_release_word_pool(reader_t *reader, word_pool_t *wp)
+static int reader_shard_release_pos(reader_shard_t *shard, word_pool_t *wp)
+{
+    int i;
+
+    if (pthread_mutex_lock(&shard->pos_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock pos_lock.");
+        return -1;
+    }
+    for (i = 0; i < shard->num_pending; i++) {
+        if (shard->pending[i] == wp) {
+            break;
+        }
+    }
+    if (i >= shard->num_pending) {
+        (void)pthread_mutex_unlock(&shard->pos_lock);
+        ST_ERROR("Word pool not pending.");
+        return -1;
+    }
+    /* keep the order of reading, the first one is the oldest. */
+    memmove(shard->pending + i, shard->pending + i + 1,
+            sizeof(word_pool_t *) * (shard->num_pending - i - 1));
+    shard->num_pending--;
+    if (pthread_mutex_unlock(&shard->pos_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock pos_lock.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int reader_release_word_pool(reader_t *reader, int tid, word_pool_t *wp)
 {
-    ST_CHECK_PARAM(reader == NULL || wp == NULL, -1);
+    reader_shard_t *shard;
+
+    ST_CHECK_PARAM(reader == NULL || tid < 0 || wp == NULL, -1);
+
+    /* release position before the word pool could be refilled. */
+    shard = reader->shards + (reader->opt.shard ? tid : 0);
+    if (reader->keep_poses) {
+        if (reader_shard_release_pos(shard, wp) < 0) {
+            ST_ERROR("Failed to reader_shard_release_pos.");
+            return -1;
+        }
+    }
+
+    if (reader->opt.shard) {
+        if (wp != shard->ring + shard->head) {
+            ST_ERROR("Word pools must be released in order.");
+            return -1;
+        }
+        shard->head = (shard->head + 1) % shard->ring_size;
+        if (st_sem_post(&shard->sem_empty) != 0) {
+            ST_ERROR("Failed to st_sem_post sem_empty.");
+            return -1;
+        }
+
+        return 0;
+    }
 
     if (pthread_mutex_lock(&reader->empty_wp_lock) != 0) {
         ST_ERROR("Failed to pthread_mutex_lock empty_wp_lock.");
@@ -950,3 +1795,69 @@ int reader_release_word_pool(reader_t *reader, word_pool_t *wp)
 
     return 0;
 }
+
+int reader_set_resume(reader_t *reader, reader_pos_t *poses, int num_poses)
+{
+    ST_CHECK_PARAM(reader == NULL || poses == NULL || num_poses <= 0, -1);
+
+    if (num_poses != (reader->opt.shard ? reader->num_thrs : 1)) {
+        ST_ERROR("Number of positions[%d] not match with shards. "
+                "Please resume with the same number of threads and "
+                "sharding option.", num_poses);
+        return -1;
+    }
+
+    reader->resume_poses = (reader_pos_t *)st_realloc(reader->resume_poses,
+            sizeof(reader_pos_t) * num_poses);
+    if (reader->resume_poses == NULL) {
+        ST_ERROR("Failed to st_realloc resume_poses.");
+        return -1;
+    }
+    memcpy(reader->resume_poses, poses, sizeof(reader_pos_t) * num_poses);
+    reader->num_resume_poses = num_poses;
+
+    return 0;
+}
+
+int reader_keep_poses(reader_t *reader)
+{
+    ST_CHECK_PARAM(reader == NULL, -1);
+
+    reader->keep_poses = true;
+
+    return 0;
+}
+
+int reader_get_poses(reader_t *reader, reader_pos_t *poses)
+{
+    reader_shard_t *shard;
+    int i;
+
+    ST_CHECK_PARAM(reader == NULL || poses == NULL, -1);
+
+    if (!reader->keep_poses) {
+        ST_ERROR("Positions are not kept.");
+        return -1;
+    }
+
+    for (i = 0; i < reader->num_shards; i++) {
+        shard = reader->shards + i;
+        if (pthread_mutex_lock(&shard->pos_lock) != 0) {
+            ST_ERROR("Failed to pthread_mutex_lock pos_lock.");
+            return -1;
+        }
+        /* pools are published in order of reading, the first pending
+         * one starts before all others, and before next_pos. */
+        if (shard->num_pending > 0) {
+            poses[i] = shard->pending[0]->start_pos;
+        } else {
+            poses[i] = shard->next_pos;
+        }
+        if (pthread_mutex_unlock(&shard->pos_lock) != 0) {
+            ST_ERROR("Failed to pthread_mutex_unlock pos_lock.");
+            return -1;
+        }
+    }
+
+    return 0;
+}
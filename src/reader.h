@@ -36,6 +36,7 @@ extern "C" {
 #include <connlm/config.h>
 #include "vector.h"
 #include "vocab.h"
+#include "corpus.h"
 
 /** @defgroup g_reader Samples Reader
  * Reader to read samples from source text files.
@@ -48,9 +49,24 @@ extern "C" {
 typedef struct _thread_statistics_t_ {
     count_t num_words; /**< total number of words trained in this thread. */
     count_t num_sents; /**< total number of sentences trained in this thread. */
+    count_t num_slots; /**< total number of target slots stepped in this
+                         thread, including paddings in mini-batch. */
     double logp; /**< total log probability in this thread. */
 } thr_stat_t;
 
+/**
+ * Position of reading in a shard, to resume reading from.
+ * @ingroup g_reader
+ */
+typedef struct _reader_pos_t_ {
+    int64_t pos; /**< byte offset of a line in text file, or index of a
+                   sentence in corpus. */
+    unsigned int random; /**< random seed of shard at pos. */
+    count_t num_sents; /**< number of sentences read before pos. */
+    count_t num_words; /**< number of words read before pos. */
+    count_t num_oovs; /**< number of OOVs read before pos. */
+} reader_pos_t;
+
 /**
  * Options for reader.
  * @ingroup g_reader
@@ -58,9 +74,13 @@ typedef struct _thread_statistics_t_ {
 typedef struct _reader_opt_t_ {
     int epoch_size;  /**< number sentences read one time per thread. */
     int mini_batch;  /**< mini-batch size. */
+    bool pack_mini_batch; /**< whether pack sentences into rows of
+                            near-equal length. */
     unsigned int rand_seed;   /**< seed for random function. */
     bool shuffle;             /**< whether shuffle the sentences. */
     bool drop_empty_line;     /**< whether drop empty lines in text. */
+    bool shard;               /**< whether split text into shards,
+                                one per worker thread. */
     char debug_file[MAX_DIR_LEN]; /**< file to print out debug infos. */
 } reader_opt_t;
 
@@ -71,13 +91,17 @@ typedef struct _reader_opt_t_ {
 typedef struct _word_pool_t_ {
     ivec_t words; /**< word ids. */
     ivec_t sent_ends; /**< postions of \</s\> */
+    ivec_t sent_ids; /**< id of each sentence, i.e. its index in the
+                        shard it read from. Empty if not tagged. */
 
     ivec_t row_starts; /**< start index of each row in mini-batch.
                            batche size is row_starts.size() - 1. */
+    reader_pos_t start_pos; /**< position in the shard it read from,
+                              only kept after reader_keep_poses. */
     struct _word_pool_t_ *next; /**< pointer to the next list element. */
 } word_pool_t;
 
-#define WORD_POOL_INITIALIZER {{0}, {0}, {0}}
+#define WORD_POOL_INITIALIZER {{0}, {0}, {0}, {0}}
 #define wp_batch_size(wp) (wp)->row_starts.size - 1
 
 /**
@@ -148,6 +172,22 @@ int word_pool_append_ivec(word_pool_t *wp, ivec_t *words);
  */
 int word_pool_build_mini_batch(word_pool_t *wp, int batch_size);
 
+/**
+ * Build mini-batch with rows of near-equal number of words.
+ * Sentences of src_wp are assigned longest first to the least loaded row,
+ * and copied into dst_wp grouped by row, so that little padding is needed
+ * at the end of the shorter rows. sent_ids are carried along if any.
+ * Falls back to word_pool_build_mini_batch if there are no more
+ * sentences than batch_size.
+ * @ingroup g_reader
+ * @param[out] dst_wp destination word pool.
+ * @param[in] src_wp source word pool.
+ * @param[in] batch_size size of mini-batch.
+ * @return non-zero value if any error.
+ */
+int word_pool_pack_mini_batch(word_pool_t *dst_wp, word_pool_t *src_wp,
+        int batch_size);
+
 /**
  * Read words into pool.
  * @ingroup g_reader
@@ -173,6 +213,51 @@ int word_pool_read(word_pool_t *wp, int epoch_size, FILE *text_fp,
 int reader_load_opt(reader_opt_t *reader_opt, st_opt_t *opt,
         const char *sec_name);
 
+struct _reader_t_;
+
+/**
+ * Shard of input, read by its own thread.
+ * In sharded mode, every shard feeds a single-producer single-consumer
+ * ring for one worker thread; otherwise, there is only one shard covering
+ * the whole input, which feeds the shared word pool list.
+ * @ingroup g_reader
+ */
+typedef struct _reader_shard_t_ {
+    struct _reader_t_ *reader; /**< the reader. */
+    int id; /**< shard id. */
+
+    off_t start; /**< start byte(or sentence for corpus) of this shard. */
+    off_t end; /**< end byte(or sentence for corpus) of this shard,
+                    lines starting before this position belongs to shard. */
+
+    word_pool_t *ring; /**< ring of word pools. */
+    int ring_size; /**< size of ring. */
+    int head; /**< next slot to be consumed, only used by consumer. */
+    int tail; /**< next slot to be filled, only used by producer. */
+    count_t num_filled; /**< number of word pools filled. */
+    count_t num_held; /**< number of word pools held by consumer. */
+    st_sem_t sem_full; /**< semaphore for filled slots. */
+    st_sem_t sem_empty; /**< semaphore for empty slots. */
+
+    count_t num_words; /**< total words readed in this shard. */
+    count_t num_sents; /**< total sentences readed in this shard. */
+    count_t num_oovs; /**< total OOVs readed in this shard. */
+
+    reader_pos_t next_pos; /**< position of the word pool being read. */
+    word_pool_t **pending; /**< word pools queued or held, i.e. published
+                             but not released, in the order of reading.
+                             NULL if positions are not kept. */
+    int num_pending; /**< number of pending word pools. */
+    int cap_pending; /**< capacity of pending. */
+    pthread_mutex_t pos_lock; /**< lock for positions. */
+
+    bool resume; /**< whether to start from resume_pos. */
+    reader_pos_t resume_pos; /**< position to start reading from. */
+
+    pthread_t tid; /**< thread id for read thread. */
+    unsigned int random; /**< random seed. */
+} reader_shard_t;
+
 /**
  * Sample reader.
  * @ingroup g_reader
@@ -180,6 +265,7 @@ int reader_load_opt(reader_opt_t *reader_opt, st_opt_t *opt,
 typedef struct _reader_t_ {
     reader_opt_t opt; /**< reader option. */
     char text_file[MAX_DIR_LEN]; /**< text file name. */
+    corpus_t *corpus; /**< mmap-ed corpus, if text_file is compiled. */
     vocab_t *vocab; /**< vocabulary. */
     int num_thrs; /**< number of working threads. */
 
@@ -191,6 +277,11 @@ typedef struct _reader_t_ {
     pthread_mutex_t full_wp_lock; /**< lock for full word pool list. */
     pthread_mutex_t empty_wp_lock; /**< lock for empty word pool list. */
 
+    reader_shard_t *shards; /**< shards of input. */
+    int num_shards; /**< number of shards. */
+    int part; /**< index of part of input to be read. */
+    int num_parts; /**< number of parts input split into. */
+
     FILE *fp_debug; /**< file pointer to print out debug info. */
     pthread_mutex_t fp_debug_lock; /**< lock for fp_debug_log. */
 
@@ -198,8 +289,11 @@ typedef struct _reader_t_ {
     count_t num_sents; /**< total sentences readed. */
     count_t num_oovs; /**< total OOVs readed. */
 
-    pthread_t tid; /**< thread id for read thread. */
-    unsigned int random; /**< random seed. */
+    reader_pos_t *resume_poses; /**< positions to resume reading from,
+                                  one for each shard. */
+    int num_resume_poses; /**< number of resume_poses. */
+    bool keep_poses; /**< whether keep positions for reader_get_poses. */
+
     thr_stat_t *stats; /**< random seed. */
     int *err; /**< error indicator. */
 } reader_t;
@@ -229,15 +323,61 @@ void reader_destroy(reader_t *reader);
  * @param[in] opt reader options.
  * @param[in] num_thrs number of worker threads.
  * @param[in] vocab vocabulary.
- * @param[in] text_file text file name.
+ * @param[in] text_file text file name, or a corpus compiled by
+ *                      connlm-compile-corpus.
  * @return reader on success, otherwise NULL.
  */
 reader_t* reader_create(reader_opt_t *opt, int num_thrs,
         vocab_t *vocab, const char *text_file);
 
+/**
+ * Read only a part of the input, e.g. for distributed training.
+ * The input is split into num_parts parts with (nearly) equal size,
+ * and shards are split inside the part.
+ * @ingroup g_reader
+ * @param[in] reader reader.
+ * @param[in] part index of part to be read.
+ * @param[in] num_parts number of parts.
+ * @return non-zero value if any error.
+ */
+int reader_set_part(reader_t *reader, int part, int num_parts);
+
+/**
+ * Resume reading from positions got by reader_get_poses, instead of
+ * the beginning of every shard. Must be called before reader_read,
+ * with the same sharding options and number of threads.
+ * @ingroup g_reader
+ * @param[in] reader reader.
+ * @param[in] poses positions, one for each shard.
+ * @param[in] num_poses number of positions.
+ * @return non-zero value if any error.
+ */
+int reader_set_resume(reader_t *reader, reader_pos_t *poses, int num_poses);
+
+/**
+ * Keep positions of word pools, so that reader_get_poses can be called
+ * while reading. Must be called before reader_read.
+ * @ingroup g_reader
+ * @param[in] reader reader.
+ * @return non-zero value if any error.
+ */
+int reader_keep_poses(reader_t *reader);
+
+/**
+ * Get positions to resume reading from, i.e. the beginning of the first
+ * word pool not released in every shard. Word pools held by worker
+ * threads are counted as not released. Positions must be kept by
+ * reader_keep_poses.
+ * @ingroup g_reader
+ * @param[in] reader reader.
+ * @param[out] poses positions, must have room for num_shards elements.
+ * @return non-zero value if any error.
+ */
+int reader_get_poses(reader_t *reader, reader_pos_t *poses);
+
 /**
  * Start reading text.
- * Will start a new thread to read text.
+ * Will start new threads to read text, one for each shard.
  * @ingroup g_reader
  * @param[in] reader reader.
  * @param[in] stats thread statistics.
@@ -258,18 +398,20 @@ int reader_wait(reader_t *reader);
  * Get and hold a word pool in reading queue.
  * @ingroup g_reader
  * @param[in] reader reader.
+ * @param[in] tid id of worker thread.
  * @return NULL if there is no more data or any error.
  */
-word_pool_t* reader_hold_word_pool(reader_t *reader);
+word_pool_t* reader_hold_word_pool(reader_t *reader, int tid);
 
 /**
  * Relase a word pool to reading queue.
  * @ingroup g_reader
  * @param[in] reader reader.
+ * @param[in] tid id of worker thread.
  * @param[in] wp word pool.
  * @return non-zero value if any error.
  */
-int reader_release_word_pool(reader_t *reader, word_pool_t* wp);
+int reader_release_word_pool(reader_t *reader, int tid, word_pool_t* wp);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1266 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stutils/st_macro.h>
+#include <stutils/st_log.h>
+#include <stutils/st_mem.h>
+
+#include "server.h"
+
+#define SERVER_QUEUE_SIZE(server) ((server)->opt.num_thrs * 2)
+
+int server_load_opt(server_opt_t *server_opt, st_opt_t *opt,
+        const char *sec_name)
+{
+    ST_CHECK_PARAM(server_opt == NULL || opt == NULL, -1);
+
+    ST_OPT_SEC_GET_INT(opt, sec_name, "NUM_THREAD",
+            server_opt->num_thrs, 1,
+            "Number of worker threads");
+    if (server_opt->num_thrs <= 0) {
+        ST_ERROR("NUM_THREAD must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_INT(opt, sec_name, "MAX_STATES",
+            server_opt->max_states, 1000000,
+            "Max number of states kept in state table");
+    if (server_opt->max_states <= 1) {
+        ST_ERROR("MAX_STATES must be larger than 1.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_INT(opt, sec_name, "MAX_REQUEST_LEN",
+            server_opt->max_req_len, 65536,
+            "Max number of items in one request");
+    if (server_opt->max_req_len <= 0) {
+        ST_ERROR("MAX_REQUEST_LEN must be positive.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_INT(opt, sec_name, "STATE_CACHE_SIZE",
+            server_opt->cache_size, 0,
+            "Size(MB) of cache for states of sentence prefixes, "
+            "0 to disable");
+    if (server_opt->cache_size < 0) {
+        ST_ERROR("STATE_CACHE_SIZE must not be negative.");
+        goto ST_OPT_ERR;
+    }
+
+    ST_OPT_SEC_GET_BOOL(opt, sec_name, "SELF_NORMALIZED",
+            server_opt->self_norm, false,
+            "Use unnormalized score as probability, "
+            "only used for NCE output.");
+
+    return 0;
+
+ST_OPT_ERR:
+    return -1;
+}
+
+static void server_worker_destroy(server_worker_t *worker)
+{
+    int i;
+
+    if (worker == NULL) {
+        return;
+    }
+
+    safe_updater_destroy(worker->updater);
+    mat_destroy(&worker->state);
+    mat_destroy(&worker->new_state);
+    if (worker->hists != NULL) {
+        for (i = 0; i < worker->server->opt.max_req_len; i++) {
+            ivec_destroy(worker->hists + i);
+        }
+        safe_st_free(worker->hists);
+    }
+    ivec_destroy(&worker->words);
+    dvec_destroy(&worker->logps);
+    safe_st_free(worker->req_buf);
+    safe_st_free(worker->handles);
+    safe_st_free(worker->resp_logps);
+    worker->server = NULL;
+}
+
+void server_destroy(server_t *server)
+{
+    int i;
+
+    if (server == NULL) {
+        return;
+    }
+
+    server->connlm = NULL;
+
+    if (server->workers != NULL) {
+        for (i = 0; i < server->opt.num_thrs; i++) {
+            server_worker_destroy(server->workers + i);
+        }
+        safe_st_free(server->workers);
+    }
+
+    if (server->states != NULL) {
+        for (i = 0; i < server->cap_states; i++) {
+            mat_destroy(&server->states[i].state);
+            ivec_destroy(&server->states[i].hist);
+        }
+        safe_st_free(server->states);
+    }
+    server->cap_states = 0;
+    server->num_states = 0;
+    if (server->state_lock_inited) {
+        (void)pthread_mutex_destroy(&server->state_lock);
+        server->state_lock_inited = false;
+    }
+
+    safe_state_cache_destroy(server->cache);
+
+    safe_st_free(server->conns);
+    if (server->sem_full_inited) {
+        (void)st_sem_destroy(&server->sem_full);
+        server->sem_full_inited = false;
+    }
+    if (server->sem_empty_inited) {
+        (void)st_sem_destroy(&server->sem_empty);
+        server->sem_empty_inited = false;
+    }
+    if (server->conn_lock_inited) {
+        (void)pthread_mutex_destroy(&server->conn_lock);
+        server->conn_lock_inited = false;
+    }
+}
+
+static int server_worker_init(server_worker_t *worker, server_t *server,
+        int id)
+{
+    ST_CHECK_PARAM(worker == NULL || server == NULL, -1);
+
+    worker->server = server;
+    worker->id = id;
+    worker->fd = -1;
+    worker->owned_states = -1;
+
+    worker->updater = updater_create(server->connlm);
+    if (worker->updater == NULL) {
+        ST_ERROR("Failed to updater_create.");
+        return -1;
+    }
+
+    if (updater_set_nce(worker->updater, 0, server->opt.self_norm) < 0) {
+        ST_ERROR("Failed to updater_set_nce.");
+        return -1;
+    }
+
+    if (updater_setup(worker->updater, false) < 0) {
+        ST_ERROR("Failed to updater_setup.");
+        return -1;
+    }
+
+    worker->hists = (ivec_t *)st_malloc(sizeof(ivec_t)
+            * server->opt.max_req_len);
+    if (worker->hists == NULL) {
+        ST_ERROR("Failed to st_malloc hists.");
+        return -1;
+    }
+    memset(worker->hists, 0, sizeof(ivec_t) * server->opt.max_req_len);
+
+    worker->req_buf = (int32_t *)st_malloc(sizeof(int32_t)
+            * (2 * server->opt.max_req_len + 1));
+    if (worker->req_buf == NULL) {
+        ST_ERROR("Failed to st_malloc req_buf.");
+        return -1;
+    }
+
+    worker->handles = (int32_t *)st_malloc(sizeof(int32_t)
+            * server->opt.max_req_len);
+    if (worker->handles == NULL) {
+        ST_ERROR("Failed to st_malloc handles.");
+        return -1;
+    }
+
+    worker->resp_logps = (double *)st_malloc(sizeof(double)
+            * (server->opt.max_req_len + 1));
+    if (worker->resp_logps == NULL) {
+        ST_ERROR("Failed to st_malloc resp_logps.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int server_init_states(server_t *server)
+{
+    server_state_t *init;
+    int word;
+
+    ST_CHECK_PARAM(server == NULL, -1);
+
+    server->cap_states = 1;
+    server->states = (server_state_t *)st_malloc(sizeof(server_state_t));
+    if (server->states == NULL) {
+        ST_ERROR("Failed to st_malloc states.");
+        return -1;
+    }
+    memset(server->states, 0, sizeof(server_state_t));
+
+    init = server->states + SERVER_INIT_STATE;
+    if (server->state_size > 0) {
+        if (mat_resize(&init->state, 1, server->state_size, 0.0) < 0) {
+            ST_ERROR("Failed to mat_resize init state.");
+            return -1;
+        }
+    }
+
+    word = vocab_get_id(server->connlm->vocab, SENT_START);
+    if (ivec_set(&init->hist, &word, 1) < 0) {
+        ST_ERROR("Failed to ivec_set init hist.");
+        return -1;
+    }
+    init->used = true;
+    init->next_free = -1;
+    init->owner = -1;
+    init->prev_owned = -1;
+    init->next_owned = -1;
+
+    server->num_states = 1;
+    server->free_states = -1;
+
+    if (pthread_mutex_init(&server->state_lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init state_lock.");
+        return -1;
+    }
+    server->state_lock_inited = true;
+
+    return 0;
+}
+
+server_t* server_create(connlm_t *connlm, server_opt_t *opt)
+{
+    server_t *server = NULL;
+    input_t *input;
+
+    int c, i;
+
+    ST_CHECK_PARAM(connlm == NULL || opt == NULL, NULL);
+
+    server = (server_t *)st_malloc(sizeof(server_t));
+    if (server == NULL) {
+        ST_ERROR("Failed to st_malloc server.");
+        return NULL;
+    }
+    memset(server, 0, sizeof(server_t));
+
+    server->connlm = connlm;
+    server->opt = *opt;
+    server->listen_fd = -1;
+
+    if (connlm_need_future_input(connlm)) {
+        ST_ERROR("Can not serve: future words in input context.");
+        goto ERR;
+    }
+
+    if (connlm_setup(connlm) < 0) {
+        ST_ERROR("Failed to connlm_setup.");
+        goto ERR;
+    }
+
+    server->max_hist = 1;
+    for (c = 0; c < connlm->num_comp; c++) {
+        input = connlm->comps[c]->input;
+        if (input->n_ctx > 0 && -input->context[0].i > server->max_hist) {
+            server->max_hist = -input->context[0].i;
+        }
+    }
+
+    server->workers = (server_worker_t *)st_malloc(sizeof(server_worker_t)
+            * opt->num_thrs);
+    if (server->workers == NULL) {
+        ST_ERROR("Failed to st_malloc workers.");
+        goto ERR;
+    }
+    memset(server->workers, 0, sizeof(server_worker_t) * opt->num_thrs);
+
+    for (i = 0; i < opt->num_thrs; i++) {
+        if (server_worker_init(server->workers + i, server, i) < 0) {
+            ST_ERROR("Failed to server_worker_init[%d].", i);
+            goto ERR;
+        }
+    }
+
+    server->state_size = updater_state_size(server->workers[0].updater);
+    if (server->state_size < 0) {
+        ST_ERROR("Failed to updater_state_size.");
+        goto ERR;
+    }
+
+    if (server_init_states(server) < 0) {
+        ST_ERROR("Failed to server_init_states.");
+        goto ERR;
+    }
+
+    if (opt->cache_size > 0) {
+        server->cache = state_cache_create(
+                (size_t)opt->cache_size * 1024 * 1024, server->state_size);
+        if (server->cache == NULL) {
+            ST_ERROR("Failed to state_cache_create.");
+            goto ERR;
+        }
+    }
+
+    server->conns = (int *)st_malloc(sizeof(int) * SERVER_QUEUE_SIZE(server));
+    if (server->conns == NULL) {
+        ST_ERROR("Failed to st_malloc conns.");
+        goto ERR;
+    }
+    if (st_sem_init(&server->sem_full, 0) != 0) {
+        ST_ERROR("Failed to st_sem_init sem_full.");
+        goto ERR;
+    }
+    server->sem_full_inited = true;
+    if (st_sem_init(&server->sem_empty, SERVER_QUEUE_SIZE(server)) != 0) {
+        ST_ERROR("Failed to st_sem_init sem_empty.");
+        goto ERR;
+    }
+    server->sem_empty_inited = true;
+    if (pthread_mutex_init(&server->conn_lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init conn_lock.");
+        goto ERR;
+    }
+    server->conn_lock_inited = true;
+
+    return server;
+
+ERR:
+    safe_server_destroy(server);
+    return NULL;
+}
+
+static int server_get_state(server_t *server, int handle,
+        mat_t *state, ivec_t *hist)
+{
+    server_state_t *entry;
+
+    ST_CHECK_PARAM(server == NULL || hist == NULL, -1);
+
+    if (pthread_mutex_lock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock state_lock.");
+        return -1;
+    }
+
+    if (handle < 0 || handle >= server->cap_states
+            || ! server->states[handle].used) {
+        ST_WARNING("Invalid state handle[%d].", handle);
+        goto ERR;
+    }
+    entry = server->states + handle;
+
+    if (server->state_size > 0) {
+        if (mat_cpy(state, &entry->state) < 0) {
+            ST_ERROR("Failed to mat_cpy state.");
+            goto ERR;
+        }
+    }
+    if (ivec_cpy(hist, &entry->hist) < 0) {
+        ST_ERROR("Failed to ivec_cpy hist.");
+        goto ERR;
+    }
+
+    if (pthread_mutex_unlock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock state_lock.");
+        return -1;
+    }
+
+    return 0;
+
+ERR:
+    (void)pthread_mutex_unlock(&server->state_lock);
+    return -1;
+}
+
+static int server_put_state(server_t *server, server_worker_t *worker,
+        mat_t *state, ivec_t *hist)
+{
+    server_state_t *entry;
+    int handle;
+    int cap;
+    int i;
+
+    ST_CHECK_PARAM(server == NULL || worker == NULL || hist == NULL, -1);
+
+    if (pthread_mutex_lock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock state_lock.");
+        return -1;
+    }
+
+    if (server->free_states < 0) {
+        if (server->cap_states >= server->opt.max_states) {
+            ST_WARNING("Too many states[%d], please free some.",
+                    server->cap_states);
+            goto ERR;
+        }
+
+        cap = min(server->cap_states * 2, server->opt.max_states);
+        server->states = (server_state_t *)st_realloc(server->states,
+                sizeof(server_state_t) * cap);
+        if (server->states == NULL) {
+            ST_ERROR("Failed to st_realloc states.");
+            goto ERR;
+        }
+        memset(server->states + server->cap_states, 0,
+                sizeof(server_state_t) * (cap - server->cap_states));
+        for (i = cap - 1; i >= server->cap_states; i--) {
+            server->states[i].next_free = server->free_states;
+            server->free_states = i;
+        }
+        server->cap_states = cap;
+    }
+
+    handle = server->free_states;
+    entry = server->states + handle;
+
+    if (server->state_size > 0) {
+        if (mat_cpy(&entry->state, state) < 0) {
+            ST_ERROR("Failed to mat_cpy state.");
+            goto ERR;
+        }
+    }
+    if (ivec_cpy(&entry->hist, hist) < 0) {
+        ST_ERROR("Failed to ivec_cpy hist.");
+        goto ERR;
+    }
+
+    server->free_states = entry->next_free;
+    entry->next_free = -1;
+    entry->used = true;
+    server->num_states++;
+
+    entry->owner = worker->id;
+    entry->prev_owned = -1;
+    entry->next_owned = worker->owned_states;
+    if (entry->next_owned >= 0) {
+        server->states[entry->next_owned].prev_owned = handle;
+    }
+    worker->owned_states = handle;
+
+    if (pthread_mutex_unlock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock state_lock.");
+        return -1;
+    }
+
+    return handle;
+
+ERR:
+    (void)pthread_mutex_unlock(&server->state_lock);
+    return -1;
+}
+
+// release an entry in use, state_lock must be held.
+static void server_release_state(server_t *server, int handle)
+{
+    server_state_t *entry;
+
+    entry = server->states + handle;
+
+    if (entry->prev_owned >= 0) {
+        server->states[entry->prev_owned].next_owned = entry->next_owned;
+    } else if (entry->owner >= 0) {
+        server->workers[entry->owner].owned_states = entry->next_owned;
+    }
+    if (entry->next_owned >= 0) {
+        server->states[entry->next_owned].prev_owned = entry->prev_owned;
+    }
+    entry->owner = -1;
+    entry->prev_owned = -1;
+    entry->next_owned = -1;
+
+    entry->used = false;
+    entry->next_free = server->free_states;
+    server->free_states = handle;
+    server->num_states--;
+}
+
+static int server_free_states(server_t *server, int32_t *handles, int n)
+{
+    int i;
+
+    ST_CHECK_PARAM(server == NULL || handles == NULL, -1);
+
+    if (pthread_mutex_lock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock state_lock.");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (handles[i] == SERVER_INIT_STATE || handles[i] == SERVER_NO_STATE) {
+            continue;
+        }
+        if (handles[i] < 0 || handles[i] >= server->cap_states
+                || ! server->states[handles[i]].used) {
+            ST_WARNING("Invalid state handle[%d].", handles[i]);
+            continue;
+        }
+
+        server_release_state(server, handles[i]);
+    }
+
+    if (pthread_mutex_unlock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock state_lock.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int server_push_hist(server_t *server, ivec_t *hist, int word)
+{
+    ST_CHECK_PARAM(server == NULL || hist == NULL, -1);
+
+    if (hist->size >= server->max_hist) {
+        memmove(hist->vals, hist->vals + hist->size - server->max_hist + 1,
+                sizeof(int) * (server->max_hist - 1));
+        hist->size = server->max_hist - 1;
+    }
+
+    if (ivec_append(hist, word) < 0) {
+        ST_ERROR("Failed to ivec_append.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static bool server_valid_word(server_t *server, int word)
+{
+    return word >= 0 && word < server->connlm->vocab->vocab_size
+        && word != vocab_get_id(server->connlm->vocab, SENT_START);
+}
+
+/*
+ * Resize buffers of worker for n hypotheses.
+ */
+static int server_worker_resize(server_worker_t *worker, int n)
+{
+    server_t *server;
+
+    ST_CHECK_PARAM(worker == NULL || n <= 0, -1);
+
+    server = worker->server;
+
+    if (server->state_size > 0) {
+        if (mat_resize(&worker->state, n, server->state_size, NAN) < 0) {
+            ST_ERROR("Failed to mat_resize state.");
+            return -1;
+        }
+        if (mat_resize(&worker->new_state, n, server->state_size, NAN) < 0) {
+            ST_ERROR("Failed to mat_resize new_state.");
+            return -1;
+        }
+    }
+
+    if (ivec_resize(&worker->words, n) < 0) {
+        ST_ERROR("Failed to ivec_resize words.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Score worker->words with the first n rows of worker->state
+ * and worker->hists.
+ */
+static int server_worker_score(server_worker_t *worker, int n)
+{
+    server_t *server;
+
+    ST_CHECK_PARAM(worker == NULL || n <= 0, -1);
+
+    server = worker->server;
+
+    if (server->state_size > 0) {
+        if (updater_score_with_state(worker->updater, &worker->state,
+                    worker->hists, n, &worker->words, &worker->logps,
+                    &worker->new_state) < 0) {
+            ST_ERROR("Failed to updater_score_with_state.");
+            return -1;
+        }
+    } else {
+        if (updater_score_with_state(worker->updater, NULL,
+                    worker->hists, n, &worker->words, &worker->logps,
+                    NULL) < 0) {
+            ST_ERROR("Failed to updater_score_with_state.");
+            return -1;
+        }
+    }
+    worker->num_words += n;
+
+    return 0;
+}
+
+static int server_worker_score_sent(server_worker_t *worker,
+        int32_t *words, int n, double *logps)
+{
+    server_t *server;
+    hist_key_t key;
+    hist_key_t next_key;
+    int word;
+    int ret;
+    int i;
+
+    ST_CHECK_PARAM(worker == NULL || words == NULL || logps == NULL, -1);
+
+    server = worker->server;
+
+    for (i = 0; i < n; i++) {
+        if (! server_valid_word(server, words[i])
+                || words[i] == SENT_END_ID) {
+            ST_WARNING("Invalid word[%d] in sentence.", words[i]);
+            return -1;
+        }
+    }
+
+    if (server_worker_resize(worker, 1) < 0) {
+        ST_ERROR("Failed to server_worker_resize.");
+        return -1;
+    }
+
+    if (server_get_state(server, SERVER_INIT_STATE,
+                &worker->state, worker->hists) < 0) {
+        ST_ERROR("Failed to server_get_state.");
+        return -1;
+    }
+
+    // words in a sentence have to be scored one by one.
+    // worker->state and worker->hists[0] always hold the state of
+    // current prefix, which is either computed or loaded from cache.
+    key = HIST_KEY_INIT;
+    for (i = 0; i <= n; i++) {
+        word = (i < n) ? words[i] : SENT_END_ID;
+        next_key = hist_key_append(key, word);
+
+        if (server->cache != NULL) {
+            ret = state_cache_lookup_logp(server->cache, key, word, logps + i);
+            if (ret < 0) {
+                ST_ERROR("Failed to state_cache_lookup_logp.");
+                return -1;
+            }
+            if (ret == 1 && i < n) {
+                ret = state_cache_lookup(server->cache, next_key,
+                        &worker->state, worker->hists);
+                if (ret < 0) {
+                    ST_ERROR("Failed to state_cache_lookup.");
+                    return -1;
+                }
+            }
+            if (ret == 1) {
+                key = next_key;
+                continue;
+            }
+        }
+
+        VEC_VAL(&worker->words, 0) = word;
+        if (server_worker_score(worker, 1) < 0) {
+            ST_ERROR("Failed to server_worker_score.");
+            return -1;
+        }
+        logps[i] = VEC_VAL(&worker->logps, 0);
+
+        if (server->cache != NULL) {
+            if (state_cache_add_logp(server->cache, key,
+                        word, logps[i]) < 0) {
+                ST_ERROR("Failed to state_cache_add_logp.");
+                return -1;
+            }
+        }
+
+        if (i == n) {
+            break;
+        }
+
+        if (server->state_size > 0) {
+            if (mat_cpy(&worker->state, &worker->new_state) < 0) {
+                ST_ERROR("Failed to mat_cpy state.");
+                return -1;
+            }
+        }
+        if (server_push_hist(server, worker->hists, word) < 0) {
+            ST_ERROR("Failed to server_push_hist.");
+            return -1;
+        }
+
+        if (server->cache != NULL) {
+            if (state_cache_insert(server->cache, next_key,
+                        &worker->state, worker->hists) < 0) {
+                ST_ERROR("Failed to state_cache_insert.");
+                return -1;
+            }
+        }
+        key = next_key;
+    }
+
+    return 0;
+}
+
+static int server_worker_score_batch(server_worker_t *worker,
+        int32_t *pairs, int n, int32_t *handles, double *logps)
+{
+    server_t *server;
+    mat_t state;
+    int word;
+    int i;
+
+    ST_CHECK_PARAM(worker == NULL || pairs == NULL
+            || handles == NULL || logps == NULL, -1);
+
+    server = worker->server;
+
+    for (i = 0; i < n; i++) {
+        word = pairs[2 * i + 1];
+        if (! server_valid_word(server, word)) {
+            ST_WARNING("Invalid word[%d] in batch.", word);
+            return -1;
+        }
+    }
+
+    if (server_worker_resize(worker, n) < 0) {
+        ST_ERROR("Failed to server_worker_resize.");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (server->state_size > 0) {
+            if (mat_submat(&worker->state, i, 1, 0, 0, &state) < 0) {
+                ST_ERROR("Failed to mat_submat state.");
+                return -1;
+            }
+        }
+        if (server_get_state(server, pairs[2 * i], &state,
+                    worker->hists + i) < 0) {
+            ST_ERROR("Failed to server_get_state.");
+            return -1;
+        }
+        VEC_VAL(&worker->words, i) = pairs[2 * i + 1];
+    }
+
+    if (server_worker_score(worker, n) < 0) {
+        ST_ERROR("Failed to server_worker_score.");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        handles[i] = SERVER_NO_STATE;
+        logps[i] = VEC_VAL(&worker->logps, i);
+    }
+
+    for (i = 0; i < n; i++) {
+        word = VEC_VAL(&worker->words, i);
+        if (word == SENT_END_ID) {
+            continue;
+        }
+
+        if (server->state_size > 0) {
+            if (mat_submat(&worker->new_state, i, 1, 0, 0, &state) < 0) {
+                ST_ERROR("Failed to mat_submat new_state.");
+                goto ERR;
+            }
+        }
+        if (server_push_hist(server, worker->hists + i, word) < 0) {
+            ST_ERROR("Failed to server_push_hist.");
+            goto ERR;
+        }
+        handles[i] = server_put_state(server, worker, &state,
+                worker->hists + i);
+        if (handles[i] < 0) {
+            ST_ERROR("Failed to server_put_state.");
+            handles[i] = SERVER_NO_STATE;
+            goto ERR;
+        }
+    }
+
+    return 0;
+
+ERR:
+    (void)server_free_states(server, handles, n);
+    return -1;
+}
+/*
+ * Read exactly len bytes.
+ * Return 1 if connection closed before anything read.
+ */
+static int server_read(int fd, void *buf, size_t len)
+{
+    char *p;
+    ssize_t n;
+    size_t total;
+
+    p = (char *)buf;
+    total = 0;
+    while (total < len) {
+        n = read(fd, p + total, len - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ST_WARNING("Failed to read from connection: %s.",
+                    strerror(errno));
+            return -1;
+        } else if (n == 0) {
+            if (total == 0) {
+                return 1;
+            }
+            ST_WARNING("Connection closed in the middle of request.");
+            return -1;
+        }
+        total += n;
+    }
+
+    return 0;
+}
+
+static int server_write(int fd, const void *buf, size_t len)
+{
+    const char *p;
+    ssize_t n;
+    size_t total;
+
+    p = (const char *)buf;
+    total = 0;
+    while (total < len) {
+        n = send(fd, p + total, len - total, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ST_WARNING("Failed to write to connection: %s.",
+                    strerror(errno));
+            return -1;
+        }
+        total += n;
+    }
+
+    return 0;
+}
+
+static int server_respond(int fd, int status, int len,
+        const void *buf1, size_t len1, const void *buf2, size_t len2)
+{
+    server_resp_header_t header;
+
+    header.status = status;
+    header.len = (status == 0) ? len : 0;
+
+    if (server_write(fd, &header, sizeof(header)) < 0) {
+        return -1;
+    }
+
+    if (status != 0) {
+        return 0;
+    }
+
+    if (buf1 != NULL && len1 > 0) {
+        if (server_write(fd, buf1, len1) < 0) {
+            return -1;
+        }
+    }
+
+    if (buf2 != NULL && len2 > 0) {
+        if (server_write(fd, buf2, len2) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Serve requests on a connection until it closed.
+ * Return non-zero value if connection broken.
+ */
+static int server_worker_serve(server_worker_t *worker, int fd)
+{
+    server_t *server;
+    server_req_header_t header;
+    char *word;
+    int32_t id;
+    int n;
+    int ret;
+
+    ST_CHECK_PARAM(worker == NULL || fd < 0, -1);
+
+    server = worker->server;
+
+    while (! server->stop) {
+        ret = server_read(fd, &header, sizeof(header));
+        if (ret == 1) {
+            return 0;
+        } else if (ret < 0) {
+            return -1;
+        }
+
+        if (header.len > (uint32_t)server->opt.max_req_len) {
+            ST_WARNING("Request too long[%u > %d].", header.len,
+                    server->opt.max_req_len);
+            return -1;
+        }
+        n = (int)header.len;
+        worker->num_reqs++;
+
+        switch (header.op) {
+            case SERVER_OP_SCORE_SENT:
+                if (server_read(fd, worker->req_buf,
+                            sizeof(int32_t) * n) != 0) {
+                    return -1;
+                }
+                ret = server_worker_score_sent(worker, worker->req_buf, n,
+                        worker->resp_logps);
+                if (server_respond(fd, ret, n + 1, worker->resp_logps,
+                            sizeof(double) * (n + 1), NULL, 0) < 0) {
+                    return -1;
+                }
+                break;
+            case SERVER_OP_SCORE_WORD:
+            case SERVER_OP_BATCH:
+                if (header.op == SERVER_OP_SCORE_WORD && n != 1) {
+                    ST_WARNING("len must be 1 for SCORE_WORD.");
+                    return -1;
+                }
+                if (server_read(fd, worker->req_buf,
+                            sizeof(int32_t) * 2 * n) != 0) {
+                    return -1;
+                }
+                ret = server_worker_score_batch(worker, worker->req_buf, n,
+                        worker->handles, worker->resp_logps);
+                if (server_respond(fd, ret, n,
+                            worker->handles, sizeof(int32_t) * n,
+                            worker->resp_logps, sizeof(double) * n) < 0) {
+                    return -1;
+                }
+                break;
+            case SERVER_OP_FREE_STATE:
+                if (server_read(fd, worker->req_buf,
+                            sizeof(int32_t) * n) != 0) {
+                    return -1;
+                }
+                ret = server_free_states(server, worker->req_buf, n);
+                if (server_respond(fd, ret, 0, NULL, 0, NULL, 0) < 0) {
+                    return -1;
+                }
+                break;
+            case SERVER_OP_WORD_ID:
+                word = (char *)worker->req_buf;
+                if (server_read(fd, word, n) != 0) {
+                    return -1;
+                }
+                word[n] = '\0';
+                id = vocab_get_id(server->connlm->vocab, word);
+                ret = (id < 0) ? -1 : 0;
+                if (server_respond(fd, ret, 1, &id, sizeof(int32_t),
+                            NULL, 0) < 0) {
+                    return -1;
+                }
+                break;
+            default:
+                ST_WARNING("Unknown op[%u].", header.op);
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Release the states owned by the connection of worker.
+ */
+static int server_worker_release_states(server_worker_t *worker)
+{
+    server_t *server;
+
+    ST_CHECK_PARAM(worker == NULL, -1);
+
+    server = worker->server;
+
+    if (pthread_mutex_lock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock state_lock.");
+        return -1;
+    }
+
+    while (worker->owned_states >= 0) {
+        server_release_state(server, worker->owned_states);
+    }
+
+    if (pthread_mutex_unlock(&server->state_lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock state_lock.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void* server_worker_thread(void *args)
+{
+    server_worker_t *worker;
+    server_t *server;
+    int fd;
+
+    ST_CHECK_PARAM(args == NULL, NULL);
+
+    worker = (server_worker_t *)args;
+    server = worker->server;
+
+    while (true) {
+        if (st_sem_wait(&server->sem_full) != 0) {
+            ST_ERROR("Failed to st_sem_wait sem_full.");
+            break;
+        }
+
+        pthread_mutex_lock(&server->conn_lock);
+        fd = server->conns[server->conn_head];
+        server->conn_head = (server->conn_head + 1) % SERVER_QUEUE_SIZE(server);
+        worker->fd = fd;
+        pthread_mutex_unlock(&server->conn_lock);
+
+        if (st_sem_post(&server->sem_empty) != 0) {
+            ST_ERROR("Failed to st_sem_post sem_empty.");
+            break;
+        }
+
+        if (fd < 0) { // finish
+            break;
+        }
+
+        if (server_worker_serve(worker, fd) < 0) {
+            ST_WARNING("Worker[%d]: connection closed on error.", worker->id);
+        }
+
+        if (server_worker_release_states(worker) < 0) {
+            ST_ERROR("Failed to server_worker_release_states.");
+            break;
+        }
+
+        pthread_mutex_lock(&server->conn_lock);
+        worker->fd = -1;
+        pthread_mutex_unlock(&server->conn_lock);
+        close(fd);
+    }
+
+    ST_NOTICE("Worker[%d]: Requests: " COUNT_FMT ", Words: " COUNT_FMT,
+            worker->id, worker->num_reqs, worker->num_words);
+
+    return NULL;
+}
+
+static int server_push_conn(server_t *server, int fd)
+{
+    ST_CHECK_PARAM(server == NULL, -1);
+
+    if (st_sem_wait(&server->sem_empty) != 0) {
+        ST_ERROR("Failed to st_sem_wait sem_empty.");
+        return -1;
+    }
+
+    pthread_mutex_lock(&server->conn_lock);
+    server->conns[server->conn_tail] = fd;
+    server->conn_tail = (server->conn_tail + 1) % SERVER_QUEUE_SIZE(server);
+    pthread_mutex_unlock(&server->conn_lock);
+
+    if (st_sem_post(&server->sem_full) != 0) {
+        ST_ERROR("Failed to st_sem_post sem_full.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int server_listen(server_t *server, const char *sock_path)
+{
+    struct sockaddr_un addr;
+
+    ST_CHECK_PARAM(server == NULL || sock_path == NULL, -1);
+
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        ST_ERROR("Socket path too long[%s].", sock_path);
+        return -1;
+    }
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) {
+        ST_ERROR("Failed to socket: %s.", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+
+    (void)unlink(sock_path);
+    if (bind(server->listen_fd, (struct sockaddr *)&addr,
+                sizeof(addr)) < 0) {
+        ST_ERROR("Failed to bind[%s]: %s.", sock_path, strerror(errno));
+        return -1;
+    }
+
+    if (listen(server->listen_fd, SOMAXCONN) < 0) {
+        ST_ERROR("Failed to listen[%s]: %s.", sock_path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int server_run(server_t *server, const char *sock_path)
+{
+    sigset_t sigs;
+    sigset_t old_sigs;
+    int num_started;
+    int fd;
+    int ret;
+    int i;
+
+    ST_CHECK_PARAM(server == NULL || sock_path == NULL, -1);
+
+    ret = 0;
+    num_started = 0;
+    server->stop = 0;
+
+    if (server_listen(server, sock_path) < 0) {
+        ST_ERROR("Failed to server_listen.");
+        ret = -1;
+        goto EXIT;
+    }
+
+    // signals should be handled only by the accepting thread
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs) != 0) {
+        ST_ERROR("Failed to pthread_sigmask.");
+        ret = -1;
+        goto EXIT;
+    }
+    for (i = 0; i < server->opt.num_thrs; i++) {
+        if (pthread_create(&server->workers[i].tid, NULL,
+                    server_worker_thread,
+                    (void *)(server->workers + i)) != 0) {
+            ST_ERROR("Failed to pthread_create server_worker_thread.");
+            ret = -1;
+            break;
+        }
+        num_started++;
+    }
+    if (pthread_sigmask(SIG_SETMASK, &old_sigs, NULL) != 0) {
+        ST_ERROR("Failed to pthread_sigmask.");
+        ret = -1;
+    }
+    if (ret != 0) {
+        goto EXIT;
+    }
+
+    ST_NOTICE("Serving on '%s' with %d threads, state size: %d.",
+            sock_path, server->opt.num_thrs, server->state_size);
+
+    while (! server->stop) {
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            ST_ERROR("Failed to accept: %s.", strerror(errno));
+            ret = -1;
+            break;
+        }
+
+        if (server_push_conn(server, fd) < 0) {
+            ST_ERROR("Failed to server_push_conn.");
+            close(fd);
+            ret = -1;
+            break;
+        }
+    }
+
+    ST_NOTICE("Stopping server...");
+
+EXIT:
+    server->stop = 1;
+
+    pthread_mutex_lock(&server->conn_lock);
+    for (i = 0; i < num_started; i++) {
+        if (server->workers[i].fd >= 0) {
+            (void)shutdown(server->workers[i].fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&server->conn_lock);
+
+    for (i = 0; i < num_started; i++) {
+        if (server_push_conn(server, -1) < 0) {
+            ST_ERROR("Failed to server_push_conn.");
+            ret = -1;
+        }
+    }
+
+    for (i = 0; i < num_started; i++) {
+        if (pthread_join(server->workers[i].tid, NULL) != 0) {
+            ST_ERROR("Failed to pthread_join.");
+            ret = -1;
+        }
+    }
+
+    if (server->cache != NULL) {
+        state_cache_report(server->cache);
+    }
+
+    // close connections left in queue
+    while (server->conn_head != server->conn_tail) {
+        fd = server->conns[server->conn_head];
+        if (fd >= 0) {
+            close(fd);
+        }
+        server->conn_head = (server->conn_head + 1) % SERVER_QUEUE_SIZE(server);
+    }
+
+    if (server->listen_fd >= 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        (void)unlink(sock_path);
+    }
+
+    return ret;
+}
+
+void server_stop(server_t *server)
+{
+    if (server != NULL) {
+        server->stop = 1;
+    }
+}
@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef  _CONNLM_SERVER_H_
+#define  _CONNLM_SERVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <stutils/st_opt.h>
+#include <stutils/st_semaphore.h>
+
+#include <connlm/config.h>
+
+#include "vector.h"
+#include "matrix.h"
+#include "connlm.h"
+#include "state_cache.h"
+#include "updaters/updater.h"
+
+/** @defgroup g_server connLM Server
+ * Server scoring with a loaded connLM model over a Unix-domain socket.
+ *
+ * Every request starts with a server_req_header_t, followed by the body:
+ * - SERVER_OP_SCORE_SENT: len int32 word ids of a sentence, without
+ *   \<s\> and \</s\>. Response carries len + 1 doubles, the log-probs of
+ *   every word and the \</s\>. Prefixes shared by sentences are scored
+ *   only once, if the state cache is enabled.
+ * - SERVER_OP_SCORE_WORD: one (state, word) pair as two int32.
+ *   Same response as SERVER_OP_BATCH with len = 1.
+ * - SERVER_OP_BATCH: len (state, word) pairs, 2 * len int32 in total.
+ *   Response carries len int32 state handles after the words,
+ *   followed by len doubles of log-probs.
+ * - SERVER_OP_FREE_STATE: len int32 state handles to be released.
+ *   Response is empty.
+ * - SERVER_OP_WORD_ID: len bytes of a word. Response carries one int32.
+ *
+ * Every response starts with a server_resp_header_t. The body is empty
+ * if status is not zero. All integers are in host byte order.
+ *
+ * State handles are owned by the connection which created them, and
+ * released when that connection is closed.
+ */
+
+/**
+ * Operations of server.
+ * @ingroup g_server
+ */
+typedef enum _server_op_t_ {
+    SERVER_OP_SCORE_SENT = 0, /**< score a sentence. */
+    SERVER_OP_SCORE_WORD, /**< score a word given a state handle. */
+    SERVER_OP_BATCH, /**< score a batch of (state, word) pairs. */
+    SERVER_OP_FREE_STATE, /**< release state handles. */
+    SERVER_OP_WORD_ID, /**< look up the id of a word. */
+} server_op_t;
+
+/**
+ * Header of request.
+ * @ingroup g_server
+ */
+typedef struct _server_req_header_t_ {
+    uint32_t op; /**< operation, value of server_op_t. */
+    uint32_t len; /**< number of items in body. */
+} server_req_header_t;
+
+/**
+ * Header of response.
+ * @ingroup g_server
+ */
+typedef struct _server_resp_header_t_ {
+    int32_t status; /**< zero on success, otherwise error. */
+    uint32_t len; /**< number of items in body. */
+} server_resp_header_t;
+
+/**
+ * Handle of state at the beginning of sentence, i.e. after \<s\>.
+ * It is always valid and never released.
+ * @ingroup g_server
+ */
+#define SERVER_INIT_STATE 0
+
+/**
+ * Handle returned after \</s\>, no more words could follow it.
+ * @ingroup g_server
+ */
+#define SERVER_NO_STATE -1
+
+/**
+ * Options for server.
+ * @ingroup g_server
+ */
+typedef struct _server_opt_t_ {
+    int num_thrs; /**< number of worker threads. */
+    int max_states; /**< max number of states kept in state table. */
+    int max_req_len; /**< max number of items in one request. */
+    bool self_norm; /**< use unnormalized score as prob for NCE model. */
+    int cache_size; /**< size of state cache in MB, 0 to disable. */
+} server_opt_t;
+
+/**
+ * Load server option.
+ * @ingroup g_server
+ * @param[out] server_opt options to be loaded.
+ * @param[in] opt runtime options passed by caller.
+ * @param[in] sec_name section name of runtime options to be loaded.
+ * @return non-zero value if any error.
+ */
+int server_load_opt(server_opt_t *server_opt, st_opt_t *opt,
+        const char *sec_name);
+
+/**
+ * Entry in state table.
+ * @ingroup g_server
+ */
+typedef struct _server_state_t_ {
+    mat_t state; /**< state of model, from updater_dump_state. */
+    ivec_t hist; /**< history words, the last one is not fed yet. */
+    int next_free; /**< next free entry, if this entry is free. */
+    bool used; /**< whether this entry is in use. */
+    int owner; /**< id of worker whose connection owns this entry. */
+    int prev_owned; /**< previous entry with same owner, -1 if none. */
+    int next_owned; /**< next entry with same owner, -1 if none. */
+} server_state_t;
+
+struct _server_t_;
+
+/**
+ * Worker of server, serving one connection at a time.
+ * @ingroup g_server
+ */
+typedef struct _server_worker_t_ {
+    struct _server_t_ *server; /**< the server. */
+    int id; /**< worker id. */
+
+    updater_t *updater; /**< updater for this worker. */
+    mat_t state; /**< buffer for states, one row per hypothesis. */
+    mat_t new_state; /**< buffer for states after scoring. */
+    ivec_t *hists; /**< buffer for histories, one per hypothesis. */
+    ivec_t words; /**< buffer for words to be scored. */
+    dvec_t logps; /**< buffer for log-probs of words. */
+
+    int32_t *req_buf; /**< buffer for request body. */
+    int32_t *handles; /**< buffer for state handles in response. */
+    double *resp_logps; /**< buffer for log-probs in response. */
+
+    int fd; /**< connection in serving, -1 if idle. */
+    int owned_states; /**< head of list of states owned by current
+                        connection, -1 if empty. Protected by
+                        server->state_lock. */
+    count_t num_reqs; /**< number of requests served. */
+    count_t num_words; /**< number of words scored. */
+
+    pthread_t tid; /**< thread id. */
+} server_worker_t;
+
+/**
+ * Server.
+ * @ingroup g_server
+ */
+typedef struct _server_t_ {
+    server_opt_t opt; /**< server options. */
+    connlm_t *connlm; /**< the model. */
+    int state_size; /**< size of model state. */
+    int max_hist; /**< max number of history words kept. */
+
+    server_state_t *states; /**< state table. */
+    int cap_states; /**< capacity of state table. */
+    int num_states; /**< number of entries in use. */
+    int free_states; /**< head of free entries list, -1 if empty. */
+    pthread_mutex_t state_lock; /**< lock for state table. */
+    bool state_lock_inited; /**< whether state_lock is initialized. */
+
+    state_cache_t *cache; /**< cache of states for sentence prefixes. */
+
+    server_worker_t *workers; /**< workers. */
+
+    int *conns; /**< queue of accepted connections. */
+    int conn_head; /**< next connection to be served. */
+    int conn_tail; /**< next slot to put connection. */
+    st_sem_t sem_full; /**< semaphore for queued connections. */
+    bool sem_full_inited; /**< whether sem_full is initialized. */
+    st_sem_t sem_empty; /**< semaphore for empty slots of queue. */
+    bool sem_empty_inited; /**< whether sem_empty is initialized. */
+    pthread_mutex_t conn_lock; /**< lock for queue and worker fds. */
+    bool conn_lock_inited; /**< whether conn_lock is initialized. */
+
+    int listen_fd; /**< listening socket. */
+    volatile sig_atomic_t stop; /**< whether to stop serving. */
+} server_t;
+
+/**
+ * Destroy a server and set the pointer to NULL.
+ * @ingroup g_server
+ * @param[in] ptr pointer to server_t.
+ */
+#define safe_server_destroy(ptr) do {\
+    if((ptr) != NULL) {\
+        server_destroy(ptr);\
+        safe_st_free(ptr);\
+        (ptr) = NULL;\
+    }\
+    } while(0)
+/**
+ * Destroy a server.
+ * @ingroup g_server
+ * @param[in] server server to be destroyed.
+ */
+void server_destroy(server_t *server);
+
+/**
+ * Create a server.
+ * @ingroup g_server
+ * @param[in] connlm the connlm model.
+ * @param[in] opt server options.
+ * @return server on success, otherwise NULL.
+ */
+server_t* server_create(connlm_t *connlm, server_opt_t *opt);
+
+/**
+ * Listen on the socket and serve requests, until server_stop called.
+ * @ingroup g_server
+ * @param[in] server server.
+ * @param[in] sock_path path of the Unix-domain socket.
+ * @return non-zero value if any error.
+ */
+int server_run(server_t *server, const char *sock_path);
+
+/**
+ * Ask server to stop. Could be called in signal handler.
+ * @ingroup g_server
+ * @param[in] server server.
+ */
+void server_stop(server_t *server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,518 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <stutils/st_macro.h>
+#include <stutils/st_log.h>
+#include <stutils/st_mem.h>
+
+#include "state_cache.h"
+
+#define STATE_CACHE_MIN_BUCKETS 1024
+
+void state_cache_destroy(state_cache_t *cache)
+{
+    int i;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    if (cache->entries != NULL) {
+        for (i = 0; i < cache->cap_entries; i++) {
+            mat_destroy(&cache->entries[i].state);
+            ivec_destroy(&cache->entries[i].hist);
+            ivec_destroy(&cache->entries[i].words);
+            dvec_destroy(&cache->entries[i].logps);
+        }
+        safe_st_free(cache->entries);
+    }
+    cache->cap_entries = 0;
+    cache->num_entries = 0;
+
+    safe_st_free(cache->buckets);
+    cache->num_buckets = 0;
+
+    (void)pthread_mutex_destroy(&cache->lock);
+}
+
+state_cache_t* state_cache_create(size_t max_bytes, int state_size)
+{
+    state_cache_t *cache = NULL;
+
+    int i;
+
+    ST_CHECK_PARAM(max_bytes <= 0 || state_size < 0, NULL);
+
+    cache = (state_cache_t *)st_malloc(sizeof(state_cache_t));
+    if (cache == NULL) {
+        ST_ERROR("Failed to st_malloc cache.");
+        return NULL;
+    }
+    memset(cache, 0, sizeof(state_cache_t));
+
+    cache->max_bytes = max_bytes;
+    cache->state_size = state_size;
+    cache->free_head = -1;
+    cache->lru_head = -1;
+    cache->lru_tail = -1;
+
+    cache->num_buckets = STATE_CACHE_MIN_BUCKETS;
+    cache->buckets = (int *)st_malloc(sizeof(int) * cache->num_buckets);
+    if (cache->buckets == NULL) {
+        ST_ERROR("Failed to st_malloc buckets.");
+        goto ERR;
+    }
+    for (i = 0; i < cache->num_buckets; i++) {
+        cache->buckets[i] = -1;
+    }
+
+    if (pthread_mutex_init(&cache->lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init.");
+        goto ERR;
+    }
+
+    return cache;
+
+ERR:
+    safe_state_cache_destroy(cache);
+    return NULL;
+}
+
+#define bucket_of(cache, key) \
+    ((int)(((key) ^ ((key) >> 32)) & (hist_key_t)((cache)->num_buckets - 1)))
+
+static int state_cache_find(state_cache_t *cache, hist_key_t key)
+{
+    int e;
+
+    e = cache->buckets[bucket_of(cache, key)];
+    while (e >= 0) {
+        if (cache->entries[e].key == key) {
+            return e;
+        }
+        e = cache->entries[e].hash_next;
+    }
+
+    return -1;
+}
+
+static void lru_unlink(state_cache_t *cache, int e)
+{
+    state_cache_entry_t *entry;
+
+    entry = cache->entries + e;
+    if (entry->prev >= 0) {
+        cache->entries[entry->prev].next = entry->next;
+    } else {
+        cache->lru_head = entry->next;
+    }
+    if (entry->next >= 0) {
+        cache->entries[entry->next].prev = entry->prev;
+    } else {
+        cache->lru_tail = entry->prev;
+    }
+    entry->prev = -1;
+    entry->next = -1;
+}
+
+static void lru_push_front(state_cache_t *cache, int e)
+{
+    state_cache_entry_t *entry;
+
+    entry = cache->entries + e;
+    entry->prev = -1;
+    entry->next = cache->lru_head;
+    if (cache->lru_head >= 0) {
+        cache->entries[cache->lru_head].prev = e;
+    }
+    cache->lru_head = e;
+    if (cache->lru_tail < 0) {
+        cache->lru_tail = e;
+    }
+}
+
+static void lru_touch(state_cache_t *cache, int e)
+{
+    if (cache->lru_head != e) {
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+    }
+}
+
+static size_t entry_bytes(state_cache_entry_t *entry)
+{
+    return sizeof(state_cache_entry_t)
+        + sizeof(real_t) * entry->state.capacity
+        + sizeof(int) * entry->hist.capacity
+        + sizeof(int) * entry->words.capacity
+        + sizeof(double) * entry->logps.capacity;
+}
+
+static void state_cache_evict(state_cache_t *cache, int e)
+{
+    state_cache_entry_t *entry;
+    int *p;
+
+    entry = cache->entries + e;
+
+    p = cache->buckets + bucket_of(cache, entry->key);
+    while (*p != e) {
+        p = &cache->entries[*p].hash_next;
+    }
+    *p = entry->hash_next;
+
+    lru_unlink(cache, e);
+
+    cache->bytes -= entry->bytes;
+    mat_destroy(&entry->state);
+    ivec_destroy(&entry->hist);
+    ivec_destroy(&entry->words);
+    dvec_destroy(&entry->logps);
+    entry->bytes = 0;
+    entry->used = false;
+
+    entry->next = cache->free_head;
+    cache->free_head = e;
+    cache->num_entries--;
+    cache->num_evicts++;
+}
+
+/*
+ * Evict least recently used entries, except the keep one,
+ * until the cache fits into max_bytes.
+ */
+static void state_cache_shrink(state_cache_t *cache, int keep)
+{
+    int e;
+
+    while (cache->bytes > cache->max_bytes) {
+        e = cache->lru_tail;
+        if (e == keep) {
+            e = cache->entries[e].prev;
+        }
+        if (e < 0) {
+            break;
+        }
+        state_cache_evict(cache, e);
+    }
+}
+
+static int state_cache_rehash(state_cache_t *cache, int num_buckets)
+{
+    int *buckets;
+    int b, e;
+
+    buckets = (int *)st_malloc(sizeof(int) * num_buckets);
+    if (buckets == NULL) {
+        ST_ERROR("Failed to st_malloc buckets.");
+        return -1;
+    }
+    for (b = 0; b < num_buckets; b++) {
+        buckets[b] = -1;
+    }
+
+    safe_st_free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+
+    for (e = 0; e < cache->cap_entries; e++) {
+        if (! cache->entries[e].used) {
+            continue;
+        }
+        b = bucket_of(cache, cache->entries[e].key);
+        cache->entries[e].hash_next = cache->buckets[b];
+        cache->buckets[b] = e;
+    }
+
+    return 0;
+}
+
+static int state_cache_alloc(state_cache_t *cache, hist_key_t key)
+{
+    state_cache_entry_t *entry;
+    int cap;
+    int b, e;
+
+    if (cache->free_head < 0) {
+        cap = max(cache->cap_entries * 2, STATE_CACHE_MIN_BUCKETS);
+        cache->entries = (state_cache_entry_t *)st_realloc(cache->entries,
+                sizeof(state_cache_entry_t) * cap);
+        if (cache->entries == NULL) {
+            ST_ERROR("Failed to st_realloc entries.");
+            return -1;
+        }
+        memset(cache->entries + cache->cap_entries, 0,
+                sizeof(state_cache_entry_t) * (cap - cache->cap_entries));
+        for (e = cap - 1; e >= cache->cap_entries; e--) {
+            cache->entries[e].next = cache->free_head;
+            cache->free_head = e;
+        }
+        cache->cap_entries = cap;
+    }
+
+    if (cache->num_entries >= cache->num_buckets) {
+        if (state_cache_rehash(cache, cache->num_buckets * 2) < 0) {
+            ST_ERROR("Failed to state_cache_rehash.");
+            return -1;
+        }
+    }
+
+    e = cache->free_head;
+    entry = cache->entries + e;
+    cache->free_head = entry->next;
+
+    entry->key = key;
+    entry->bytes = 0;
+    entry->used = true;
+
+    b = bucket_of(cache, key);
+    entry->hash_next = cache->buckets[b];
+    cache->buckets[b] = e;
+
+    lru_push_front(cache, e);
+    cache->num_entries++;
+
+    return e;
+}
+
+int state_cache_lookup(state_cache_t *cache, hist_key_t key,
+        mat_t *state, ivec_t *hist)
+{
+    state_cache_entry_t *entry;
+    int e;
+
+    ST_CHECK_PARAM(cache == NULL, -1);
+
+    if (pthread_mutex_lock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+
+    cache->num_lookups++;
+    e = state_cache_find(cache, key);
+    if (e < 0) {
+        goto EXIT;
+    }
+    cache->num_hits++;
+    lru_touch(cache, e);
+
+    entry = cache->entries + e;
+    if (state != NULL && cache->state_size > 0) {
+        if (mat_cpy(state, &entry->state) < 0) {
+            ST_ERROR("Failed to mat_cpy state.");
+            goto ERR;
+        }
+    }
+    if (hist != NULL) {
+        if (ivec_cpy(hist, &entry->hist) < 0) {
+            ST_ERROR("Failed to ivec_cpy hist.");
+            goto ERR;
+        }
+    }
+
+EXIT:
+    if (pthread_mutex_unlock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock.");
+        return -1;
+    }
+
+    return (e >= 0) ? 1 : 0;
+
+ERR:
+    (void)pthread_mutex_unlock(&cache->lock);
+    return -1;
+}
+
+int state_cache_lookup_logp(state_cache_t *cache, hist_key_t key,
+        int word, double *logp)
+{
+    state_cache_entry_t *entry;
+    int e, i;
+    int ret;
+
+    ST_CHECK_PARAM(cache == NULL || logp == NULL, -1);
+
+    if (pthread_mutex_lock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+
+    ret = 0;
+    cache->num_logp_lookups++;
+    e = state_cache_find(cache, key);
+    if (e >= 0) {
+        entry = cache->entries + e;
+        for (i = 0; i < entry->words.size; i++) {
+            if (VEC_VAL(&entry->words, i) == word) {
+                *logp = VEC_VAL(&entry->logps, i);
+                cache->num_logp_hits++;
+                lru_touch(cache, e);
+                ret = 1;
+                break;
+            }
+        }
+    }
+
+    if (pthread_mutex_unlock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock.");
+        return -1;
+    }
+
+    return ret;
+}
+
+int state_cache_insert(state_cache_t *cache, hist_key_t key,
+        mat_t *state, ivec_t *hist)
+{
+    state_cache_entry_t *entry;
+    int e;
+
+    ST_CHECK_PARAM(cache == NULL || hist == NULL
+            || (state == NULL && cache->state_size > 0), -1);
+
+    if (pthread_mutex_lock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+
+    e = state_cache_find(cache, key);
+    if (e < 0) {
+        e = state_cache_alloc(cache, key);
+        if (e < 0) {
+            ST_ERROR("Failed to state_cache_alloc.");
+            goto ERR;
+        }
+    } else {
+        lru_touch(cache, e);
+    }
+
+    entry = cache->entries + e;
+    if (cache->state_size > 0) {
+        if (mat_cpy(&entry->state, state) < 0) {
+            ST_ERROR("Failed to mat_cpy state.");
+            goto ERR;
+        }
+    }
+    if (ivec_cpy(&entry->hist, hist) < 0) {
+        ST_ERROR("Failed to ivec_cpy hist.");
+        goto ERR;
+    }
+
+    cache->bytes -= entry->bytes;
+    entry->bytes = entry_bytes(entry);
+    cache->bytes += entry->bytes;
+
+    state_cache_shrink(cache, e);
+
+    if (pthread_mutex_unlock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock.");
+        return -1;
+    }
+
+    return 0;
+
+ERR:
+    (void)pthread_mutex_unlock(&cache->lock);
+    return -1;
+}
+
+int state_cache_add_logp(state_cache_t *cache, hist_key_t key,
+        int word, double logp)
+{
+    state_cache_entry_t *entry;
+    int e, i;
+
+    ST_CHECK_PARAM(cache == NULL, -1);
+
+    if (pthread_mutex_lock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_lock.");
+        return -1;
+    }
+
+    e = state_cache_find(cache, key);
+    if (e < 0) {
+        goto EXIT;
+    }
+
+    entry = cache->entries + e;
+    for (i = 0; i < entry->words.size; i++) {
+        if (VEC_VAL(&entry->words, i) == word) {
+            goto EXIT;
+        }
+    }
+
+    if (ivec_append(&entry->words, word) < 0) {
+        ST_ERROR("Failed to ivec_append words.");
+        goto ERR;
+    }
+    if (dvec_resize(&entry->logps, entry->words.size, NAN) < 0) {
+        ST_ERROR("Failed to dvec_resize logps.");
+        goto ERR;
+    }
+    VEC_VAL(&entry->logps, entry->words.size - 1) = logp;
+
+    cache->bytes -= entry->bytes;
+    entry->bytes = entry_bytes(entry);
+    cache->bytes += entry->bytes;
+
+    lru_touch(cache, e);
+    state_cache_shrink(cache, e);
+
+EXIT:
+    if (pthread_mutex_unlock(&cache->lock) != 0) {
+        ST_ERROR("Failed to pthread_mutex_unlock.");
+        return -1;
+    }
+
+    return 0;
+
+ERR:
+    (void)pthread_mutex_unlock(&cache->lock);
+    return -1;
+}
+
+void state_cache_report(state_cache_t *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    ST_NOTICE("State cache: entries: %d, bytes: %zu/%zu, evicts: " COUNT_FMT,
+            cache->num_entries, cache->bytes, cache->max_bytes,
+            cache->num_evicts);
+    ST_NOTICE("State cache: state hits: " COUNT_FMT "/" COUNT_FMT
+            "(%.2f%%), logp hits: " COUNT_FMT "/" COUNT_FMT "(%.2f%%)",
+            cache->num_hits, cache->num_lookups,
+            cache->num_lookups > 0
+                ? 100.0 * cache->num_hits / cache->num_lookups : 0.0,
+            cache->num_logp_hits, cache->num_logp_lookups,
+            cache->num_logp_lookups > 0
+                ? 100.0 * cache->num_logp_hits / cache->num_logp_lookups
+                : 0.0);
+}
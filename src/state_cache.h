@@ -0,0 +1,202 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef  _CONNLM_STATE_CACHE_H_
+#define  _CONNLM_STATE_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <connlm/config.h>
+
+#include "vector.h"
+#include "matrix.h"
+
+/** @defgroup g_state_cache State Cache
+ * LRU cache of model states, keyed by the hash of word history.
+ *
+ * Every entry holds the state and the (truncated) history words needed
+ * to score the next word after a history, together with the log-probs
+ * of the next words already scored. The total size of entries is bounded
+ * by bytes; the least recently used entries are evicted first.
+ */
+
+/**
+ * Key of word history.
+ * @ingroup g_state_cache
+ */
+typedef uint64_t hist_key_t;
+
+/**
+ * Key of the empty history, i.e. only with \<s\>.
+ * @ingroup g_state_cache
+ */
+#define HIST_KEY_INIT ((hist_key_t)14695981039346656037ULL)
+
+/**
+ * Rolling hash: key of history extended with a word.
+ * @ingroup g_state_cache
+ */
+#define hist_key_append(key, word) \
+    (((key) ^ (hist_key_t)(uint32_t)(word)) * (hist_key_t)1099511628211ULL)
+
+/**
+ * Entry of state cache.
+ * @ingroup g_state_cache
+ */
+typedef struct _state_cache_entry_t_ {
+    hist_key_t key; /**< key of history. */
+    mat_t state; /**< state, one row. */
+    ivec_t hist; /**< history words fed with state. */
+    ivec_t words; /**< next words with log-prob cached. */
+    dvec_t logps; /**< log-probs of words. */
+    size_t bytes; /**< size of this entry in bytes. */
+
+    int prev; /**< previous entry in LRU list. */
+    int next; /**< next entry in LRU list, or free list. */
+    int hash_next; /**< next entry in hash bucket. */
+    bool used; /**< whether this entry is in use. */
+} state_cache_entry_t;
+
+/**
+ * State cache.
+ * @ingroup g_state_cache
+ */
+typedef struct _state_cache_t_ {
+    size_t max_bytes; /**< max size of cache in bytes. */
+    size_t bytes; /**< current size of cache in bytes. */
+    int state_size; /**< size of state. */
+
+    state_cache_entry_t *entries; /**< entries. */
+    int cap_entries; /**< capacity of entries. */
+    int num_entries; /**< number of entries in use. */
+    int free_head; /**< head of free entries list. */
+    int lru_head; /**< most recently used entry. */
+    int lru_tail; /**< least recently used entry. */
+
+    int *buckets; /**< hash buckets, head entry of every bucket. */
+    int num_buckets; /**< number of buckets, power of 2. */
+
+    count_t num_lookups; /**< number of state lookups. */
+    count_t num_hits; /**< number of state hits. */
+    count_t num_logp_lookups; /**< number of log-prob lookups. */
+    count_t num_logp_hits; /**< number of log-prob hits. */
+    count_t num_evicts; /**< number of evicted entries. */
+
+    pthread_mutex_t lock; /**< lock for cache. */
+} state_cache_t;
+
+/**
+ * Destroy a state cache and set the pointer to NULL.
+ * @ingroup g_state_cache
+ * @param[in] ptr pointer to state_cache_t.
+ */
+#define safe_state_cache_destroy(ptr) do {\
+    if((ptr) != NULL) {\
+        state_cache_destroy(ptr);\
+        safe_st_free(ptr);\
+        (ptr) = NULL;\
+    }\
+    } while(0)
+/**
+ * Destroy a state cache.
+ * @ingroup g_state_cache
+ * @param[in] cache state cache to be destroyed.
+ */
+void state_cache_destroy(state_cache_t *cache);
+
+/**
+ * Create a state cache.
+ * @ingroup g_state_cache
+ * @param[in] max_bytes max size of cache in bytes.
+ * @param[in] state_size size of state, could be 0.
+ * @return state cache on success, otherwise NULL.
+ */
+state_cache_t* state_cache_create(size_t max_bytes, int state_size);
+
+/**
+ * Look up the state of a history.
+ * @ingroup g_state_cache
+ * @param[in] cache state cache.
+ * @param[in] key key of history.
+ * @param[out] state state of history, one row, ignored if NULL.
+ * @param[out] hist history words, ignored if NULL.
+ * @return -1 if any error, 1 if found, otherwise 0.
+ */
+int state_cache_lookup(state_cache_t *cache, hist_key_t key,
+        mat_t *state, ivec_t *hist);
+
+/**
+ * Look up the log-prob of a word following a history.
+ * @ingroup g_state_cache
+ * @param[in] cache state cache.
+ * @param[in] key key of history.
+ * @param[in] word the word.
+ * @param[out] logp log-prob of word.
+ * @return -1 if any error, 1 if found, otherwise 0.
+ */
+int state_cache_lookup_logp(state_cache_t *cache, hist_key_t key,
+        int word, double *logp);
+
+/**
+ * Insert (or update) the state of a history.
+ * @ingroup g_state_cache
+ * @param[in] cache state cache.
+ * @param[in] key key of history.
+ * @param[in] state state of history, one row.
+ * @param[in] hist history words.
+ * @return non-zero value if any error.
+ */
+int state_cache_insert(state_cache_t *cache, hist_key_t key,
+        mat_t *state, ivec_t *hist);
+
+/**
+ * Add the log-prob of a word following a history.
+ * Nothing will be done if the history is not in cache.
+ * @ingroup g_state_cache
+ * @param[in] cache state cache.
+ * @param[in] key key of history.
+ * @param[in] word the word.
+ * @param[in] logp log-prob of word.
+ * @return non-zero value if any error.
+ */
+int state_cache_add_logp(state_cache_t *cache, hist_key_t key,
+        int word, double logp);
+
+/**
+ * Print out statistics of cache.
+ * @ingroup g_state_cache
+ * @param[in] cache state cache.
+ */
+void state_cache_report(state_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,665 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "ckpt.h"
+#include "vocab-test.h"
+
+#define NUM_THRS 2
+#define NUM_LINES 29
+#define NUM_TRAINED 5
+#define NUM_ROWS 8
+#define NUM_COLS 1500 /* more than one block per row. */
+#define TOL 2e-3
+
+static int make_file(const char *file)
+{
+    FILE *fp;
+
+    fp = fopen(file, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static int save_state(ckpt_opt_t *opt, ckpt_state_t *state)
+{
+    char file[MAX_DIR_LEN];
+    FILE *fp;
+    int ret;
+
+    snprintf(file, MAX_DIR_LEN, "%s.state", opt->file);
+    fp = fopen(file, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    ret = ckpt_state_save(state, fp);
+    fclose(fp);
+
+    return ret;
+}
+
+static void remove_files(ckpt_opt_t *opt)
+{
+    char file[MAX_DIR_LEN];
+
+    snprintf(file, MAX_DIR_LEN, "%s.state", opt->file);
+    (void)unlink(file);
+    (void)unlink(opt->file);
+}
+
+static int unit_test_ckpt_state()
+{
+    ckpt_opt_t opt;
+    ckpt_state_t state;
+    ckpt_state_t loaded;
+    reader_pos_t poses[NUM_THRS];
+    unsigned int seeds[NUM_THRS + 1];
+    int i;
+
+    fprintf(stderr, "  Testing saving and loading state...");
+
+    memset(&opt, 0, sizeof(ckpt_opt_t));
+    memset(&loaded, 0, sizeof(ckpt_state_t));
+    snprintf(opt.file, MAX_DIR_LEN, "/tmp/connlm-ckpt-test.%d",
+            (int)getpid());
+
+    memset(&state, 0, sizeof(ckpt_state_t));
+    state.epoch = 3;
+    state.lr_scale = 1.0 / 3;
+    state.halving = true;
+    state.loss = 123.456789012345;
+    state.accepted = true;
+    for (i = 0; i < NUM_THRS; i++) {
+        poses[i].pos = ((int64_t)1 << 40) + i;
+        poses[i].random = 4000000000U - i;
+        poses[i].num_sents = 1000 + i;
+        poses[i].num_words = 20000 + i;
+        poses[i].num_oovs = 30 + i;
+    }
+    state.poses = poses;
+    state.num_poses = NUM_THRS;
+    for (i = 0; i < NUM_THRS + 1; i++) {
+        seeds[i] = 7 * i + 1;
+    }
+    state.seeds = seeds;
+    state.num_seeds = NUM_THRS + 1;
+
+    /* nothing to resume without the model file. */
+    if (save_state(&opt, &state) < 0) {
+        goto ERR;
+    }
+    if (ckpt_load_state(&opt, &loaded) != 1) {
+        goto ERR;
+    }
+
+    if (make_file(opt.file) < 0) {
+        goto ERR;
+    }
+    if (ckpt_load_state(&opt, &loaded) != 0) {
+        goto ERR;
+    }
+
+    if (loaded.epoch != state.epoch || loaded.lr_scale != state.lr_scale
+            || loaded.halving != state.halving
+            || loaded.loss != state.loss
+            || loaded.accepted != state.accepted) {
+        goto ERR;
+    }
+    if (loaded.num_poses != state.num_poses) {
+        goto ERR;
+    }
+    for (i = 0; i < state.num_poses; i++) {
+        if (loaded.poses[i].pos != poses[i].pos
+                || loaded.poses[i].random != poses[i].random
+                || loaded.poses[i].num_sents != poses[i].num_sents
+                || loaded.poses[i].num_words != poses[i].num_words
+                || loaded.poses[i].num_oovs != poses[i].num_oovs) {
+            goto ERR;
+        }
+    }
+    if (loaded.num_seeds != state.num_seeds) {
+        goto ERR;
+    }
+    for (i = 0; i < state.num_seeds; i++) {
+        if (loaded.seeds[i] != seeds[i]) {
+            goto ERR;
+        }
+    }
+
+    /* nothing to resume once removed, and removing again is fine. */
+    if (ckpt_remove(&opt) < 0 || ckpt_remove(&opt) < 0) {
+        goto ERR;
+    }
+    if (access(opt.file, F_OK) == 0) {
+        goto ERR;
+    }
+    ckpt_state_destroy(&loaded);
+    if (ckpt_load_state(&opt, &loaded) != 1) {
+        goto ERR;
+    }
+
+    ckpt_state_destroy(&loaded);
+    remove_files(&opt);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    ckpt_state_destroy(&loaded);
+    remove_files(&opt);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+/* a model with a single weight. */
+typedef struct _test_model_t_ {
+    connlm_t connlm;
+    component_t comp;
+    component_t *comps[1];
+    glue_t glue;
+    glue_t *glues[1];
+    weight_t wt;
+    weight_t *wts[1];
+} test_model_t;
+
+/* an updater of worker thread, training the single weight. */
+typedef struct _test_updater_t_ {
+    updater_t updater;
+    comp_updater_t comp_updater;
+    comp_updater_t *comp_updaters[1];
+    glue_updater_t glue_updater;
+    glue_updater_t *glue_updaters[1];
+    wt_updater_t *wt_updaters[1];
+} test_updater_t;
+
+static real_t val_of(int i, int j)
+{
+    return (real_t)(((i * 31 + j * 17) % 23) - 11) / 23.0;
+}
+
+static void test_model_destroy(test_model_t *model)
+{
+    mat_destroy(&model->wt.w);
+    vec_destroy(&model->wt.bias);
+}
+
+static int test_model_init(test_model_t *model)
+{
+    int i, j;
+
+    memset(model, 0, sizeof(test_model_t));
+
+    if (mat_resize(&model->wt.w, NUM_ROWS, NUM_COLS, 0.0) < 0
+            || vec_resize(&model->wt.bias, NUM_ROWS, 0.0) < 0) {
+        return -1;
+    }
+    for (i = 0; i < NUM_ROWS; i++) {
+        for (j = 0; j < NUM_COLS; j++) {
+            MAT_VAL(&model->wt.w, i, j) = val_of(i, j);
+        }
+        VEC_VAL(&model->wt.bias, i) = val_of(i, NUM_COLS);
+    }
+
+    strcpy(model->glue.name, "glue");
+    model->wts[0] = &model->wt;
+    model->glue.wts = model->wts;
+    model->glue.num_wts = 1;
+    model->glues[0] = &model->glue;
+    model->comp.glues = model->glues;
+    model->comp.num_glue = 1;
+    model->comps[0] = &model->comp;
+    model->connlm.comps = model->comps;
+    model->connlm.num_comp = 1;
+
+    return 0;
+}
+
+static void test_updater_destroy(test_updater_t *tu)
+{
+    safe_wt_updater_destroy(tu->wt_updaters[0]);
+}
+
+static int test_updater_init(test_updater_t *tu, test_model_t *model)
+{
+    param_t param;
+
+    memset(tu, 0, sizeof(test_updater_t));
+
+    memset(&param, 0, sizeof(param_t));
+    param.learn_rate = 0.1;
+    param.learn_rate_coef = 1.0;
+    param.bias_learn_rate_coef = 1.0;
+    param.l2_penalty = 0.2;
+    param.momentum = 0.5;
+    param.momentum_coef = 1.0;
+    param.sync_size = 2;
+    tu->wt_updaters[0] = wt_updater_create(&param, &model->wt.w,
+            &model->wt.bias, WT_UT_ONE_SHOT);
+    if (tu->wt_updaters[0] == NULL) {
+        return -1;
+    }
+
+    tu->glue_updater.glue = &model->glue;
+    tu->glue_updater.wt_updaters = tu->wt_updaters;
+    tu->glue_updater.num_wt_updaters = 1;
+    tu->glue_updaters[0] = &tu->glue_updater;
+    tu->comp_updater.comp = &model->comp;
+    tu->comp_updater.glue_updaters = tu->glue_updaters;
+    tu->comp_updaters[0] = &tu->comp_updater;
+    tu->updater.connlm = &model->connlm;
+    tu->updater.comp_updaters = tu->comp_updaters;
+
+    return 0;
+}
+
+/* train a mini-batch updating a single row. */
+static int test_updater_step(test_updater_t *tu, int row)
+{
+    mat_t er = {0};
+    mat_t in = {0};
+    int j;
+
+    if (mat_resize(&er, 1, 1, 0.0) < 0
+            || mat_resize(&in, 1, NUM_COLS, 0.0) < 0) {
+        goto ERR;
+    }
+    MAT_VAL(&er, 0, 0) = val_of(row, 0) + 0.5;
+    for (j = 0; j < NUM_COLS; j++) {
+        MAT_VAL(&in, 0, j) = val_of(row, j + 1);
+    }
+
+    if (wt_update_rows(tu->wt_updaters[0], &er, 1.0, &in, 1.0, &row) < 0) {
+        goto ERR;
+    }
+    if (wt_updater_flush(tu->wt_updaters[0]) < 0) {
+        goto ERR;
+    }
+
+    mat_destroy(&er);
+    mat_destroy(&in);
+    return 0;
+
+ERR:
+    mat_destroy(&er);
+    mat_destroy(&in);
+    return -1;
+}
+
+static double max_diff(weight_t *a, weight_t *b)
+{
+    double d, diff;
+    int i, j;
+
+    diff = 0.0;
+    for (i = 0; i < NUM_ROWS; i++) {
+        for (j = 0; j < NUM_COLS; j++) {
+            d = fabs(MAT_VAL(&a->w, i, j) - MAT_VAL(&b->w, i, j));
+            diff = d > diff ? d : diff;
+        }
+        d = fabs(VEC_VAL(&a->bias, i) - VEC_VAL(&b->bias, i));
+        diff = d > diff ? d : diff;
+    }
+
+    return diff;
+}
+
+static int unit_test_ckpt_pending()
+{
+    test_model_t model;
+    test_model_t shadow;
+    test_model_t live;
+    test_updater_t tus[NUM_THRS];
+    updater_t *updaters[NUM_THRS];
+    int t;
+
+    fprintf(stderr, "  Testing copying weights with pending updates...");
+
+    memset(&model, 0, sizeof(test_model_t));
+    memset(&shadow, 0, sizeof(test_model_t));
+    memset(&live, 0, sizeof(test_model_t));
+    memset(tus, 0, sizeof(tus));
+    if (test_model_init(&model) < 0 || test_model_init(&shadow) < 0
+            || test_model_init(&live) < 0) {
+        goto ERR;
+    }
+    for (t = 0; t < NUM_THRS; t++) {
+        if (test_updater_init(tus + t, &model) < 0) {
+            goto ERR;
+        }
+        updaters[t] = &tus[t].updater;
+    }
+
+    /* the first two steps are synced, and the last one is pending.
+     * blocks not updated in the last step are behind on the penalty
+     * and momentum. */
+    for (t = 0; t < NUM_THRS; t++) {
+        if (test_updater_step(tus + t, t) < 0
+                || test_updater_step(tus + t, t + 2) < 0
+                || test_updater_step(tus + t, t + 4) < 0) {
+            goto ERR;
+        }
+    }
+
+    if (ckpt_copy_weights(&live.connlm, &model.connlm, NULL, 0) < 0) {
+        goto ERR;
+    }
+    if (ckpt_copy_weights(&shadow.connlm, &model.connlm,
+                updaters, NUM_THRS) < 0) {
+        goto ERR;
+    }
+    if (max_diff(&live.wt, &model.wt) != 0.0) {
+        goto ERR;
+    }
+    if (max_diff(&shadow.wt, &model.wt) <= TOL) {
+        goto ERR;
+    }
+
+    /* finishing applies the same updates on the model, up to the order
+     * of the updaters catching up. */
+    for (t = 0; t < NUM_THRS; t++) {
+        if (wt_updater_finish(tus[t].wt_updaters[0]) < 0) {
+            goto ERR;
+        }
+    }
+    if (max_diff(&shadow.wt, &model.wt) > TOL) {
+        goto ERR;
+    }
+
+    for (t = 0; t < NUM_THRS; t++) {
+        test_updater_destroy(tus + t);
+    }
+    test_model_destroy(&model);
+    test_model_destroy(&shadow);
+    test_model_destroy(&live);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    for (t = 0; t < NUM_THRS; t++) {
+        test_updater_destroy(tus + t);
+    }
+    test_model_destroy(&model);
+    test_model_destroy(&shadow);
+    test_model_destroy(&live);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+static int make_text(const char *text_file)
+{
+    FILE *fp;
+    int i, j, c;
+
+    fp = fopen(text_file, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    for (i = 0; i < NUM_LINES; i++) {
+        for (j = 0; j <= i % 3; j++) {
+            c = 'C' + (i + j) % (VOCAB_TEST_SIZE - 2);
+            fprintf(fp, "%s%c%c%c", j > 0 ? " " : "", c, c, c);
+        }
+        fprintf(fp, "\n");
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static reader_t* start_reader(const char *text_file, vocab_t *vocab,
+        reader_pos_t *poses, thr_stat_t *stats, int *err)
+{
+    reader_opt_t reader_opt;
+    reader_t *reader;
+
+    memset(&reader_opt, 0, sizeof(reader_opt_t));
+    reader_opt.epoch_size = 3;
+    reader_opt.mini_batch = 1;
+    reader_opt.rand_seed = 1;
+    reader_opt.shuffle = true;
+    reader_opt.drop_empty_line = true;
+    reader = reader_create(&reader_opt, NUM_THRS, vocab, text_file);
+    if (reader == NULL) {
+        return NULL;
+    }
+    if (poses != NULL) {
+        if (reader_set_resume(reader, poses, 1) < 0) {
+            safe_reader_destroy(reader);
+            return NULL;
+        }
+    }
+    if (reader_keep_poses(reader) < 0) {
+        safe_reader_destroy(reader);
+        return NULL;
+    }
+    memset(stats, 0, sizeof(thr_stat_t) * NUM_THRS);
+    if (reader_read(reader, stats, err) < 0) {
+        safe_reader_destroy(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+/* read words of all word pools left, or only n of them if n >= 0. */
+static int read_words(reader_t *reader, ivec_t *words, int n)
+{
+    word_pool_t *wp;
+    int i;
+
+    while (n != 0 && (wp = reader_hold_word_pool(reader, 0)) != NULL) {
+        if (words != NULL) {
+            for (i = 0; i < wp->words.size; i++) {
+                if (ivec_append(words, VEC_VAL(&wp->words, i)) < 0) {
+                    (void)reader_release_word_pool(reader, 0, wp);
+                    return -1;
+                }
+            }
+        }
+        if (reader_release_word_pool(reader, 0, wp) < 0) {
+            return -1;
+        }
+        if (n > 0) {
+            n--;
+        }
+    }
+
+    return 0;
+}
+
+static int unit_test_reader_resume()
+{
+    char text_file[MAX_DIR_LEN];
+    ckpt_opt_t opt;
+    ckpt_state_t state;
+    ckpt_state_t loaded;
+    thr_stat_t stats[NUM_THRS];
+    reader_pos_t poses[1];
+    unsigned int seeds[NUM_THRS];
+    ivec_t words = {0};
+    ivec_t resumed = {0};
+    vocab_t *vocab = NULL;
+    reader_t *reader = NULL;
+    bool reading = false;
+    int err = 0;
+    int i;
+
+    fprintf(stderr, "  Testing resuming reader...");
+
+    memset(&opt, 0, sizeof(ckpt_opt_t));
+    memset(&loaded, 0, sizeof(ckpt_state_t));
+    snprintf(opt.file, MAX_DIR_LEN, "/tmp/connlm-ckpt-test.%d",
+            (int)getpid());
+    snprintf(text_file, MAX_DIR_LEN, "/tmp/connlm-ckpt-test.%d.txt",
+            (int)getpid());
+    if (make_text(text_file) < 0) {
+        goto ERR;
+    }
+
+    vocab = vocab_test_new();
+
+    /* train some word pools, and take a checkpoint. */
+    reader = start_reader(text_file, vocab, NULL, stats, &err);
+    if (reader == NULL) {
+        goto ERR;
+    }
+    reading = true;
+    if (read_words(reader, NULL, NUM_TRAINED) < 0) {
+        goto ERR;
+    }
+    if (reader_get_poses(reader, poses) < 0) {
+        goto ERR;
+    }
+    if (read_words(reader, &words, -1) < 0) {
+        goto ERR;
+    }
+    reading = false;
+    if (reader_wait(reader) < 0 || err != 0) {
+        goto ERR;
+    }
+    safe_reader_destroy(reader);
+
+    memset(&state, 0, sizeof(ckpt_state_t));
+    state.epoch = 1;
+    state.lr_scale = 1.0;
+    state.poses = poses;
+    state.num_poses = 1;
+    for (i = 0; i < NUM_THRS; i++) {
+        seeds[i] = i;
+    }
+    state.seeds = seeds;
+    state.num_seeds = NUM_THRS;
+    if (make_file(opt.file) < 0 || save_state(&opt, &state) < 0) {
+        goto ERR;
+    }
+    if (ckpt_load_state(&opt, &loaded) != 0) {
+        goto ERR;
+    }
+
+    /* resumed reader reads the same words as the rest of the first one. */
+    reader = start_reader(text_file, vocab, loaded.poses, stats, &err);
+    if (reader == NULL) {
+        goto ERR;
+    }
+    reading = true;
+    if (read_words(reader, &resumed, -1) < 0) {
+        goto ERR;
+    }
+    reading = false;
+    if (reader_wait(reader) < 0 || err != 0) {
+        goto ERR;
+    }
+    if (reader->num_sents != NUM_LINES) {
+        goto ERR;
+    }
+
+    if (words.size <= 0 || resumed.size != words.size) {
+        goto ERR;
+    }
+    for (i = 0; i < words.size; i++) {
+        if (VEC_VAL(&resumed, i) != VEC_VAL(&words, i)) {
+            goto ERR;
+        }
+    }
+
+    safe_reader_destroy(reader);
+    safe_vocab_destroy(vocab);
+    ivec_destroy(&words);
+    ivec_destroy(&resumed);
+    ckpt_state_destroy(&loaded);
+    remove_files(&opt);
+    (void)unlink(text_file);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    if (reading) {
+        err = -1;
+        (void)read_words(reader, NULL, -1);
+        (void)reader_wait(reader);
+    }
+    safe_reader_destroy(reader);
+    safe_vocab_destroy(vocab);
+    ivec_destroy(&words);
+    ivec_destroy(&resumed);
+    ckpt_state_destroy(&loaded);
+    remove_files(&opt);
+    (void)unlink(text_file);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+static int run_all_tests()
+{
+    int ret = 0;
+
+    if (unit_test_ckpt_state() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_reader_resume() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_ckpt_pending() != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret;
+
+    fprintf(stderr, "Start testing...\n");
+    ret = run_all_tests();
+    if (ret != 0) {
+        fprintf(stderr, "Tests failed.\n");
+    } else {
+        fprintf(stderr, "Tests succeeded.\n");
+    }
+
+    return ret;
+}
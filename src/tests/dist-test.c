@@ -0,0 +1,349 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "dist.h"
+#include "updaters/wt_updater.h"
+
+#define NUM_ROWS 4
+#define NUM_COLS 600
+
+/* a model with a single weight, and an updater training it. */
+typedef struct _test_worker_t_ {
+    connlm_t connlm;
+    component_t comp;
+    component_t *comps[1];
+    glue_t glue;
+    glue_t *glues[1];
+    weight_t wt;
+    weight_t *wts[1];
+
+    updater_t updater;
+    comp_updater_t comp_updater;
+    comp_updater_t *comp_updaters[1];
+    glue_updater_t glue_updater;
+    glue_updater_t *glue_updaters[1];
+    wt_updater_t *wt_updaters[1];
+
+    dist_opt_t opt;
+    dist_t *dist;
+    int rank;
+    int err;
+} test_worker_t;
+
+static real_t val_of(int i, int j)
+{
+    return (real_t)(((i * 31 + j * 17) % 23) - 11) / 23.0;
+}
+
+static void worker_destroy(test_worker_t *worker)
+{
+    safe_dist_destroy(worker->dist);
+    safe_wt_updater_destroy(worker->wt_updaters[0]);
+    mat_destroy(&worker->wt.w);
+    vec_destroy(&worker->wt.bias);
+}
+
+static int worker_init(test_worker_t *worker, int rank, const char *addr)
+{
+    param_t param;
+    int i, j;
+
+    memset(worker, 0, sizeof(test_worker_t));
+    worker->rank = rank;
+
+    if (mat_resize(&worker->wt.w, NUM_ROWS, NUM_COLS, 0.0) < 0
+            || vec_resize(&worker->wt.bias, NUM_ROWS, 0.0) < 0) {
+        return -1;
+    }
+    for (i = 0; i < NUM_ROWS; i++) {
+        for (j = 0; j < NUM_COLS; j++) {
+            MAT_VAL(&worker->wt.w, i, j) = val_of(i, j);
+        }
+        VEC_VAL(&worker->wt.bias, i) = val_of(i, NUM_COLS);
+    }
+
+    strcpy(worker->glue.name, "glue");
+    worker->wts[0] = &worker->wt;
+    worker->glue.wts = worker->wts;
+    worker->glue.num_wts = 1;
+    worker->glues[0] = &worker->glue;
+    worker->comp.glues = worker->glues;
+    worker->comp.num_glue = 1;
+    worker->comps[0] = &worker->comp;
+    worker->connlm.comps = worker->comps;
+    worker->connlm.num_comp = 1;
+
+    memset(&param, 0, sizeof(param_t));
+    param.learn_rate = 0.1;
+    param.learn_rate_coef = 1.0;
+    param.bias_learn_rate_coef = 1.0;
+    worker->wt_updaters[0] = wt_updater_create(&param, &worker->wt.w,
+            &worker->wt.bias, WT_UT_FULL);
+    if (worker->wt_updaters[0] == NULL) {
+        return -1;
+    }
+
+    worker->glue_updater.glue = &worker->glue;
+    worker->glue_updater.wt_updaters = worker->wt_updaters;
+    worker->glue_updater.num_wt_updaters = 1;
+    worker->glue_updaters[0] = &worker->glue_updater;
+    worker->comp_updater.comp = &worker->comp;
+    worker->comp_updater.glue_updaters = worker->glue_updaters;
+    worker->comp_updaters[0] = &worker->comp_updater;
+    worker->updater.connlm = &worker->connlm;
+    worker->updater.comp_updaters = worker->comp_updaters;
+
+    worker->opt.num_workers = 2;
+    worker->opt.rank = rank;
+    snprintf(worker->opt.addr, MAX_DIR_LEN, "%s", addr);
+    worker->opt.sync_words = 1;
+    worker->opt.timeout = 10;
+    worker->opt.split_text = false;
+
+    return 0;
+}
+
+/* worker of rank k updates the rows k and k + 1. */
+static int worker_step(test_worker_t *worker)
+{
+    mat_t er = {0};
+    mat_t in = {0};
+    int rows[2];
+    int b, j;
+
+    if (mat_resize(&er, 2, 1, 0.0) < 0
+            || mat_resize(&in, 2, NUM_COLS, 0.0) < 0) {
+        goto ERR;
+    }
+
+    for (b = 0; b < 2; b++) {
+        rows[b] = worker->rank + b;
+        MAT_VAL(&er, b, 0) = val_of(worker->rank, b) + 0.5;
+        for (j = 0; j < NUM_COLS; j++) {
+            MAT_VAL(&in, b, j) = val_of(worker->rank + b, j + 1);
+        }
+    }
+
+    if (wt_update_rows(worker->wt_updaters[0], &er, 1.0, &in, 1.0,
+                rows) < 0) {
+        goto ERR;
+    }
+    if (wt_updater_flush(worker->wt_updaters[0]) < 0) {
+        goto ERR;
+    }
+
+    mat_destroy(&er);
+    mat_destroy(&in);
+    return 0;
+
+ERR:
+    mat_destroy(&er);
+    mat_destroy(&in);
+    return -1;
+}
+
+/* train one step in a process with a single worker thread. */
+static void* worker_thread(void *args)
+{
+    test_worker_t *worker;
+
+    worker = (test_worker_t *)args;
+
+    worker->dist = dist_create(&worker->opt, &worker->connlm);
+    if (worker->dist == NULL) {
+        goto ERR;
+    }
+    if (dist_attach_updater(worker->dist, &worker->updater) < 0) {
+        goto ERR;
+    }
+    if (dist_start(worker->dist, 1, &worker->err) < 0) {
+        goto ERR;
+    }
+
+    if (dist_enter(worker->dist) < 0) {
+        worker->err = -1;
+    } else {
+        if (worker_step(worker) < 0) {
+            worker->err = -1;
+        }
+        (void)dist_leave(worker->dist, 1);
+    }
+    dist_finish(worker->dist);
+
+    if (dist_wait(worker->dist) < 0) {
+        goto ERR;
+    }
+
+    return NULL;
+
+ERR:
+    worker->err = -1;
+    return NULL;
+}
+
+static bool check_val(real_t val, real_t expected, const char *name,
+        int i, int j)
+{
+    if (fabs(val - expected) > 1e-5) {
+        fprintf(stderr, "%s[%d, %d]: %g != %g\n", name, i, j,
+                (double)val, (double)expected);
+        return false;
+    }
+
+    return true;
+}
+
+static int unit_test_dist_sync()
+{
+    test_worker_t workers[2];
+    test_worker_t refs[2];
+    pthread_t tids[2];
+    char addr[MAX_DIR_LEN];
+    real_t expected;
+    int k, i, j;
+
+    memset(workers, 0, sizeof(workers));
+    memset(refs, 0, sizeof(refs));
+
+    fprintf(stderr, "  Testing averaging changed segments...");
+
+    snprintf(addr, MAX_DIR_LEN, "unix:/tmp/connlm-dist-test.%d",
+            (int)getpid());
+
+    /* the step of every worker trained alone. */
+    for (k = 0; k < 2; k++) {
+        if (worker_init(refs + k, k, addr) < 0) {
+            goto ERR;
+        }
+        if (worker_step(refs + k) < 0) {
+            goto ERR;
+        }
+    }
+
+    for (k = 0; k < 2; k++) {
+        if (worker_init(workers + k, k, addr) < 0) {
+            goto ERR;
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        if (pthread_create(tids + k, NULL, worker_thread,
+                    (void *)(workers + k)) != 0) {
+            goto ERR;
+        }
+    }
+    for (k = 0; k < 2; k++) {
+        (void)pthread_join(tids[k], NULL);
+    }
+    for (k = 0; k < 2; k++) {
+        if (workers[k].err != 0) {
+            goto ERR;
+        }
+    }
+
+    /* row 0 is touched by worker 0, row 1 by both, row 2 by worker 1,
+       and row 3 by none. the only segment of bias is touched by both. */
+    for (i = 0; i < NUM_ROWS; i++) {
+        for (j = 0; j < NUM_COLS; j++) {
+            if (i == 0) {
+                expected = MAT_VAL(&refs[0].wt.w, i, j);
+            } else if (i == 1) {
+                expected = (MAT_VAL(&refs[0].wt.w, i, j)
+                        + MAT_VAL(&refs[1].wt.w, i, j)) / 2;
+            } else if (i == 2) {
+                expected = MAT_VAL(&refs[1].wt.w, i, j);
+            } else {
+                expected = val_of(i, j);
+            }
+            if (!check_val(MAT_VAL(&workers[0].wt.w, i, j), expected,
+                        "wt", i, j)) {
+                goto ERR;
+            }
+            if (MAT_VAL(&workers[1].wt.w, i, j)
+                    != MAT_VAL(&workers[0].wt.w, i, j)) {
+                fprintf(stderr, "wt[%d, %d] differs among workers\n", i, j);
+                goto ERR;
+            }
+        }
+
+        expected = (VEC_VAL(&refs[0].wt.bias, i)
+                + VEC_VAL(&refs[1].wt.bias, i)) / 2;
+        if (!check_val(VEC_VAL(&workers[0].wt.bias, i), expected,
+                    "bias", i, 0)) {
+            goto ERR;
+        }
+        if (VEC_VAL(&workers[1].wt.bias, i)
+                != VEC_VAL(&workers[0].wt.bias, i)) {
+            fprintf(stderr, "bias[%d] differs among workers\n", i);
+            goto ERR;
+        }
+    }
+
+    for (k = 0; k < 2; k++) {
+        worker_destroy(refs + k);
+        worker_destroy(workers + k);
+    }
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    for (k = 0; k < 2; k++) {
+        worker_destroy(refs + k);
+        worker_destroy(workers + k);
+    }
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
+static int run_all_tests()
+{
+    int ret = 0;
+
+    if (unit_test_dist_sync() != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret;
+
+    fprintf(stderr, "Start testing...\n");
+    ret = run_all_tests();
+    if (ret != 0) {
+        fprintf(stderr, "Tests failed.\n");
+    } else {
+        fprintf(stderr, "Tests succeeded.\n");
+    }
+
+    return ret;
+}
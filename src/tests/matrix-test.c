@@ -24,7 +24,10 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
+#include <math.h>
+#include <unistd.h>
 
 #include "matrix.h"
 
@@ -294,6 +297,399 @@ FAILED:
     return -1;
 }
 
+static int check_mmap_mat(mat_t *ref, FILE *fp, bool mapped)
+{
+    mat_t mat = {0};
+    connlm_fmt_t fmt;
+    size_t i, j;
+
+    if (mat_load_header(&mat, CONNLM_FILE_VERSION, fp, &fmt, NULL) < 0) {
+        goto FAILED;
+    }
+    if (fmt != (CONN_FMT_BIN | CONN_FMT_MMAP)) {
+        goto FAILED;
+    }
+    if (mat_load_body(&mat, CONNLM_FILE_VERSION, fp, fmt) < 0) {
+        goto FAILED;
+    }
+
+    if (mapped != (mat.map_addr != NULL)) {
+        goto FAILED;
+    }
+    if (mapped && ((uintptr_t)mat.vals) % MMAP_ALIGN_SIZE != 0) {
+        goto FAILED;
+    }
+    if (mat.num_rows != ref->num_rows || mat.num_cols != ref->num_cols) {
+        goto FAILED;
+    }
+    for (i = 0; i < ref->num_rows; i++) {
+        for (j = 0; j < ref->num_cols; j++) {
+            if (MAT_VAL(&mat, i, j) != MAT_VAL(ref, i, j)) {
+                goto FAILED;
+            }
+        }
+    }
+
+    // must be writable, with copy-on-write
+    MAT_VAL(&mat, 0, 0) += 1.0;
+
+    mat_destroy(&mat);
+    return 0;
+
+FAILED:
+    mat_destroy(&mat);
+    return -1;
+}
+
+static int unit_test_mmap()
+{
+    mat_t ref = {0};
+    FILE *fp = NULL;
+    FILE *mem_fp = NULL;
+    char *buf = NULL;
+    long sz;
+
+    fprintf(stderr, "  Testing mmap format...");
+
+    init_mat(&ref, 3, 5);
+
+    fp = tmpfile();
+    if (fp == NULL) {
+        goto FAILED;
+    }
+    // misalign the start of matrix
+    if (fwrite("x", 1, 1, fp) != 1) {
+        goto FAILED;
+    }
+    if (mat_save_header(&ref, fp, CONN_FMT_BIN | CONN_FMT_MMAP) < 0) {
+        goto FAILED;
+    }
+    if (mat_save_body(&ref, fp, CONN_FMT_BIN | CONN_FMT_MMAP, NULL) < 0) {
+        goto FAILED;
+    }
+    fflush(fp);
+
+    sz = ftell(fp);
+    if (sz % MMAP_ALIGN_SIZE != 0) {
+        goto FAILED;
+    }
+
+    if (fseek(fp, 1, SEEK_SET) != 0) {
+        goto FAILED;
+    }
+    if (check_mmap_mat(&ref, fp, true) < 0) {
+        goto FAILED;
+    }
+    if (ftell(fp) != sz) {
+        goto FAILED;
+    }
+
+    // streams without file descriptor fall back to read
+    buf = (char *)malloc(sz);
+    if (buf == NULL) {
+        goto FAILED;
+    }
+    rewind(fp);
+    if (fread(buf, 1, sz, fp) != sz) {
+        goto FAILED;
+    }
+    mem_fp = fmemopen(buf + 1, sz - 1, "rb");
+    if (mem_fp == NULL) {
+        goto FAILED;
+    }
+    if (check_mmap_mat(&ref, mem_fp, false) < 0) {
+        goto FAILED;
+    }
+
+    // truncated file is rejected, instead of mapping past EOF
+    if (ftruncate(fileno(fp), sz - 1) != 0) {
+        goto FAILED;
+    }
+    if (fseek(fp, 1, SEEK_SET) != 0) {
+        goto FAILED;
+    }
+    if (check_mmap_mat(&ref, fp, true) == 0) {
+        goto FAILED;
+    }
+
+    fclose(mem_fp);
+    free(buf);
+    fclose(fp);
+    mat_destroy(&ref);
+    fprintf(stderr, "Success\n");
+    return 0;
+
+FAILED:
+    if (mem_fp != NULL) {
+        fclose(mem_fp);
+    }
+    free(buf);
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    mat_destroy(&ref);
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
+static int unit_test_qmat()
+{
+    mat_t mat = {0};
+    mat_t in = {0};
+    mat_t out = {0};
+    qmat_t qmat = {0};
+    real_t vec[2100];
+    real_t seg[7];
+    double ref, scale;
+    size_t i, j;
+
+    fprintf(stderr, "  Testing quantized matrix...");
+
+    // wider than one block, to check the per-block scales
+    assert(mat_resize(&mat, 3, 2100, NAN) == 0);
+    for (i = 0; i < mat.num_rows; i++) {
+        for (j = 0; j < mat.num_cols; j++) {
+            MAT_VAL(&mat, i, j) = sin(i * 7.0 + j) * (j / 1000 + 1);
+        }
+    }
+    for (j = 0; j < mat.num_cols; j++) {
+        vec[j] = cos(j);
+    }
+
+    if (qmat_quantize(&qmat, &mat) < 0) {
+        goto FAILED;
+    }
+    if (qmat.num_rows != 3 || qmat.num_cols != 2100
+            || qmat.blks_per_row != 3) {
+        goto FAILED;
+    }
+
+    for (i = 0; i < mat.num_rows; i++) {
+        for (j = 0; j < mat.num_cols; j++) {
+            scale = QMAT_SCALE(&qmat, i, j);
+            if (fabs(QMAT_VAL(&qmat, i, j) - MAT_VAL(&mat, i, j))
+                    > scale / 2 + 1e-6) {
+                goto FAILED;
+            }
+        }
+    }
+
+    for (i = 0; i < mat.num_rows; i++) {
+        ref = 0.0;
+        for (j = 0; j < mat.num_cols; j++) {
+            ref += QMAT_VAL(&qmat, i, j) * vec[j];
+        }
+        if (fabs(qmat_dot_row(&qmat, i, vec) - ref) > 1e-3) {
+            goto FAILED;
+        }
+    }
+
+    // segment crosses the boundary of blocks
+    for (j = 0; j < 7; j++) {
+        seg[j] = 1.0;
+    }
+    qmat_add_row_seg(&qmat, 1, 1020, 7, 0.5, seg);
+    for (j = 0; j < 7; j++) {
+        if (fabs(seg[j] - 1.0 - 0.5 * QMAT_VAL(&qmat, 1, 1020 + j)) > 1e-5) {
+            goto FAILED;
+        }
+    }
+
+    assert(mat_resize(&in, 2, 2100, NAN) == 0);
+    for (i = 0; i < in.num_rows; i++) {
+        for (j = 0; j < in.num_cols; j++) {
+            MAT_VAL(&in, i, j) = vec[j] * (i + 1);
+        }
+    }
+    assert(mat_resize(&out, 2, 3, 1.0) == 0);
+    if (qmat_add_mat_mat(2.0, &in, &qmat, &out) < 0) {
+        goto FAILED;
+    }
+    for (i = 0; i < out.num_rows; i++) {
+        for (j = 0; j < out.num_cols; j++) {
+            ref = 1.0 + 2.0 * (i + 1) * qmat_dot_row(&qmat, j, vec);
+            if (fabs(MAT_VAL(&out, i, j) - ref) > 1e-2) {
+                goto FAILED;
+            }
+        }
+    }
+
+    qmat_destroy(&qmat);
+    mat_destroy(&mat);
+    mat_destroy(&in);
+    mat_destroy(&out);
+    fprintf(stderr, "Success\n");
+    return 0;
+
+FAILED:
+    qmat_destroy(&qmat);
+    mat_destroy(&mat);
+    mat_destroy(&in);
+    mat_destroy(&out);
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
+static int unit_test_gather_scatter()
+{
+    mat_t src = {0};
+    mat_t dst = {0};
+    real_t out[3 * 5];
+    bmat_word_t mask[1];
+    real_t ref;
+    int rows[] = {4, 0, 4, 2, 1, 3, 0};
+    real_t scales[] = {0.5, 1.0, -2.0, 3.0, 1.5, -1.0, 0.25};
+    int offs[] = {0, 5, 10, 0, 5, 10, 0};
+    size_t dst_rows[] = {1, 3, 1, 0, 2, 4, 3};
+    size_t src_rows[] = {0, 1, 2, 0, 1, 2, 0};
+    size_t i, k;
+
+    fprintf(stderr, "  Testing gather/scatter rows...");
+
+    init_mat(&src, 6, 5);
+
+    // bag of rows
+    memset(out, 0, sizeof(out));
+    mat_gather_add_rows(&src, rows, scales, NULL, 7, 2.0, NULL, out);
+    for (i = 0; i < 5; i++) {
+        ref = 0.0;
+        for (k = 0; k < 7; k++) {
+            ref += 2.0 * scales[k] * MAT_VAL(&src, rows[k], i);
+        }
+        if (fabs(out[i] - ref) > 1e-4) {
+            goto FAILED;
+        }
+    }
+
+    // concat with dropout
+    memset(out, 0, sizeof(out));
+    mask[0] = 0;
+    for (i = 0; i < 15; i++) {
+        if (i % 3 != 0) {
+            mask[0] |= 1U << i;
+        }
+    }
+    mat_gather_add_rows(&src, rows, scales, offs, 7, 1.0, mask, out);
+    for (i = 0; i < 15; i++) {
+        ref = 0.0;
+        for (k = 0; k < 7; k++) {
+            if (i >= offs[k] && i < offs[k] + 5 && BMAT_BIT(mask, i)) {
+                ref += scales[k] * MAT_VAL(&src, rows[k], i - offs[k]);
+            }
+        }
+        if (fabs(out[i] - ref) > 1e-4) {
+            goto FAILED;
+        }
+    }
+
+    // scatter-add with repeated rows
+    assert(mat_resize(&dst, 5, 5, 1.0) == 0);
+    mat_scatter_add_rows(&dst, dst_rows, &src, src_rows, scales, 7, 0.5);
+    for (i = 0; i < 5; i++) {
+        ref = 1.0;
+        for (k = 0; k < 7; k++) {
+            if (dst_rows[k] == 1) {
+                ref += 0.5 * scales[k] * MAT_VAL(&src, src_rows[k], i);
+            }
+        }
+        if (fabs(MAT_VAL(&dst, 1, i) - ref) > 1e-4) {
+            goto FAILED;
+        }
+    }
+
+    mat_destroy(&src);
+    mat_destroy(&dst);
+    fprintf(stderr, "Success\n");
+    return 0;
+
+FAILED:
+    mat_destroy(&src);
+    mat_destroy(&dst);
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
+static int unit_test_bmat()
+{
+    bmat_t bmat = {0};
+    bmat_t bmat2 = {0};
+    mat_t mat = {0};
+    mat_t out = {0};
+    unsigned int seed, seed2;
+    uint32_t key;
+    size_t r, c, n;
+    real_t ref;
+
+    fprintf(stderr, "  Testing bit matrix...");
+
+    assert(bmat_resize(&bmat, 7, 1000) == 0);
+    assert(bmat_resize(&bmat2, 7, 1000) == 0);
+
+    // density
+    seed = 1;
+    n = 0;
+    assert(bmat_rand(&bmat, 0.3, &seed) == 0);
+    for (r = 0; r < bmat.num_rows; r++) {
+        for (c = 0; c < bmat.num_cols; c++) {
+            n += BMAT_VAL(&bmat, r, c);
+        }
+    }
+    if (fabs(n / 7000.0 - 0.3) > 0.03) {
+        goto FAILED;
+    }
+
+    // filled by segments the same as whole rows
+    seed = 2;
+    seed2 = 2;
+    assert(bmat_rand(&bmat, 0.5, &seed) == 0);
+    key = bmat_rand_key(&seed2);
+    if (seed != seed2) {
+        goto FAILED;
+    }
+    for (r = 0; r < bmat2.num_rows; r++) {
+        for (c = 0; c < bmat2.num_cols; c += n) {
+            n = min(r * 7 + 3, bmat2.num_cols - c);
+            bmat_rand_seg(&bmat2, r, c, n, 0.5, key);
+        }
+    }
+    for (r = 0; r < bmat.num_rows; r++) {
+        for (c = 0; c < bmat.num_cols; c++) {
+            if (BMAT_VAL(&bmat, r, c) != BMAT_VAL(&bmat2, r, c)) {
+                goto FAILED;
+            }
+        }
+    }
+
+    // fused mask and scale, in place
+    init_mat(&mat, 7, 1000);
+    assert(mat_resize(&out, 7, 1000, NAN) == 0);
+    assert(mat_cpy(&out, &mat) == 0);
+    assert(mat_mask_scale(&out, &bmat, 2.0, &out) == 0);
+    for (r = 0; r < mat.num_rows; r++) {
+        for (c = 0; c < mat.num_cols; c++) {
+            ref = BMAT_VAL(&bmat, r, c) ? 2.0 * MAT_VAL(&mat, r, c) : 0.0;
+            if (fabs(MAT_VAL(&out, r, c) - ref) > 1e-6) {
+                goto FAILED;
+            }
+        }
+    }
+
+    bmat_destroy(&bmat);
+    bmat_destroy(&bmat2);
+    mat_destroy(&mat);
+    mat_destroy(&out);
+    fprintf(stderr, "Success\n");
+    return 0;
+
+FAILED:
+    bmat_destroy(&bmat);
+    bmat_destroy(&bmat2);
+    mat_destroy(&mat);
+    mat_destroy(&out);
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
 static int run_all_tests()
 {
     int ret = 0;
@@ -302,6 +698,22 @@ static int run_all_tests()
         ret = -1;
     }
 
+    if (unit_test_mmap() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_qmat() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_gather_scatter() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_bmat() != 0) {
+        ret = -1;
+    }
+
     return ret;
 }
 
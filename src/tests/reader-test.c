@@ -0,0 +1,350 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reader.h"
+#include "vocab-test.h"
+
+#define NUM_SENTS 37
+#define BATCH_SIZE 4
+#define NUM_THRS 2
+#define NUM_LINES 23
+
+/* sentence s has (s * 7) % 11 + 1 words, with word ids s * 100 + i. */
+static int make_pool(word_pool_t *wp, int num_sents)
+{
+    int s, i, len;
+
+    for (s = 0; s < num_sents; s++) {
+        len = (s * 7) % 11 + 1;
+        for (i = 0; i < len; i++) {
+            if (ivec_append(&wp->words, s * 100 + i) < 0) {
+                return -1;
+            }
+        }
+        if (ivec_append(&wp->sent_ends, wp->words.size) < 0) {
+            return -1;
+        }
+        if (ivec_append(&wp->sent_ids, s) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int check_pool(word_pool_t *wp, word_pool_t *src_wp, int batch_size)
+{
+    int seen[NUM_SENTS] = {0};
+    int r, s, i, id, start, end;
+    int len, min_len, max_len;
+
+    if (wp_batch_size(wp) != batch_size) {
+        return -1;
+    }
+    if (wp->words.size != src_wp->words.size
+            || wp->sent_ends.size != src_wp->sent_ends.size
+            || wp->sent_ids.size != wp->sent_ends.size) {
+        return -1;
+    }
+
+    start = 0;
+    for (s = 0; s < wp->sent_ends.size; s++) {
+        id = VEC_VAL(&wp->sent_ids, s);
+        if (id < 0 || id >= NUM_SENTS || seen[id]) {
+            return -1;
+        }
+        seen[id] = 1;
+
+        end = VEC_VAL(&wp->sent_ends, s);
+        if (end - start != (id * 7) % 11 + 1) {
+            return -1;
+        }
+        for (i = start; i < end; i++) {
+            if (VEC_VAL(&wp->words, i) != id * 100 + i - start) {
+                return -1;
+            }
+        }
+        start = end;
+    }
+
+    /* rows start and end at sentence boundaries. */
+    min_len = wp->words.size;
+    max_len = 0;
+    s = 0;
+    for (r = 0; r < batch_size; r++) {
+        end = VEC_VAL(&wp->row_starts, r + 1);
+        while (s < wp->sent_ends.size && VEC_VAL(&wp->sent_ends, s) < end) {
+            s++;
+        }
+        if (s >= wp->sent_ends.size || VEC_VAL(&wp->sent_ends, s) != end) {
+            return -1;
+        }
+        len = VEC_VAL(&wp->row_starts, r + 1) - VEC_VAL(&wp->row_starts, r);
+        min_len = len < min_len ? len : min_len;
+        max_len = len > max_len ? len : max_len;
+    }
+
+    /* longest-first never leaves a gap larger than the longest sentence. */
+    if (max_len - min_len > 11) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int unit_test_word_pool_pack()
+{
+    word_pool_t src_wp = WORD_POOL_INITIALIZER;
+    word_pool_t wp = WORD_POOL_INITIALIZER;
+    int i;
+
+    fprintf(stderr, "  Testing packing mini-batch...");
+
+    if (make_pool(&src_wp, NUM_SENTS) < 0) {
+        goto ERR;
+    }
+
+    if (word_pool_pack_mini_batch(&wp, &src_wp, BATCH_SIZE) < 0) {
+        goto ERR;
+    }
+    if (check_pool(&wp, &src_wp, BATCH_SIZE) < 0) {
+        goto ERR;
+    }
+
+    /* packing into a used pool. */
+    if (word_pool_pack_mini_batch(&wp, &src_wp, BATCH_SIZE + 1) < 0) {
+        goto ERR;
+    }
+    if (check_pool(&wp, &src_wp, BATCH_SIZE + 1) < 0) {
+        goto ERR;
+    }
+
+    /* one sentence per row, in order. */
+    if (word_pool_clear(&src_wp) < 0) {
+        goto ERR;
+    }
+    if (make_pool(&src_wp, BATCH_SIZE) < 0) {
+        goto ERR;
+    }
+    if (word_pool_pack_mini_batch(&wp, &src_wp, BATCH_SIZE) < 0) {
+        goto ERR;
+    }
+    if (check_pool(&wp, &src_wp, BATCH_SIZE) < 0) {
+        goto ERR;
+    }
+    for (i = 0; i < BATCH_SIZE; i++) {
+        if (VEC_VAL(&wp.sent_ids, i) != i) {
+            goto ERR;
+        }
+    }
+
+    word_pool_destroy(&src_wp);
+    word_pool_destroy(&wp);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    word_pool_destroy(&src_wp);
+    word_pool_destroy(&wp);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+static int make_text(const char *text_file)
+{
+    FILE *fp;
+    int i, c;
+
+    fp = fopen(text_file, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    for (i = 0; i < NUM_LINES; i++) {
+        c = 'C' + i % (VOCAB_TEST_SIZE - 2);
+        fprintf(fp, "%c%c%c %c%c%c\n", c, c, c, c, c, c);
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static int unit_test_reader_poses()
+{
+    char text_file[MAX_DIR_LEN];
+    reader_opt_t reader_opt;
+    thr_stat_t stats[NUM_THRS];
+    reader_pos_t poses[1];
+    vocab_t *vocab = NULL;
+    reader_t *reader = NULL;
+    word_pool_t *held = NULL;
+    word_pool_t *wp;
+    bool reading = false;
+    int err = 0;
+    int n;
+
+    fprintf(stderr, "  Testing positions with a word pool held...");
+
+    snprintf(text_file, MAX_DIR_LEN, "/tmp/connlm-reader-test.%d",
+            (int)getpid());
+    if (make_text(text_file) < 0) {
+        goto ERR;
+    }
+
+    vocab = vocab_test_new();
+
+    memset(&reader_opt, 0, sizeof(reader_opt_t));
+    reader_opt.epoch_size = 1;
+    reader_opt.mini_batch = 1;
+    reader_opt.rand_seed = 1;
+    reader_opt.drop_empty_line = true;
+    reader = reader_create(&reader_opt, NUM_THRS, vocab, text_file);
+    if (reader == NULL) {
+        goto ERR;
+    }
+    if (reader_keep_poses(reader) < 0) {
+        goto ERR;
+    }
+    memset(stats, 0, sizeof(thr_stat_t) * NUM_THRS);
+    if (reader_read(reader, stats, &err) < 0) {
+        goto ERR;
+    }
+    reading = true;
+
+    held = reader_hold_word_pool(reader, 0);
+    if (held == NULL || held->start_pos.pos != 0
+            || held->start_pos.num_sents != 0) {
+        goto ERR;
+    }
+
+    /* the other threads go on for more pools than the list holds. */
+    for (n = 0; n < 3 * NUM_THRS; n++) {
+        wp = reader_hold_word_pool(reader, 1);
+        if (wp == NULL || wp == held) {
+            goto ERR;
+        }
+        if (wp->start_pos.pos <= held->start_pos.pos) {
+            goto ERR;
+        }
+        if (reader_release_word_pool(reader, 1, wp) < 0) {
+            goto ERR;
+        }
+
+        if (reader_get_poses(reader, poses) < 0) {
+            goto ERR;
+        }
+        if (poses[0].pos != held->start_pos.pos
+                || poses[0].num_sents != held->start_pos.num_sents) {
+            goto ERR;
+        }
+    }
+
+    if (reader_release_word_pool(reader, 0, held) < 0) {
+        goto ERR;
+    }
+    held = NULL;
+    if (reader_get_poses(reader, poses) < 0) {
+        goto ERR;
+    }
+    if (poses[0].pos <= 0 || poses[0].num_sents <= n) {
+        goto ERR;
+    }
+
+    while ((wp = reader_hold_word_pool(reader, 1)) != NULL) {
+        if (reader_release_word_pool(reader, 1, wp) < 0) {
+            goto ERR;
+        }
+    }
+    reading = false;
+    if (reader_wait(reader) < 0 || err != 0) {
+        goto ERR;
+    }
+    if (reader->num_sents != NUM_LINES) {
+        goto ERR;
+    }
+
+    safe_reader_destroy(reader);
+    safe_vocab_destroy(vocab);
+    (void)unlink(text_file);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    if (reading) {
+        err = -1;
+        if (held != NULL) {
+            (void)reader_release_word_pool(reader, 0, held);
+        }
+        while ((wp = reader_hold_word_pool(reader, 1)) != NULL) {
+            (void)reader_release_word_pool(reader, 1, wp);
+        }
+        (void)reader_wait(reader);
+    }
+    safe_reader_destroy(reader);
+    safe_vocab_destroy(vocab);
+    (void)unlink(text_file);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+static int run_all_tests()
+{
+    int ret = 0;
+
+    if (unit_test_word_pool_pack() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_reader_poses() != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret;
+
+    fprintf(stderr, "Start testing...\n");
+    ret = run_all_tests();
+    if (ret != 0) {
+        fprintf(stderr, "Tests failed.\n");
+    } else {
+        fprintf(stderr, "Tests succeeded.\n");
+    }
+
+    return ret;
+}
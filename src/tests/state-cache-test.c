@@ -0,0 +1,282 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "state_cache.h"
+
+#define STATE_SIZE 4
+
+static int make_state(mat_t *state, ivec_t *hist, int seed)
+{
+    int i;
+
+    if (mat_resize(state, 1, STATE_SIZE, NAN) < 0) {
+        return -1;
+    }
+    for (i = 0; i < STATE_SIZE; i++) {
+        MAT_VAL(state, 0, i) = seed * 10 + i;
+    }
+
+    if (ivec_set(hist, &seed, 1) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int unit_test_state_cache_key()
+{
+    hist_key_t key1, key2;
+
+    fprintf(stderr, "  Testing key...");
+
+    key1 = hist_key_append(hist_key_append(HIST_KEY_INIT, 3), 5);
+    key2 = hist_key_append(hist_key_append(HIST_KEY_INIT, 5), 3);
+    if (key1 == key2) {
+        fprintf(stderr, "Failed\n");
+        return -1;
+    }
+
+    key2 = hist_key_append(hist_key_append(HIST_KEY_INIT, 3), 5);
+    if (key1 != key2) {
+        fprintf(stderr, "Failed\n");
+        return -1;
+    }
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+}
+
+static int unit_test_state_cache_lookup()
+{
+    state_cache_t *cache = NULL;
+    mat_t state = {0};
+    mat_t out_state = {0};
+    ivec_t hist = {0};
+    ivec_t out_hist = {0};
+    hist_key_t key;
+    double logp;
+    int i;
+
+    fprintf(stderr, "  Testing lookup...");
+
+    cache = state_cache_create(1024 * 1024, STATE_SIZE);
+    if (cache == NULL) {
+        goto ERR;
+    }
+
+    key = HIST_KEY_INIT;
+    for (i = 0; i < 10; i++) {
+        key = hist_key_append(key, i);
+        if (make_state(&state, &hist, i) < 0) {
+            goto ERR;
+        }
+        if (state_cache_insert(cache, key, &state, &hist) < 0) {
+            goto ERR;
+        }
+        if (state_cache_add_logp(cache, key, i + 1, -(double)i) < 0) {
+            goto ERR;
+        }
+    }
+
+    key = HIST_KEY_INIT;
+    for (i = 0; i < 10; i++) {
+        key = hist_key_append(key, i);
+        if (state_cache_lookup(cache, key, &out_state, &out_hist) != 1) {
+            goto ERR;
+        }
+        if (make_state(&state, &hist, i) < 0) {
+            goto ERR;
+        }
+        if (! mat_eq(&state, &out_state)) {
+            goto ERR;
+        }
+        if (out_hist.size != 1 || VEC_VAL(&out_hist, 0) != i) {
+            goto ERR;
+        }
+
+        if (state_cache_lookup_logp(cache, key, i + 1, &logp) != 1) {
+            goto ERR;
+        }
+        if (logp != -(double)i) {
+            goto ERR;
+        }
+        if (state_cache_lookup_logp(cache, key, i + 2, &logp) != 0) {
+            goto ERR;
+        }
+    }
+
+    if (state_cache_lookup(cache, hist_key_append(key, 100),
+                NULL, NULL) != 0) {
+        goto ERR;
+    }
+
+    if (cache->num_hits != 10 || cache->num_lookups != 11
+            || cache->num_logp_hits != 10 || cache->num_logp_lookups != 20) {
+        goto ERR;
+    }
+
+    mat_destroy(&state);
+    mat_destroy(&out_state);
+    ivec_destroy(&hist);
+    ivec_destroy(&out_hist);
+    safe_state_cache_destroy(cache);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    mat_destroy(&state);
+    mat_destroy(&out_state);
+    ivec_destroy(&hist);
+    ivec_destroy(&out_hist);
+    safe_state_cache_destroy(cache);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+static int unit_test_state_cache_evict()
+{
+    state_cache_t *cache = NULL;
+    mat_t state = {0};
+    ivec_t hist = {0};
+    size_t entry_size;
+    int i;
+
+    fprintf(stderr, "  Testing evict...");
+
+    cache = state_cache_create(1024 * 1024, STATE_SIZE);
+    if (cache == NULL) {
+        goto ERR;
+    }
+
+    if (make_state(&state, &hist, 0) < 0) {
+        goto ERR;
+    }
+    if (state_cache_insert(cache, 0, &state, &hist) < 0) {
+        goto ERR;
+    }
+    entry_size = cache->bytes;
+    safe_state_cache_destroy(cache);
+
+    // room for 3 entries
+    cache = state_cache_create(entry_size * 3, STATE_SIZE);
+    if (cache == NULL) {
+        goto ERR;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (make_state(&state, &hist, i) < 0) {
+            goto ERR;
+        }
+        if (state_cache_insert(cache, i, &state, &hist) < 0) {
+            goto ERR;
+        }
+    }
+
+    // touch 0, so that 1 is the least recently used one
+    if (state_cache_lookup(cache, 0, NULL, NULL) != 1) {
+        goto ERR;
+    }
+
+    if (make_state(&state, &hist, 3) < 0) {
+        goto ERR;
+    }
+    if (state_cache_insert(cache, 3, &state, &hist) < 0) {
+        goto ERR;
+    }
+
+    if (cache->num_entries != 3 || cache->bytes > cache->max_bytes) {
+        goto ERR;
+    }
+    if (state_cache_lookup(cache, 1, NULL, NULL) != 0) {
+        goto ERR;
+    }
+    for (i = 0; i < 4; i++) {
+        if (i == 1) {
+            continue;
+        }
+        if (state_cache_lookup(cache, i, NULL, NULL) != 1) {
+            goto ERR;
+        }
+    }
+
+    mat_destroy(&state);
+    ivec_destroy(&hist);
+    safe_state_cache_destroy(cache);
+
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    mat_destroy(&state);
+    ivec_destroy(&hist);
+    safe_state_cache_destroy(cache);
+
+    fprintf(stderr, "Failed\n");
+
+    return -1;
+}
+
+static int run_all_tests()
+{
+    int ret = 0;
+
+    if (unit_test_state_cache_key() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_state_cache_lookup() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_state_cache_evict() != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret;
+
+    fprintf(stderr, "Start testing...\n");
+    ret = run_all_tests();
+    if (ret != 0) {
+        fprintf(stderr, "Tests failed.\n");
+    } else {
+        fprintf(stderr, "Tests succeeded.\n");
+    }
+
+    return ret;
+}
@@ -23,7 +23,11 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+
+#include <stutils/st_varint.h>
 
 #include "utils.h"
 
@@ -391,6 +395,280 @@ ERR:
     return -1;
 }
 
+/*
+ * Reference encoders, copied from the element-by-element writers used
+ * before save_rows, so that save_rows is checked against the format read
+ * by existing models, not against itself.
+ */
+static int16_t ref_quantify_int16(real_t r)
+{
+    r = r * 1024.0;
+    r = min(r, (1 << 15) - 1);
+    r = max(r, -(1 << 15));
+
+    return (int16_t)r;
+}
+
+static int ref_write_zeros(void *zero, size_t sz, uint64_t num_zeros,
+        FILE *fp)
+{
+    if (fwrite(zero, sz, 1, fp) != 1) {
+        return -1;
+    }
+    if (st_varint_encode_stream_uint64(num_zeros, fp) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ref_save_sq_zc(real_t *a, size_t sz, FILE *fp)
+{
+    uint64_t num_zeros;
+    size_t i;
+    int16_t si;
+    int16_t zero = 0;
+
+    num_zeros = 0;
+    for (i = 0; i < sz; i++) {
+        si = ref_quantify_int16(a[i]);
+        if (si == 0) {
+            ++num_zeros;
+            continue;
+        }
+
+        if (num_zeros > 0) {
+            if (ref_write_zeros(&zero, sizeof(int16_t), num_zeros, fp) < 0) {
+                return -1;
+            }
+            num_zeros = 0;
+        }
+
+        if (fwrite(&si, sizeof(int16_t), 1, fp) != 1) {
+            return -1;
+        }
+    }
+    if (num_zeros > 0) {
+        if (ref_write_zeros(&zero, sizeof(int16_t), num_zeros, fp) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int ref_save_sq(real_t *a, size_t sz, FILE *fp)
+{
+    size_t i;
+    int16_t si;
+
+    for (i = 0; i < sz; i++) {
+        si = ref_quantify_int16(a[i]);
+        if (fwrite(&si, sizeof(int16_t), 1, fp) != 1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int ref_save_zc(real_t *a, size_t sz, FILE *fp)
+{
+    uint64_t num_zeros;
+    size_t i;
+    real_t zero = 0;
+
+    num_zeros = 0;
+    for (i = 0; i < sz; i++) {
+        if (a[i] == 0.0) {
+            ++num_zeros;
+            continue;
+        }
+
+        if (num_zeros > 0) {
+            if (ref_write_zeros(&zero, sizeof(real_t), num_zeros, fp) < 0) {
+                return -1;
+            }
+            num_zeros = 0;
+        }
+
+        if (fwrite(a + i, sizeof(real_t), 1, fp) != 1) {
+            return -1;
+        }
+    }
+    if (num_zeros > 0) {
+        if (ref_write_zeros(&zero, sizeof(real_t), num_zeros, fp) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int check_save_rows(real_t *vals, size_t num_rows, size_t num_cols,
+        connlm_fmt_t fmt)
+{
+    FILE *fp_ref = NULL;
+    FILE *fp = NULL;
+    real_t *loaded = NULL;
+    uint64_t checksum;
+    long sz, sz_ref;
+    size_t i;
+    int c1, c2;
+
+    fp_ref = tmpfile();
+    fp = tmpfile();
+    if (fp_ref == NULL || fp == NULL) {
+        goto FAILED;
+    }
+
+    // reference: row by row
+    for (i = 0; i < num_rows; i++) {
+        if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
+            if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
+                if (ref_save_sq_zc(vals + i * num_cols, num_cols,
+                            fp_ref) < 0) {
+                    goto FAILED;
+                }
+            } else {
+                if (ref_save_sq(vals + i * num_cols, num_cols, fp_ref) < 0) {
+                    goto FAILED;
+                }
+            }
+        } else {
+            if (ref_save_zc(vals + i * num_cols, num_cols, fp_ref) < 0) {
+                goto FAILED;
+            }
+        }
+    }
+    if (save_rows(vals, num_rows, num_cols, num_cols, fmt, fp) < 0) {
+        goto FAILED;
+    }
+
+    sz_ref = ftell(fp_ref);
+    sz = ftell(fp);
+    if (sz != sz_ref) {
+        goto FAILED;
+    }
+    rewind(fp_ref);
+    rewind(fp);
+    do {
+        c1 = fgetc(fp_ref);
+        c2 = fgetc(fp);
+        if (c1 != c2) {
+            goto FAILED;
+        }
+    } while (c1 != EOF);
+
+    loaded = (real_t *)malloc(sizeof(real_t) * num_rows * num_cols);
+    if (loaded == NULL) {
+        goto FAILED;
+    }
+    // appending checksum
+    rewind(fp);
+    if (save_rows(vals, num_rows, num_cols, num_cols,
+                fmt | CONN_FMT_CHECKSUM, fp) < 0) {
+        goto FAILED;
+    }
+    if (ftell(fp) != sz + sizeof(uint64_t)) {
+        goto FAILED;
+    }
+    rewind(fp);
+    if (load_rows(loaded, num_rows, num_cols, num_cols,
+                fmt | CONN_FMT_CHECKSUM, fp) < 0) {
+        goto FAILED;
+    }
+    for (i = 0; i < num_rows * num_cols; i++) {
+        if (fabs(loaded[i] - vals[i]) > 1e-3) {
+            goto FAILED;
+        }
+    }
+
+    // corrupted value with the original checksum
+    if (fseek(fp, sz, SEEK_SET) != 0) {
+        goto FAILED;
+    }
+    if (fread(&checksum, sizeof(uint64_t), 1, fp) != 1) {
+        goto FAILED;
+    }
+    loaded[num_cols / 2] += 1.0;
+    rewind(fp);
+    if (save_rows(loaded, num_rows, num_cols, num_cols, fmt, fp) < 0) {
+        goto FAILED;
+    }
+    if (fwrite(&checksum, sizeof(uint64_t), 1, fp) != 1) {
+        goto FAILED;
+    }
+    rewind(fp);
+    if (load_rows(loaded, num_rows, num_cols, num_cols,
+                fmt | CONN_FMT_CHECKSUM, fp) == 0) {
+        goto FAILED;
+    }
+
+    free(loaded);
+    fclose(fp);
+    fclose(fp_ref);
+    return 0;
+
+FAILED:
+    free(loaded);
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    if (fp_ref != NULL) {
+        fclose(fp_ref);
+    }
+    return -1;
+}
+
+static int unit_test_save_rows()
+{
+    connlm_fmt_t fmts[] = {
+        CONN_FMT_BIN | CONN_FMT_SHORT_QUANTIZATION | CONN_FMT_ZEROS_COMPRESSED,
+        CONN_FMT_BIN | CONN_FMT_SHORT_QUANTIZATION,
+        CONN_FMT_BIN | CONN_FMT_ZEROS_COMPRESSED,
+    };
+    // a long row to be split, and many short rows. the zero run in
+    // [1000000, 1200000) crosses both the chunk and the row boundaries.
+    size_t shapes[][2] = {{2, 2500000}, {3000, 700}, {3, 5}};
+    real_t *vals = NULL;
+    size_t i, s, f;
+
+    fprintf(stderr, " Testing save_rows...");
+
+    vals = (real_t *)malloc(sizeof(real_t) * 5000000);
+    if (vals == NULL) {
+        goto FAILED;
+    }
+    srand(1);
+    for (i = 0; i < 5000000; i++) {
+        if (rand() % 2 == 0 || (i >= 1000000 && i < 1200000)) {
+            vals[i] = 0.0;
+        } else {
+            vals[i] = rand() / (real_t)RAND_MAX - 0.5;
+        }
+    }
+
+    for (s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        for (f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++) {
+            if (check_save_rows(vals, shapes[s][0], shapes[s][1],
+                        fmts[f]) < 0) {
+                fprintf(stderr, "Failed at shape[%zu], fmt[%zu]\n", s, f);
+                goto FAILED;
+            }
+        }
+    }
+
+    free(vals);
+    fprintf(stderr, "Passed\n");
+    return 0;
+
+FAILED:
+    free(vals);
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
 static int run_all_tests()
 {
     int ret = 0;
@@ -411,6 +689,10 @@ static int run_all_tests()
         ret = -1;
     }
 
+    if (unit_test_save_rows() != 0) {
+        ret = -1;
+    }
+
     return ret;
 }
 
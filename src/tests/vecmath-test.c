@@ -0,0 +1,208 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <stutils/st_macro.h>
+
+#include "vecmath.h"
+
+#define N 37 /* not a multiple of any vector width, to cover the tails */
+
+static const char *g_isas[] = {"scalar", "sse2", "avx2", "avx512"};
+
+#if _CONNLM_MATH_ == 0
+#  define TOL 5e-2 // approximations in fastexp.h
+#else
+#  define TOL 1e-5
+#endif
+
+static void fill(real_t *vec, int n, double lo, double hi)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        vec[i] = lo + (hi - lo) * i / (n - 1);
+    }
+}
+
+static double ref_sigmoid(double x)
+{
+    return 1.0 / (1.0 + exp(-x));
+}
+
+static int check_map(const char *isa, const char *name,
+        void (*func)(real_t *, int), double (*ref)(double),
+        double lo, double hi, bool relative)
+{
+    real_t vec[N];
+    real_t in[N];
+    double err;
+    int n, i;
+
+    for (n = 0; n <= N; n++) {
+        fill(in, N, lo, hi);
+        memcpy(vec, in, sizeof(real_t) * N);
+        func(vec, n);
+        for (i = 0; i < N; i++) {
+            if (i >= n) {
+                if (vec[i] != in[i]) {
+                    fprintf(stderr, "[%s] %s wrote out of range: %d/%d\n",
+                            isa, name, i, n);
+                    return -1;
+                }
+                continue;
+            }
+            err = fabs(vec[i] - ref(in[i]));
+            if (relative) {
+                err /= fabs(ref(in[i]));
+            }
+            if (err > TOL) {
+                fprintf(stderr, "[%s] %s(%g) = %g, expected %g\n", isa, name,
+                        (double)in[i], (double)vec[i], ref(in[i]));
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int check_softmax(const char *isa, bool multi_logit)
+{
+    real_t vec[N];
+    double ref[N];
+    double max, sum;
+    int n, i;
+
+    for (n = 1; n <= N; n++) {
+        fill(vec, n, -20.0, 15.0 * n / N);
+        max = multi_logit ? 0.0 : -HUGE_VAL;
+        for (i = 0; i < n; i++) {
+            if (vec[i] > max) {
+                max = vec[i];
+            }
+        }
+        sum = multi_logit ? exp(-max) : 0.0;
+        for (i = 0; i < n; i++) {
+            ref[i] = exp(vec[i] - max);
+            sum += ref[i];
+        }
+
+        if (multi_logit) {
+            vm_multi_logit(vec, n);
+        } else {
+            vm_softmax(vec, n);
+        }
+
+        for (i = 0; i < n; i++) {
+            if (fabs(vec[i] - ref[i] / sum) > TOL) {
+                fprintf(stderr, "[%s] %s[%d/%d] = %g, expected %g\n", isa,
+                        multi_logit ? "multi_logit" : "softmax", i, n,
+                        (double)vec[i], ref[i] / sum);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int unit_test_vecmath()
+{
+    const char *isa;
+    int i;
+
+    for (i = 0; i < sizeof(g_isas) / sizeof(g_isas[0]); i++) {
+        isa = g_isas[i];
+        if (vm_set_isa(isa) < 0) {
+            fprintf(stderr, "  Skipping %s.\n", isa);
+            continue;
+        }
+
+        fprintf(stderr, "  Testing %s...", isa);
+        if (strcmp(vm_isa(), isa) != 0) {
+            goto ERR;
+        }
+
+        if (check_map(isa, "exp", vm_exp, exp, -20.0, 20.0, true) < 0) {
+            goto ERR;
+        }
+        if (check_map(isa, "log", vm_log, log, 1e-3, 1e3, false) < 0) {
+            goto ERR;
+        }
+        if (check_map(isa, "sigmoid", vm_sigmoid, ref_sigmoid,
+                    -60.0, 60.0, false) < 0) {
+            goto ERR;
+        }
+        if (check_map(isa, "tanh", vm_tanh, tanh, -3.0, 3.0, false) < 0) {
+            goto ERR;
+        }
+        if (check_softmax(isa, false) < 0) {
+            goto ERR;
+        }
+        if (check_softmax(isa, true) < 0) {
+            goto ERR;
+        }
+
+        fprintf(stderr, "Success\n");
+    }
+
+    (void)vm_set_isa(NULL);
+
+    return 0;
+
+ERR:
+    fprintf(stderr, "Failed\n");
+    (void)vm_set_isa(NULL);
+    return -1;
+}
+
+static int run_all_tests()
+{
+    int ret = 0;
+
+    if (unit_test_vecmath() != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret;
+
+    fprintf(stderr, "Start testing...\n");
+    ret = run_all_tests();
+    if (ret != 0) {
+        fprintf(stderr, "Tests failed.\n");
+    } else {
+        fprintf(stderr, "Tests succeeded.\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,601 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "param.h"
+#include "updaters/wt_updater.h"
+
+#define HASH_SIZE 3000
+#define NUM_ROWS 20
+#define NUM_COLS 1500
+#define NUM_BATCHES 7
+#define BATCH_SIZE 3
+
+static real_t val_of(int i, int j)
+{
+    return (real_t)(((i * 31 + j * 17) % 23) - 11) / 23.0;
+}
+
+static int check_mat(mat_t *mat1, mat_t *mat2)
+{
+    size_t i, j;
+
+    for (i = 0; i < mat1->num_rows; i++) {
+        for (j = 0; j < mat1->num_cols; j++) {
+            if (fabs(MAT_VAL(mat1, i, j) - MAT_VAL(mat2, i, j)) > 1e-5) {
+                fprintf(stderr, "[%zu, %zu]: %g != %g\n", i, j,
+                        (double)MAT_VAL(mat1, i, j),
+                        (double)MAT_VAL(mat2, i, j));
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* every batch updates a few parts of the hash weight, the last one
+   wraps around. */
+static int update_hash(wt_updater_t *wt_updater, int batch)
+{
+    mat_t er = {0};
+    st_size_seg_t part;
+    int p, j;
+
+    if (mat_resize(&er, 1, 5, 0.0) < 0) {
+        return -1;
+    }
+
+    for (p = 0; p < 3; p++) {
+        part.n = er.num_cols;
+        if (p == 2) {
+            part.s = HASH_SIZE - 2;
+        } else {
+            part.s = (batch * 977 + p * 1021) % (HASH_SIZE - part.n);
+        }
+        for (j = 0; j < part.n; j++) {
+            MAT_VAL(&er, 0, j) = val_of(batch + p, j);
+        }
+        if (wt_update(wt_updater, &er, 1.0, NULL, 1.0, &part, NULL) < 0) {
+            mat_destroy(&er);
+            return -1;
+        }
+    }
+
+    mat_destroy(&er);
+    return 0;
+}
+
+/* every batch updates BATCH_SIZE distinct rows, i.e. row (batch + b * 2). */
+static int update_rows(wt_updater_t *wt_updater, int batch)
+{
+    mat_t er = {0};
+    mat_t in = {0};
+    int rows[BATCH_SIZE];
+    int b, j;
+
+    if (mat_resize(&er, BATCH_SIZE, 1, 0.0) < 0
+            || mat_resize(&in, BATCH_SIZE, NUM_COLS, 0.0) < 0) {
+        return -1;
+    }
+
+    for (b = 0; b < BATCH_SIZE; b++) {
+        rows[b] = (batch + b * 2) % NUM_ROWS;
+        MAT_VAL(&er, b, 0) = val_of(batch, b);
+        for (j = 0; j < NUM_COLS; j++) {
+            MAT_VAL(&in, b, j) = val_of(b, j);
+        }
+    }
+
+    if (wt_update_rows(wt_updater, &er, 1.0, &in, 1.0, rows) < 0) {
+        mat_destroy(&er);
+        mat_destroy(&in);
+        return -1;
+    }
+
+    mat_destroy(&er);
+    mat_destroy(&in);
+    return 0;
+}
+
+typedef int (*update_func_t)(wt_updater_t *wt_updater, int batch);
+
+static int run_updates(param_t *param, size_t num_rows, size_t num_cols,
+        wt_update_type_t type, update_func_t update, mat_t *wt)
+{
+    wt_updater_t *wt_updater = NULL;
+    vec_t bias = {0};
+    size_t i, j;
+    int b;
+
+    if (mat_resize(wt, num_rows, num_cols, 0.0) < 0) {
+        return -1;
+    }
+    for (i = 0; i < num_rows; i++) {
+        for (j = 0; j < num_cols; j++) {
+            MAT_VAL(wt, i, j) = val_of(i, j);
+        }
+    }
+
+    wt_updater = wt_updater_create(param, wt, &bias, type);
+    if (wt_updater == NULL) {
+        return -1;
+    }
+
+    for (b = 0; b < NUM_BATCHES; b++) {
+        if (update(wt_updater, b) < 0) {
+            goto ERR;
+        }
+        if (wt_updater_flush(wt_updater) < 0) {
+            goto ERR;
+        }
+        if (wt_updater->acc_wt.num_rows > 0) {
+            fprintf(stderr, "dense accumulation for sparse updates\n");
+            goto ERR;
+        }
+    }
+
+    if (wt_updater_finish(wt_updater) < 0) {
+        goto ERR;
+    }
+
+    safe_wt_updater_destroy(wt_updater);
+    return 0;
+
+ERR:
+    safe_wt_updater_destroy(wt_updater);
+    return -1;
+}
+
+static int unit_test_wt_updater_sync()
+{
+    param_t param;
+    mat_t wt1 = {0};
+    mat_t wt2 = {0};
+
+    memset(&param, 0, sizeof(param_t));
+    param.learn_rate = 0.1;
+    param.learn_rate_coef = 1.0;
+    param.bias_learn_rate_coef = 1.0;
+
+    fprintf(stderr, "  Testing accumulating hash weight...");
+    param.sync_size = 0;
+    if (run_updates(&param, 1, HASH_SIZE, WT_UT_PART,
+                update_hash, &wt1) < 0) {
+        goto ERR;
+    }
+    param.sync_size = 3;
+    if (run_updates(&param, 1, HASH_SIZE, WT_UT_PART,
+                update_hash, &wt2) < 0) {
+        goto ERR;
+    }
+    if (check_mat(&wt1, &wt2) < 0) {
+        goto ERR;
+    }
+    fprintf(stderr, "Success\n");
+
+    fprintf(stderr, "  Testing accumulating rows...");
+    param.sync_size = 0;
+    if (run_updates(&param, NUM_ROWS, NUM_COLS, WT_UT_ONE_SHOT,
+                update_rows, &wt1) < 0) {
+        goto ERR;
+    }
+    param.sync_size = 2;
+    if (run_updates(&param, NUM_ROWS, NUM_COLS, WT_UT_ONE_SHOT,
+                update_rows, &wt2) < 0) {
+        goto ERR;
+    }
+    if (check_mat(&wt1, &wt2) < 0) {
+        goto ERR;
+    }
+    fprintf(stderr, "Success\n");
+
+    mat_destroy(&wt1);
+    mat_destroy(&wt2);
+    return 0;
+
+ERR:
+    fprintf(stderr, "Failed\n");
+    mat_destroy(&wt1);
+    mat_destroy(&wt2);
+    return -1;
+}
+
+/* gradient of row r in batch. */
+static real_t grad_of(int batch, int r, int j)
+{
+    return val_of(batch, r) * val_of(r + batch, j);
+}
+
+/* update rows[0..n) with one wt_update_rows. */
+static int update_some_rows(wt_updater_t *wt_updater, int batch,
+        int *rows, int n)
+{
+    mat_t er = {0};
+    mat_t in = {0};
+    int b, j;
+
+    if (mat_resize(&er, n, 1, 0.0) < 0
+            || mat_resize(&in, n, NUM_COLS, 0.0) < 0) {
+        return -1;
+    }
+
+    for (b = 0; b < n; b++) {
+        MAT_VAL(&er, b, 0) = val_of(batch, rows[b]);
+        for (j = 0; j < NUM_COLS; j++) {
+            MAT_VAL(&in, b, j) = val_of(rows[b] + batch, j);
+        }
+    }
+
+    if (wt_update_rows(wt_updater, &er, 1.0, &in, 1.0, rows) < 0) {
+        mat_destroy(&er);
+        mat_destroy(&in);
+        return -1;
+    }
+
+    mat_destroy(&er);
+    mat_destroy(&in);
+    return 0;
+}
+
+/* several wt_update_rows per batch, touching a few rows only. */
+static int lazy_updates(param_t *param, mat_t *wt)
+{
+    wt_updater_t *wt_updater = NULL;
+    vec_t bias = {0};
+    int rows1[2], rows2[1];
+    int b;
+
+    wt_updater = wt_updater_create(param, wt, &bias, WT_UT_FULL);
+    if (wt_updater == NULL) {
+        return -1;
+    }
+
+    for (b = 0; b < NUM_BATCHES; b++) {
+        rows1[0] = b % NUM_ROWS;
+        rows1[1] = (b + 5) % NUM_ROWS;
+        rows2[0] = (b + 10) % NUM_ROWS;
+        if (update_some_rows(wt_updater, b, rows1, 2) < 0
+                || update_some_rows(wt_updater, b, rows2, 1) < 0) {
+            goto ERR;
+        }
+        if (wt_updater_flush(wt_updater) < 0) {
+            goto ERR;
+        }
+    }
+
+    if (wt_updater_finish(wt_updater) < 0) {
+        goto ERR;
+    }
+
+    safe_wt_updater_destroy(wt_updater);
+    return 0;
+
+ERR:
+    safe_wt_updater_destroy(wt_updater);
+    return -1;
+}
+
+/* apply penalties and momentum on every row in every batch. */
+static int eager_updates(param_t *param, mat_t *wt)
+{
+    mat_t delta = {0};
+    real_t lr, l2, mmt, g;
+    int b, r, j;
+
+    if (mat_resize(&delta, NUM_ROWS, NUM_COLS, 0.0) < 0) {
+        return -1;
+    }
+
+    lr = param->learn_rate * (1.0 - param->momentum);
+    l2 = lr * param->l2_penalty;
+    mmt = param->momentum;
+
+    for (b = 0; b < NUM_BATCHES; b++) {
+        for (r = 0; r < NUM_ROWS; r++) {
+            for (j = 0; j < NUM_COLS; j++) {
+                if (r == b % NUM_ROWS || r == (b + 5) % NUM_ROWS
+                        || r == (b + 10) % NUM_ROWS) {
+                    g = lr * grad_of(b, r, j);
+                } else {
+                    g = 0.0;
+                }
+                MAT_VAL(&delta, r, j) = mmt * MAT_VAL(&delta, r, j) + g;
+                MAT_VAL(wt, r, j) += - l2 * MAT_VAL(wt, r, j)
+                    + MAT_VAL(&delta, r, j);
+            }
+        }
+    }
+
+    mat_destroy(&delta);
+    return 0;
+}
+
+static int check_lazy(param_t *param)
+{
+    mat_t wt1 = {0};
+    mat_t wt2 = {0};
+    int r, j;
+
+    if (mat_resize(&wt1, NUM_ROWS, NUM_COLS, 0.0) < 0
+            || mat_resize(&wt2, NUM_ROWS, NUM_COLS, 0.0) < 0) {
+        goto ERR;
+    }
+    for (r = 0; r < NUM_ROWS; r++) {
+        for (j = 0; j < NUM_COLS; j++) {
+            MAT_VAL(&wt1, r, j) = val_of(r, j);
+            MAT_VAL(&wt2, r, j) = val_of(r, j);
+        }
+    }
+
+    if (lazy_updates(param, &wt1) < 0) {
+        goto ERR;
+    }
+    if (eager_updates(param, &wt2) < 0) {
+        goto ERR;
+    }
+    if (check_mat(&wt1, &wt2) < 0) {
+        goto ERR;
+    }
+
+    mat_destroy(&wt1);
+    mat_destroy(&wt2);
+    return 0;
+
+ERR:
+    mat_destroy(&wt1);
+    mat_destroy(&wt2);
+    return -1;
+}
+
+static int unit_test_wt_updater_lazy()
+{
+    param_t param;
+
+    memset(&param, 0, sizeof(param_t));
+    param.learn_rate = 0.1;
+    param.learn_rate_coef = 1.0;
+    param.bias_learn_rate_coef = 1.0;
+    param.momentum_coef = 1.0;
+    param.bias_momentum_coef = 1.0;
+
+    fprintf(stderr, "  Testing lazy L2 penalty...");
+    param.l2_penalty = 0.05;
+    if (check_lazy(&param) < 0) {
+        goto ERR;
+    }
+    fprintf(stderr, "Success\n");
+
+    fprintf(stderr, "  Testing lazy momentum...");
+    param.l2_penalty = 0.0;
+    param.momentum = 0.5;
+    if (check_lazy(&param) < 0) {
+        goto ERR;
+    }
+    fprintf(stderr, "Success\n");
+
+    return 0;
+
+ERR:
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
+#define SEG_SIZE 100
+
+/* every changed value must be in a flagged segment. */
+static int check_segs(mat_t *wt, mat_t *last, bool *segs,
+        size_t segs_per_row, int *num_changed)
+{
+    size_t i, j;
+
+    for (i = 0; i < wt->num_rows; i++) {
+        for (j = 0; j < wt->num_cols; j++) {
+            if (MAT_VAL(wt, i, j) == MAT_VAL(last, i, j)) {
+                continue;
+            }
+            if (!segs[i * segs_per_row + j / SEG_SIZE]) {
+                fprintf(stderr, "[%zu, %zu] changed without flag\n", i, j);
+                return -1;
+            }
+            (*num_changed)++;
+        }
+    }
+
+    memset(segs, 0, sizeof(bool) * wt->num_rows * segs_per_row);
+    if (mat_cpy(last, wt) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int watch_updates(param_t *param, size_t num_rows, size_t num_cols,
+        wt_update_type_t type, update_func_t update)
+{
+    wt_updater_t *wt_updater = NULL;
+    vec_t bias = {0};
+    mat_t wt = {0};
+    mat_t last = {0};
+    bool *segs = NULL;
+    size_t segs_per_row;
+    size_t i, j;
+    int num_changed;
+    int b;
+
+    if (mat_resize(&wt, num_rows, num_cols, 0.0) < 0) {
+        goto ERR;
+    }
+    for (i = 0; i < num_rows; i++) {
+        for (j = 0; j < num_cols; j++) {
+            MAT_VAL(&wt, i, j) = val_of(i, j);
+        }
+    }
+    if (mat_cpy(&last, &wt) < 0) {
+        goto ERR;
+    }
+
+    segs_per_row = (num_cols + SEG_SIZE - 1) / SEG_SIZE;
+    segs = (bool *)malloc(sizeof(bool) * num_rows * segs_per_row);
+    if (segs == NULL) {
+        goto ERR;
+    }
+    memset(segs, 0, sizeof(bool) * num_rows * segs_per_row);
+
+    wt_updater = wt_updater_create(param, &wt, &bias, type);
+    if (wt_updater == NULL) {
+        goto ERR;
+    }
+    if (wt_updater_watch_segs(wt_updater, segs, NULL, SEG_SIZE) < 0) {
+        goto ERR;
+    }
+
+    num_changed = 0;
+    for (b = 0; b < NUM_BATCHES; b++) {
+        if (update(wt_updater, b) < 0) {
+            goto ERR;
+        }
+        if (wt_updater_flush(wt_updater) < 0) {
+            goto ERR;
+        }
+        if (check_segs(&wt, &last, segs, segs_per_row, &num_changed) < 0) {
+            goto ERR;
+        }
+    }
+
+    if (wt_updater_finish(wt_updater) < 0) {
+        goto ERR;
+    }
+    if (check_segs(&wt, &last, segs, segs_per_row, &num_changed) < 0) {
+        goto ERR;
+    }
+    if (num_changed == 0) {
+        fprintf(stderr, "nothing changed\n");
+        goto ERR;
+    }
+
+    safe_wt_updater_destroy(wt_updater);
+    free(segs);
+    mat_destroy(&wt);
+    mat_destroy(&last);
+    return 0;
+
+ERR:
+    safe_wt_updater_destroy(wt_updater);
+    free(segs);
+    mat_destroy(&wt);
+    mat_destroy(&last);
+    return -1;
+}
+
+static int unit_test_wt_updater_watch()
+{
+    param_t param;
+    int sync_size;
+
+    memset(&param, 0, sizeof(param_t));
+    param.learn_rate = 0.1;
+    param.learn_rate_coef = 1.0;
+    param.bias_learn_rate_coef = 1.0;
+    param.momentum_coef = 1.0;
+    param.bias_momentum_coef = 1.0;
+
+    for (sync_size = 0; sync_size <= 2; sync_size += 2) {
+        param.sync_size = sync_size;
+
+        fprintf(stderr, "  Testing watching hash weight(sync_size = %d)...",
+                sync_size);
+        param.l2_penalty = 0.0;
+        param.momentum = 0.0;
+        if (watch_updates(&param, 1, HASH_SIZE, WT_UT_PART,
+                    update_hash) < 0) {
+            goto ERR;
+        }
+        param.l2_penalty = 0.05;
+        if (watch_updates(&param, 1, HASH_SIZE, WT_UT_PART,
+                    update_hash) < 0) {
+            goto ERR;
+        }
+        fprintf(stderr, "Success\n");
+
+        fprintf(stderr, "  Testing watching rows(sync_size = %d)...",
+                sync_size);
+        param.l2_penalty = 0.0;
+        if (watch_updates(&param, NUM_ROWS, NUM_COLS, WT_UT_ONE_SHOT,
+                    update_rows) < 0) {
+            goto ERR;
+        }
+        param.momentum = 0.5;
+        if (watch_updates(&param, NUM_ROWS, NUM_COLS, WT_UT_ONE_SHOT,
+                    update_rows) < 0) {
+            goto ERR;
+        }
+        fprintf(stderr, "Success\n");
+    }
+
+    return 0;
+
+ERR:
+    fprintf(stderr, "Failed\n");
+    return -1;
+}
+
+static int run_all_tests()
+{
+    int ret = 0;
+
+    if (unit_test_wt_updater_sync() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_wt_updater_lazy() != 0) {
+        ret = -1;
+    }
+
+    if (unit_test_wt_updater_watch() != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int main(int argc, const char *argv[])
+{
+    int ret;
+
+    fprintf(stderr, "Start testing...\n");
+    ret = run_all_tests();
+    if (ret != 0) {
+        fprintf(stderr, "Tests failed.\n");
+    } else {
+        fprintf(stderr, "Tests succeeded.\n");
+    }
+
+    return ret;
+}
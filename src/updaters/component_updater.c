@@ -540,10 +540,10 @@ static int comp_updater_bptt(comp_updater_t *comp_updater, bool clear)
 
                         // dropout in_er
                         if (keep_prob < 1.0) {
-                            if (mat_mul_elems(in_er,
+                            if (mat_mask_scale(in_er,
                                         &comp_updater->glue_updaters[g]->keep_mask,
-                                        in_er) < 0) {
-                                ST_ERROR("Failed to mat_mul_elems.");
+                                        1.0, in_er) < 0) {
+                                ST_ERROR("Failed to mat_mask_scale.");
                                 return -1;
                             }
                         }
@@ -739,6 +739,14 @@ int comp_updater_backprop(comp_updater_t *comp_updater, egs_batch_t *batch)
         }
     }
 
+    for (g = 0; g < comp->num_glue; g++) {
+        if (glue_updater_flush(comp_updater->glue_updaters[g]) < 0) {
+            ST_ERROR("Failed to glue_updater_flush[%s].",
+                    comp->glues[g]->name);
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -788,6 +796,7 @@ int comp_updater_prepare(comp_updater_t *comp_updater, egs_batch_t *batch)
 int comp_updater_finish(comp_updater_t *comp_updater)
 {
     component_t *comp;
+    int g;
 
     ST_CHECK_PARAM(comp_updater == NULL, -1);
 
@@ -804,6 +813,14 @@ int comp_updater_finish(comp_updater_t *comp_updater)
         }
     }
 
+    for (g = 0; g < comp->num_glue; g++) {
+        if (glue_updater_finish(comp_updater->glue_updaters[g]) < 0) {
+            ST_ERROR("Failed to glue_updater_finish[%s].",
+                    comp->glues[g]->name);
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -947,7 +964,10 @@ int comp_updater_dump_state(comp_updater_t *comp_updater, mat_t *state)
                     comp_updater->comp->layers[i]->name);
             return -1;
         }
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (size == 0) {
+            continue;
+        }
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -982,7 +1002,10 @@ int comp_updater_dump_pre_ac_state(comp_updater_t *comp_updater,
                     comp_updater->comp->layers[i]->name);
             return -1;
         }
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (size == 0) {
+            continue;
+        }
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -1016,7 +1039,10 @@ int comp_updater_feed_state(comp_updater_t *comp_updater, mat_t *state)
                     comp_updater->comp->layers[i]->name);
             return -1;
         }
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (size == 0) {
+            continue;
+        }
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -1049,7 +1075,10 @@ int comp_updater_random_state(comp_updater_t *comp_updater, mat_t *state)
                     comp_updater->comp->layers[i]->name);
             return -1;
         }
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (size == 0) {
+            continue;
+        }
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -1083,7 +1112,10 @@ int comp_updater_activate_state(comp_updater_t *comp_updater, mat_t *state)
                     comp_updater->comp->layers[i]->name);
             return -1;
         }
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (size == 0) {
+            continue;
+        }
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -28,7 +28,6 @@
 #include <stutils/st_macro.h>
 #include <stutils/st_utils.h>
 #include <stutils/st_log.h>
-#include <stutils/st_rand.h>
 
 #include "output.h"
 #include "../../glues/direct_glue.h"
@@ -47,6 +46,9 @@ const unsigned int PRIMES[] = {
 
 const unsigned int PRIMES_SIZE = sizeof(PRIMES) / sizeof(PRIMES[0]);
 
+#define DIRECT_NODE_PRIME 2654435761U /* spread nodes among buckets. */
+#define DIRECT_PREFETCH_DIST 2 /* number of examples prefetched ahead. */
+
 typedef struct _dgu_data_t_ {
     hash_t **hash_vals;
     int *hash_orders;
@@ -56,6 +58,8 @@ typedef struct _dgu_data_t_ {
     unsigned int **P; /**< coefficients of hash function, which is like
                            P0 + P0 * P1 * w1 + P0 * P1 * P2 * w2 + ... */
     int num_feats;
+
+    bool bucket; /**< whether using bucketed layout. */
 } dgu_data_t;
 
 #define safe_dgu_data_destroy(ptr) do {\
@@ -300,75 +304,135 @@ static int direct_get_hash_neg(hash_t *hash, hash_t init_val,
 int direct_glue_updater_setup(glue_updater_t *glue_updater,
         comp_updater_t *comp_updater, bool backprop)
 {
+    dgu_data_t *data;
+
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL, -1);
 
-    if (dgu_data_setup((dgu_data_t *)glue_updater->extra,
-                comp_updater->comp->input->context,
+    data = (dgu_data_t *)glue_updater->extra;
+
+    if (dgu_data_setup(data, comp_updater->comp->input->context,
                 comp_updater->comp->input->n_ctx) < 0) {
         ST_ERROR("Failed to dgu_data_setup");
         return -1;
     }
 
+    data->bucket = ((direct_glue_data_t *)glue_updater->glue->extra)->bucket;
+
     return 0;
 }
 
+/*
+ * Position in hash table of the first child of node for one hash value.
+ * With the bucketed layout, all children of a node start at an aligned
+ * bucket, so that the weights for one n-gram on one node share the same
+ * cache lines, instead of being offset by child_s.
+ */
+static inline hash_t direct_node_pos(hash_t hash, output_node_id_t node,
+        output_node_id_t child_s, size_t hash_sz, bool bucket)
+{
+    hash_t h;
+
+    if (bucket) {
+        h = hash + (hash_t)node * DIRECT_NODE_PRIME;
+        return (h % (hash_sz / DIRECT_BUCKET_SIZE)) * DIRECT_BUCKET_SIZE;
+    }
+
+    h = hash + child_s;
+    if (h >= hash_sz) {
+        h -= hash_sz;
+    }
+
+    return h;
+}
+
+static inline void direct_prefetch_node(real_t *hash_wt, qmat_t *qwt,
+        size_t hash_sz, bool bucket, hash_t *hash_vals, int hash_order,
+        output_node_id_t node, output_node_id_t child_s)
+{
+    hash_t h;
+    int a;
+
+    for (a = 0; a < hash_order; a++) {
+        h = direct_node_pos(hash_vals[a], node, child_s, hash_sz, bucket);
+        if (qwt != NULL) {
+            __builtin_prefetch(qwt->vals + h, 0);
+        } else {
+            __builtin_prefetch(hash_wt + h, 0);
+        }
+    }
+}
+
 static int forward_one_node(output_norm_t norm, output_node_id_t node,
         output_node_id_t child_s, output_node_id_t child_e,
-        real_t *hash_wt, size_t hash_sz,
+        real_t *hash_wt, qmat_t *qwt, size_t hash_sz, bool bucket,
         hash_t *hash_vals, int hash_order, real_t *out_ac, real_t scale,
-        real_t *keep_mask, real_t keep_prob, unsigned int *rand_seed)
+        bmat_t *keep_mask, size_t row, real_t keep_prob, uint32_t keep_key)
 {
+    bmat_word_t *mask;
     hash_t h;
-    output_node_id_t ch;
-    double p;
+    output_node_id_t ch, ch_e;
     int a;
 
     ST_CHECK_PARAM(out_ac == NULL, -1);
 
+    if (norm == ON_NCE) {
+        ch_e = child_e;
+    } else {
+        ch_e = child_e - 1; // the last child is implicit
+    }
+
+    /* issue loads for all orders before accumulating any of them. */
+    direct_prefetch_node(hash_wt, qwt, hash_sz, bucket,
+            hash_vals, hash_order, node, child_s);
+
+    mask = NULL;
+    if (keep_mask != NULL) {
+        /* only the children of visited nodes need a mask. */
+        bmat_rand_seg(keep_mask, row, child_s, ch_e - child_s,
+                keep_prob, keep_key);
+        mask = BMAT_ROWP(keep_mask, row);
+    }
+
     for (a = 0; a < hash_order; a++) {
-        h = hash_vals[a] + child_s;
-        if (h > hash_sz) {
-            h -= hash_sz;
-        }
-
-        if (keep_mask != NULL) {
-            for (ch = child_s; ch < child_e - 1; ch++) {
-                p = st_random_r(0, 1, rand_seed);
-                if (p < keep_prob) {
-                    keep_mask[ch] = 1.0;
-                } else {
-                    keep_mask[ch] = 0.0;
-                }
-            }
+        h = direct_node_pos(hash_vals[a], node, child_s, hash_sz, bucket);
 
-            if (h + child_e - child_s - 1 > hash_sz) {
+        if (mask != NULL) {
+            if (h + ch_e - child_s > hash_sz) {
                 for (ch = child_s; h < hash_sz; ch++, h++) {
-                    if (keep_mask[ch] == 1.0) {
+                    if (BMAT_BIT(mask, ch)) {
                         out_ac[ch - child_s] += scale * hash_wt[h] / keep_prob;
                     }
                 }
-                for (h = 0; ch < child_e - 1; ch++, h++) {
-                    if (keep_mask[ch] == 1.0) {
+                for (h = 0; ch < ch_e; ch++, h++) {
+                    if (BMAT_BIT(mask, ch)) {
                         out_ac[ch - child_s] += scale * hash_wt[h] / keep_prob;
                     }
                 }
             } else {
-                for (ch = child_s; ch < child_e - 1; ch++, h++) {
-                    if (keep_mask[ch] == 1.0) {
+                for (ch = child_s; ch < ch_e; ch++, h++) {
+                    if (BMAT_BIT(mask, ch)) {
                         out_ac[ch - child_s] += scale * hash_wt[h] / keep_prob;
                     }
                 }
             }
+        } else if (qwt != NULL) {
+            if (h + ch_e - child_s > hash_sz) {
+                qmat_add_row_seg(qwt, 0, h, hash_sz - h, scale, out_ac);
+                qmat_add_row_seg(qwt, 0, 0, ch_e - child_s - (hash_sz - h),
+                        scale, out_ac + (hash_sz - h));
+            } else {
+                qmat_add_row_seg(qwt, 0, h, ch_e - child_s, scale, out_ac);
+            }
         } else {
-            if (h + child_e - child_s - 1 > hash_sz) {
+            if (h + ch_e - child_s > hash_sz) {
                 for (ch = child_s; h < hash_sz; ch++, h++) {
                     out_ac[ch - child_s] += scale * hash_wt[h];
                 }
-                for (h = 0; ch < child_e - 1; ch++, h++) {
+                for (h = 0; ch < ch_e; ch++, h++) {
                     out_ac[ch - child_s] += scale * hash_wt[h];
                 }
             } else {
-                for (ch = child_s; ch < child_e - 1; ch++, h++) {
+                for (ch = child_s; ch < ch_e; ch++, h++) {
                     out_ac[ch - child_s] += scale * hash_wt[h];
                 }
             }
@@ -385,13 +449,18 @@ typedef struct _direct_forward_walker_args_t_ {
     int *node_iters;
 
     real_t *hash_wt;
+    qmat_t *qwt; /* quantized hash_wt, if not NULL. */
     hash_t hash_sz;
+    bool bucket;
     hash_t *hash_vals;
     int hash_order;
 
-    real_t *keep_mask;
+    bmat_t *keep_mask;
+    size_t row;
     real_t keep_prob;
-    unsigned int *rand_seed;
+    uint32_t keep_key;
+
+    ivec_t *node_cands;
 } direct_fwd_walker_args_t;
 
 static int direct_forward_walker(output_t *output, output_node_id_t node,
@@ -407,11 +476,12 @@ static int direct_forward_walker(output_t *output, output_node_id_t node,
     }
 
     if (forward_one_node(output->norm, node,
-                child_s, child_e, dfw_args->hash_wt, dfw_args->hash_sz,
+                child_s, child_e, dfw_args->hash_wt, dfw_args->qwt,
+                dfw_args->hash_sz, dfw_args->bucket,
                 dfw_args->hash_vals, dfw_args->hash_order,
                 MAT_VALP(dfw_args->node_out_acs + node, dfw_args->node_iters[node], 0),
-                dfw_args->scale, dfw_args->keep_mask, dfw_args->keep_prob,
-                dfw_args->rand_seed) < 0) {
+                dfw_args->scale, dfw_args->keep_mask, dfw_args->row,
+                dfw_args->keep_prob, dfw_args->keep_key) < 0) {
         ST_ERROR("Failed to forward_one_node");
         return -1;
     }
@@ -421,6 +491,48 @@ static int direct_forward_walker(output_t *output, output_node_id_t node,
     return 0;
 }
 
+static int direct_forward_sampled_walker(output_t *output,
+        output_node_id_t node, output_node_id_t next_node,
+        output_node_id_t child_s, output_node_id_t child_e, void *args)
+{
+    direct_fwd_walker_args_t *dfw_args;
+    mat_t *out_ac;
+    int *cands;
+
+    hash_t h;
+    double score;
+    int row, a, j;
+
+    dfw_args = (direct_fwd_walker_args_t *) args;
+
+    if (child_e - child_s <= 1) {
+        return 0;
+    }
+
+    out_ac = dfw_args->node_out_acs + node;
+    row = dfw_args->node_iters[node];
+    cands = VEC_VALP(dfw_args->node_cands + node, row * out_ac->num_cols);
+
+    for (j = 0; j < out_ac->num_cols; j++) {
+        score = 0.0;
+        for (a = 0; a < dfw_args->hash_order; a++) {
+            h = (direct_node_pos(dfw_args->hash_vals[a], node, child_s,
+                        dfw_args->hash_sz, dfw_args->bucket) + cands[j])
+                % dfw_args->hash_sz;
+            if (dfw_args->qwt != NULL) {
+                score += QMAT_VAL(dfw_args->qwt, 0, h);
+            } else {
+                score += dfw_args->hash_wt[h];
+            }
+        }
+        MAT_VAL(out_ac, row, j) += dfw_args->scale * score;
+    }
+
+    dfw_args->node_iters[node]++;
+
+    return 0;
+}
+
 static int direct_compute_hash(glue_updater_t *glue_updater, int batch_id,
         egs_input_t *input)
 {
@@ -486,16 +598,21 @@ static int reset_node_iters_walker(output_t *output, output_node_id_t node,
 
 static int reset_node_iters(out_updater_t *out_updater, egs_batch_t *batch)
 {
+    output_step_t *step;
     int b;
 
     for (b = 0; b < batch->num_egs; b++) {
         if (batch->targets[b] == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(out_updater->output, batch->targets[b],
-                    reset_node_iters_walker, (void *)out_updater->node_iters) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(out_updater->output, batch->targets[b],
+                step) {
+            if (reset_node_iters_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)out_updater->node_iters) < 0) {
+                ST_ERROR("Failed to reset_node_iters_walker.");
+                return -1;
+            }
         }
     }
 
@@ -527,7 +644,11 @@ int direct_glue_updater_forward(glue_updater_t *glue_updater,
     out_updater_t *out_updater;
 
     direct_fwd_walker_args_t dfw_args;
-    int b;
+    output_step_t *step;
+    output_node_id_t root, root_s;
+    bool sampled;
+    int b, n;
+    int ret;
 
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL
             || batch == NULL, -1);
@@ -546,35 +667,74 @@ int direct_glue_updater_forward(glue_updater_t *glue_updater,
     dfw_args.node_iters = comp_updater->out_updater->node_iters;
 
     dfw_args.hash_wt = MAT_VALP(&glue_updater->wt_updaters[0]->wt, 0, 0);
+    dfw_args.qwt = glue_updater->wt_updaters[0]->qwt;
     dfw_args.hash_sz = glue_updater->wt_updaters[0]->wt.num_cols;
+    dfw_args.bucket = data->bucket;
 
     dfw_args.keep_mask = NULL;
+    dfw_args.row = 0;
     dfw_args.keep_prob = glue_updater->keep_prob;
-    dfw_args.rand_seed = glue_updater->rand_seed;
+    dfw_args.keep_key = glue_updater->keep_key;
+
+    dfw_args.node_cands = out_updater->node_cands;
+    sampled = (dfw_args.node_cands != NULL);
+    if (sampled) {
+        if (glue_updater->keep_mask.num_rows > 0) {
+            ST_ERROR("Dropout is not supported for direct glue with NCE.");
+            return -1;
+        }
+    }
+
+    // hash_vals of whole batch are computed in advance, so that the
+    // root node of upcoming examples can be prefetched while walking
+    // the current one. Nodes are mixed into the position by
+    // direct_node_pos, if the bucketed layout is used.
     for (b = 0; b < batch->num_egs; b++) {
         if (batch->targets[b] == PADDING_ID) {
             continue;
         }
-
-        // TODO: instead of computing hash_vals here in advance,
-        //       move this function inside direct_forward_walker
-        //       with node_id as init_val, so that we can get different
-        //       hash_vals on different tree nodes.
         if (direct_compute_hash(glue_updater, b, batch->inputs + b) < 0) {
             ST_ERROR("Failed to direct_compute_hash.");
             return -1;
         }
+    }
+
+    root = out_updater->output->tree->root;
+    root_s = s_children(out_updater->output->tree, root);
+    for (b = 0; b < batch->num_egs; b++) {
+        if (batch->targets[b] == PADDING_ID) {
+            continue;
+        }
+
+        n = b + DIRECT_PREFETCH_DIST;
+        if (n < batch->num_egs && batch->targets[n] != PADDING_ID) {
+            direct_prefetch_node(dfw_args.hash_wt, dfw_args.qwt,
+                    dfw_args.hash_sz, dfw_args.bucket,
+                    data->hash_vals[n], data->hash_orders[n], root, root_s);
+        }
 
         dfw_args.hash_vals = data->hash_vals[b];
         dfw_args.hash_order = data->hash_orders[b];
         if (glue_updater->keep_mask.num_rows > 0) {
-            dfw_args.keep_mask = MAT_VALP(&glue_updater->keep_mask, b, 0);
+            dfw_args.keep_mask = &glue_updater->keep_mask;
+            dfw_args.row = b;
         }
-        if (output_walk_through_path(out_updater->output,
-                    batch->targets[b],
-                    direct_forward_walker, (void *)&dfw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(out_updater->output, batch->targets[b],
+                step) {
+            if (sampled) {
+                ret = direct_forward_sampled_walker(out_updater->output,
+                        step->node, step->next_node,
+                        step->child_s, step->child_e, (void *)&dfw_args);
+            } else {
+                ret = direct_forward_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)&dfw_args);
+            }
+            if (ret < 0) {
+                ST_ERROR("Failed to walk node["OUTPUT_NODE_FMT"].",
+                        step->node);
+                return -1;
+            }
         }
     }
 
@@ -588,12 +748,15 @@ typedef struct _direct_backprop_walker_args_t_ {
     int *node_iters;
 
     wt_updater_t *wt_updater;
+    bool bucket;
 
     hash_t *hash_vals;
     int hash_order;
 
-    real_t *keep_mask;
+    bmat_word_t *keep_mask;
     real_t *dropout_val;
+
+    ivec_t *node_cands;
 } direct_bp_walker_args_t;
 
 static int direct_backprop_walker(output_t *output, output_node_id_t node,
@@ -602,7 +765,6 @@ static int direct_backprop_walker(output_t *output, output_node_id_t node,
 {
     direct_bp_walker_args_t *dbw_args;
     real_t *out_er;
-    real_t *keep_mask;
     real_t *node_out_er;
 
     mat_t out_er_mat = {0};
@@ -623,9 +785,8 @@ static int direct_backprop_walker(output_t *output, output_node_id_t node,
 
     if (dbw_args->keep_mask != NULL) {
         out_er = dbw_args->dropout_val + child_s;
-        keep_mask = dbw_args->keep_mask + child_s;
-        for (ch = 0; ch < child_e - child_s - 1; ch++) {
-            if (keep_mask[ch]) {
+        for (ch = 0; ch < output_num_scores(output, child_s, child_e); ch++) {
+            if (BMAT_BIT(dbw_args->keep_mask, child_s + ch)) {
                 out_er[ch] = node_out_er[ch];
             } else {
                 out_er[ch] = 0.0;
@@ -636,13 +797,11 @@ static int direct_backprop_walker(output_t *output, output_node_id_t node,
     }
 
     for (a = 0; a < dbw_args->hash_order; a++) {
-        h = dbw_args->hash_vals[a] + child_s;
-        if (h >= hash_sz) {
-            h -= hash_sz;
-        }
+        h = direct_node_pos(dbw_args->hash_vals[a], node, child_s,
+                hash_sz, dbw_args->bucket);
 
         seg.s = h;
-        seg.n = child_e - child_s - 1;
+        seg.n = output_num_scores(output, child_s, child_e);
         mat_from_array(&out_er_mat, out_er, seg.n, true);
         if (wt_update(dbw_args->wt_updater, &out_er_mat, dbw_args->scale,
                     NULL, 1.0, &seg, NULL) < 0) {
@@ -656,6 +815,51 @@ static int direct_backprop_walker(output_t *output, output_node_id_t node,
     return 0;
 }
 
+static int direct_backprop_sampled_walker(output_t *output,
+        output_node_id_t node, output_node_id_t next_node,
+        output_node_id_t child_s, output_node_id_t child_e, void *args)
+{
+    direct_bp_walker_args_t *dbw_args;
+    mat_t *node_out_er;
+    int *cands;
+
+    mat_t out_er_mat = {0};
+    st_size_seg_t seg;
+    size_t hash_sz;
+    int row, a, j;
+
+    dbw_args = (direct_bp_walker_args_t *) args;
+
+    if (child_e - child_s <= 1) {
+        return 0;
+    }
+
+    node_out_er = dbw_args->node_out_ers + node;
+    row = dbw_args->node_iters[node];
+    cands = VEC_VALP(dbw_args->node_cands + node,
+            row * node_out_er->num_cols);
+
+    hash_sz = dbw_args->wt_updater->wt.num_cols;
+
+    seg.n = 1;
+    for (j = 0; j < node_out_er->num_cols; j++) {
+        mat_from_array(&out_er_mat, MAT_VALP(node_out_er, row, j), 1, true);
+        for (a = 0; a < dbw_args->hash_order; a++) {
+            seg.s = (direct_node_pos(dbw_args->hash_vals[a], node, child_s,
+                        hash_sz, dbw_args->bucket) + cands[j]) % hash_sz;
+            if (wt_update(dbw_args->wt_updater, &out_er_mat, dbw_args->scale,
+                        NULL, 1.0, &seg, NULL) < 0) {
+                ST_ERROR("Failed to wt_update.");
+                return -1;
+            }
+        }
+    }
+
+    dbw_args->node_iters[node]++;
+
+    return 0;
+}
+
 int direct_glue_updater_backprop(glue_updater_t *glue_updater,
         comp_updater_t *comp_updater, egs_batch_t *batch,
         mat_t *in_ac, mat_t *out_er, mat_t *in_er)
@@ -664,7 +868,10 @@ int direct_glue_updater_backprop(glue_updater_t *glue_updater,
     out_updater_t *out_updater;
 
     direct_bp_walker_args_t dbw_args;
+    output_step_t *step;
+    bool sampled;
     int b;
+    int ret;
 
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL
             || batch == NULL, -1);
@@ -681,8 +888,11 @@ int direct_glue_updater_backprop(glue_updater_t *glue_updater,
     dbw_args.node_out_ers = out_updater->node_ers;
     dbw_args.node_iters = out_updater->node_iters;
     dbw_args.wt_updater = glue_updater->wt_updaters[0];
+    dbw_args.bucket = data->bucket;
     dbw_args.keep_mask = NULL;
     dbw_args.dropout_val = NULL;
+    dbw_args.node_cands = out_updater->node_cands;
+    sampled = (dbw_args.node_cands != NULL);
     for (b = 0; b < batch->num_egs; b++) {
         if (batch->targets[b] == PADDING_ID) {
             continue;
@@ -691,14 +901,25 @@ int direct_glue_updater_backprop(glue_updater_t *glue_updater,
         dbw_args.hash_vals = data->hash_vals[b];
         dbw_args.hash_order = data->hash_orders[b];
         if (glue_updater->keep_mask.num_rows > 0) {
-            dbw_args.keep_mask = MAT_VALP(&glue_updater->keep_mask, b, 0);
+            dbw_args.keep_mask = BMAT_ROWP(&glue_updater->keep_mask, b);
             dbw_args.dropout_val = MAT_VALP(&glue_updater->dropout_val, b, 0);
         }
-        if (output_walk_through_path(out_updater->output,
-                    batch->targets[b],
-                    direct_backprop_walker, (void *)&dbw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(out_updater->output, batch->targets[b],
+                step) {
+            if (sampled) {
+                ret = direct_backprop_sampled_walker(out_updater->output,
+                        step->node, step->next_node,
+                        step->child_s, step->child_e, (void *)&dbw_args);
+            } else {
+                ret = direct_backprop_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)&dbw_args);
+            }
+            if (ret < 0) {
+                ST_ERROR("Failed to walk node["OUTPUT_NODE_FMT"].",
+                        step->node);
+                return -1;
+            }
         }
     }
 
@@ -758,11 +979,12 @@ int direct_glue_updater_forward_out(glue_updater_t *glue_updater,
     if (forward_one_node(output->norm, node,
                 child_s, child_e,
                 MAT_VALP(&glue_updater->wt_updaters[0]->wt, 0, 0),
-                glue_updater->wt_updaters[0]->wt.num_cols,
+                glue_updater->wt_updaters[0]->qwt,
+                glue_updater->wt_updaters[0]->wt.num_cols, data->bucket,
                 data->hash_vals[0], data->hash_orders[0],
                 MAT_VALP(out_updater->node_acs + node, 0, 0),
                 comp_updater->comp->comp_scale,
-                NULL, 0.0, NULL) < 0) {
+                NULL, 0, 0.0, 0) < 0) {
         ST_ERROR("Failed to forward_one_node");
         return -1;
     }
@@ -788,10 +1010,10 @@ static int forward_out_words_walker(output_t *output, output_node_id_t node,
     }
 
     if (forward_one_node(output->norm, node, child_s, child_e,
-                dfw_args->hash_wt, dfw_args->hash_sz,
-                dfw_args->hash_vals, dfw_args->hash_order,
+                dfw_args->hash_wt, dfw_args->qwt, dfw_args->hash_sz,
+                dfw_args->bucket, dfw_args->hash_vals, dfw_args->hash_order,
                 MAT_VALP(dfw_args->node_out_acs + node, 0, 0),
-                dfw_args->scale, NULL, 0.0, NULL) < 0) {
+                dfw_args->scale, NULL, 0, 0.0, 0) < 0) {
         ST_ERROR("Failed to forward_one_node["OUTPUT_NODE_FMT"]", node);
         return -1;
     }
@@ -810,6 +1032,7 @@ int direct_glue_updater_forward_out_words(glue_updater_t *glue_updater,
     out_updater_t *out_updater;
     dgu_data_t *data;
 
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL
@@ -833,17 +1056,23 @@ int direct_glue_updater_forward_out_words(glue_updater_t *glue_updater,
     dfw_args.node_iters = out_updater->node_iters;
 
     dfw_args.hash_wt = MAT_VALP(&glue_updater->wt_updaters[0]->wt, 0, 0);
+    dfw_args.qwt = glue_updater->wt_updaters[0]->qwt;
     dfw_args.hash_sz = glue_updater->wt_updaters[0]->wt.num_cols;
+    dfw_args.bucket = data->bucket;
     dfw_args.hash_vals = data->hash_vals[0];
     dfw_args.hash_order = data->hash_orders[0];
     for (i = 0; i < words->size; i++) {
         if (VEC_VAL(words, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(out_updater->output, VEC_VAL(words, i),
-                    forward_out_words_walker, (void *)&dfw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path for forward_out_words.");
-            return -1;
+        output_path_for_each_step(out_updater->output, VEC_VAL(words, i),
+                step) {
+            if (forward_out_words_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)&dfw_args) < 0) {
+                ST_ERROR("Failed to forward_out_words_walker.");
+                return -1;
+            }
         }
     }
 
@@ -852,8 +1081,8 @@ int direct_glue_updater_forward_out_words(glue_updater_t *glue_updater,
 
 int direct_glue_updater_gen_keep_mask(glue_updater_t *glue_updater, int batch_size)
 {
-    if (mat_resize_row(&glue_updater->keep_mask, batch_size, NAN) < 0) {
-        ST_ERROR("Failed to mat_resize_row for keep_mask.");
+    if (bmat_resize_row(&glue_updater->keep_mask, batch_size) < 0) {
+        ST_ERROR("Failed to bmat_resize_row for keep_mask.");
         return -1;
     }
     if (mat_resize(&glue_updater->dropout_val,
@@ -862,7 +1091,12 @@ int direct_glue_updater_gen_keep_mask(glue_updater_t *glue_updater, int batch_si
         ST_ERROR("Failed to mat_resize for dropout_val.");
         return -1;
     }
-    /* keep_mask will be generated on the fly. */
+    if(glue_updater->rand_seed == NULL) {
+        ST_ERROR("rand_seed not set for glue[%s]", glue_updater->glue->name);
+        return -1;
+    }
+    /* keep_mask will be generated on the fly, for the visited nodes. */
+    glue_updater->keep_key = bmat_rand_key(glue_updater->rand_seed);
 
     return 0;
 }
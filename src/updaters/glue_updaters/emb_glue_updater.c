@@ -37,6 +37,7 @@
 
 typedef struct _egu_data_t_ {
     sp_mat_t word_buf;
+    ivec_t offs; /* offsets of words in out_ac for concat. */
 } egu_data_t;
 
 #define safe_egu_data_destroy(ptr) do {\
@@ -54,6 +55,7 @@ void egu_data_destroy(egu_data_t *data)
     }
 
     sp_mat_destroy(&data->word_buf);
+    ivec_destroy(&data->offs);
 }
 
 egu_data_t* egu_data_init(glue_updater_t *glue_updater)
@@ -161,94 +163,73 @@ int emb_glue_updater_forward(glue_updater_t *glue_updater,
     glue_t *glue;
     input_t *input;
     emb_glue_data_t *data;
+    egu_data_t *egu_data;
+    egs_input_t *eg;
     mat_t *wt;
+    bmat_word_t *keep_mask;
 
     size_t col;
-    int b, w, i, j, pos;
-    real_t scale, ac;
+    int b, w, pos;
+    real_t scale;
 
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL
             || batch == NULL || out_ac == NULL, -1);
 
     glue = glue_updater->glue;
     data = (emb_glue_data_t *)glue->extra;
+    egu_data = (egu_data_t *)glue_updater->extra;
     input = comp_updater->comp->input;
     wt = &glue_updater->wt_updaters[0]->wt;
     col = wt->num_cols;
 
+    scale = 1.0;
+    if (glue_updater->keep_mask.num_rows > 0) {
+        scale /= glue_updater->keep_prob;
+    }
+
     switch (data->combine) {
         case EC_SUM:
-            for (b = 0; b < batch->num_egs; b++) {
-                for (w = 0; w < batch->inputs[b].num_words; w++) {
-                    scale = batch->inputs[b].weights[w];
-
-                    j = batch->inputs[b].words[w];
-                    if (glue_updater->keep_mask.num_rows > 0) {
-                        scale /= glue_updater->keep_prob;
-                        for (i = 0; i < col; i++) {
-                            if (MAT_VAL(&glue_updater->keep_mask, b, i) == 1.0) {
-                                MAT_VAL(out_ac, b, i) += scale * MAT_VAL(wt, j, i);
-                            }
-                        }
-                    } else {
-                        for (i = 0; i < col; i++) {
-                            MAT_VAL(out_ac, b, i) += scale * MAT_VAL(wt, j, i);
-                        }
-                    }
-                }
-            }
-            break;
         case EC_AVG:
+            if (data->combine == EC_AVG) {
+                scale /= input->n_ctx;
+            }
             for (b = 0; b < batch->num_egs; b++) {
-                for (i = 0; i < col; i++) {
-                    if (glue_updater->keep_mask.num_rows > 0
-                            && MAT_VAL(&glue_updater->keep_mask, b, i) == 0.0) {
-                        continue;
-                    }
-
-                    ac = 0;
-                    for (w = 0; w < batch->inputs[b].num_words; w++) {
-                        scale = batch->inputs[b].weights[w];
-                        j = batch->inputs[b].words[w];
-
-                        ac += scale * MAT_VAL(wt, j, i);
-                    }
-                    if (glue_updater->keep_mask.num_rows > 0) {
-                        ac /= glue_updater->keep_prob;
-                    }
-                    MAT_VAL(out_ac, b, i) += ac / input->n_ctx;
+                eg = batch->inputs + b;
+                keep_mask = NULL;
+                if (glue_updater->keep_mask.num_rows > 0) {
+                    keep_mask = BMAT_ROWP(&glue_updater->keep_mask, b);
                 }
+                mat_gather_add_rows(wt, eg->words, eg->weights, NULL,
+                        eg->num_words, scale, keep_mask,
+                        MAT_VALP(out_ac, b, 0));
             }
             break;
         case EC_CONCAT:
+            if (ivec_resize(&egu_data->offs, input->n_ctx) < 0) {
+                ST_ERROR("Failed to ivec_resize offs.");
+                return -1;
+            }
             for (b = 0; b < batch->num_egs; b++) {
+                eg = batch->inputs + b;
                 pos = 0;
-                for (w = 0; w < batch->inputs[b].num_words; w++) {
-                    scale = batch->inputs[b].weights[w];
-
-                    j = batch->inputs[b].words[w];
-
+                for (w = 0; w < eg->num_words; w++) {
                     while (pos < input->n_ctx) {
-                        if (input->context[pos].i == batch->inputs[b].positions[w]) {
+                        if (input->context[pos].i == eg->positions[w]) {
                             break;
                         }
                         pos++;
                     }
                     assert(pos < input->n_ctx);
+                    VEC_VAL(&egu_data->offs, w) = pos * col;
+                }
 
-                    if (glue_updater->keep_mask.num_rows > 0) {
-                        scale /= glue_updater->keep_prob;
-                        for (i = 0; i < col; i++) {
-                            if (MAT_VAL(&glue_updater->keep_mask, b, pos * col + i) == 1.0) {
-                                MAT_VAL(out_ac, b, pos * col + i) += scale * MAT_VAL(wt, j, i);
-                            }
-                        }
-                    } else {
-                        for (i = 0; i < col; i++) {
-                            MAT_VAL(out_ac, b, pos * col + i) += scale * MAT_VAL(wt, j, i);
-                        }
-                    }
+                keep_mask = NULL;
+                if (glue_updater->keep_mask.num_rows > 0) {
+                    keep_mask = BMAT_ROWP(&glue_updater->keep_mask, b);
                 }
+                mat_gather_add_rows(wt, eg->words, eg->weights,
+                        VEC_VALP(&egu_data->offs, 0), eg->num_words,
+                        scale, keep_mask, MAT_VALP(out_ac, b, 0));
             }
             break;
         default:
@@ -284,9 +265,14 @@ int emb_glue_updater_backprop(glue_updater_t *glue_updater,
     col = glue_updater->wt_updaters[0]->wt.num_cols;
 
     if (glue_updater->keep_mask.num_rows > 0) {
-        if (mat_mul_elems(out_er, &glue_updater->keep_mask,
+        if (mat_resize(&glue_updater->dropout_val, out_er->num_rows,
+                    out_er->num_cols, NAN) < 0) {
+            ST_ERROR("Failed to mat_resize dropout_val.");
+            return -1;
+        }
+        if (mat_mask_scale(out_er, &glue_updater->keep_mask, 1.0,
                     &glue_updater->dropout_val) < 0) {
-            ST_ERROR("Failed to mat_mul_elems.");
+            ST_ERROR("Failed to mat_mask_scale.");
             return -1;
         }
         mat_assign(&er, &glue_updater->dropout_val);
@@ -92,7 +92,7 @@ void glue_updater_destroy(glue_updater_t *glue_updater)
     }
 
     if (glue_updater->glue->recur_type != RECUR_BODY) {
-        mat_destroy(&glue_updater->keep_mask);
+        bmat_destroy(&glue_updater->keep_mask);
     }
     mat_destroy(&glue_updater->dropout_val);
 
@@ -168,9 +168,20 @@ int glue_updater_setup(glue_updater_t *glue_updater,
 {
     glue_t *glue;
     layer_updater_t *layer_updater;
+    int i;
 
     ST_CHECK_PARAM(glue_updater == NULL, -1);
 
+    if (backprop) {
+        for (i = 0; i < glue_updater->num_wt_updaters; i++) {
+            if (glue_updater->wt_updaters[i]->qwt != NULL) {
+                ST_ERROR("Can not train quantized glue[%s].",
+                        glue_updater->glue->name);
+                goto ERR;
+            }
+        }
+    }
+
     if (glue_updater->impl != NULL && glue_updater->impl->setup != NULL) {
         if (glue_updater->impl->setup(glue_updater,
                     comp_updater, backprop) < 0) {
@@ -232,6 +243,40 @@ int glue_updater_set_rand_seed(glue_updater_t *glue_updater, unsigned int *seed)
     return 0;
 }
 
+int glue_updater_flush(glue_updater_t *glue_updater)
+{
+    int i;
+
+    ST_CHECK_PARAM(glue_updater == NULL, -1);
+
+    for (i = 0; i < glue_updater->num_wt_updaters; i++) {
+        if (wt_updater_flush(glue_updater->wt_updaters[i]) < 0) {
+            ST_ERROR("Failed to wt_updater_flush.[%s]",
+                    glue_updater->glue->name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int glue_updater_finish(glue_updater_t *glue_updater)
+{
+    int i;
+
+    ST_CHECK_PARAM(glue_updater == NULL, -1);
+
+    for (i = 0; i < glue_updater->num_wt_updaters; i++) {
+        if (wt_updater_finish(glue_updater->wt_updaters[i]) < 0) {
+            ST_ERROR("Failed to wt_updater_finish.[%s]",
+                    glue_updater->glue->name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int glue_updater_setup_dropout(glue_updater_t *glue_updater, real_t dropout)
 {
     int keep_mask_len;
@@ -249,8 +294,8 @@ int glue_updater_setup_dropout(glue_updater_t *glue_updater, real_t dropout)
                 - glue_updater->glue->in_offset;
         }
 
-        if (mat_resize(&glue_updater->keep_mask, 1, keep_mask_len, NAN) < 0) {
-            ST_ERROR("Failed to mat_resize keep_mask");
+        if (bmat_resize(&glue_updater->keep_mask, 1, keep_mask_len) < 0) {
+            ST_ERROR("Failed to bmat_resize keep_mask");
             return -1;
         }
     }
@@ -258,28 +303,7 @@ int glue_updater_setup_dropout(glue_updater_t *glue_updater, real_t dropout)
     return 0;
 }
 
-int mat_gen_keep_mask(unsigned int *rand_seed, real_t keep_prob, mat_t *mask)
-{
-    double p;
-    int r, c;
-
-    ST_CHECK_PARAM(mask == NULL || rand_seed == NULL, -1);
-
-    for (r = 0; r < mask->num_rows; r++) {
-        for (c = 0; c < mask->num_cols; c++) {
-            p = st_random_r(0, 1, rand_seed);
-            if (p < keep_prob) {
-                MAT_VAL(mask, r, c) = 1.0;
-            } else {
-                MAT_VAL(mask, r, c) = 0.0;
-            }
-        }
-    }
-
-    return 0;
-}
-
-int mat_dropout(mat_t *in, mat_t *mask, real_t keep_prob, mat_t *out)
+static int mat_dropout(mat_t *in, bmat_t *mask, real_t keep_prob, mat_t *out)
 {
     ST_CHECK_PARAM(in == NULL || mask == NULL || out == NULL, -1);
 
@@ -288,9 +312,8 @@ int mat_dropout(mat_t *in, mat_t *mask, real_t keep_prob, mat_t *out)
         return -1;
     }
 
-    mat_scale(in, 1.0 / keep_prob);
-    if (mat_mul_elems(in, mask, out) < 0) {
-        ST_ERROR("Failed to mat_mul_elems.");
+    if (mat_mask_scale(in, mask, 1.0 / keep_prob, out) < 0) {
+        ST_ERROR("Failed to mat_mask_scale.");
         return -1;
     }
 
@@ -321,14 +344,14 @@ int glue_updater_gen_keep_mask(glue_updater_t *glue_updater, int batch_size)
         return -1;
     }
 
-    if (mat_resize_row(&glue_updater->keep_mask, batch_size, NAN) < 0) {
-        ST_ERROR("Failed to mat_resize_row for keep_mask.");
+    if (bmat_resize_row(&glue_updater->keep_mask, batch_size) < 0) {
+        ST_ERROR("Failed to bmat_resize_row for keep_mask.");
         return -1;
     }
 
-    if (mat_gen_keep_mask(glue_updater->rand_seed, glue_updater->keep_prob,
-                &glue_updater->keep_mask) < 0) {
-        ST_ERROR("Failed to mat_gen_keep_mask.");
+    if (bmat_rand(&glue_updater->keep_mask, glue_updater->keep_prob,
+                glue_updater->rand_seed) < 0) {
+        ST_ERROR("Failed to bmat_rand.");
         return -1;
     }
 
@@ -494,8 +517,9 @@ int glue_updater_backprop(glue_updater_t *glue_updater,
         }
 
         if (glue_updater->keep_prob < 1.0 && in_er.num_rows > 0) {
-            if (mat_mul_elems(&in_er, &glue_updater->keep_mask, &in_er) < 0) {
-                ST_ERROR("Failed to mat_mul_elems.");
+            if (mat_mask_scale(&in_er, &glue_updater->keep_mask,
+                        1.0, &in_er) < 0) {
+                ST_ERROR("Failed to mat_mask_scale.");
                 return -1;
             }
         }
@@ -92,7 +92,8 @@ typedef struct _glue_updater_t_ {
 
     unsigned int *rand_seed; /**< random seed. */
     real_t keep_prob; /**< keep probability, i.e., 1 - dropout probability. */
-    mat_t keep_mask; /**< keep mask. */
+    bmat_t keep_mask; /**< keep mask, bit-packed. */
+    uint32_t keep_key; /**< key of keep_mask, for masks generated on demand. */
     mat_t dropout_val; /**< transformed activation/error after dropout. */
 
     wt_updater_t **wt_updaters; /**< the wt_updaters. */
@@ -187,6 +188,23 @@ int glue_updater_set_rand_seed(glue_updater_t *glue_updater, unsigned int *seed)
 int glue_updater_prepare(glue_updater_t *glue_updater,
         comp_updater_t *comp_updater, egs_batch_t *batch);
 
+/**
+ * Finish updates of one mini-batch for a glue_updater.
+ * @ingroup g_updater_glue
+ * @param[in] glue_updater the glue_updater.
+ * @return non-zero value if any error.
+ */
+int glue_updater_flush(glue_updater_t *glue_updater);
+
+/**
+ * Finish running for a glue_updater.
+ * Apply all pending updates into the shared weights.
+ * @ingroup g_updater_glue
+ * @param[in] glue_updater the glue_updater.
+ * @return non-zero value if any error.
+ */
+int glue_updater_finish(glue_updater_t *glue_updater);
+
 /**
  * Feed-forward a batch for a glue_updater.
  * @ingroup g_updater_glue
@@ -40,6 +40,13 @@ typedef struct _ogu_data_t_ {
     mat_t *node_in_acs;
     mat_t *node_in_ers;
 
+    ivec_t nodes; // nodes visited by current batch
+    int *node_pos; // position of node in nodes, -1 if not visited
+    ivec_t node_egs_s; // start of examples in node_egs for every nodes
+    ivec_t node_egs; // examples grouped by node, in order of batch
+    ivec_t pair_nodes; // buffer for (node, example) pairs
+    ivec_t pair_egs;
+
     // const variables
     int *node_iters;
 } ogu_data_t;
@@ -74,6 +81,13 @@ void ogu_data_destroy(ogu_data_t *data)
         safe_st_free(data->node_in_ers);
     }
 
+    ivec_destroy(&data->nodes);
+    safe_st_free(data->node_pos);
+    ivec_destroy(&data->node_egs_s);
+    ivec_destroy(&data->node_egs);
+    ivec_destroy(&data->pair_nodes);
+    ivec_destroy(&data->pair_egs);
+
     data->num_nodes = 0;
 }
 
@@ -131,6 +145,8 @@ ERR:
 
 int ogu_data_setup(ogu_data_t *data, out_updater_t *out_updater, bool backprop)
 {
+    int i;
+
     ST_CHECK_PARAM(data == NULL, -1);
 
     data->num_nodes = out_updater->output->tree->num_node;
@@ -144,6 +160,15 @@ int ogu_data_setup(ogu_data_t *data, out_updater_t *out_updater, bool backprop)
     }
     memset(data->node_in_acs, 0, sizeof(mat_t) * data->num_nodes);
 
+    data->node_pos = (int *)st_malloc(sizeof(int) * data->num_nodes);
+    if (data->node_pos == NULL) {
+        ST_ERROR("Failed to st_malloc node_pos.");
+        goto ERR;
+    }
+    for (i = 0; i < data->num_nodes; i++) {
+        data->node_pos[i] = -1;
+    }
+
     if (backprop) {
         data->node_in_ers = (mat_t *)st_malloc(sizeof(mat_t) * data->num_nodes);
         if (data->node_in_ers == NULL) {
@@ -186,120 +211,133 @@ static int clear_tree_node_iters_walker(output_t *output,
     return 0;
 }
 
-static int clear_tree_node_iters(output_t *output, egs_batch_t *batch,
-        ogu_data_t *data)
-{
-    int i;
-
-    for (i = 0; i < batch->num_egs; i++) {
-        if (batch->targets[i] == PADDING_ID) {
-            continue;
-        }
-        if (output_walk_through_path(output, batch->targets[i],
-                    clear_tree_node_iters_walker,
-                    (void *)data->node_iters) < 0) {
-            ST_ERROR("Failed to output_walk_through_path "
-                       "clear_tree_node_iters_walker.");
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-static int acc_tree_node_iters_walker(output_t *output,
-        output_node_id_t node, output_node_id_t next_node,
-        output_node_id_t child_s, output_node_id_t child_e, void *args)
-{
-    int *node_iters;
-
-    node_iters = (int *) args;
-
-    node_iters[node]++;
-
-    return 0;
-}
-
-typedef struct _tree_nodes_prepare_walker_args_t_ {
+typedef struct _collect_tree_nodes_walker_args_t_ {
     ogu_data_t *data;
-    size_t in_size;
-} tree_nodes_prepare_walker_args_t;
+    int batch_i;
+} collect_tree_nodes_walker_args_t;
 
-static int prepare_tree_nodes_walker(output_t *output,
+static int collect_tree_nodes_walker(output_t *output,
         output_node_id_t node, output_node_id_t next_node,
         output_node_id_t child_s, output_node_id_t child_e, void *args)
 {
-    tree_nodes_prepare_walker_args_t *tnpw_args;
+    collect_tree_nodes_walker_args_t *ctnw_args;
     ogu_data_t *data;
 
-    tnpw_args = (tree_nodes_prepare_walker_args_t *) args;
-    data = tnpw_args->data;
+    ctnw_args = (collect_tree_nodes_walker_args_t *) args;
+    data = ctnw_args->data;
 
-    if (child_e - child_s <= 1 || data->node_iters[node] <= 0) {
+    if (child_e - child_s <= 1) {
         return 0;
     }
 
-    if (mat_resize(data->node_in_acs + node,
-                data->node_iters[node], tnpw_args->in_size,
-                NAN /* no need to init acs. */) < 0) {
-        ST_ERROR("Failed to mat_resize node_in_acs["OUTPUT_NODE_FMT".",
-                node);
-        return -1;
-    }
-
-
-    if (data->node_in_ers != NULL) {
-        if (mat_resize(data->node_in_ers + node,
-                    data->node_iters[node], tnpw_args->in_size,
-                    0.0) < 0) {
-            ST_ERROR("Failed to mat_resize node_in_ers["
-                       OUTPUT_NODE_FMT".", node);
+    if (data->node_pos[node] < 0) {
+        data->node_pos[node] = data->nodes.size;
+        if (ivec_append(&data->nodes, node) < 0) {
+            ST_ERROR("Failed to ivec_append nodes.");
             return -1;
         }
     }
 
-    data->node_iters[node] = 0;
+    if (ivec_append(&data->pair_nodes, data->node_pos[node]) < 0) {
+        ST_ERROR("Failed to ivec_append pair_nodes.");
+        return -1;
+    }
+    if (ivec_append(&data->pair_egs, ctnw_args->batch_i) < 0) {
+        ST_ERROR("Failed to ivec_append pair_egs.");
+        return -1;
+    }
 
     return 0;
 }
 
+// this function groups the examples in batch by tree node, so that all
+// examples passing through the same node could be computed in one GEMM.
 static int prepare_tree_nodes(output_t *output, egs_batch_t *batch,
         size_t in_size, ogu_data_t *data)
 {
-    tree_nodes_prepare_walker_args_t tnpw_args;
-    int i;
+    collect_tree_nodes_walker_args_t ctnw_args;
+    output_node_id_t node;
+    output_step_t *step;
+    int i, n, pos;
 
     ST_CHECK_PARAM(output == NULL || batch == NULL || data == NULL, -1);
 
-    if (clear_tree_node_iters(output, batch, data) < 0) {
-        ST_ERROR("Failed to clear_tree_node_iters.");
+    for (n = 0; n < data->nodes.size; n++) {
+        data->node_pos[VEC_VAL(&data->nodes, n)] = -1;
+    }
+    if (ivec_clear(&data->nodes) < 0
+            || ivec_clear(&data->pair_nodes) < 0
+            || ivec_clear(&data->pair_egs) < 0) {
+        ST_ERROR("Failed to ivec_clear.");
         return -1;
     }
 
+    ctnw_args.data = data;
     for (i = 0; i < batch->num_egs; i++) {
         if (batch->targets[i] == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(output, batch->targets[i],
-                    acc_tree_node_iters_walker, (void *)data->node_iters) < 0) {
-            ST_ERROR("Failed to output_walk_through_path "
-                       "acc_tree_node_iters_walker.");
-            return -1;
+        ctnw_args.batch_i = i;
+        output_path_for_each_step(output, batch->targets[i], step) {
+            if (collect_tree_nodes_walker(output, step->node, step->next_node,
+                        step->child_s, step->child_e, (void *)&ctnw_args) < 0) {
+                ST_ERROR("Failed to collect_tree_nodes_walker.");
+                return -1;
+            }
         }
     }
 
-    tnpw_args.data = data;
-    tnpw_args.in_size = in_size;
-    for (i = 0; i < batch->num_egs; i++) {
-        if (batch->targets[i] == PADDING_ID) {
-            continue;
+    // counting sort on nodes, stable in order of batch
+    if (ivec_resize(&data->node_egs_s, data->nodes.size + 1) < 0) {
+        ST_ERROR("Failed to ivec_resize node_egs_s.");
+        return -1;
+    }
+    memset(data->node_egs_s.vals, 0, sizeof(int) * data->node_egs_s.size);
+    for (i = 0; i < data->pair_nodes.size; i++) {
+        VEC_VAL(&data->node_egs_s, VEC_VAL(&data->pair_nodes, i) + 1)++;
+    }
+    for (n = 0; n < data->nodes.size; n++) {
+        VEC_VAL(&data->node_egs_s, n + 1) += VEC_VAL(&data->node_egs_s, n);
+    }
+
+    if (data->pair_egs.size > 0) {
+        if (ivec_resize(&data->node_egs, data->pair_egs.size) < 0) {
+            ST_ERROR("Failed to ivec_resize node_egs.");
+            return -1;
         }
-        if (output_walk_through_path(output, batch->targets[i],
-                    prepare_tree_nodes_walker, (void *)&tnpw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path "
-                       "prepare_tree_nodes_walker.");
+    }
+    for (n = 0; n < data->nodes.size; n++) {
+        data->node_iters[VEC_VAL(&data->nodes, n)] = 0;
+    }
+    for (i = 0; i < data->pair_nodes.size; i++) {
+        n = VEC_VAL(&data->pair_nodes, i);
+        node = VEC_VAL(&data->nodes, n);
+        pos = VEC_VAL(&data->node_egs_s, n) + data->node_iters[node];
+        VEC_VAL(&data->node_egs, pos) = VEC_VAL(&data->pair_egs, i);
+        data->node_iters[node]++;
+    }
+
+    for (n = 0; n < data->nodes.size; n++) {
+        node = VEC_VAL(&data->nodes, n);
+
+        if (mat_resize(data->node_in_acs + node,
+                    data->node_iters[node], in_size,
+                    NAN /* no need to init acs. */) < 0) {
+            ST_ERROR("Failed to mat_resize node_in_acs["OUTPUT_NODE_FMT".",
+                    node);
             return -1;
         }
+
+        if (data->node_in_ers != NULL) {
+            if (mat_resize(data->node_in_ers + node,
+                        data->node_iters[node], in_size, 0.0) < 0) {
+                ST_ERROR("Failed to mat_resize node_in_ers["
+                        OUTPUT_NODE_FMT".", node);
+                return -1;
+            }
+        }
+
+        data->node_iters[node] = 0;
     }
 
     return 0;
@@ -326,73 +364,36 @@ int out_glue_updater_prepare(glue_updater_t *glue_updater,
     return 0;
 }
 
-typedef struct _tree_nodes_walker_args_t_ {
-    mat_t *in_vals;
-    int batch_i;
-    ogu_data_t *data;
-} tree_nodes_walker_args_t;
-
-static int fill_tree_node_acs_walker(output_t *output, output_node_id_t node,
-        output_node_id_t next_node,
-        output_node_id_t child_s, output_node_id_t child_e, void *args)
+// this function gathers the activation into ogu_data_t's buffer
+static int fill_tree_node_acs(mat_t *in_ac, ogu_data_t *data)
 {
-    tree_nodes_walker_args_t *tnw_args;
-    ogu_data_t *data;
-
-    tnw_args = (tree_nodes_walker_args_t *)args;
-    data = tnw_args->data;
-
-    if (child_e - child_s <= 1) {
-        return 0;
-    }
-
-    if (mat_cpy_row(data->node_in_acs + node, data->node_iters[node],
-                tnw_args->in_vals, tnw_args->batch_i) < 0) {
-        ST_ERROR("Failed to mat_cpy_row for node_in_acs.");
-        return -1;
+    mat_t *node_in_ac;
+    int n, r, s;
+
+    ST_CHECK_PARAM(data == NULL || in_ac == NULL, -1);
+
+    for (n = 0; n < data->nodes.size; n++) {
+        node_in_ac = data->node_in_acs + VEC_VAL(&data->nodes, n);
+        s = VEC_VAL(&data->node_egs_s, n);
+        for (r = 0; r < node_in_ac->num_rows; r++) {
+            memcpy(MAT_VALP(node_in_ac, r, 0),
+                    MAT_VALP(in_ac, VEC_VAL(&data->node_egs, s + r), 0),
+                    sizeof(real_t) * in_ac->num_cols);
+        }
     }
 
-    data->node_iters[node]++;
-
     return 0;
 }
 
-// this function fill in the activation into ogu_data_t's buffer
-static int fill_tree_node_acs(output_t *output, egs_batch_t *batch,
-        mat_t *in_ac, ogu_data_t *data)
+static int forward_one_node(output_norm_t norm, mat_t *wt, qmat_t *qwt,
+        vec_t *bias, real_t scale, mat_t *in_ac, mat_t *out_ac)
 {
-    tree_nodes_walker_args_t tnw_args;
-    int i;
-
-    ST_CHECK_PARAM(output == NULL || data == NULL
-            || in_ac == NULL || batch == NULL, -1);
-
-    if (clear_tree_node_iters(output, batch, data) < 0) {
-        ST_ERROR("Failed to clear_tree_node_iters.");
-        return -1;
-    }
-
-    tnw_args.in_vals = in_ac;
-    tnw_args.data = data;
-    for (i = 0; i < batch->num_egs; i++) {
-        if (batch->targets[i] == PADDING_ID) {
-            continue;
-        }
-        tnw_args.batch_i = i;
-        if (output_walk_through_path(output, batch->targets[i],
-                    fill_tree_node_acs_walker, (void *)&tnw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
+    if (qwt != NULL) {
+        if (qmat_add_mat_mat(scale, in_ac, qwt, out_ac) < 0) {
+            ST_ERROR("Failed to qmat_add_mat_mat.");
             return -1;
         }
-    }
-
-    return 0;
-}
-
-static int forward_one_node(output_norm_t norm, mat_t *wt, vec_t *bias,
-        real_t scale, mat_t *in_ac, mat_t *out_ac)
-{
-    if (add_mat_mat(scale, in_ac, MT_NoTrans,
+    } else if (add_mat_mat(scale, in_ac, MT_NoTrans,
                 wt, MT_Trans, 1.0, out_ac) < 0) {
         ST_ERROR("Failed to add_mat_mat.");
         return -1;
@@ -408,68 +409,71 @@ static int forward_one_node(output_norm_t norm, mat_t *wt, vec_t *bias,
     return 0;
 }
 
-typedef struct _tree_nodes_forward_args_t_ {
-    wt_updater_t **wt_updaters;
-    real_t scale;
-    mat_t *node_in_acs;
-    mat_t *node_out_acs;
-    int *node_iters;
-} tree_nodes_fwd_walker_args_t;
-
-static int forward_tree_nodes_walker(output_t *output, output_node_id_t node,
-        output_node_id_t next_node,
-        output_node_id_t child_s, output_node_id_t child_e, void *args)
+// this function do forward with ogu_data_t's buffer, one GEMM per node
+static int forward_tree_nodes(output_t *output, wt_updater_t **wt_updaters,
+        real_t scale, ogu_data_t *data, mat_t *node_out_acs)
 {
-    tree_nodes_fwd_walker_args_t *tnfw_args;
-
-    tnfw_args = (tree_nodes_fwd_walker_args_t *)args;
-
-    if (child_e - child_s <= 1) {
-        return 0;
-    }
-
-    if (tnfw_args->node_iters[node] != 0) {
-        // already forwarded
-        return 0;
-    }
-
-    if (forward_one_node(output->norm, &tnfw_args->wt_updaters[node]->wt,
-                &tnfw_args->wt_updaters[node]->bias, tnfw_args->scale,
-                tnfw_args->node_in_acs + node,
-                tnfw_args->node_out_acs + node) < 0) {
-        ST_ERROR("Failed to forward_one_node["OUTPUT_NODE_FMT"]", node);
-        return -1;
+    output_node_id_t node;
+    int n;
+
+    ST_CHECK_PARAM(output == NULL || wt_updaters == NULL
+            || data == NULL || node_out_acs == NULL, -1);
+
+    for (n = 0; n < data->nodes.size; n++) {
+        node = VEC_VAL(&data->nodes, n);
+        if (forward_one_node(output->norm, &wt_updaters[node]->wt,
+                    wt_updaters[node]->qwt, &wt_updaters[node]->bias, scale,
+                    data->node_in_acs + node, node_out_acs + node) < 0) {
+            ST_ERROR("Failed to forward_one_node["OUTPUT_NODE_FMT"]", node);
+            return -1;
+        }
     }
 
-    tnfw_args->node_iters[node] = 1;
-
     return 0;
 }
 
-// this function do forward with ogu_data_t's buffer
-static int forward_tree_nodes(output_t *output, egs_batch_t *batch,
-        wt_updater_t **wt_updaters, real_t scale, mat_t *node_in_acs,
-        mat_t *node_out_acs, int *node_iters)
+// this function only computes scores of the candidate children, for NCE
+static int forward_tree_nodes_sampled(wt_updater_t **wt_updaters,
+        real_t scale, ogu_data_t *data, ivec_t *node_cands,
+        mat_t *node_out_acs)
 {
-    tree_nodes_fwd_walker_args_t tnfw_args;
-    int i;
-
-    ST_CHECK_PARAM(output == NULL || batch == NULL || wt_updaters == NULL
-            || node_in_acs == NULL || node_out_acs == NULL, -1);
-
-    tnfw_args.wt_updaters = wt_updaters;
-    tnfw_args.scale = scale;
-    tnfw_args.node_in_acs = node_in_acs;
-    tnfw_args.node_out_acs = node_out_acs;
-    tnfw_args.node_iters = node_iters;
-    for (i = 0; i < batch->num_egs; i++) {
-        if (batch->targets[i] == PADDING_ID) {
-            continue;
-        }
-        if (output_walk_through_path(output, batch->targets[i],
-                    forward_tree_nodes_walker, (void *)&tnfw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+    mat_t *wt;
+    qmat_t *qwt;
+    vec_t *bias;
+    mat_t *in_ac;
+    mat_t *out_ac;
+    ivec_t *cands;
+
+    output_node_id_t node;
+    double score;
+    int n, r, j, c;
+
+    ST_CHECK_PARAM(wt_updaters == NULL || data == NULL
+            || node_cands == NULL || node_out_acs == NULL, -1);
+
+    for (n = 0; n < data->nodes.size; n++) {
+        node = VEC_VAL(&data->nodes, n);
+        wt = &wt_updaters[node]->wt;
+        qwt = wt_updaters[node]->qwt;
+        bias = &wt_updaters[node]->bias;
+        in_ac = data->node_in_acs + node;
+        out_ac = node_out_acs + node;
+        cands = node_cands + node;
+
+        for (r = 0; r < out_ac->num_rows; r++) {
+            for (j = 0; j < out_ac->num_cols; j++) {
+                c = VEC_VAL(cands, r * out_ac->num_cols + j);
+                if (qwt != NULL) {
+                    score = qmat_dot_row(qwt, c, MAT_VALP(in_ac, r, 0));
+                } else {
+                    score = dot_product(MAT_VALP(in_ac, r, 0),
+                            MAT_VALP(wt, c, 0), in_ac->num_cols);
+                }
+                if (bias->size > 0) {
+                    score += VEC_VAL(bias, c);
+                }
+                MAT_VAL(out_ac, r, j) += scale * score;
+            }
         }
     }
 
@@ -494,77 +498,80 @@ int out_glue_updater_forward(glue_updater_t *glue_updater,
         return -1;
     }
 
-    if (fill_tree_node_acs(output, batch, in_ac, data) < 0) {
+    if (fill_tree_node_acs(in_ac, data) < 0) {
         ST_ERROR("Failed to fill_tree_node_acs.");
         return -1;
     }
 
-    if (clear_tree_node_iters(output, batch, data) < 0) {
-        ST_ERROR("Failed to clear_tree_node_iters.");
-        return -1;
-    }
-
-    if (forward_tree_nodes(output, batch, glue_updater->wt_updaters,
-                comp_updater->comp->comp_scale, data->node_in_acs,
-                comp_updater->out_updater->node_acs,
-                data->node_iters) < 0) {
-        ST_ERROR("Failed to forward_tree_nodes.");
-        return -1;
+    if (comp_updater->out_updater->node_cands != NULL) {
+        if (forward_tree_nodes_sampled(glue_updater->wt_updaters,
+                    comp_updater->comp->comp_scale, data,
+                    comp_updater->out_updater->node_cands,
+                    comp_updater->out_updater->node_acs) < 0) {
+            ST_ERROR("Failed to forward_tree_nodes_sampled.");
+            return -1;
+        }
+    } else {
+        if (forward_tree_nodes(output, glue_updater->wt_updaters,
+                    comp_updater->comp->comp_scale, data,
+                    comp_updater->out_updater->node_acs) < 0) {
+            ST_ERROR("Failed to forward_tree_nodes.");
+            return -1;
+        }
     }
 
     return 0;
 }
 
-static int export_tree_node_ers_walker(output_t *output, output_node_id_t node,
-        output_node_id_t next_node,
-        output_node_id_t child_s, output_node_id_t child_e, void *args)
+// this function scatters out in_er from ogu_data_t's buffer
+static int export_tree_node_ers(mat_t *in_er, ogu_data_t *data)
 {
-    tree_nodes_walker_args_t *tnw_args;
-    ogu_data_t *data;
-
-    tnw_args = (tree_nodes_walker_args_t *)args;
-    data = tnw_args->data;
-
-    if (child_e - child_s <= 1) {
-        return 0;
-    }
-
-    if (mat_acc_row(tnw_args->in_vals, tnw_args->batch_i,
-                data->node_in_ers + node, data->node_iters[node]) < 0) {
-        ST_ERROR("Failed to mat_acc_row for node_in_ers.");
-        return -1;
+    mat_t *node_in_er;
+    int n, r, s;
+
+    ST_CHECK_PARAM(data == NULL || in_er == NULL, -1);
+
+    for (n = 0; n < data->nodes.size; n++) {
+        node_in_er = data->node_in_ers + VEC_VAL(&data->nodes, n);
+        s = VEC_VAL(&data->node_egs_s, n);
+        for (r = 0; r < node_in_er->num_rows; r++) {
+            if (mat_acc_row(in_er, VEC_VAL(&data->node_egs, s + r),
+                        node_in_er, r) < 0) {
+                ST_ERROR("Failed to mat_acc_row for node_in_ers.");
+                return -1;
+            }
+        }
     }
 
-    data->node_iters[node]++;
-
     return 0;
 }
 
-// this function export out in_er from ogu_data_t's buffer
-static int export_tree_node_ers(output_t *output, egs_batch_t *batch,
-        mat_t *in_er, ogu_data_t *data)
+// this function do back-prop within ogu_data_t's buffer, one GEMM per node
+static int backprop_tree_nodes(wt_updater_t **wt_updaters, real_t scale,
+        ogu_data_t *data, mat_t *node_out_ers)
 {
-    tree_nodes_walker_args_t tnw_args;
-    int i;
+    wt_updater_t *wt_updater;
+    output_node_id_t node;
+    int n;
 
-    ST_CHECK_PARAM(output == NULL || data == NULL
-            || in_er == NULL || batch == NULL, -1);
+    ST_CHECK_PARAM(wt_updaters == NULL || data == NULL
+            || node_out_ers == NULL || data->node_in_ers == NULL, -1);
 
-    if (clear_tree_node_iters(output, batch, data) < 0) {
-        ST_ERROR("Failed to clear_tree_node_iters.");
-        return -1;
-    }
+    for (n = 0; n < data->nodes.size; n++) {
+        node = VEC_VAL(&data->nodes, n);
+        wt_updater = wt_updaters[node];
 
-    tnw_args.in_vals = in_er;
-    tnw_args.data = data;
-    for (i = 0; i < batch->num_egs; i++) {
-        if (batch->targets[i] == PADDING_ID) {
-            continue;
+        // propagate from out_er to in_er
+        if (propagate_error(&wt_updater->wt, node_out_ers + node, scale,
+                    wt_updater->param.er_cutoff,
+                    data->node_in_ers + node) < 0) {
+            ST_ERROR("Failed to propagate_error.");
+            return -1;
         }
-        tnw_args.batch_i = i;
-        if (output_walk_through_path(output, batch->targets[i],
-                    export_tree_node_ers_walker, (void *)&tnw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
+
+        if (wt_update(wt_updater, node_out_ers + node, scale,
+                    data->node_in_acs + node, 1.0, NULL, NULL) < 0) {
+            ST_ERROR("Failed to wt_update.");
             return -1;
         }
     }
@@ -572,83 +579,51 @@ static int export_tree_node_ers(output_t *output, egs_batch_t *batch,
     return 0;
 }
 
-typedef struct _tree_nodes_backprop_args_t_ {
-    wt_updater_t **wt_updaters;
-    real_t scale;
-    mat_t *node_in_acs;
-    mat_t *node_out_ers;
-    mat_t *node_in_ers;
-    int *node_iters;
-} tree_nodes_bp_walker_args_t;
-
-static int backprop_tree_nodes_walker(output_t *output, output_node_id_t node,
-        output_node_id_t next_node,
-        output_node_id_t child_s, output_node_id_t child_e, void *args)
+// this function do back-prop only for the candidate children, for NCE
+static int backprop_tree_nodes_sampled(wt_updater_t **wt_updaters,
+        real_t scale, ogu_data_t *data, ivec_t *node_cands,
+        mat_t *node_out_ers)
 {
-    tree_nodes_bp_walker_args_t *tnbw_args;
-    mat_t *in_ac;
+    wt_updater_t *wt_updater;
     mat_t *out_er;
     mat_t *in_er;
-    wt_updater_t *wt_updater;
-
-    tnbw_args = (tree_nodes_bp_walker_args_t *)args;
-    in_ac = tnbw_args->node_in_acs + node;
-    out_er = tnbw_args->node_out_ers + node;
-    in_er = tnbw_args->node_in_ers + node;
-    wt_updater = tnbw_args->wt_updaters[node];
-
-    if (child_e - child_s <= 1) {
-        return 0;
-    }
-
-    if (tnbw_args->node_iters[node] != 0) {
-        // already backproped
-        return 0;
-    }
-
-    // propagate from out_er to in_er
-    if (propagate_error(&wt_updater->wt, out_er, tnbw_args->scale,
-                wt_updater->param.er_cutoff, in_er) < 0) {
-        ST_ERROR("Failed to propagate_error.");
-        return -1;
-    }
-
-    if (wt_update(wt_updater, out_er, tnbw_args->scale,
-                in_ac, 1.0, NULL, NULL) < 0) {
-        ST_ERROR("Failed to wt_update.");
-        return -1;
-    }
-
-    tnbw_args->node_iters[node] = 1;
-
-    return 0;
-}
-
-// this function do back-prop within ogu_data_t's buffer
-static int backprop_tree_nodes(output_t *output, egs_batch_t *batch,
-        wt_updater_t **wt_updaters, real_t scale, mat_t *node_in_acs,
-        mat_t *node_out_ers, mat_t *node_in_ers, int *node_iters)
-{
-    tree_nodes_bp_walker_args_t tnbw_args;
-    int i;
-
-    ST_CHECK_PARAM(output == NULL || batch == NULL || wt_updaters == NULL
-            || node_in_acs == NULL || node_out_ers == NULL
-            || node_in_ers == NULL, -1);
-
-    tnbw_args.wt_updaters = wt_updaters;
-    tnbw_args.scale = scale;
-    tnbw_args.node_in_acs = node_in_acs;
-    tnbw_args.node_out_ers = node_out_ers;
-    tnbw_args.node_in_ers = node_in_ers;
-    tnbw_args.node_iters = node_iters;
-    for (i = 0; i < batch->num_egs; i++) {
-        if (batch->targets[i] == PADDING_ID) {
-            continue;
+    ivec_t *cands;
+    real_t *wt_row;
+    real_t *in_er_row;
+
+    output_node_id_t node;
+    real_t er;
+    int n, r, j, c, i;
+
+    ST_CHECK_PARAM(wt_updaters == NULL || data == NULL || node_cands == NULL
+            || node_out_ers == NULL || data->node_in_ers == NULL, -1);
+
+    for (n = 0; n < data->nodes.size; n++) {
+        node = VEC_VAL(&data->nodes, n);
+        wt_updater = wt_updaters[node];
+        out_er = node_out_ers + node;
+        in_er = data->node_in_ers + node;
+        cands = node_cands + node;
+
+        // propagate from out_er to in_er
+        for (r = 0; r < out_er->num_rows; r++) {
+            in_er_row = MAT_VALP(in_er, r, 0);
+            for (j = 0; j < out_er->num_cols; j++) {
+                c = VEC_VAL(cands, r * out_er->num_cols + j);
+                er = scale * MAT_VAL(out_er, r, j);
+                wt_row = MAT_VALP(&wt_updater->wt, c, 0);
+                for (i = 0; i < in_er->num_cols; i++) {
+                    in_er_row[i] += er * wt_row[i];
+                }
+            }
+        }
+        if (wt_updater->param.er_cutoff > 0) {
+            mat_cutoff(in_er, wt_updater->param.er_cutoff);
         }
-        if (output_walk_through_path(output, batch->targets[i],
-                    backprop_tree_nodes_walker, (void *)&tnbw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
+
+        if (wt_update_rows(wt_updater, out_er, scale,
+                    data->node_in_acs + node, 1.0, cands->vals) < 0) {
+            ST_ERROR("Failed to wt_update_rows.");
             return -1;
         }
     }
@@ -660,29 +635,31 @@ int out_glue_updater_backprop(glue_updater_t *glue_updater,
         comp_updater_t *comp_updater, egs_batch_t *batch,
         mat_t *in_ac, mat_t *out_er /* unused */, mat_t *in_er)
 {
-    output_t *output;
     ogu_data_t *data;
 
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL
             || batch == NULL || out_er == NULL, -1);
 
     data = (ogu_data_t *)glue_updater->extra;
-    output = comp_updater->out_updater->output;
 
-    if (clear_tree_node_iters(output, batch, data) < 0) {
-        ST_ERROR("Failed to clear_tree_node_iters.");
-        return -1;
-    }
-
-    if (backprop_tree_nodes(output, batch, glue_updater->wt_updaters,
-                comp_updater->comp->comp_scale, data->node_in_acs,
-                comp_updater->out_updater->node_ers,
-                data->node_in_ers, data->node_iters) < 0) {
-        ST_ERROR("Failed to backprop_tree_nodes.");
-        return -1;
+    if (comp_updater->out_updater->node_cands != NULL) {
+        if (backprop_tree_nodes_sampled(glue_updater->wt_updaters,
+                    comp_updater->comp->comp_scale, data,
+                    comp_updater->out_updater->node_cands,
+                    comp_updater->out_updater->node_ers) < 0) {
+            ST_ERROR("Failed to backprop_tree_nodes_sampled.");
+            return -1;
+        }
+    } else {
+        if (backprop_tree_nodes(glue_updater->wt_updaters,
+                    comp_updater->comp->comp_scale, data,
+                    comp_updater->out_updater->node_ers) < 0) {
+            ST_ERROR("Failed to backprop_tree_nodes.");
+            return -1;
+        }
     }
 
-    if (export_tree_node_ers(output, batch, in_er, data) < 0) {
+    if (export_tree_node_ers(in_er, data) < 0) {
         ST_ERROR("Failed to export_tree_node_ers.");
         return -1;
     }
@@ -710,6 +687,7 @@ int out_glue_updater_forward_out(glue_updater_t *glue_updater,
     }
 
     if (forward_one_node(output->norm, &glue_updater->wt_updaters[node]->wt,
+                glue_updater->wt_updaters[node]->qwt,
                 &glue_updater->wt_updaters[node]->bias,
                 comp_updater->comp->comp_scale, in_ac,
                 comp_updater->out_updater->node_acs + node) < 0) {
@@ -746,6 +724,7 @@ static int forward_out_words_walker(output_t *output, output_node_id_t node,
     }
 
     if (forward_one_node(output->norm, &fow_args->wt_updaters[node]->wt,
+                fow_args->wt_updaters[node]->qwt,
                 &fow_args->wt_updaters[node]->bias, fow_args->scale,
                 fow_args->in_ac,
                 fow_args->node_out_acs + node) < 0) {
@@ -766,6 +745,7 @@ int out_glue_updater_forward_out_words(glue_updater_t *glue_updater,
     output_t *output;
     ogu_data_t *data;
 
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(glue_updater == NULL || comp_updater == NULL
@@ -784,11 +764,13 @@ int out_glue_updater_forward_out_words(glue_updater_t *glue_updater,
         if (VEC_VAL(words, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(output, VEC_VAL(words, i),
-                    clear_tree_node_iters_walker, (void *)data->node_iters) < 0) {
-            ST_ERROR("Failed to output_walk_through_path "
-                       "clear_tree_node_iters_walker.");
-            return -1;
+        output_path_for_each_step(output, VEC_VAL(words, i), step) {
+            if (clear_tree_node_iters_walker(output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)data->node_iters) < 0) {
+                ST_ERROR("Failed to clear_tree_node_iters_walker.");
+                return -1;
+            }
         }
     }
 
@@ -801,10 +783,12 @@ int out_glue_updater_forward_out_words(glue_updater_t *glue_updater,
         if (VEC_VAL(words, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(output, VEC_VAL(words, i),
-                    forward_out_words_walker, (void *)&fow_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path for forward_out_words.");
-            return -1;
+        output_path_for_each_step(output, VEC_VAL(words, i), step) {
+            if (forward_out_words_walker(output, step->node, step->next_node,
+                        step->child_s, step->child_e, (void *)&fow_args) < 0) {
+                ST_ERROR("Failed to forward_out_words_walker.");
+                return -1;
+            }
         }
     }
 
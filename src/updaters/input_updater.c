@@ -181,6 +181,11 @@ int input_updater_clear(input_updater_t *input_updater)
         return -1;
     }
 
+    if (word_pool_clear(&input_updater->wp) < 0) {
+        ST_ERROR("Failed to word_pool_clear wp");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -208,6 +213,7 @@ int input_updater_update_batch(input_updater_t *input_updater,
     int cur_pos, row_start, idx;
     int ctx_leftmost = 0;
     int ctx_rightmost = 0;
+    int leftmost, rightmost;
 
     ST_CHECK_PARAM(input_updater == NULL || batch == NULL, -1);
 
@@ -252,7 +258,7 @@ int input_updater_update_batch(input_updater_t *input_updater,
             }
             --i;
         }
-        ctx_leftmost = -(i + 1 - cur_pos);
+        leftmost = -(i + 1 - cur_pos);
 
         i = cur_pos;
         while (i < cur_pos + ctx_rightmost
@@ -262,18 +268,18 @@ int input_updater_update_batch(input_updater_t *input_updater,
             }
             ++i;
         }
-        ctx_rightmost = i - cur_pos;
+        rightmost = i - cur_pos;
 
         // add inputs
         egs_input = batch->inputs + batch->num_egs;
         egs_input->num_words = 0;
         for (i = 0; i < input->n_ctx; i++) {
             if (input->context[i].i < 0) {
-                if (-input->context[i].i > ctx_leftmost) {
+                if (-input->context[i].i > leftmost) {
                     continue;
                 }
             } else {
-                if (input->context[i].i > ctx_rightmost) {
+                if (input->context[i].i > rightmost) {
                     continue;
                 }
             }
@@ -415,10 +421,9 @@ int input_updater_move_to_end(input_updater_t *input_updater)
     wp = &input_updater->wp;
     for (b = 0; b < wp_batch_size(wp); b++) {
         VEC_VAL(&input_updater->cursors, b) = VEC_VAL(&wp->row_starts, b + 1)
-                - VEC_VAL(&wp->row_starts, b);
+                - VEC_VAL(&wp->row_starts, b) - 1;
     }
 
-
     return 0;
 }
 
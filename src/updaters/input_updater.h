@@ -156,7 +156,8 @@ int input_updater_feed(input_updater_t *input_updater, word_pool_t *wp);
 int input_updater_move(input_updater_t *input_updater);
 
 /**
- * Move forward input word to the end and return the sentence buffer.
+ * Move cursor to the last word of every row, i.e. the last word
+ * will be the target and the words before it are the inputs.
  * @ingroup g_updater_input
  * @param[in] input_updater input_updater.
  * @return non-zero value if any error.
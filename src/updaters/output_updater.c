@@ -31,6 +31,7 @@
 #include <stutils/st_mem.h>
 
 #include "utils.h"
+#include "vecmath.h"
 #include "output_updater.h"
 
 void out_updater_destroy(out_updater_t *out_updater)
@@ -43,6 +44,17 @@ void out_updater_destroy(out_updater_t *out_updater)
 
     safe_st_free(out_updater->node_iters);
 
+    if (out_updater->node_cands != NULL) {
+        for (i = 0; i < out_updater->output->tree->num_node; i++) {
+            ivec_destroy(out_updater->node_cands + i);
+        }
+        safe_st_free(out_updater->node_cands);
+    }
+    safe_st_free(out_updater->noise_probs);
+    safe_st_free(out_updater->alias_probs);
+    safe_st_free(out_updater->alias_idxs);
+    out_updater->rand_seed = NULL;
+
     if (out_updater->node_acs != NULL) {
         for (i = 0; i < out_updater->output->tree->num_node; i++) {
             mat_destroy(out_updater->node_acs + i);
@@ -112,12 +124,219 @@ int out_updater_setup(out_updater_t *out_updater, bool backprop)
         memset(out_updater->node_ers, 0, sizeof(mat_t) * num_nodes);
     }
 
+    if (out_updater->output->norm == ON_NCE
+            && (backprop || out_updater->self_norm)) {
+        if (! backprop) {
+            // only score of target is needed
+            out_updater->num_samples = 0;
+        } else if (out_updater->num_samples <= 0) {
+            ST_ERROR("num_samples must be positive for NCE training.");
+            goto ERR;
+        }
+
+        out_updater->node_cands = (ivec_t *)st_malloc(sizeof(ivec_t)
+                * num_nodes);
+        if (out_updater->node_cands == NULL) {
+            ST_ERROR("Failed to st_malloc node_cands.");
+            goto ERR;
+        }
+        memset(out_updater->node_cands, 0, sizeof(ivec_t) * num_nodes);
+    }
+
     return 0;
 ERR:
     out_updater_destroy(out_updater);
     return -1;
 }
 
+int out_updater_set_nce(out_updater_t *out_updater, int num_samples,
+        bool self_norm)
+{
+    ST_CHECK_PARAM(out_updater == NULL || num_samples < 0, -1);
+
+    out_updater->num_samples = num_samples;
+    out_updater->self_norm = self_norm;
+
+    return 0;
+}
+
+typedef struct _out_noise_walker_args_t_ {
+    double *node_cnts;
+    double cnt;
+} out_noise_walker_args_t;
+
+static int out_noise_walker(output_t *output, output_node_id_t node,
+        output_node_id_t next_node,
+        output_node_id_t child_s, output_node_id_t child_e, void *args)
+{
+    out_noise_walker_args_t *onw_args;
+
+    onw_args = (out_noise_walker_args_t *) args;
+
+    onw_args->node_cnts[next_node] += onw_args->cnt;
+
+    return 0;
+}
+
+// Vose's alias method, probs, alias_probs and alias_idxs are all
+// indexed by offset to the first child.
+static void out_build_alias(real_t *probs, int n, real_t *alias_probs,
+        output_node_id_t *alias_idxs, int *smalls, int *larges)
+{
+    int num_small, num_large;
+    int i, l, m;
+
+    num_small = 0;
+    num_large = 0;
+    for (i = 0; i < n; i++) {
+        alias_probs[i] = probs[i] * n;
+        alias_idxs[i] = i;
+        if (alias_probs[i] < 1.0) {
+            smalls[num_small++] = i;
+        } else {
+            larges[num_large++] = i;
+        }
+    }
+
+    while (num_small > 0 && num_large > 0) {
+        m = smalls[--num_small];
+        l = larges[--num_large];
+
+        alias_idxs[m] = l;
+        alias_probs[l] = alias_probs[l] + alias_probs[m] - 1.0;
+        if (alias_probs[l] < 1.0) {
+            smalls[num_small++] = l;
+        } else {
+            larges[num_large++] = l;
+        }
+    }
+
+    // left ones are caused by numerical errors
+    while (num_large > 0) {
+        alias_probs[larges[--num_large]] = 1.0;
+    }
+    while (num_small > 0) {
+        alias_probs[smalls[--num_small]] = 1.0;
+    }
+}
+
+int out_updater_setup_noise(out_updater_t *out_updater, count_t *word_cnts,
+        unsigned int *rand_seed)
+{
+    out_noise_walker_args_t onw_args;
+    output_t *output;
+    output_tree_t *tree;
+
+    double *node_cnts = NULL;
+    output_step_t *step;
+    int *smalls = NULL;
+    int *larges = NULL;
+
+    output_node_id_t node, ch, child_s, child_e;
+    double sum;
+    int num_nodes;
+    int w;
+
+    ST_CHECK_PARAM(out_updater == NULL || word_cnts == NULL
+            || rand_seed == NULL, -1);
+
+    output = out_updater->output;
+    tree = output->tree;
+    num_nodes = tree->num_node;
+
+    node_cnts = (double *)st_malloc(sizeof(double) * num_nodes);
+    if (node_cnts == NULL) {
+        ST_ERROR("Failed to st_malloc node_cnts.");
+        goto ERR;
+    }
+    memset(node_cnts, 0, sizeof(double) * num_nodes);
+
+    // count of subtree for every node, add-one smoothed
+    onw_args.node_cnts = node_cnts;
+    for (w = 0; w < output->output_size; w++) {
+        onw_args.cnt = word_cnts[w] + 1.0;
+        output_path_for_each_step(output, w, step) {
+            if (out_noise_walker(output, step->node, step->next_node,
+                        step->child_s, step->child_e, (void *)&onw_args) < 0) {
+                ST_ERROR("Failed to out_noise_walker.");
+                goto ERR;
+            }
+        }
+    }
+
+    out_updater->noise_probs = (real_t *)st_malloc(sizeof(real_t)
+            * num_nodes);
+    if (out_updater->noise_probs == NULL) {
+        ST_ERROR("Failed to st_malloc noise_probs.");
+        goto ERR;
+    }
+    out_updater->alias_probs = (real_t *)st_malloc(sizeof(real_t)
+            * num_nodes);
+    if (out_updater->alias_probs == NULL) {
+        ST_ERROR("Failed to st_malloc alias_probs.");
+        goto ERR;
+    }
+    out_updater->alias_idxs = (output_node_id_t *)st_malloc(
+            sizeof(output_node_id_t) * num_nodes);
+    if (out_updater->alias_idxs == NULL) {
+        ST_ERROR("Failed to st_malloc alias_idxs.");
+        goto ERR;
+    }
+    smalls = (int *)st_malloc(sizeof(int) * num_nodes);
+    if (smalls == NULL) {
+        ST_ERROR("Failed to st_malloc smalls.");
+        goto ERR;
+    }
+    larges = (int *)st_malloc(sizeof(int) * num_nodes);
+    if (larges == NULL) {
+        ST_ERROR("Failed to st_malloc larges.");
+        goto ERR;
+    }
+
+    for (node = 0; node < num_nodes; node++) {
+        out_updater->noise_probs[node] = 1.0;
+        out_updater->alias_probs[node] = 1.0;
+        out_updater->alias_idxs[node] = 0;
+    }
+
+    for (node = 0; node < num_nodes; node++) {
+        child_s = s_children(tree, node);
+        child_e = e_children(tree, node);
+        if (child_e == OUTPUT_NODE_NONE || child_e - child_s <= 1) {
+            continue;
+        }
+
+        sum = 0.0;
+        for (ch = child_s; ch < child_e; ch++) {
+            sum += node_cnts[ch];
+        }
+        for (ch = child_s; ch < child_e; ch++) {
+            out_updater->noise_probs[ch] = node_cnts[ch] / sum;
+        }
+
+        out_build_alias(out_updater->noise_probs + child_s,
+                child_e - child_s, out_updater->alias_probs + child_s,
+                out_updater->alias_idxs + child_s, smalls, larges);
+    }
+
+    out_updater->rand_seed = rand_seed;
+
+    safe_st_free(node_cnts);
+    safe_st_free(smalls);
+    safe_st_free(larges);
+
+    return 0;
+
+ERR:
+    safe_st_free(node_cnts);
+    safe_st_free(smalls);
+    safe_st_free(larges);
+    safe_st_free(out_updater->noise_probs);
+    safe_st_free(out_updater->alias_probs);
+    safe_st_free(out_updater->alias_idxs);
+    return -1;
+}
+
 static int out_reset_walker(output_t *output, output_node_id_t node,
         output_node_id_t next_node,
         output_node_id_t child_s, output_node_id_t child_e, void *args)
@@ -133,6 +352,7 @@ static int out_reset_walker(output_t *output, output_node_id_t node,
 
 int out_updater_reset_iters(out_updater_t *out_updater, ivec_t *targets)
 {
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(out_updater == NULL || targets == NULL, -1);
@@ -141,10 +361,14 @@ int out_updater_reset_iters(out_updater_t *out_updater, ivec_t *targets)
         if (VEC_VAL(targets, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(out_updater->output, VEC_VAL(targets, i),
-                    out_reset_walker, (void *)out_updater->node_iters) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(out_updater->output, VEC_VAL(targets, i),
+                step) {
+            if (out_reset_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)out_updater->node_iters) < 0) {
+                ST_ERROR("Failed to out_reset_walker.");
+                return -1;
+            }
         }
     }
 
@@ -166,6 +390,7 @@ static int out_acc_iter_walker(output_t *output, output_node_id_t node,
 
 static int out_updater_acc_iters(out_updater_t *out_updater, ivec_t *targets)
 {
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(out_updater == NULL, -1);
@@ -179,10 +404,14 @@ static int out_updater_acc_iters(out_updater_t *out_updater, ivec_t *targets)
         if (VEC_VAL(targets, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(out_updater->output, VEC_VAL(targets, i),
-                    out_acc_iter_walker, (void *)out_updater->node_iters) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(out_updater->output, VEC_VAL(targets, i),
+                step) {
+            if (out_acc_iter_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)out_updater->node_iters) < 0) {
+                ST_ERROR("Failed to out_acc_iter_walker.");
+                return -1;
+            }
         }
     }
 
@@ -223,10 +452,27 @@ static int out_prepare_walker(output_t *output, output_node_id_t node,
         return 0;
     }
 
-    if (out_prepare_node_buf(out_updater, node,
-                out_updater->node_iters[node], child_e - child_s - 1) < 0) {
-        ST_ERROR("Failed to out_prepare_node_buf.");
-        return -1;
+    if (out_updater->node_cands != NULL) {
+        if (out_prepare_node_buf(out_updater, node,
+                    out_updater->node_iters[node],
+                    out_updater->num_samples + 1) < 0) {
+            ST_ERROR("Failed to out_prepare_node_buf.");
+            return -1;
+        }
+
+        if (ivec_resize(out_updater->node_cands + node,
+                    out_updater->node_iters[node]
+                    * (out_updater->num_samples + 1)) < 0) {
+            ST_ERROR("Failed to ivec_resize node_cands.");
+            return -1;
+        }
+    } else {
+        if (out_prepare_node_buf(out_updater, node,
+                    out_updater->node_iters[node],
+                    output_num_scores(output, child_s, child_e)) < 0) {
+            ST_ERROR("Failed to out_prepare_node_buf.");
+            return -1;
+        }
     }
 
     out_updater->node_iters[node] = 0;
@@ -234,8 +480,47 @@ static int out_prepare_walker(output_t *output, output_node_id_t node,
     return 0;
 }
 
+static int out_sample_noise_walker(output_t *output, output_node_id_t node,
+        output_node_id_t next_node,
+        output_node_id_t child_s, output_node_id_t child_e, void *args)
+{
+    out_updater_t *out_updater;
+    int *cands;
+    int num_children;
+    int i, j;
+
+    if (child_e - child_s <= 1 || child_e == OUTPUT_NODE_NONE) {
+        return 0;
+    }
+
+    out_updater = (out_updater_t *)args;
+
+    cands = VEC_VALP(out_updater->node_cands + node,
+            out_updater->node_iters[node] * (out_updater->num_samples + 1));
+    cands[0] = next_node - child_s;
+
+    num_children = child_e - child_s;
+    for (j = 1; j <= out_updater->num_samples; j++) {
+        i = (int)(st_random_r(0, 1, out_updater->rand_seed) * num_children);
+        if (i >= num_children) {
+            i = num_children - 1;
+        }
+        if (st_random_r(0, 1, out_updater->rand_seed)
+                < out_updater->alias_probs[child_s + i]) {
+            cands[j] = i;
+        } else {
+            cands[j] = out_updater->alias_idxs[child_s + i];
+        }
+    }
+
+    out_updater->node_iters[node]++;
+
+    return 0;
+}
+
 int out_updater_prepare(out_updater_t *out_updater, ivec_t *targets)
 {
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(out_updater == NULL, -1);
@@ -249,10 +534,32 @@ int out_updater_prepare(out_updater_t *out_updater, ivec_t *targets)
         if (VEC_VAL(targets, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(out_updater->output, VEC_VAL(targets, i),
-                    out_prepare_walker, (void *)out_updater) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(out_updater->output, VEC_VAL(targets, i),
+                step) {
+            if (out_prepare_walker(out_updater->output, step->node,
+                        step->next_node, step->child_s, step->child_e,
+                        (void *)out_updater) < 0) {
+                ST_ERROR("Failed to out_prepare_walker.");
+                return -1;
+            }
+        }
+    }
+
+    if (out_updater->node_cands != NULL) {
+        // node_iters were reset by out_prepare_walker
+        for (i = 0; i < targets->size; i++) {
+            if (VEC_VAL(targets, i) == PADDING_ID) {
+                continue;
+            }
+            output_path_for_each_step(out_updater->output, VEC_VAL(targets, i),
+                    step) {
+                if (out_sample_noise_walker(out_updater->output, step->node,
+                            step->next_node, step->child_s, step->child_e,
+                            (void *)out_updater) < 0) {
+                    ST_ERROR("Failed to out_sample_noise_walker.");
+                    return -1;
+                }
+            }
         }
     }
 
@@ -283,10 +590,22 @@ static int out_act_walker(output_t *output, output_node_id_t node,
     ac = oaw_args->out_updater->node_acs + node;
     this_row = oaw_args->out_updater->node_iters[node];
 
-    assert(ac->num_cols == child_e - child_s - 1);
-    multi_logit(MAT_VALP(ac, this_row, 0), ac->num_cols);
+    if (oaw_args->out_updater->node_cands != NULL) {
+        // unnormalized score of target, which is the first candidate
+        VEC_VAL(oaw_args->logps, oaw_args->batch_i) +=
+            MAT_VAL(ac, this_row, 0);
+        oaw_args->out_updater->node_iters[node]++;
+        return 0;
+    }
+
+    assert(ac->num_cols == output_num_scores(output, child_s, child_e));
+    if (output->norm == ON_NCE) {
+        vm_softmax(MAT_VALP(ac, this_row, 0), ac->num_cols);
+    } else {
+        vm_multi_logit(MAT_VALP(ac, this_row, 0), ac->num_cols);
+    }
 
-    if (next_node == child_e - 1) {
+    if (output->norm != ON_NCE && next_node == child_e - 1) {
         sum = 0.0;
         for (j = 0; j < ac->num_cols; j++) {
             sum += MAT_VAL(ac, this_row, j);
@@ -307,6 +626,7 @@ int out_updater_activate(out_updater_t *out_updater,
     out_act_walker_args_t oaw_args;
     output_t *output;
 
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(out_updater == NULL || targets == NULL || logps == NULL, -1);
@@ -337,10 +657,12 @@ int out_updater_activate(out_updater_t *out_updater,
             continue;
         }
         oaw_args.batch_i = i;
-        if (output_walk_through_path(output, VEC_VAL(targets, i),
-                    out_act_walker, (void *)&oaw_args) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(output, VEC_VAL(targets, i), step) {
+            if (out_act_walker(output, step->node, step->next_node,
+                        step->child_s, step->child_e, (void *)&oaw_args) < 0) {
+                ST_ERROR("Failed to out_act_walker.");
+                return -1;
+            }
         }
     }
 
@@ -355,7 +677,10 @@ static int out_loss_walker(output_t *output, output_node_id_t node,
     output_node_id_t ch;
     mat_t *ac;
     mat_t *er;
+    int *cands;
+    double p;
     int this_row;
+    int j;
 
     if (child_e - child_s <= 1 || child_e == OUTPUT_NODE_NONE) {
         return 0;
@@ -366,6 +691,26 @@ static int out_loss_walker(output_t *output, output_node_id_t node,
     er = out_updater->node_ers + node;
     this_row = out_updater->node_iters[node];
 
+    if (out_updater->node_cands != NULL) {
+        cands = VEC_VALP(out_updater->node_cands + node,
+                this_row * ac->num_cols);
+        for (j = 0; j < ac->num_cols; j++) {
+            // posterior of data vs. noise:
+            //   sigmoid(s - log(k * q))
+            p = MAT_VAL(ac, this_row, j) - log(out_updater->num_samples
+                    * out_updater->noise_probs[child_s + cands[j]]);
+            p = 1.0 / (1.0 + exp(-p));
+            if (j == 0) {
+                MAT_VAL(er, this_row, j) = 1 - p;
+            } else {
+                MAT_VAL(er, this_row, j) = 0 - p;
+            }
+        }
+
+        out_updater->node_iters[node]++;
+        return 0;
+    }
+
     assert(ac->num_cols == child_e - child_s - 1);
     for (ch = 0; ch < ac->num_cols; ++ch) {
         MAT_VAL(er, this_row, ch) = (0 - MAT_VAL(ac, this_row, ch));
@@ -383,6 +728,7 @@ static int out_loss_walker(output_t *output, output_node_id_t node,
 int out_updater_loss(out_updater_t *out_updater, ivec_t *targets)
 {
     output_t *output;
+    output_step_t *step;
     int i;
 
     ST_CHECK_PARAM(out_updater == NULL || targets == NULL, -1);
@@ -404,10 +750,13 @@ int out_updater_loss(out_updater_t *out_updater, ivec_t *targets)
         if (VEC_VAL(targets, i) == PADDING_ID) {
             continue;
         }
-        if (output_walk_through_path(output, VEC_VAL(targets, i),
-                    out_loss_walker, (void *)out_updater) < 0) {
-            ST_ERROR("Failed to output_walk_through_path.");
-            return -1;
+        output_path_for_each_step(output, VEC_VAL(targets, i), step) {
+            if (out_loss_walker(output, step->node, step->next_node,
+                        step->child_s, step->child_e,
+                        (void *)out_updater) < 0) {
+                ST_ERROR("Failed to out_loss_walker.");
+                return -1;
+            }
         }
     }
 
@@ -434,8 +783,8 @@ int out_updater_prepare_node(out_updater_t *out_updater, output_node_id_t node,
     child_s = s_children(output->tree, node);
     child_e = e_children(output->tree, node);
 
-    if (out_prepare_node_buf(out_updater, node,
-                node_batch_size, child_e - child_s - 1) < 0) {
+    if (out_prepare_node_buf(out_updater, node, node_batch_size,
+                output_num_scores(output, child_s, child_e)) < 0) {
         ST_ERROR("Failed to out_prepare_node_buf.");
         return -1;
     }
@@ -485,7 +834,11 @@ output_node_id_t out_updater_sample(out_updater_t *out_updater,
 
     ac = out_updater->node_acs + node;
     row = 0; // batch_size == 1
-    multi_logit(MAT_VALP(ac, row, 0), ac->num_cols);
+    if (output->norm == ON_NCE) {
+        vm_softmax(MAT_VALP(ac, row, 0), ac->num_cols);
+    } else {
+        vm_multi_logit(MAT_VALP(ac, row, 0), ac->num_cols);
+    }
 
     while (true) {
         u = st_random(0, 1);
@@ -60,6 +60,24 @@ typedef struct _output_updater_t_ {
     mat_t *node_acs; /**< activation of each output tree node. */
     mat_t *node_ers; /**< error of each output tree node. */
     int *node_iters; /**< error of each output tree node. */
+
+    /* for NCE, when training or evaluating with self-normalization,
+       only scores of candidate children are computed, i.e.
+       MAT_VAL(node_acs[node], r, j) is the score of the child
+       child_s + VEC_VAL(node_cands[node], r * node_acs[node].num_cols + j).
+       The first candidate is always the target, and the others are
+       the noise samples.
+    */
+    ivec_t *node_cands; /**< candidate children of each output tree node,
+                             NULL if all children are computed. */
+    int num_samples; /**< number of noise samples per target for NCE. */
+    bool self_norm; /**< use unnormalized score as logp for NCE. */
+
+    real_t *noise_probs; /**< noise prob of every node given its parent. */
+    real_t *alias_probs; /**< alias table to sample noise children. */
+    output_node_id_t *alias_idxs; /**< alias of every node, i.e. offset to
+                                    the first child of its parent. */
+    unsigned int *rand_seed; /**< rand seed for sampling noise. */
 } out_updater_t;
 
 /**
@@ -98,6 +116,32 @@ out_updater_t* out_updater_create(output_t *output);
  */
 int out_updater_setup(out_updater_t *out_updater, bool backprop);
 
+/**
+ * Set NCE options for out_updater.
+ * Must be called before out_updater_setup.
+ * @ingroup g_updater_output
+ * @param[in] out_updater out_updater.
+ * @param[in] num_samples number of noise samples per target in training.
+ * @param[in] self_norm whether use the unnormalized score as logp,
+ *                      so that only score of target is computed.
+ * @return non-zero value if any error.
+ */
+int out_updater_set_nce(out_updater_t *out_updater, int num_samples,
+        bool self_norm);
+
+/**
+ * Setup noise distribution for NCE training.
+ * The noise is the unigram distribution of words, factorized along
+ * the output tree, and an alias table is built for every node.
+ * @ingroup g_updater_output
+ * @param[in] out_updater out_updater.
+ * @param[in] word_cnts count of every word.
+ * @param[in] rand_seed rand seed for sampling noise.
+ * @return non-zero value if any error.
+ */
+int out_updater_setup_noise(out_updater_t *out_updater, count_t *word_cnts,
+        unsigned int *rand_seed);
+
 /**
  * Prepare to forward a word for out_updater.
  * @ingroup g_updater_out
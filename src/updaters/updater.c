@@ -297,6 +297,14 @@ int updater_setup(updater_t *updater, bool backprop)
         goto ERR;
     }
 
+    if (backprop && updater->connlm->output->norm == ON_NCE) {
+        if (out_updater_setup_noise(updater->out_updater,
+                    updater->connlm->vocab->cnts, &updater->rand_seed) < 0) {
+            ST_ERROR("Failed to out_updater_setup_noise.");
+            goto ERR;
+        }
+    }
+
     ctx_leftmost = 0;
     ctx_rightmost = 0;
     for (c = 0; c < updater->connlm->num_comp; c++) {
@@ -358,6 +366,19 @@ int updater_set_rand_seed(updater_t *updater, unsigned int seed)
     return 0;
 }
 
+int updater_set_nce(updater_t *updater, int num_samples, bool self_norm)
+{
+    ST_CHECK_PARAM(updater == NULL, -1);
+
+    if (out_updater_set_nce(updater->out_updater,
+                num_samples, self_norm) < 0) {
+        ST_ERROR("Failed to out_updater_set_nce.");
+        return -1;
+    }
+
+    return 0;
+}
+
 int updater_feed(updater_t *updater, word_pool_t *wp)
 {
     ST_CHECK_PARAM(updater == NULL, -1);
@@ -650,8 +671,11 @@ int updater_dump_state(updater_t *updater, mat_t *state)
                     updater->connlm->comps[c]->name);
             return -1;
         }
+        if (size == 0) {
+            continue;
+        }
 
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -685,8 +709,11 @@ int updater_dump_pre_ac_state(updater_t *updater, mat_t *state)
                     updater->connlm->comps[c]->name);
             return -1;
         }
+        if (size == 0) {
+            continue;
+        }
 
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -720,8 +747,11 @@ int updater_feed_state(updater_t *updater, mat_t *state)
                     updater->connlm->comps[c]->name);
             return -1;
         }
+        if (size == 0) {
+            continue;
+        }
 
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -755,8 +785,11 @@ int updater_random_state(updater_t *updater, mat_t *state)
                     updater->connlm->comps[c]->name);
             return -1;
         }
+        if (size == 0) {
+            continue;
+        }
 
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
@@ -783,28 +816,25 @@ static int updater_cleanup(updater_t *updater)
         return -1;
     }
 
-    if (updater_reset(updater) < 0) {
-        ST_ERROR("Failed to updater_reset.");
-        return -1;
-    }
-
+    // state will be fed explicitly, so batch size could be changed
     for (c = 0; c < updater->connlm->num_comp; c++) {
-        if (comp_updater_prepare(updater->comp_updaters[c],
-                    updater->batches + c) < 0) {
-            ST_ERROR("Failed to comp_updater_prepare[%s].",
-                    updater->connlm->comps[c]->name);
-            return -1;
-        }
+        updater->comp_updaters[c]->batch_size = 0;
     }
 
     return 0;
 }
 
-static int updater_set_hist(updater_t *updater, ivec_t *hists, int num_hists)
+/*
+ * Build batch with hists, one row for every hist.
+ * The target of every row is words[i], or a </s> as placeholder
+ * if words is NULL.
+ */
+static int updater_set_hist(updater_t *updater, ivec_t *hists, int num_hists,
+        ivec_t *words)
 {
     int i, c;
 
-    ST_CHECK_PARAM(updater == NULL || hists == NULL, -1);
+    ST_CHECK_PARAM(updater == NULL || hists == NULL || num_hists <= 0, -1);
 
     // build mini_batch with hists
     if (word_pool_clear(&updater->tmp_wp) < 0) {
@@ -818,6 +848,12 @@ static int updater_set_hist(updater_t *updater, ivec_t *hists, int num_hists)
             return -1;
         }
 
+        if (word_pool_append(&updater->tmp_wp, (words != NULL)
+                    ? VEC_VAL(words, i) : SENT_END_ID) < 0) {
+            ST_ERROR("Failed to word_pool_append[%d].", i);
+            return -1;
+        }
+
         // set the sent_ends
         if (ivec_append(&updater->tmp_wp.sent_ends,
                     updater->tmp_wp.words.size) < 0) {
@@ -852,26 +888,43 @@ static int updater_set_hist(updater_t *updater, ivec_t *hists, int num_hists)
         }
     }
 
+    if (ivec_set(&updater->targets,
+                updater->batches[0].targets,
+                updater->batches[0].num_egs) < 0) {
+        ST_ERROR("Failed to ivec_set targets.");
+        return -1;
+    }
+
     return 0;
 }
 
 int updater_step_with_state(updater_t *updater, mat_t *state,
         ivec_t *hists, int num_hists)
 {
-    ST_CHECK_PARAM(updater == NULL || state == NULL, -1);
+    int c;
+
+    ST_CHECK_PARAM(updater == NULL || hists == NULL || num_hists <= 0, -1);
+
+    if (state != NULL && num_hists != state->num_rows) {
+        ST_ERROR("num_hists must be equal to state->num_rows.");
+        return -1;
+    }
 
     if (updater_cleanup(updater) < 0) {
         ST_ERROR("Failed to updater_cleanup.");
         return -1;
     }
 
-    if (hists != NULL && num_hists > 0) {
-        if (num_hists != state->num_rows) {
-            ST_ERROR("num_hists must be equal to state->num_rows.");
-            return -1;
-        }
-        if (updater_set_hist(updater, hists, num_hists) < 0) {
-            ST_ERROR("Failed to updater_set_hist.");
+    if (updater_set_hist(updater, hists, num_hists, NULL) < 0) {
+        ST_ERROR("Failed to updater_set_hist.");
+        return -1;
+    }
+
+    for (c = 0; c < updater->connlm->num_comp; c++) {
+        if (comp_updater_prepare(updater->comp_updaters[c],
+                    updater->batches + c) < 0) {
+            ST_ERROR("Failed to comp_updater_prepare[%s].",
+                    updater->connlm->comps[c]->name);
             return -1;
         }
     }
@@ -896,6 +949,88 @@ int updater_step_with_state(updater_t *updater, mat_t *state,
     return 0;
 }
 
+int updater_score_with_state(updater_t *updater, mat_t *state,
+        ivec_t *hists, int num_hists, ivec_t *words,
+        dvec_t *logps, mat_t *new_state)
+{
+    int i;
+
+    ST_CHECK_PARAM(updater == NULL || hists == NULL || num_hists <= 0
+            || words == NULL || logps == NULL, -1);
+
+    if (words->size != num_hists) {
+        ST_ERROR("words->size must be equal to num_hists.");
+        return -1;
+    }
+
+    if ((state != NULL && num_hists != state->num_rows)
+            || (new_state != NULL && num_hists != new_state->num_rows)) {
+        ST_ERROR("num_hists must be equal to num_rows of state/new_state.");
+        return -1;
+    }
+
+    for (i = 0; i < words->size; i++) {
+        if (VEC_VAL(words, i) < 0
+                || VEC_VAL(words, i) >= updater->connlm->vocab->vocab_size) {
+            ST_ERROR("Invalid word[%d].", VEC_VAL(words, i));
+            return -1;
+        }
+    }
+
+#ifdef _CONNLM_TRACE_PROCEDURE_
+    char buf[MAX_LINE_LEN];
+    ST_TRACE("Score-with-state: words[%s]",
+            ivec_dump(words, buf, MAX_LINE_LEN));
+#endif
+
+    if (updater_cleanup(updater) < 0) {
+        ST_ERROR("Failed to updater_cleanup.");
+        return -1;
+    }
+
+    if (updater_set_hist(updater, hists, num_hists, words) < 0) {
+        ST_ERROR("Failed to updater_set_hist.");
+        return -1;
+    }
+
+    if (updater_prepare(updater) < 0) {
+        ST_ERROR("Failed to updater_prepare.");
+        return -1;
+    }
+
+    if (state != NULL) {
+        if (updater_feed_state(updater, state) < 0) {
+            ST_ERROR("Failed to updater_feed_state.");
+            return -1;
+        }
+    }
+
+    if (updater_forward_comp(updater) < 0) {
+        ST_ERROR("Failed to updater_forward_comp.");
+        return -1;
+    }
+
+    if (out_updater_activate(updater->out_updater,
+                &updater->targets, logps) < 0) {
+        ST_ERROR("Failed to out_updater_activate.");
+        return -1;
+    }
+
+    if (updater_save_state(updater) < 0) {
+        ST_ERROR("Failed to updater_save_state.");
+        return -1;
+    }
+
+    if (new_state != NULL) {
+        if (updater_dump_state(updater, new_state) < 0) {
+            ST_ERROR("Failed to updater_dump_state.");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 int updater_forward_out_words(updater_t *updater, ivec_t *words, dvec_t *logps)
 {
     ST_CHECK_PARAM(updater == NULL || words == NULL, -1);
@@ -938,8 +1073,11 @@ int updater_activate_state(updater_t *updater, mat_t *state)
                     updater->connlm->comps[c]->name);
             return -1;
         }
+        if (size == 0) {
+            continue;
+        }
 
-        if (mat_submat(state, 0, 0, total_size, 0, &sub_state) < 0) {
+        if (mat_submat(state, 0, 0, total_size, size, &sub_state) < 0) {
             ST_ERROR("Failed to mat_submat state.");
             return -1;
         }
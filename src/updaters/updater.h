@@ -107,6 +107,17 @@ int updater_setup(updater_t *updater, bool backprop);
  */
 int updater_set_rand_seed(updater_t *updater, unsigned int seed);
 
+/**
+ * Set NCE options for updater.
+ * Must be called before updater_setup. Ignored if output is not NCE.
+ * @ingroup g_updater
+ * @param[in] updater the updater.
+ * @param[in] num_samples number of noise samples per target in training.
+ * @param[in] self_norm whether use the unnormalized score as logp.
+ * @return non-zero value if any error.
+ */
+int updater_set_nce(updater_t *updater, int num_samples, bool self_norm);
+
 /**
  * Feed input words to a updater.
  * @ingroup g_updater
@@ -215,13 +226,36 @@ int updater_random_state(updater_t *updater, mat_t *state);
  * @ingroup g_updater
  * @param[in] updater the updater.
  * @param[in] state state for model, from updater_dump_state.
- * @param[in] hists array of word histories.
+ *                  Could be NULL, if the model has no state.
+ * @param[in] hists array of word histories. The last word of every
+ *                  history is the input of this step.
  * @param[in] num_hists size of hists array.
  * @return non-zero value if any error.
  */
 int updater_step_with_state(updater_t *updater, mat_t *state,
         ivec_t *hists, int num_hists);
 
+/**
+ * Score a batch of hypotheses, each with its own state, history and
+ * next word. All hypotheses are forwarded together as one mini-batch,
+ * so every layer is computed with one matrix multiplication.
+ * @ingroup g_updater
+ * @param[in] updater the updater.
+ * @param[in] state states of hypotheses, one row per hypothesis.
+ *                  Could be NULL, if the model has no state.
+ * @param[in] hists array of word histories. The last word of every
+ *                  history is the input of this step.
+ * @param[in] num_hists size of hists array.
+ * @param[in] words next word of every hypothesis.
+ * @param[out] logps log-prob of the words.
+ * @param[out] new_state states after this step, if not NULL. Row i is
+ *                  the state for hists[i] extended with words[i].
+ * @return non-zero value if any error.
+ */
+int updater_score_with_state(updater_t *updater, mat_t *state,
+        ivec_t *hists, int num_hists, ivec_t *words,
+        dvec_t *logps, mat_t *new_state);
+
 /**
  * Forward and activate in output layer for a word.
  * Activate the word if logp != NULL
@@ -23,6 +23,9 @@
  */
 
 #include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include <stutils/st_macro.h>
 #include <stutils/st_log.h>
@@ -34,6 +37,22 @@
 
 #define REALLOC_NUM 100
 
+#define BLOCK_SIZE 1024
+#define NUM_SYNC_LOCKS 256
+
+/* striped locks protecting the shared weights while merging. */
+static pthread_mutex_t sync_locks[NUM_SYNC_LOCKS];
+static pthread_once_t sync_locks_once = PTHREAD_ONCE_INIT;
+
+static void init_sync_locks()
+{
+    int i;
+
+    for (i = 0; i < NUM_SYNC_LOCKS; i++) {
+        pthread_mutex_init(sync_locks + i, NULL);
+    }
+}
+
 #ifdef _CONNLM_TRACE_PROCEDURE_
 static const char *wt_update_type_str[] = {
     "Full",
@@ -72,6 +91,16 @@ void wt_updater_destroy(wt_updater_t *wt_updater)
     mat_destroy(&wt_updater->delta_wt);
     vec_destroy(&wt_updater->bias);
     vec_destroy(&wt_updater->delta_bias);
+
+    mat_destroy(&wt_updater->acc_wt);
+    mat_destroy(&wt_updater->acc_blks);
+    vec_destroy(&wt_updater->acc_bias);
+    safe_st_free(wt_updater->blk_slots);
+    ivec_destroy(&wt_updater->dirty_blks);
+    wt_updater->num_batches = 0;
+
+    safe_st_free(wt_updater->blk_steps);
+    wt_updater->step = 0;
 }
 
 wt_updater_t* wt_updater_create(param_t *param, mat_t *wt, vec_t *bias,
@@ -122,6 +151,73 @@ ERR:
     return NULL;
 }
 
+int wt_updater_watch_segs(wt_updater_t *wt_updater, bool *wt_segs,
+        bool *bias_segs, size_t seg_size)
+{
+    ST_CHECK_PARAM(wt_updater == NULL || wt_segs == NULL
+            || seg_size == 0, -1);
+
+    if (bias_segs != NULL && wt_updater->bias.size == 0) {
+        ST_ERROR("No bias to be watched.");
+        return -1;
+    }
+
+    wt_updater->wt_segs = wt_segs;
+    wt_updater->bias_segs = bias_segs;
+    wt_updater->seg_size = seg_size;
+    wt_updater->segs_per_row = (wt_updater->wt.num_cols + seg_size - 1)
+        / seg_size;
+
+    return 0;
+}
+
+// flag the segments of [col, col + num_cols) in a row of shared weight.
+static void touch_wt(wt_updater_t *wt_updater, size_t row,
+        size_t col, size_t num_cols)
+{
+    size_t seg, seg_e;
+
+    if (wt_updater->wt_segs == NULL || num_cols == 0) {
+        return;
+    }
+
+    seg = row * wt_updater->segs_per_row + col / wt_updater->seg_size;
+    seg_e = row * wt_updater->segs_per_row
+        + (col + num_cols - 1) / wt_updater->seg_size;
+    for (; seg <= seg_e; seg++) {
+        wt_updater->wt_segs[seg] = true;
+    }
+}
+
+static inline void touch_bias(wt_updater_t *wt_updater, size_t row)
+{
+    if (wt_updater->bias_segs != NULL) {
+        wt_updater->bias_segs[row / wt_updater->seg_size] = true;
+    }
+}
+
+// flag the segments with any non-zero delta, delta has num_cols values.
+static void touch_wt_delta(wt_updater_t *wt_updater, size_t row,
+        size_t col, real_t *delta, size_t num_cols)
+{
+    size_t s, e, j;
+
+    if (wt_updater->wt_segs == NULL) {
+        return;
+    }
+
+    for (s = 0; s < num_cols; s = e) {
+        e = min(num_cols, (col + s) / wt_updater->seg_size
+                * wt_updater->seg_size + wt_updater->seg_size - col);
+        for (j = s; j < e; j++) {
+            if (delta[j] != 0.0) {
+                touch_wt(wt_updater, row, col + s, 1);
+                break;
+            }
+        }
+    }
+}
+
 static inline real_t get_lr(param_t *param)
 {
     if (param->momentum != 0.0) {
@@ -131,9 +227,13 @@ static inline real_t get_lr(param_t *param)
     }
 }
 
-static int mat_regularize_l1_l2(mat_t *mat, real_t l1, real_t l2)
+// regularization terms computed with mat are added to dst,
+// which can be the same as mat.
+static int mat_regularize_l1_l2(mat_t *mat, real_t l1, real_t l2,
+        mat_t *dst)
 {
     real_t *vals;
+    real_t *dst_vals;
     real_t l1_term;
     size_t i, j;
 
@@ -141,14 +241,17 @@ static int mat_regularize_l1_l2(mat_t *mat, real_t l1, real_t l2)
         return 0;
     } else if (l1 == 0.0) {
         vals = mat->vals;
+        dst_vals = dst->vals;
         for (i = 0; i < mat->num_rows; i++) {
             for (j = 0; j < mat->num_cols; j++) {
-                vals[j] = vals[j] - l2 * vals[j];
+                dst_vals[j] = dst_vals[j] - l2 * vals[j];
             }
             vals += mat->stride;
+            dst_vals += dst->stride;
         }
     } else if (l2 == 0.0) {
         vals = mat->vals;
+        dst_vals = dst->vals;
         for (i = 0; i < mat->num_rows; i++) {
             for (j = 0; j < mat->num_cols; j++) {
                 if (vals[j] > 0.0) {
@@ -159,12 +262,14 @@ static int mat_regularize_l1_l2(mat_t *mat, real_t l1, real_t l2)
                     l1_term = 0.0;
                 }
 
-                vals[j] = vals[j] + l1_term;
+                dst_vals[j] = dst_vals[j] + l1_term;
             }
             vals += mat->stride;
+            dst_vals += dst->stride;
         }
     } else {
         vals = mat->vals;
+        dst_vals = dst->vals;
         for (i = 0; i < mat->num_rows; i++) {
             for (j = 0; j < mat->num_cols; j++) {
                 if (vals[j] > 0.0) {
@@ -175,74 +280,423 @@ static int mat_regularize_l1_l2(mat_t *mat, real_t l1, real_t l2)
                     l1_term = 0.0;
                 }
 
-                vals[j] = vals[j] - l2 * vals[j] + l1_term;
+                dst_vals[j] = dst_vals[j] - l2 * vals[j] + l1_term;
             }
             vals += mat->stride;
+            dst_vals += dst->stride;
         }
     }
 
     return 0;
 }
 
-static int update_part(size_t num_rows, size_t num_cols,
-        mat_t *wt, size_t wt_row, size_t wt_col,
-        mat_t *er, size_t er_row, size_t er_col,
-        real_t lr, real_t l1, real_t l2,
-        real_t mmt, mat_t *delta_wt)
+static size_t wt_updater_setup_blks(wt_updater_t *wt_updater)
+{
+    if (wt_updater->blk_cols == 0) {
+        wt_updater->blk_cols = min(wt_updater->wt.num_cols, BLOCK_SIZE);
+        wt_updater->blks_per_row = (wt_updater->wt.num_cols
+                + wt_updater->blk_cols - 1) / wt_updater->blk_cols;
+    }
+
+    return wt_updater->blks_per_row * wt_updater->wt.num_rows;
+}
+
+static inline int sync_lock(wt_updater_t *wt_updater, int blk)
 {
-    mat_t sub_wt = {0};
-    mat_t sub_delta_wt = {0};
-    mat_t sub_er = {0};
+    return (int)((((uintptr_t)wt_updater->wt.vals) / ALIGN_SIZE + blk)
+            % NUM_SYNC_LOCKS);
+}
+
+static int wt_updater_setup_sync(wt_updater_t *wt_updater)
+{
+    size_t num_blks;
+    size_t i;
+
+    if (wt_updater->blk_slots != NULL) {
+        return 0;
+    }
+
+    pthread_once(&sync_locks_once, init_sync_locks);
 
-    if (mmt != 0.0) {
-        if (mat_submat(wt, wt_row, num_rows, wt_col, num_cols, &sub_wt) < 0) {
-            ST_ERROR("Failed to mat_submat wt.");
+    // full weight is touched entirely by every update
+    if (wt_updater->type == WT_UT_FULL) {
+        if (mat_resize(&wt_updater->acc_wt, wt_updater->wt.num_rows,
+                    wt_updater->wt.num_cols, 0.0) < 0) {
+            ST_ERROR("Failed to mat_resize acc_wt.");
             return -1;
         }
+    }
 
-        if (mat_regularize_l1_l2(&sub_wt, l1, l2) < 0) {
-            ST_ERROR("Failed to mat_regularize_l1_l2 sub_wt.");
+    if (wt_updater->bias.size > 0) {
+        if (vec_resize(&wt_updater->acc_bias,
+                    wt_updater->bias.size, 0.0) < 0) {
+            ST_ERROR("Failed to vec_resize acc_bias.");
             return -1;
         }
+    }
+
+    num_blks = wt_updater_setup_blks(wt_updater);
+
+    wt_updater->blk_slots = (int *)st_malloc(sizeof(int) * num_blks);
+    if (wt_updater->blk_slots == NULL) {
+        ST_ERROR("Failed to st_malloc blk_slots.");
+        return -1;
+    }
+    for (i = 0; i < num_blks; i++) {
+        wt_updater->blk_slots[i] = -1;
+    }
+
+    wt_updater->num_batches = 0;
 
-        if (mat_submat(er, er_row, num_rows, er_col, num_cols, &sub_er) < 0) {
-            ST_ERROR("Failed to mat_submat er.");
+    return 0;
+}
+
+// mark the block dirty, and return its slot in dirty_blks.
+static int wt_updater_dirty_slot(wt_updater_t *wt_updater, int blk)
+{
+    mat_t *acc_blks;
+    int slot;
+
+    slot = wt_updater->blk_slots[blk];
+    if (slot >= 0) {
+        return slot;
+    }
+
+    slot = wt_updater->dirty_blks.size;
+    if (ivec_append(&wt_updater->dirty_blks, blk) < 0) {
+        ST_ERROR("Failed to ivec_append dirty_blks.");
+        return -1;
+    }
+    wt_updater->blk_slots[blk] = slot;
+
+    if (wt_updater->acc_wt.num_rows > 0) {
+        return slot;
+    }
+
+    acc_blks = &wt_updater->acc_blks;
+    if ((size_t)slot >= acc_blks->num_rows) {
+        if (mat_resize(acc_blks, max(2 * acc_blks->num_rows, REALLOC_NUM),
+                    wt_updater->blk_cols, NAN) < 0) {
+            ST_ERROR("Failed to mat_resize acc_blks.");
             return -1;
         }
+    }
+    memset(MAT_VALP(acc_blks, slot, 0), 0,
+            sizeof(real_t) * wt_updater->blk_cols);
+
+    return slot;
+}
+
+/*
+ * Get the values where updates on a block are written to, i.e. the
+ * shared weight itself, or the accumulated delta if syncing, in which
+ * case the block is marked dirty.
+ * Return NULL if any error.
+ */
+static real_t* wt_updater_blk_dst(wt_updater_t *wt_updater, int blk)
+{
+    size_t row, col;
+    int slot;
+
+    row = blk / wt_updater->blks_per_row;
+    col = (blk % wt_updater->blks_per_row) * wt_updater->blk_cols;
 
-        if (mat_submat(delta_wt, wt_row, num_rows, wt_col, num_cols, &sub_delta_wt) < 0) {
-            ST_ERROR("Failed to mat_submat delta_wt.");
+    if (wt_updater->blk_slots == NULL) {
+        return MAT_VALP(&wt_updater->wt, row, col);
+    }
+
+    slot = wt_updater_dirty_slot(wt_updater, blk);
+    if (slot < 0) {
+        ST_ERROR("Failed to wt_updater_dirty_slot.");
+        return NULL;
+    }
+
+    if (wt_updater->acc_wt.num_rows > 0) {
+        return MAT_VALP(&wt_updater->acc_wt, row, col);
+    }
+
+    return MAT_VALP(&wt_updater->acc_blks, slot, 0);
+}
+
+static int wt_updater_mark_dirty(wt_updater_t *wt_updater,
+        size_t row, size_t col, size_t num_cols)
+{
+    int blk, blk_e;
+
+    if (wt_updater->blk_slots == NULL || num_cols == 0) {
+        return 0;
+    }
+
+    blk = row * wt_updater->blks_per_row + col / wt_updater->blk_cols;
+    blk_e = row * wt_updater->blks_per_row
+        + (col + num_cols - 1) / wt_updater->blk_cols;
+    for (; blk <= blk_e; blk++) {
+        if (wt_updater_dirty_slot(wt_updater, blk) < 0) {
+            ST_ERROR("Failed to wt_updater_dirty_slot.");
             return -1;
         }
-        if (mat_add_elems(&sub_delta_wt, mmt, &sub_er, lr, &sub_delta_wt) < 0) {
-            ST_ERROR("Failed to mat_add_elems sub_er to sub_delta_wt.");
-            return -1;
+    }
+
+    return 0;
+}
+
+int wt_updater_sync(wt_updater_t *wt_updater)
+{
+    mat_t *wt;
+    real_t *wt_vals;
+    real_t *acc_vals;
+
+    size_t row, col, n, j;
+    int lock;
+    int i, blk;
+
+    ST_CHECK_PARAM(wt_updater == NULL, -1);
+
+    if (wt_updater->blk_slots == NULL) {
+        return 0;
+    }
+
+    wt = &wt_updater->wt;
+
+    for (i = 0; i < wt_updater->dirty_blks.size; i++) {
+        blk = VEC_VAL(&wt_updater->dirty_blks, i);
+        row = blk / wt_updater->blks_per_row;
+        col = (blk % wt_updater->blks_per_row) * wt_updater->blk_cols;
+        n = min(wt_updater->blk_cols, wt->num_cols - col);
+
+        wt_vals = MAT_VALP(wt, row, col);
+        if (wt_updater->acc_wt.num_rows > 0) {
+            acc_vals = MAT_VALP(&wt_updater->acc_wt, row, col);
+        } else {
+            acc_vals = MAT_VALP(&wt_updater->acc_blks, i, 0);
+        }
+
+        lock = sync_lock(wt_updater, blk);
+        pthread_mutex_lock(sync_locks + lock);
+        for (j = 0; j < n; j++) {
+            wt_vals[j] += acc_vals[j];
+        }
+        // bias is only updated along with the whole row
+        if (col == 0 && wt_updater->bias.size > 0) {
+            VEC_VAL(&wt_updater->bias, row) +=
+                VEC_VAL(&wt_updater->acc_bias, row);
         }
+        pthread_mutex_unlock(sync_locks + lock);
 
-        if (mat_add_elems(&sub_delta_wt, 1.0, &sub_wt, 1.0, &sub_wt) < 0) {
-            ST_ERROR("Failed to mat_add_elems sub_delta_wt to sub_wt.");
+        touch_wt_delta(wt_updater, row, col, acc_vals, n);
+        if (col == 0 && wt_updater->bias.size > 0
+                && VEC_VAL(&wt_updater->acc_bias, row) != 0.0) {
+            touch_bias(wt_updater, row);
+        }
+
+        memset(acc_vals, 0, sizeof(real_t) * n);
+        if (col == 0 && wt_updater->bias.size > 0) {
+            VEC_VAL(&wt_updater->acc_bias, row) = 0.0;
+        }
+        wt_updater->blk_slots[blk] = -1;
+    }
+
+    if (ivec_clear(&wt_updater->dirty_blks) < 0) {
+        ST_ERROR("Failed to ivec_clear dirty_blks.");
+        return -1;
+    }
+    wt_updater->num_batches = 0;
+
+    return 0;
+}
+
+int wt_updater_flush(wt_updater_t *wt_updater)
+{
+    ST_CHECK_PARAM(wt_updater == NULL, -1);
+
+    wt_updater->step++;
+
+    if (wt_updater->blk_slots == NULL) {
+        return 0;
+    }
+
+    wt_updater->num_batches++;
+    if (wt_updater->num_batches >= wt_updater->param.sync_size) {
+        if (wt_updater_sync(wt_updater) < 0) {
+            ST_ERROR("Failed to wt_updater_sync.");
             return -1;
         }
+    }
+
+    return 0;
+}
+
+static int wt_updater_setup_lazy(wt_updater_t *wt_updater)
+{
+    size_t num_blks;
+    size_t i;
+
+    if (wt_updater->blk_steps != NULL) {
+        return 0;
+    }
+
+    num_blks = wt_updater_setup_blks(wt_updater);
+
+    wt_updater->blk_steps = (int *)st_malloc(sizeof(int) * num_blks);
+    if (wt_updater->blk_steps == NULL) {
+        ST_ERROR("Failed to st_malloc blk_steps.");
+        return -1;
+    }
+    for (i = 0; i < num_blks; i++) {
+        wt_updater->blk_steps[i] = wt_updater->step;
+    }
+
+    return 0;
+}
+
+// apply momentum and penalties of the skipped steps on a block, as if
+// the block was updated with zero error in these steps. the changes are
+// added to dst_vals, or applied in place if dst_vals is the block of wt.
+// if peek, only dst_vals is changed, and the block is still behind.
+static void catchup_block(wt_updater_t *wt_updater, int blk, int upto,
+        real_t *dst_vals, bool peek)
+{
+    mat_t *wt;
+    real_t *wt_vals;
+    real_t *delta_vals;
+
+    double mmt_sum, mmt_k, l2_k, l1_k;
+    real_t w;
+    size_t row, col, n, j;
+    int k;
+
+    k = upto - wt_updater->blk_steps[blk];
+    if (k <= 0) {
+        return;
+    }
+    if (!peek) {
+        wt_updater->blk_steps[blk] = upto;
+    }
+
+    wt = &wt_updater->wt;
+    row = blk / wt_updater->blks_per_row;
+    col = (blk % wt_updater->blks_per_row) * wt_updater->blk_cols;
+    n = min(wt_updater->blk_cols, wt->num_cols - col);
+
+    wt_vals = MAT_VALP(wt, row, col);
+
+    if (wt_updater->lazy_mmt != 0.0) {
+        // delta_wt is decayed by mmt every step and added to wt
+        mmt_k = pow(wt_updater->lazy_mmt, k);
+        mmt_sum = wt_updater->lazy_mmt * (1.0 - mmt_k)
+            / (1.0 - wt_updater->lazy_mmt);
+        delta_vals = MAT_VALP(&wt_updater->delta_wt, row, col);
     } else {
-        if (mat_submat(wt, wt_row, num_rows, wt_col, num_cols, &sub_wt) < 0) {
-            ST_ERROR("Failed to mat_submat wt.");
-            return -1;
+        mmt_k = 0.0;
+        mmt_sum = 0.0;
+        delta_vals = NULL;
+    }
+    l2_k = pow(1.0 - wt_updater->lazy_l2, k);
+    l1_k = wt_updater->lazy_l1 * k;
+
+    for (j = 0; j < n; j++) {
+        w = wt_vals[j];
+        if (delta_vals != NULL) {
+            w += mmt_sum * delta_vals[j];
+            if (!peek) {
+                delta_vals[j] *= mmt_k;
+            }
+        }
+        w *= l2_k;
+        if (w > l1_k) {
+            w -= l1_k;
+        } else if (w < -l1_k) {
+            w += l1_k;
+        } else if (l1_k > 0.0) {
+            w = 0.0;
         }
 
-        if (mat_regularize_l1_l2(&sub_wt, l1, l2) < 0) {
-            ST_ERROR("Failed to mat_regularize_l1_l2 sub_wt.");
-            return -1;
+        if (dst_vals == wt_vals) {
+            wt_vals[j] = w;
+        } else {
+            dst_vals[j] += w - wt_vals[j];
         }
+    }
 
-        if (mat_submat(er, er_row, num_rows, er_col, num_cols, &sub_er) < 0) {
-            ST_ERROR("Failed to mat_submat er.");
-            return -1;
+    if (dst_vals == wt_vals) {
+        touch_wt(wt_updater, row, col, n);
+    }
+}
+
+// catch up a block before updating it, the current step is counted
+// as applied, since the penalties are applied along with the update.
+static void wt_updater_catchup(wt_updater_t *wt_updater, int blk,
+        real_t *dst_vals)
+{
+    if (wt_updater->blk_steps == NULL) {
+        return;
+    }
+
+    catchup_block(wt_updater, blk, wt_updater->step, dst_vals, false);
+    wt_updater->blk_steps[blk] = wt_updater->step + 1;
+}
+
+// penalties on wt and lr * er, with momentum if delta is not NULL,
+// are added to dst, which can be the same as wt.
+static void update_vals(real_t *wt, real_t *dst, real_t *delta,
+        real_t *er, size_t n, real_t lr, real_t l1, real_t l2, real_t mmt)
+{
+    real_t reg;
+    size_t j;
+
+    for (j = 0; j < n; j++) {
+        reg = - l2 * wt[j];
+        if (wt[j] > 0.0) {
+            reg -= l1;
+        } else if (wt[j] < 0.0) {
+            reg += l1;
         }
 
-        if (mat_add_elems(&sub_wt, 1.0, &sub_er, lr, &sub_wt) < 0) {
-            ST_ERROR("Failed to mat_add_elems sub_wt vs sub_er.");
+        if (delta != NULL) {
+            delta[j] = mmt * delta[j] + lr * er[j];
+            dst[j] += reg + delta[j];
+        } else {
+            dst[j] += reg + lr * er[j];
+        }
+    }
+}
+
+// update part of a row block by block, er has num_cols values.
+static int update_part(wt_updater_t *wt_updater, size_t row, size_t col,
+        size_t num_cols, real_t *er, real_t lr, real_t l1, real_t l2,
+        real_t mmt)
+{
+    real_t *dst_vals;
+    real_t *delta;
+    size_t off, n;
+    int blk;
+
+    while (num_cols > 0) {
+        blk = row * wt_updater->blks_per_row + col / wt_updater->blk_cols;
+        off = col % wt_updater->blk_cols;
+        n = min(num_cols, wt_updater->blk_cols - off);
+
+        dst_vals = wt_updater_blk_dst(wt_updater, blk);
+        if (dst_vals == NULL) {
+            ST_ERROR("Failed to wt_updater_blk_dst.");
             return -1;
         }
+        wt_updater_catchup(wt_updater, blk, dst_vals);
+
+        if (mmt != 0.0) {
+            delta = MAT_VALP(&wt_updater->delta_wt, row, col);
+        } else {
+            delta = NULL;
+        }
+        update_vals(MAT_VALP(&wt_updater->wt, row, col), dst_vals + off,
+                delta, er, n, lr, l1, l2, mmt);
+        if (wt_updater->blk_slots == NULL) {
+            touch_wt(wt_updater, row, col, n);
+        }
+
+        er += n;
+        col += n;
+        num_cols -= n;
     }
 
     return 0;
@@ -257,6 +711,8 @@ int wt_update(wt_updater_t *wt_updater,
     mat_t *delta_wt;
     vec_t *bias;
     vec_t *delta_bias;
+    mat_t *dst_wt;
+    vec_t *dst_bias;
 
     size_t a;
     int batch_size;
@@ -280,6 +736,22 @@ int wt_update(wt_updater_t *wt_updater,
     bias = &wt_updater->bias;
     delta_bias = &wt_updater->delta_bias;
 
+    wt_updater_setup_blks(wt_updater);
+    if (wt_updater->param.sync_size > 0) {
+        if (wt_updater_setup_sync(wt_updater) < 0) {
+            ST_ERROR("Failed to wt_updater_setup_sync.");
+            return -1;
+        }
+        dst_bias = &wt_updater->acc_bias;
+    } else {
+        dst_bias = bias;
+    }
+    if (wt_updater->acc_wt.num_rows > 0) {
+        dst_wt = &wt_updater->acc_wt;
+    } else {
+        dst_wt = wt;
+    }
+
     batch_size = er->num_rows;
 
     lr = get_lr(&(wt_updater->param));
@@ -293,6 +765,17 @@ int wt_update(wt_updater_t *wt_updater,
     mmt = wt_updater->param.momentum * wt_updater->param.momentum_coef;
     mmt_bias = wt_updater->param.momentum * wt_updater->param.bias_momentum_coef;
 
+    if (wt_updater->type != WT_UT_FULL
+            && (mmt != 0.0 || l1 != 0.0 || l2 != 0.0)) {
+        if (wt_updater_setup_lazy(wt_updater) < 0) {
+            ST_ERROR("Failed to wt_updater_setup_lazy.");
+            return -1;
+        }
+        wt_updater->lazy_l1 = l1;
+        wt_updater->lazy_l2 = l2;
+        wt_updater->lazy_mmt = mmt;
+    }
+
     switch (wt_updater->type) {
         case WT_UT_FULL:
             if (er->num_cols != wt->num_rows) {
@@ -311,23 +794,23 @@ int wt_update(wt_updater_t *wt_updater,
                     return -1;
                 }
 
-                if (mat_regularize_l1_l2(wt, l1, l2) < 0) {
+                if (mat_regularize_l1_l2(wt, l1, l2, dst_wt) < 0) {
                     ST_ERROR("Failed to mat_regularize_l1_l2 wt.");
                     return -1;
                 }
 
-                if (mat_add_elems(wt, 1.0, delta_wt, 1.0, wt) < 0) {
+                if (mat_add_elems(dst_wt, 1.0, delta_wt, 1.0, dst_wt) < 0) {
                     ST_ERROR("Failed to mat_add_elems for wt.");
                     return -1;
                 }
             } else {
-                if (mat_regularize_l1_l2(wt, l1, l2) < 0) {
+                if (mat_regularize_l1_l2(wt, l1, l2, dst_wt) < 0) {
                     ST_ERROR("Failed to mat_regularize_l1_l2 wt.");
                     return -1;
                 }
 
                 if (add_mat_mat(lr, er, MT_Trans, in, MT_NoTrans,
-                            1.0, wt) < 0) {
+                            1.0, dst_wt) < 0) {
                     ST_ERROR("Failed to add_mat_mat for in and er");
                     return -1;
                 }
@@ -341,17 +824,32 @@ int wt_update(wt_updater_t *wt_updater,
                         return -1;
                     }
 
-                    if (vec_add_elems(bias, 1.0, delta_bias, 1.0, bias) < 0) {
+                    if (vec_add_elems(dst_bias, 1.0, delta_bias,
+                                1.0, dst_bias) < 0) {
                         ST_ERROR("Failed to vec_add_elems bias");
                         return -1;
                     }
                 } else {
-                    if (vec_add_col_sum_mat(bias, lr_bias, er, 1.0) < 0) {
+                    if (vec_add_col_sum_mat(dst_bias, lr_bias, er, 1.0) < 0) {
                         ST_ERROR("Failed to vec_add_col_sum_mat bias");
                         return -1;
                     }
                 }
             }
+
+            for (a = 0; a < wt->num_rows; a++) {
+                if (wt_updater_mark_dirty(wt_updater, a,
+                            0, wt->num_cols) < 0) {
+                    ST_ERROR("Failed to wt_updater_mark_dirty.");
+                    return -1;
+                }
+                if (wt_updater->blk_slots == NULL) {
+                    touch_wt(wt_updater, a, 0, wt->num_cols);
+                    if (bias->size > 0) {
+                        touch_bias(wt_updater, a);
+                    }
+                }
+            }
             break;
 
         case WT_UT_PART:
@@ -363,19 +861,19 @@ int wt_update(wt_updater_t *wt_updater,
 
             if (part->s + part->n > wt->num_cols) {
                 a = wt->num_cols - part->s;
-                if (update_part(1, a, wt, 0, part->s, er, 0, 0, lr, l1, l2,
-                            mmt, delta_wt) < 0) {
+                if (update_part(wt_updater, 0, part->s, a,
+                            MAT_VALP(er, 0, 0), lr, l1, l2, mmt) < 0) {
                     ST_ERROR("Failed to update_part first part");
                     return -1;
                 }
-                if (update_part(1, part->n - a, wt, 0, 0,
-                            er, 0, a, lr, l1, l2, mmt, delta_wt) < 0) {
+                if (update_part(wt_updater, 0, 0, part->n - a,
+                            MAT_VALP(er, 0, a), lr, l1, l2, mmt) < 0) {
                     ST_ERROR("Failed to update_part second part");
                     return -1;
                 }
             } else {
-                if (update_part(1, part->n, wt, 0, part->s, er, 0, 0,
-                            lr, l1, l2, mmt, delta_wt) < 0) {
+                if (update_part(wt_updater, 0, part->s, part->n,
+                            MAT_VALP(er, 0, 0), lr, l1, l2, mmt) < 0) {
                     ST_ERROR("Failed to update_part whole part");
                     return -1;
                 }
@@ -393,14 +891,25 @@ int wt_update(wt_updater_t *wt_updater,
                 ST_ERROR("Error format of sp_mat.[%d]", sp_mat->fmt);
                 return -1;
             }
+            if (mmt == 0.0 && l1 == 0.0 && l2 == 0.0
+                    && wt_updater->blk_slots == NULL) {
+                // plain SGD on shared weight, scatter-add all rows at once
+                mat_scatter_add_rows(wt, sp_mat->coo.cols,
+                        er, sp_mat->coo.rows, sp_mat->vals,
+                        sp_mat->size, lr);
+                for (a = 0; a < sp_mat->size; a++) {
+                    touch_wt(wt_updater, sp_mat->coo.cols[a],
+                            0, wt->num_cols);
+                }
+                break;
+            }
             for (a = 0; a < sp_mat->size; a++) {
                 // sp_mat->coo.cols[a] is word_id
                 // sp_mat->coo.rows[a] is batch_id
-                if (update_part(1, wt->num_cols,
-                            wt, sp_mat->coo.cols[a], 0,
-                            er, sp_mat->coo.rows[a], 0,
-                            lr * sp_mat->vals[a], l1, l2,
-                            mmt, delta_wt) < 0) {
+                if (update_part(wt_updater, sp_mat->coo.cols[a], 0,
+                            wt->num_cols,
+                            MAT_VALP(er, sp_mat->coo.rows[a], 0),
+                            lr * sp_mat->vals[a], l1, l2, mmt) < 0) {
                     ST_ERROR("Failed to update_part one-shot");
                     return -1;
                 }
@@ -414,3 +923,199 @@ int wt_update(wt_updater_t *wt_updater,
 
     return 0;
 }
+
+int wt_update_rows(wt_updater_t *wt_updater,
+        mat_t *er, real_t er_scale,
+        mat_t *in, real_t in_scale, int *rows)
+{
+    mat_t *wt;
+    vec_t *bias;
+    vec_t *delta_bias;
+    vec_t *dst_bias;
+
+    real_t e;
+
+    size_t b, j;
+    int r;
+
+    real_t lr, lr_bias, l1, l2;
+    real_t mmt, mmt_bias;
+
+    ST_CHECK_PARAM(wt_updater == NULL || er == NULL || in == NULL
+            || rows == NULL, -1);
+
+    if (wt_updater->param.learn_rate == 0.0) {
+        // fixed weight
+        return 0;
+    }
+
+    wt = &wt_updater->wt;
+    bias = &wt_updater->bias;
+    delta_bias = &wt_updater->delta_bias;
+
+    if (er->num_rows != in->num_rows || in->num_cols != wt->num_cols) {
+        ST_ERROR("Error size of er mat[%zux%zu], in mat[%zux%zu], "
+                "wt[%zux%zu]", er->num_rows, er->num_cols,
+                in->num_rows, in->num_cols, wt->num_rows, wt->num_cols);
+        return -1;
+    }
+
+#ifdef _CONNLM_TRACE_PROCEDURE_
+    ST_TRACE("Update weight rows.");
+#endif
+
+    wt_updater_setup_blks(wt_updater);
+    if (wt_updater->param.sync_size > 0) {
+        if (wt_updater_setup_sync(wt_updater) < 0) {
+            ST_ERROR("Failed to wt_updater_setup_sync.");
+            return -1;
+        }
+        dst_bias = &wt_updater->acc_bias;
+    } else {
+        dst_bias = bias;
+    }
+
+    lr = get_lr(&(wt_updater->param));
+    lr *= er_scale * in_scale;
+    lr_bias = lr * wt_updater->param.bias_learn_rate_coef;
+    lr = lr * wt_updater->param.learn_rate_coef;
+
+    l1 = lr * wt_updater->param.l1_penalty;
+    l2 = lr * wt_updater->param.l2_penalty;
+
+    mmt = wt_updater->param.momentum * wt_updater->param.momentum_coef;
+    mmt_bias = wt_updater->param.momentum * wt_updater->param.bias_momentum_coef;
+
+    if (mmt != 0.0 || l1 != 0.0 || l2 != 0.0) {
+        if (wt_updater_setup_lazy(wt_updater) < 0) {
+            ST_ERROR("Failed to wt_updater_setup_lazy.");
+            return -1;
+        }
+        wt_updater->lazy_l1 = l1;
+        wt_updater->lazy_l2 = l2;
+        wt_updater->lazy_mmt = mmt;
+    }
+
+    for (b = 0; b < er->num_rows; b++) {
+        for (j = 0; j < er->num_cols; j++) {
+            r = rows[b * er->num_cols + j];
+            e = MAT_VAL(er, b, j);
+
+            if (update_part(wt_updater, r, 0, wt->num_cols,
+                        MAT_VALP(in, b, 0), lr * e, l1, l2, mmt) < 0) {
+                ST_ERROR("Failed to update_part row.");
+                return -1;
+            }
+
+            if (bias->size > 0) {
+                if (mmt_bias != 0.0) {
+                    VEC_VAL(delta_bias, r) = mmt_bias * VEC_VAL(delta_bias, r)
+                        + lr_bias * e;
+                    VEC_VAL(dst_bias, r) += VEC_VAL(delta_bias, r);
+                } else {
+                    VEC_VAL(dst_bias, r) += lr_bias * e;
+                }
+                if (dst_bias == bias) {
+                    touch_bias(wt_updater, r);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+int wt_updater_finish(wt_updater_t *wt_updater)
+{
+    mat_t *wt;
+    real_t *wt_vals;
+    size_t num_blks;
+    int blk, lock;
+
+    ST_CHECK_PARAM(wt_updater == NULL, -1);
+
+    if (wt_updater_sync(wt_updater) < 0) {
+        ST_ERROR("Failed to wt_updater_sync.");
+        return -1;
+    }
+
+    if (wt_updater->blk_steps == NULL) {
+        return 0;
+    }
+
+    // nothing is accumulated now, catch up the shared weight in place
+    wt = &wt_updater->wt;
+    num_blks = wt_updater->blks_per_row * wt->num_rows;
+    for (blk = 0; blk < num_blks; blk++) {
+        wt_vals = MAT_VALP(wt, blk / wt_updater->blks_per_row,
+                (blk % wt_updater->blks_per_row) * wt_updater->blk_cols);
+        if (wt_updater->blk_slots != NULL) {
+            lock = sync_lock(wt_updater, blk);
+            pthread_mutex_lock(sync_locks + lock);
+            catchup_block(wt_updater, blk, wt_updater->step, wt_vals,
+                    false);
+            pthread_mutex_unlock(sync_locks + lock);
+        } else {
+            catchup_block(wt_updater, blk, wt_updater->step, wt_vals,
+                    false);
+        }
+    }
+
+    return 0;
+}
+
+int wt_updater_add_pending(wt_updater_t *wt_updater, mat_t *wt, vec_t *bias)
+{
+    real_t *acc_vals;
+    real_t *dst_vals;
+    size_t row, col, n, j, num_blks;
+    int i, blk;
+
+    ST_CHECK_PARAM(wt_updater == NULL || wt == NULL || bias == NULL, -1);
+
+    if (wt->num_rows != wt_updater->wt.num_rows
+            || wt->num_cols != wt_updater->wt.num_cols
+            || bias->size != wt_updater->bias.size) {
+        ST_ERROR("Size of wt[%zux%zu] or bias[%zu] not match.",
+                wt->num_rows, wt->num_cols, bias->size);
+        return -1;
+    }
+
+    if (wt_updater->blk_slots != NULL) {
+        for (i = 0; i < wt_updater->dirty_blks.size; i++) {
+            blk = VEC_VAL(&wt_updater->dirty_blks, i);
+            row = blk / wt_updater->blks_per_row;
+            col = (blk % wt_updater->blks_per_row) * wt_updater->blk_cols;
+            n = min(wt_updater->blk_cols, wt->num_cols - col);
+
+            if (wt_updater->acc_wt.num_rows > 0) {
+                acc_vals = MAT_VALP(&wt_updater->acc_wt, row, col);
+            } else {
+                acc_vals = MAT_VALP(&wt_updater->acc_blks, i, 0);
+            }
+            dst_vals = MAT_VALP(wt, row, col);
+            for (j = 0; j < n; j++) {
+                dst_vals[j] += acc_vals[j];
+            }
+            // bias is only updated along with the whole row
+            if (col == 0 && bias->size > 0) {
+                VEC_VAL(bias, row) += VEC_VAL(&wt_updater->acc_bias, row);
+            }
+        }
+    }
+
+    if (wt_updater->blk_steps == NULL) {
+        return 0;
+    }
+
+    // changes of catching up are computed from the shared weight, the
+    // same as what the next update of the block would do.
+    num_blks = wt_updater->blks_per_row * wt->num_rows;
+    for (blk = 0; blk < num_blks; blk++) {
+        dst_vals = MAT_VALP(wt, blk / wt_updater->blks_per_row,
+                (blk % wt_updater->blks_per_row) * wt_updater->blk_cols);
+        catchup_block(wt_updater, blk, wt_updater->step, dst_vals, true);
+    }
+
+    return 0;
+}
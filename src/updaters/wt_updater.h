@@ -65,7 +65,45 @@ typedef struct _weight_updater_t_ {
     mat_t delta_wt; /**< buffer for delta weight. used by momentum. */
     vec_t bias; /**< local bias of this updater. */
     vec_t delta_bias; /**< buffer for delta bias. used by momentum. */
+    qmat_t *qwt; /**< quantized weight, NULL if not quantized. */
     wt_update_type_t type; /**< updating type. */
+
+    /* weight is split into blocks(a part of row), which is the unit for
+       tracking the touched parts of weight. */
+    size_t blk_cols; /**< number of columns in one block. */
+    size_t blks_per_row; /**< number of blocks in one row. */
+
+    /* when param.sync_size > 0, updates are accumulated in thread-local
+       buffers, and merged into the shared weights every sync_size
+       mini-batches. Only the touched blocks are buffered and merged.
+       WT_UT_FULL weights are touched entirely by every update, so they
+       are accumulated in a dense acc_wt; for other weights, the delta
+       of the i-th dirty block is kept in the i-th row of acc_blks. */
+    mat_t acc_wt; /**< accumulated delta weight, only for WT_UT_FULL. */
+    mat_t acc_blks; /**< accumulated delta of dirty blocks. */
+    vec_t acc_bias; /**< accumulated delta bias since last sync. */
+    int *blk_slots; /**< index of block in dirty_blks, -1 if clean. */
+    ivec_t dirty_blks; /**< list of dirty blocks. */
+    int num_batches; /**< number of mini-batches since last sync. */
+
+    /* for sparse updating(WT_UT_PART, WT_UT_ONE_SHOT and wt_update_rows),
+       momentum and L1/L2 penalty are applied lazily, i.e. only on the
+       touched blocks, with a catch-up for the steps skipped since the
+       last time the block was updated. A step is a mini-batch. */
+    int step; /**< number of finished mini-batches. */
+    int *blk_steps; /**< number of steps applied on every block. */
+    real_t lazy_l1; /**< L1 penalty per step for catching up. */
+    real_t lazy_l2; /**< L2 penalty per step for catching up. */
+    real_t lazy_mmt; /**< momentum per step for catching up. */
+
+    /* optional flags of changed segments, set whenever the shared
+       weight is changed and cleared by the one watching it, e.g. dist.
+       A segment is a part of row with no more than seg_size values,
+       the j-th segment of row i is wt_segs[i * segs_per_row + j]. */
+    bool *wt_segs; /**< flags for segments of wt, NULL if not watched. */
+    bool *bias_segs; /**< flags for segments of bias, NULL if not watched. */
+    size_t seg_size; /**< max number of values in one segment. */
+    size_t segs_per_row; /**< number of segments in a row of wt. */
 } wt_updater_t;
 
 /**
@@ -100,6 +138,23 @@ void wt_updater_destroy(wt_updater_t *wt_updater);
 wt_updater_t* wt_updater_create(param_t *param, mat_t *wt, vec_t *bias,
         wt_update_type_t type);
 
+/**
+ * Watch changes of the shared weight and bias by segments.
+ * Flag of a segment is set to true once it is changed in the shared
+ * weight, either updated directly or merged from the local buffers.
+ * Flags are never cleared by wt_updater.
+ * @ingroup g_updater_wt
+ * @param[in] wt_updater the wt_updater.
+ * @param[in] wt_segs flags for segments of weight, rows of weight are
+ *                    split into ceil(num_cols / seg_size) segments.
+ * @param[in] bias_segs flags for segments of bias, bias is split into
+ *                      ceil(size / seg_size) segments. Can be NULL.
+ * @param[in] seg_size max number of values in one segment.
+ * @return non-zero value if any error.
+ */
+int wt_updater_watch_segs(wt_updater_t *wt_updater, bool *wt_segs,
+        bool *bias_segs, size_t seg_size);
+
 /**
  * Update weights.
  * @ingroup g_updater_wt
@@ -130,6 +185,73 @@ int wt_update(wt_updater_t *wt_updater,
         mat_t *in, real_t in_scale,
         st_size_seg_t* part, sp_mat_t *sp_mat);
 
+/**
+ * Update rows of weights, scattered by the given row indices.
+ * Used when only some rows of weight are involved, e.g. the noise
+ * samples in NCE. The type of wt_updater is ignored.
+ * @ingroup g_updater_wt
+ *
+ * Denote Batch size by B and number of rows per example by N,
+ * er is [ B x N ]; in is [ B x col ]; rows has B * N elements,
+ * i.e. MAT_VAL(er, b, j) is the error of weight row rows[b * N + j]
+ * with the input MAT_ROW(in, b).
+ *
+ * @param[in] wt_updater the wt_updater.
+ * @param[in] er the error matrix.
+ * @param[in] er_scale scale of error matrix.
+ * @param[in] in the input matrix.
+ * @param[in] in_scale scale of input matrix.
+ * @param[in] rows index of weight rows.
+ * @return non-zero value if any error.
+ */
+int wt_update_rows(wt_updater_t *wt_updater,
+        mat_t *er, real_t er_scale,
+        mat_t *in, real_t in_scale, int *rows);
+
+/**
+ * Finish updates of one mini-batch.
+ * Advance the step of lazy updating, and merge the locally accumulated
+ * updates into the shared weights every param.sync_size mini-batches.
+ * @ingroup g_updater_wt
+ * @param[in] wt_updater the wt_updater.
+ * @return non-zero value if any error.
+ */
+int wt_updater_flush(wt_updater_t *wt_updater);
+
+/**
+ * Merge the locally accumulated updates into the shared weights.
+ * Nothing to do, if param.sync_size is zero.
+ * Must be called after the last update, e.g. at the end of training.
+ * @ingroup g_updater_wt
+ * @param[in] wt_updater the wt_updater.
+ * @return non-zero value if any error.
+ */
+int wt_updater_sync(wt_updater_t *wt_updater);
+
+/**
+ * Finish updating for wt_updater.
+ * Catch up the lazy momentum and penalties for all blocks, and
+ * merge the locally accumulated updates.
+ * @ingroup g_updater_wt
+ * @param[in] wt_updater the wt_updater.
+ * @return non-zero value if any error.
+ */
+int wt_updater_finish(wt_updater_t *wt_updater);
+
+/**
+ * Add the updates not applied to the shared weights yet into a copy
+ * of them, i.e. the locally accumulated updates and the lazy momentum
+ * and penalties not caught up, as if wt_updater_finish was called.
+ * Neither the shared weights nor the state of wt_updater is changed,
+ * so it must not be called while the wt_updater is updating.
+ * @ingroup g_updater_wt
+ * @param[in] wt_updater the wt_updater.
+ * @param[in,out] wt copy of the weight.
+ * @param[in,out] bias copy of the bias.
+ * @return non-zero value if any error.
+ */
+int wt_updater_add_pending(wt_updater_t *wt_updater, mat_t *wt, vec_t *bias);
+
 #ifdef __cplusplus
 }
 #endif
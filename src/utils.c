@@ -26,6 +26,8 @@
 #include <string.h>
 #include <float.h>
 #include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <stutils/st_macro.h>
 #include <stutils/st_log.h>
@@ -41,6 +43,10 @@
 
 #define SQ_MULTIPLE 1024.0
 
+#define SAVE_BLOCK_SIZE 4096 /* number of values written in one fwrite. */
+#define SAVE_CHUNK_SIZE (1 << 20) /* number of values encoded in one job. */
+#define SAVE_MAX_THREADS 16
+
 void matXvec(real_t *dst, real_t *mat, real_t *vec,
         int mat_row, int in_vec_size, real_t scale)
 {
@@ -233,99 +239,6 @@ real_t dot_product(real_t *v1, real_t *v2, int vec_size)
     return (real_t)s;
 }
 
-double sigmoidd(double x)
-{
-    return 1.0 / (1.0 + exp(-x));
-}
-
-float sigmoidf(float x)
-{
-    return 1.0f / (1.0f + expf(-x));
-}
-
-void sigmoid(real_t *vec, int vec_size)
-{
-    int a;
-
-    for (a = 0; a < vec_size; a++) {
-        if (vec[a] > 50) {
-            vec[a] = 50;
-        }
-        if (vec[a] < -50) {
-            vec[a] = -50;
-        }
-
-        vec[a] = sigmoidr(vec[a]);
-    }
-}
-
-void softmax(real_t *vec, int vec_size)
-{
-    double sum;
-    real_t max;
-
-    int i;
-
-    max = -FLT_MAX;
-    sum = 0;
-
-    for (i = 0; i < vec_size; i++) {
-        if (vec[i] > max) {
-            max = vec[i]; //this prevents the need to check for overflow
-        }
-    }
-
-    for (i = 0; i < vec_size; i++) {
-        vec[i] = expr(vec[i] - max);
-        sum += vec[i];
-    }
-
-    for (i = 0; i < vec_size; i++) {
-        vec[i] = vec[i] / sum;
-    }
-}
-
-void tanH(real_t *vec, int vec_size)
-{
-    int a;
-
-    for (a = 0; a < vec_size; a++) {
-        if (vec[a] > 25) {
-            vec[a] = 25;
-        }
-        if (vec[a] < -25) {
-            vec[a] = -25;
-        }
-
-        vec[a] = tanhr(vec[a]);
-    }
-}
-
-void multi_logit(real_t *vec, int vec_size)
-{
-    double sum;
-    real_t max;
-
-    int i;
-
-    max = 0.0;
-    for (i = 0; i < vec_size; i++) {
-        if (vec[i] > max) {
-            max = vec[i]; //this prevents the need to check for overflow
-        }
-    }
-
-    sum = expr(0.0 - max);;
-    for (i = 0; i < vec_size; i++) {
-        vec[i] = expr(vec[i] - max);
-        sum += vec[i];
-    }
-
-    for (i = 0; i < vec_size; i++) {
-        vec[i] = vec[i] / sum;
-    }
-}
-
 void connlm_show_usage(const char *module_name, const char *header,
         const char *usage, const char *eg,
         st_opt_t *opt, const char *trailer)
@@ -636,6 +549,12 @@ connlm_fmt_t connlm_format_parse(const char *str)
                 || strcasecmp(buf, "Short-Q") == 0
                 || strcasecmp(buf, "SQ") == 0) {
             fmt |= CONN_FMT_SHORT_QUANTIZATION;
+        } else if (strcasecmp(buf, "Mmap") == 0
+                || strcasecmp(buf, "M") == 0) {
+            fmt |= CONN_FMT_BIN | CONN_FMT_MMAP;
+        } else if (strcasecmp(buf, "Checksum") == 0
+                || strcasecmp(buf, "CS") == 0) {
+            fmt |= CONN_FMT_BIN | CONN_FMT_CHECKSUM;
         }
 
         if (*p == '\0') {
@@ -644,6 +563,12 @@ connlm_fmt_t connlm_format_parse(const char *str)
         ++p;
     }
 
+    if (connlm_fmt_is_mmap(fmt) && (fmt & (CONN_FMT_ZEROS_COMPRESSED
+                    | CONN_FMT_SHORT_QUANTIZATION | CONN_FMT_CHECKSUM))) {
+        ST_ERROR("Mmap format can't be combined with ZC, SQ or Checksum");
+        return CONN_FMT_UNKNOWN;
+    }
+
     return fmt;
 }
 
@@ -656,6 +581,11 @@ int16_t quantify_int16(real_t r, real_t multiple)
     return (int16_t)r;
 }
 
+static inline real_t dequantify_int16(int16_t si)
+{
+    return ((real_t)si) / SQ_MULTIPLE;
+}
+
 int load_sq_zc(real_t *a, size_t sz, FILE *fp)
 {
     size_t i;
@@ -670,7 +600,7 @@ int load_sq_zc(real_t *a, size_t sz, FILE *fp)
         }
 
         if (si != 0) {
-            a[i] = ((real_t)si) / SQ_MULTIPLE;
+            a[i] = dequantify_int16(si);
             ++i;
             continue;
         }
@@ -699,7 +629,7 @@ int load_sq(real_t *a, size_t sz, FILE *fp)
             return -1;
         }
 
-        a[i] = ((real_t)si) / SQ_MULTIPLE;
+        a[i] = dequantify_int16(si);
     }
 
     return 0;
@@ -754,52 +684,245 @@ static int write_zeros_int16(uint64_t num_zeros, FILE *fp)
     return 0;
 }
 
-int save_sq_zc(real_t *a, size_t sz, FILE *fp)
+static int write_zeros_real(uint64_t num_zeros, FILE *fp)
 {
+    real_t zero = 0;
+
+    if (fwrite(&zero, sizeof(real_t), 1, fp) != 1) {
+        ST_ERROR("Failed to write zero.");
+        return -1;
+    }
+    if (st_varint_encode_stream_uint64(num_zeros, fp) < 0) {
+        ST_ERROR("Failed to st_varint_encode_stream_uint64[%"PRIu64"]",
+                num_zeros);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int write_zeros(uint64_t num_zeros, connlm_fmt_t fmt, FILE *fp)
+{
+    if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
+        return write_zeros_int16(num_zeros, fp);
+    }
+
+    return write_zeros_real(num_zeros, fp);
+}
+
+/*
+ * Hash of a decoded value at position idx, the checksum of a vector
+ * is the sum of all hashes, so that chunks can be summed in any order.
+ */
+static inline uint64_t checksum_val(real_t r, uint64_t idx)
+{
+    uint64_t x = 0;
+
+    memcpy(&x, &r, sizeof(real_t));
+    x ^= idx * 0x9E3779B97F4A7C15ULL;
+    // finalizer of splitmix64
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static int flush_block(void *buf, size_t n, connlm_fmt_t fmt, FILE *fp)
+{
+    size_t sz;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
+        sz = sizeof(int16_t);
+    } else {
+        sz = sizeof(real_t);
+    }
+    if (fwrite(buf, sz, n, fp) != n) {
+        ST_ERROR("Failed to write block.");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Encode a[0, sz) into fp, values are buffered and written by blocks.
+ * If lead_zeros and trail_zeros are not NULL, the leading and trailing
+ * zeros are returned instead of written, so that the caller can join
+ * the chunks of a long vector encoded separately.
+ * If checksum is not NULL, hashes of the values, as they would be decoded
+ * by load_*, are added to it, with positions starting from offset.
+ */
+static int encode_reals(real_t *a, size_t sz, connlm_fmt_t fmt, FILE *fp,
+        uint64_t *lead_zeros, uint64_t *trail_zeros,
+        uint64_t offset, uint64_t *checksum)
+{
+    int16_t sbuf[SAVE_BLOCK_SIZE];
+    real_t rbuf[SAVE_BLOCK_SIZE];
+    void *buf;
+
     uint64_t num_zeros;
-    size_t i;
-    int16_t si;
+    uint64_t sum;
+    size_t i, n;
+    int16_t si = 0;
+    real_t r;
+    bool sq, zc, emitted, zero;
+
+    sq = (fmt & CONN_FMT_SHORT_QUANTIZATION) != 0;
+    zc = (fmt & CONN_FMT_ZEROS_COMPRESSED) != 0;
+    buf = sq ? (void *)sbuf : (void *)rbuf;
+
+    if (lead_zeros != NULL) {
+        *lead_zeros = 0;
+    }
+    if (trail_zeros != NULL) {
+        *trail_zeros = 0;
+    }
+
+    sum = 0;
+    if (!sq && !zc) {
+        if (checksum != NULL) {
+            for (i = 0; i < sz; i++) {
+                sum += checksum_val(a[i], offset + i);
+            }
+            *checksum += sum;
+        }
+        if (sz > 0 && fwrite(a, sizeof(real_t), sz, fp) != sz) {
+            ST_ERROR("Failed to write reals.");
+            return -1;
+        }
+        return 0;
+    }
 
     num_zeros = 0;
+    emitted = false;
+    n = 0;
     for (i = 0; i < sz; i++) {
-        si = quantify_int16(a[i], SQ_MULTIPLE);
-        if (si == 0) {
+        if (sq) {
+            si = quantify_int16(a[i], SQ_MULTIPLE);
+            r = dequantify_int16(si);
+            zero = (si == 0);
+        } else {
+            r = a[i];
+            zero = (r == 0.0);
+            if (zero) {
+                r = 0.0; // -0.0 is decoded as 0.0
+            }
+        }
+        if (checksum != NULL) {
+            sum += checksum_val(r, offset + i);
+        }
+
+        if (zc && zero) {
             ++num_zeros;
             continue;
         }
 
         if (num_zeros > 0) {
-            if (write_zeros_int16(num_zeros, fp) < 0) {
-                ST_ERROR("Failed to write_zeros_int16.");
+            if (flush_block(buf, n, fmt, fp) < 0) {
+                return -1;
+            }
+            n = 0;
+            if (!emitted && lead_zeros != NULL) {
+                *lead_zeros = num_zeros;
+            } else if (write_zeros(num_zeros, fmt, fp) < 0) {
+                ST_ERROR("Failed to write_zeros.");
                 return -1;
             }
             num_zeros = 0;
         }
+        emitted = true;
 
-        if (fwrite(&si, sizeof(int16_t), 1, fp) != 1) {
-            ST_ERROR("Failed to write short.");
-            return -1;
+        if (sq) {
+            sbuf[n++] = si;
+        } else {
+            rbuf[n++] = r;
+        }
+        if (n == SAVE_BLOCK_SIZE) {
+            if (flush_block(buf, n, fmt, fp) < 0) {
+                return -1;
+            }
+            n = 0;
         }
     }
+
+    if (flush_block(buf, n, fmt, fp) < 0) {
+        return -1;
+    }
+
     if (num_zeros > 0) {
-        if (write_zeros_int16(num_zeros, fp) < 0) {
-            ST_ERROR("Failed to write_zeros_int16.");
+        if (!emitted && lead_zeros != NULL) {
+            *lead_zeros = num_zeros;
+        } else if (trail_zeros != NULL) {
+            *trail_zeros = num_zeros;
+        } else if (write_zeros(num_zeros, fmt, fp) < 0) {
+            ST_ERROR("Failed to write_zeros.");
             return -1;
         }
     }
 
+    if (checksum != NULL) {
+        *checksum += sum;
+    }
+
     return 0;
 }
 
+int save_sq_zc(real_t *a, size_t sz, FILE *fp)
+{
+    return encode_reals(a, sz, CONN_FMT_BIN | CONN_FMT_SHORT_QUANTIZATION
+            | CONN_FMT_ZEROS_COMPRESSED, fp, NULL, NULL, 0, NULL);
+}
+
 int save_sq(real_t *a, size_t sz, FILE *fp)
 {
-    size_t i;
-    int16_t si;
+    return encode_reals(a, sz, CONN_FMT_BIN | CONN_FMT_SHORT_QUANTIZATION,
+            fp, NULL, NULL, 0, NULL);
+}
 
-    for (i = 0; i < sz; i++) {
-        si = quantify_int16(a[i], SQ_MULTIPLE);
-        if (fwrite(&si, sizeof(int16_t), 1, fp) != 1) {
-            ST_ERROR("Failed to write short.");
+int save_zc(real_t *a, size_t sz, FILE *fp)
+{
+    return encode_reals(a, sz, CONN_FMT_BIN | CONN_FMT_ZEROS_COMPRESSED,
+            fp, NULL, NULL, 0, NULL);
+}
+
+/*
+ * A job of save_rows, either some whole rows, or a segment of one row.
+ */
+typedef struct _save_job_t_ {
+    real_t *vals;
+    size_t num_cols;
+    size_t stride;
+    connlm_fmt_t fmt;
+
+    size_t row_s;
+    size_t row_e;
+    size_t col_s;
+    size_t col_e;
+    bool split; /* whether this is a segment of one row. */
+
+    char *buf; /* encoded data. */
+    size_t buf_len;
+    uint64_t lead_zeros;
+    uint64_t trail_zeros;
+    uint64_t checksum;
+    int ret;
+} save_job_t;
+
+static int save_job_encode(save_job_t *job, FILE *fp)
+{
+    size_t r;
+
+    for (r = job->row_s; r < job->row_e; r++) {
+        if (encode_reals(job->vals + r * job->stride + job->col_s,
+                    job->col_e - job->col_s, job->fmt, fp,
+                    job->split ? &job->lead_zeros : NULL,
+                    job->split ? &job->trail_zeros : NULL,
+                    r * job->num_cols + job->col_s,
+                    (job->fmt & CONN_FMT_CHECKSUM) ? &job->checksum : NULL) < 0) {
+            ST_ERROR("Failed to encode_reals for row[%zu].", r);
             return -1;
         }
     }
@@ -807,51 +930,283 @@ int save_sq(real_t *a, size_t sz, FILE *fp)
     return 0;
 }
 
-static int write_zeros_real(uint64_t num_zeros, FILE *fp)
+static void* save_job_thread(void *args)
 {
-    real_t zero = 0;
+    save_job_t *job;
+    FILE *fp;
 
-    if (fwrite(&zero, sizeof(real_t), 1, fp) != 1) {
-        ST_ERROR("Failed to write zero.");
-        return -1;
+    job = (save_job_t *)args;
+
+    fp = open_memstream(&job->buf, &job->buf_len);
+    if (fp == NULL) {
+        ST_ERROR("Failed to open_memstream.");
+        job->ret = -1;
+        return NULL;
     }
-    if (st_varint_encode_stream_uint64(num_zeros, fp) < 0) {
-        ST_ERROR("Failed to st_varint_encode_stream_uint64[%"PRIu64"]",
-                num_zeros);
-        return -1;
+
+    job->ret = save_job_encode(job, fp);
+
+    if (fclose(fp) != 0) {
+        ST_ERROR("Failed to close memstream.");
+        job->ret = -1;
+    }
+
+    return NULL;
+}
+
+/*
+ * Write out the encoded jobs in order, joining zeros across the segments
+ * of a row, so that the output is identical to encoding row by row.
+ */
+static int save_job_write(save_job_t *job, uint64_t *num_zeros, FILE *fp)
+{
+    if (!job->split) {
+        if (job->buf_len > 0 && fwrite(job->buf, 1,
+                    job->buf_len, fp) != job->buf_len) {
+            ST_ERROR("Failed to write buf.");
+            return -1;
+        }
+        return 0;
+    }
+
+    *num_zeros += job->lead_zeros;
+    if (job->buf_len > 0) {
+        if (*num_zeros > 0) {
+            if (write_zeros(*num_zeros, job->fmt, fp) < 0) {
+                ST_ERROR("Failed to write_zeros.");
+                return -1;
+            }
+        }
+        if (fwrite(job->buf, 1, job->buf_len, fp) != job->buf_len) {
+            ST_ERROR("Failed to write buf.");
+            return -1;
+        }
+        *num_zeros = job->trail_zeros;
+    }
+
+    if (job->col_e == job->num_cols) {
+        if (*num_zeros > 0) {
+            if (write_zeros(*num_zeros, job->fmt, fp) < 0) {
+                ST_ERROR("Failed to write_zeros.");
+                return -1;
+            }
+        }
+        *num_zeros = 0;
     }
 
     return 0;
 }
 
-int save_zc(real_t *a, size_t sz, FILE *fp)
+static int save_rows_parallel(real_t *vals, size_t num_rows,
+        size_t num_cols, size_t stride, connlm_fmt_t fmt, FILE *fp,
+        int num_thrs, uint64_t *checksum)
 {
+    save_job_t *jobs = NULL;
+    pthread_t *tids = NULL;
+
     uint64_t num_zeros;
-    size_t i;
+    size_t rows_per_job, segs_per_row, seg_len;
+    size_t num_jobs, j, r, s;
+    int b, n;
+
+    if (num_cols >= SAVE_CHUNK_SIZE) {
+        rows_per_job = 1;
+        segs_per_row = (num_cols + SAVE_CHUNK_SIZE - 1) / SAVE_CHUNK_SIZE;
+        seg_len = (num_cols + segs_per_row - 1) / segs_per_row;
+        num_jobs = num_rows * segs_per_row;
+    } else {
+        rows_per_job = SAVE_CHUNK_SIZE / num_cols;
+        segs_per_row = 1;
+        seg_len = num_cols;
+        num_jobs = (num_rows + rows_per_job - 1) / rows_per_job;
+    }
+
+    jobs = (save_job_t *)st_malloc(sizeof(save_job_t) * num_jobs);
+    if (jobs == NULL) {
+        ST_ERROR("Failed to st_malloc jobs.");
+        goto ERR;
+    }
+    memset(jobs, 0, sizeof(save_job_t) * num_jobs);
+
+    j = 0;
+    for (r = 0; r < num_rows; r += rows_per_job) {
+        for (s = 0; s < segs_per_row; s++) {
+            jobs[j].vals = vals;
+            jobs[j].num_cols = num_cols;
+            jobs[j].stride = stride;
+            jobs[j].fmt = fmt;
+            jobs[j].row_s = r;
+            jobs[j].row_e = min(r + rows_per_job, num_rows);
+            jobs[j].col_s = s * seg_len;
+            jobs[j].col_e = min((s + 1) * seg_len, num_cols);
+            jobs[j].split = (segs_per_row > 1);
+            j++;
+        }
+    }
+    assert(j == num_jobs);
+
+    tids = (pthread_t *)st_malloc(sizeof(pthread_t) * num_thrs);
+    if (tids == NULL) {
+        ST_ERROR("Failed to st_malloc tids.");
+        goto ERR;
+    }
 
+    // encode num_thrs jobs at a time, to bound the size of buffers
     num_zeros = 0;
-    for (i = 0; i < sz; i++) {
-        if (a[i] == 0.0) {
-            ++num_zeros;
-            continue;
+    for (j = 0; j < num_jobs; j += num_thrs) {
+        n = (int)min(num_jobs - j, (size_t)num_thrs);
+        for (b = 0; b < n; b++) {
+            if (pthread_create(tids + b, NULL, save_job_thread,
+                        (void *)(jobs + j + b)) != 0) {
+                ST_ERROR("Failed to pthread_create.");
+                for (--b; b >= 0; b--) {
+                    pthread_join(tids[b], NULL);
+                }
+                goto ERR;
+            }
+        }
+        for (b = 0; b < n; b++) {
+            pthread_join(tids[b], NULL);
         }
 
-        if (num_zeros > 0) {
-            if (write_zeros_real(num_zeros, fp) < 0) {
-                ST_ERROR("Failed to write_zeros_real.");
+        for (b = 0; b < n; b++) {
+            if (jobs[j + b].ret < 0) {
+                ST_ERROR("Failed to encode job[%zu].", j + b);
+                goto ERR;
+            }
+            if (save_job_write(jobs + j + b, &num_zeros, fp) < 0) {
+                ST_ERROR("Failed to save_job_write[%zu].", j + b);
+                goto ERR;
+            }
+            *checksum += jobs[j + b].checksum;
+            free(jobs[j + b].buf);
+            jobs[j + b].buf = NULL;
+        }
+    }
+
+    safe_st_free(tids);
+    safe_st_free(jobs);
+
+    return 0;
+
+ERR:
+    if (jobs != NULL) {
+        for (j = 0; j < num_jobs; j++) {
+            free(jobs[j].buf);
+        }
+    }
+    safe_st_free(tids);
+    safe_st_free(jobs);
+    return -1;
+}
+
+int save_rows(real_t *vals, size_t num_rows, size_t num_cols,
+        size_t stride, connlm_fmt_t fmt, FILE *fp)
+{
+    uint64_t checksum;
+    size_t r;
+    long n;
+    int num_thrs;
+
+    ST_CHECK_PARAM(fp == NULL, -1);
+
+    if (num_rows == 0 || num_cols == 0) {
+        return 0;
+    }
+
+    ST_CHECK_PARAM(vals == NULL, -1);
+
+    num_thrs = 1;
+    if ((fmt & (CONN_FMT_SHORT_QUANTIZATION | CONN_FMT_ZEROS_COMPRESSED))
+            && num_rows * num_cols >= 2 * SAVE_CHUNK_SIZE) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        num_thrs = (int)min(max(n, 1), SAVE_MAX_THREADS);
+    }
+
+    checksum = 0;
+    if (num_thrs > 1) {
+        if (save_rows_parallel(vals, num_rows, num_cols, stride, fmt, fp,
+                    num_thrs, &checksum) < 0) {
+            ST_ERROR("Failed to save_rows_parallel.");
+            return -1;
+        }
+    } else {
+        for (r = 0; r < num_rows; r++) {
+            if (encode_reals(vals + r * stride, num_cols, fmt, fp,
+                        NULL, NULL, r * num_cols,
+                        (fmt & CONN_FMT_CHECKSUM) ? &checksum : NULL) < 0) {
+                ST_ERROR("Failed to encode_reals for row[%zu].", r);
                 return -1;
             }
-            num_zeros = 0;
         }
+    }
 
-        if (fwrite(a + i, sizeof(real_t), 1, fp) != 1) {
-            ST_ERROR("Failed to write real_t.");
+    if (fmt & CONN_FMT_CHECKSUM) {
+        if (fwrite(&checksum, sizeof(uint64_t), 1, fp) != 1) {
+            ST_ERROR("Failed to write checksum.");
             return -1;
         }
     }
-    if (num_zeros > 0) {
-        if (write_zeros_real(num_zeros, fp) < 0) {
-            ST_ERROR("Failed to write_zeros_real.");
+
+    return 0;
+}
+
+int load_rows(real_t *vals, size_t num_rows, size_t num_cols,
+        size_t stride, connlm_fmt_t fmt, FILE *fp)
+{
+    uint64_t checksum, sum;
+    size_t r, i;
+
+    ST_CHECK_PARAM(fp == NULL, -1);
+
+    if (num_rows == 0 || num_cols == 0) {
+        return 0;
+    }
+
+    ST_CHECK_PARAM(vals == NULL, -1);
+
+    for (r = 0; r < num_rows; r++) {
+        if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
+            if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
+                if (load_sq_zc(vals + r * stride, num_cols, fp) < 0) {
+                    ST_ERROR("Failed to load_sq_zc for row[%zu].", r);
+                    return -1;
+                }
+            } else {
+                if (load_sq(vals + r * stride, num_cols, fp) < 0) {
+                    ST_ERROR("Failed to load_sq for row[%zu].", r);
+                    return -1;
+                }
+            }
+        } else if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
+            if (load_zc(vals + r * stride, num_cols, fp) < 0) {
+                ST_ERROR("Failed to load_zc for row[%zu].", r);
+                return -1;
+            }
+        } else {
+            if (fread(vals + r * stride, sizeof(real_t),
+                        num_cols, fp) != num_cols) {
+                ST_ERROR("Failed to read row[%zu].", r);
+                return -1;
+            }
+        }
+    }
+
+    if (fmt & CONN_FMT_CHECKSUM) {
+        if (fread(&checksum, sizeof(uint64_t), 1, fp) != 1) {
+            ST_ERROR("Failed to read checksum.");
+            return -1;
+        }
+
+        sum = 0;
+        for (r = 0; r < num_rows; r++) {
+            for (i = 0; i < num_cols; i++) {
+                sum += checksum_val(vals[r * stride + i], r * num_cols + i);
+            }
+        }
+        if (sum != checksum) {
+            ST_ERROR("Checksum mismatch: expected[%"PRIx64"], "
+                    "computed[%"PRIx64"].", checksum, sum);
             return -1;
         }
     }
@@ -75,21 +75,6 @@ void matXmat(real_t *C, real_t *A, real_t *B, int m, int n, int k,
 
 real_t dot_product(real_t *v1, real_t *v2, int vec_size);
 
-void sigmoid(real_t *vec, int vec_size);
-
-void softmax(real_t *vec, int vec_size);
-
-/*
- * compute multinomial logit.
- * can be seen as
- *  full = vec + [0.0]
- *  softmax(full)
- *  return vec
- */
-void multi_logit(real_t *vec, int vec_size);
-
-void tanH(real_t *vec, int vec_size);
-
 void connlm_show_usage(const char *module_name, const char *header,
         const char *usage, const char *eg,
         st_opt_t *opt, const char *trailer);
@@ -168,9 +153,15 @@ typedef enum _connlm_format_t_ {
     CONN_FMT_BIN                 = 0x0002, /**< (flat) Binary format. */
     CONN_FMT_ZEROS_COMPRESSED    = 0x0004, /**< zeros-compressed (binary) format. */
     CONN_FMT_SHORT_QUANTIZATION  = 0x0008, /**< quantify to short (binary) format. */
+    CONN_FMT_MMAP                = 0x0010, /**< flat binary format, with matrices
+                                             aligned and padded to pages,
+                                             so that they can be mmap-ed. */
+    CONN_FMT_CHECKSUM            = 0x0020, /**< binary format with a checksum
+                                             after every matrix and vector. */
 } connlm_fmt_t;
 
 #define connlm_fmt_is_bin(fmt) ((fmt) > 1)
+#define connlm_fmt_is_mmap(fmt) (((fmt) & CONN_FMT_MMAP) != 0)
 
 /**
  * Parse the string representation to a connlm_fmt_t
@@ -249,6 +240,39 @@ int save_sq(real_t *a, size_t sz, FILE *fp);
  */
 int save_zc(real_t *a, size_t sz, FILE *fp);
 
+/**
+ * Save rows of a matrix to a stream in binary format.
+ * The output is the same as saving every row with save_sq_zc, save_sq,
+ * save_zc or fwrite according to fmt, followed by a checksum if
+ * CONN_FMT_CHECKSUM is set. Large matrices are split into chunks, which
+ * are encoded into memory by parallel threads and written in order.
+ * @ingroup g_connlm
+ * @param[in] vals values of the matrix.
+ * @param[in] num_rows number of rows.
+ * @param[in] num_cols number of columns.
+ * @param[in] stride stride of rows.
+ * @param[in] fmt storage format, must be binary.
+ * @param[out] fp file stream.
+ * @return non-zero if any error.
+ */
+int save_rows(real_t *vals, size_t num_rows, size_t num_cols,
+        size_t stride, connlm_fmt_t fmt, FILE *fp);
+
+/**
+ * Load rows of a matrix saved by save_rows from a stream.
+ * The checksum is verified if CONN_FMT_CHECKSUM is set.
+ * @ingroup g_connlm
+ * @param[out] vals values of the matrix.
+ * @param[in] num_rows number of rows.
+ * @param[in] num_cols number of columns.
+ * @param[in] stride stride of rows.
+ * @param[in] fmt storage format, must be binary.
+ * @param[in] fp file stream.
+ * @return non-zero if any error.
+ */
+int load_rows(real_t *vals, size_t num_rows, size_t num_cols,
+        size_t stride, connlm_fmt_t fmt, FILE *fp);
+
 /**
  * parse a real-valued vector from a string.
  * @ingroup g_connlm
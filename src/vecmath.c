@@ -0,0 +1,324 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <float.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <stutils/st_log.h>
+
+#include "utils.h"
+#include "vecmath.h"
+
+typedef struct _vm_kernels_t_ {
+    const char *isa;
+    void (*exp)(real_t *vec, int vec_size);
+    void (*log)(real_t *vec, int vec_size);
+    void (*sigmoid)(real_t *vec, int vec_size);
+    void (*tanh)(real_t *vec, int vec_size);
+    void (*softmax)(real_t *vec, int vec_size);
+    void (*multi_logit)(real_t *vec, int vec_size);
+} vm_kernels_t;
+
+#define VM_STR_(a) #a
+#define VM_STR(a) VM_STR_(a)
+
+// only the one picked by sigmoidr in utils.h is defined
+#if _CONNLM_MATH_ == 1
+static float sigmoidf(float x)
+{
+    return 1.0f / (1.0f + expf(-x));
+}
+#elif _CONNLM_MATH_ != 0
+static double sigmoidd(double x)
+{
+    return 1.0 / (1.0 + exp(-x));
+}
+#endif // _CONNLM_MATH_
+
+static void scalar_exp(real_t *vec, int vec_size)
+{
+    int a;
+
+    for (a = 0; a < vec_size; a++) {
+        vec[a] = expr(vec[a]);
+    }
+}
+
+static void scalar_log(real_t *vec, int vec_size)
+{
+    int a;
+
+    for (a = 0; a < vec_size; a++) {
+        vec[a] = logr(vec[a]);
+    }
+}
+
+static void scalar_sigmoid(real_t *vec, int vec_size)
+{
+    int a;
+
+    for (a = 0; a < vec_size; a++) {
+        if (vec[a] > 50) {
+            vec[a] = 50;
+        }
+        if (vec[a] < -50) {
+            vec[a] = -50;
+        }
+
+        vec[a] = sigmoidr(vec[a]);
+    }
+}
+
+static void scalar_tanh(real_t *vec, int vec_size)
+{
+    int a;
+
+    for (a = 0; a < vec_size; a++) {
+        if (vec[a] > 25) {
+            vec[a] = 25;
+        }
+        if (vec[a] < -25) {
+            vec[a] = -25;
+        }
+
+        vec[a] = tanhr(vec[a]);
+    }
+}
+
+static void scalar_softmax(real_t *vec, int vec_size)
+{
+    double sum;
+    real_t max;
+
+    int i;
+
+    max = -FLT_MAX;
+    sum = 0;
+
+    for (i = 0; i < vec_size; i++) {
+        if (vec[i] > max) {
+            max = vec[i]; //this prevents the need to check for overflow
+        }
+    }
+
+    for (i = 0; i < vec_size; i++) {
+        vec[i] = expr(vec[i] - max);
+        sum += vec[i];
+    }
+
+    for (i = 0; i < vec_size; i++) {
+        vec[i] = vec[i] / sum;
+    }
+}
+
+static void scalar_multi_logit(real_t *vec, int vec_size)
+{
+    double sum;
+    real_t max;
+
+    int i;
+
+    max = 0.0;
+    for (i = 0; i < vec_size; i++) {
+        if (vec[i] > max) {
+            max = vec[i]; //this prevents the need to check for overflow
+        }
+    }
+
+    sum = expr(0.0 - max);
+    for (i = 0; i < vec_size; i++) {
+        vec[i] = expr(vec[i] - max);
+        sum += vec[i];
+    }
+
+    for (i = 0; i < vec_size; i++) {
+        vec[i] = vec[i] / sum;
+    }
+}
+
+static vm_kernels_t vm_kernels_scalar = {
+    .isa = "scalar",
+    .exp = scalar_exp,
+    .log = scalar_log,
+    .sigmoid = scalar_sigmoid,
+    .tanh = scalar_tanh,
+    .softmax = scalar_softmax,
+    .multi_logit = scalar_multi_logit,
+};
+
+#if _USE_DOUBLE_ == 0 && defined(__GNUC__) && !defined(__clang__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#  define _VM_X86_
+#endif
+
+#ifdef _VM_X86_
+
+/* keep the clipped input away from denormals, so that 2^n is normal */
+#define VM_EXP_LO -87.33654f
+#define VM_EXP_HI 88.37626f
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define VM_W 4
+#define VM_SFX sse2
+#include "vecmath_kernel.h"
+#undef VM_SFX
+#undef VM_W
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define VM_W 8
+#define VM_SFX avx2
+#include "vecmath_kernel.h"
+#undef VM_SFX
+#undef VM_W
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#define VM_W 16
+#define VM_SFX avx512
+#include "vecmath_kernel.h"
+#undef VM_SFX
+#undef VM_W
+#pragma GCC pop_options
+
+#endif
+
+/* published with a single atomic store, since it is read without lock
+ * by every call, and may be switched by vm_set_isa at any time. */
+static vm_kernels_t *g_vm_kernels = NULL;
+static pthread_once_t g_vm_once = PTHREAD_ONCE_INIT;
+
+static vm_kernels_t* vm_best_kernels()
+{
+#ifdef _VM_X86_
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return &vm_kernels_avx512;
+    } else if (__builtin_cpu_supports("avx2")
+            && __builtin_cpu_supports("fma")) {
+        return &vm_kernels_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return &vm_kernels_sse2;
+    }
+#endif
+
+    return &vm_kernels_scalar;
+}
+
+static void vm_init_kernels()
+{
+    __atomic_store_n(&g_vm_kernels, vm_best_kernels(), __ATOMIC_RELEASE);
+}
+
+static inline vm_kernels_t* vm_kernels()
+{
+    vm_kernels_t *kernels;
+
+    kernels = __atomic_load_n(&g_vm_kernels, __ATOMIC_ACQUIRE);
+    if (kernels == NULL) {
+        (void)pthread_once(&g_vm_once, vm_init_kernels);
+        kernels = __atomic_load_n(&g_vm_kernels, __ATOMIC_ACQUIRE);
+    }
+
+    return kernels;
+}
+
+int vm_set_isa(const char *isa)
+{
+    vm_kernels_t *kernels = NULL;
+
+    /* initialize first, so that it never overwrites the one set here. */
+    (void)vm_kernels();
+
+    if (isa == NULL) {
+        kernels = vm_best_kernels();
+    } else if (strcmp(isa, vm_kernels_scalar.isa) == 0) {
+        kernels = &vm_kernels_scalar;
+    }
+#ifdef _VM_X86_
+    else if (strcmp(isa, vm_kernels_avx512.isa) == 0) {
+        if (__builtin_cpu_supports("avx512f")) {
+            kernels = &vm_kernels_avx512;
+        }
+    } else if (strcmp(isa, vm_kernels_avx2.isa) == 0) {
+        if (__builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma")) {
+            kernels = &vm_kernels_avx2;
+        }
+    } else if (strcmp(isa, vm_kernels_sse2.isa) == 0) {
+        if (__builtin_cpu_supports("sse2")) {
+            kernels = &vm_kernels_sse2;
+        }
+    }
+#endif
+
+    if (kernels == NULL) {
+        ST_WARNING("Instruction set [%s] not supported.", isa);
+        return -1;
+    }
+
+    __atomic_store_n(&g_vm_kernels, kernels, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+const char* vm_isa()
+{
+    return vm_kernels()->isa;
+}
+
+void vm_exp(real_t *vec, int vec_size)
+{
+    vm_kernels()->exp(vec, vec_size);
+}
+
+void vm_log(real_t *vec, int vec_size)
+{
+    vm_kernels()->log(vec, vec_size);
+}
+
+void vm_sigmoid(real_t *vec, int vec_size)
+{
+    vm_kernels()->sigmoid(vec, vec_size);
+}
+
+void vm_tanh(real_t *vec, int vec_size)
+{
+    vm_kernels()->tanh(vec, vec_size);
+}
+
+void vm_softmax(real_t *vec, int vec_size)
+{
+    vm_kernels()->softmax(vec, vec_size);
+}
+
+void vm_multi_logit(real_t *vec, int vec_size)
+{
+    vm_kernels()->multi_logit(vec, vec_size);
+}
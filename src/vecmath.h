@@ -0,0 +1,114 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef  _CONNLM_VECMATH_H_
+#define  _CONNLM_VECMATH_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <connlm/config.h>
+
+/** @defgroup g_vecmath Vector Math
+ * Element-wise math functions over vectors of real_t.
+ *
+ * For float build on x86, SSE2, AVX2 and AVX-512 versions are compiled
+ * into the same binary, and the widest one supported by the CPU is
+ * selected at the first call. Double build and other architectures
+ * fall back to the scalar versions defined by _CONNLM_MATH_.
+ */
+
+/**
+ * Compute exp(x) in place.
+ * @ingroup g_vecmath
+ * @param[in,out] vec the vector.
+ * @param[in] vec_size size of vector.
+ */
+void vm_exp(real_t *vec, int vec_size);
+
+/**
+ * Compute log(x) in place.
+ * @ingroup g_vecmath
+ * @param[in,out] vec the vector.
+ * @param[in] vec_size size of vector.
+ */
+void vm_log(real_t *vec, int vec_size);
+
+/**
+ * Compute sigmoid(x) in place, with x clipped into [-50, 50].
+ * @ingroup g_vecmath
+ * @param[in,out] vec the vector.
+ * @param[in] vec_size size of vector.
+ */
+void vm_sigmoid(real_t *vec, int vec_size);
+
+/**
+ * Compute tanh(x) in place, with x clipped into [-25, 25].
+ * @ingroup g_vecmath
+ * @param[in,out] vec the vector.
+ * @param[in] vec_size size of vector.
+ */
+void vm_tanh(real_t *vec, int vec_size);
+
+/**
+ * Compute softmax in place.
+ * @ingroup g_vecmath
+ * @param[in,out] vec the vector.
+ * @param[in] vec_size size of vector.
+ */
+void vm_softmax(real_t *vec, int vec_size);
+
+/**
+ * Compute multinomial logit in place.
+ * Can be seen as
+ *  full = vec + [0.0]
+ *  softmax(full)
+ *  return vec
+ * @ingroup g_vecmath
+ * @param[in,out] vec the vector.
+ * @param[in] vec_size size of vector.
+ */
+void vm_multi_logit(real_t *vec, int vec_size);
+
+/**
+ * Get name of the instruction set currently used.
+ * @ingroup g_vecmath
+ * @return one of "avx512", "avx2", "sse2" or "scalar".
+ */
+const char* vm_isa();
+
+/**
+ * Force the instruction set to be used, mainly for testing.
+ * @ingroup g_vecmath
+ * @param[in] isa name of instruction set, NULL to select automatically.
+ * @return non-zero value if the isa is unknown or not supported by CPU.
+ */
+int vm_set_isa(const char *isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
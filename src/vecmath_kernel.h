@@ -0,0 +1,388 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2016 Wang Jian
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Template of vector math kernels, included by vecmath.c once per
+ * instruction set, with the following macros defined:
+ *  VM_W   number of floats in one vector.
+ *  VM_SFX suffix of the names defined here.
+ * The instruction set is chosen by '#pragma GCC target' in vecmath.c,
+ * the code here only uses GCC vector extensions.
+ */
+
+#define VM_CAT_(a, b) a##_##b
+#define VM_CAT(a, b) VM_CAT_(a, b)
+#define VM_N(name) VM_CAT(name, VM_SFX)
+
+typedef float VM_N(vf) __attribute__((vector_size(VM_W * 4)));
+typedef int32_t VM_N(vi) __attribute__((vector_size(VM_W * 4)));
+
+#define vf VM_N(vf)
+#define vi VM_N(vi)
+
+static inline vf VM_N(vload)(const float *p)
+{
+    vf v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return v;
+}
+
+static inline void VM_N(vstore)(float *p, vf v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/* load n(< VM_W) elements, with the rest filled by val */
+static inline vf VM_N(vload_part)(const float *p, int n, float val)
+{
+    float buf[VM_W];
+    int i;
+
+    for (i = 0; i < n; i++) {
+        buf[i] = p[i];
+    }
+    for (; i < VM_W; i++) {
+        buf[i] = val;
+    }
+
+    return VM_N(vload)(buf);
+}
+
+static inline void VM_N(vstore_part)(float *p, int n, vf v)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        p[i] = v[i];
+    }
+}
+
+/* mask ? a : b, mask must be all-ones or all-zeros in every lane */
+static inline vf VM_N(vselect)(vi mask, vf a, vf b)
+{
+    return (vf)((mask & (vi)a) | (~mask & (vi)b));
+}
+
+/* written lane by lane, so that compiler emits minps/maxps */
+static inline vf VM_N(vmin)(vf a, vf b)
+{
+    int i;
+
+    for (i = 0; i < VM_W; i++) {
+        a[i] = a[i] < b[i] ? a[i] : b[i];
+    }
+
+    return a;
+}
+
+static inline vf VM_N(vmax)(vf a, vf b)
+{
+    int i;
+
+    for (i = 0; i < VM_W; i++) {
+        a[i] = a[i] > b[i] ? a[i] : b[i];
+    }
+
+    return a;
+}
+
+static inline vf VM_N(vclip)(vf x, float lo, float hi)
+{
+    vf vlo = (vf){0} + lo;
+    vf vhi = (vf){0} + hi;
+
+    return VM_N(vmax)(VM_N(vmin)(x, vhi), vlo);
+}
+
+#if _CONNLM_MATH_ == 0
+
+/* same approximations as fasterexp, fasterlog and friends in fastexp.h */
+static inline vf VM_N(vexp)(vf x)
+{
+    vf p;
+
+    p = VM_N(vclip)(x * 1.442695040f, -126.0f, 128.0f);
+    p = (p + 126.94269504f) * (float)(1 << 23);
+
+    return (vf)__builtin_convertvector(p, vi);
+}
+
+static inline vf VM_N(vlog)(vf x)
+{
+    vf y;
+
+    y = __builtin_convertvector((vi)x, vf);
+
+    return y * 8.2629582881927490e-8f - 87.989971088f;
+}
+
+static inline vf VM_N(vsigmoid)(vf x)
+{
+    x = VM_N(vclip)(x, -50.0f, 50.0f);
+
+    return 1.0f / (1.0f + VM_N(vexp)(-x));
+}
+
+static inline vf VM_N(vtanh)(vf x)
+{
+    x = VM_N(vclip)(x, -25.0f, 25.0f);
+
+    return -1.0f + 2.0f / (1.0f + VM_N(vexp)(-2.0f * x));
+}
+
+#else
+
+/* Cephes expf: exp(x) = 2^n * exp(r), with |r| <= ln2/2 */
+static inline vf VM_N(vexp)(vf x)
+{
+    vf fx, y, z;
+    vi n;
+
+    x = VM_N(vclip)(x, VM_EXP_LO, VM_EXP_HI);
+
+    /* n = floor(x * log2(e) + 0.5) */
+    fx = x * 1.44269504088896341f + 0.5f;
+    n = __builtin_convertvector(fx, vi);
+    n += (vi)(__builtin_convertvector(n, vf) > fx); /* -1 for truncated up */
+    fx = __builtin_convertvector(n, vf);
+
+    x -= fx * 0.693359375f;
+    x -= fx * -2.12194440e-4f;
+    z = x * x;
+
+    y = (vf){0} + 1.9875691500e-4f;
+    y = y * x + 1.3981999507e-3f;
+    y = y * x + 8.3334519073e-3f;
+    y = y * x + 4.1665795894e-2f;
+    y = y * x + 1.6666665459e-1f;
+    y = y * x + 5.0000001201e-1f;
+    y = y * z + x + 1.0f;
+
+    return y * (vf)((n + 127) << 23);
+}
+
+/* Cephes logf: log(x) = e * ln2 + log(m), with m in [sqrt(0.5), sqrt(2)) */
+static inline vf VM_N(vlog)(vf x)
+{
+    vf e, y, z, t;
+    vi ix, invalid, m;
+
+    invalid = (x <= 0.0f);
+    x = VM_N(vmax)(x, (vf){0} + FLT_MIN);
+
+    ix = (vi)x;
+    e = __builtin_convertvector((ix >> 23) - 126, vf);
+    x = (vf)((ix & 0x007fffff) | 0x3f000000); /* in [0.5, 1) */
+
+    m = (x < 0.707106781186547524f);
+    t = (vf)(m & (vi)x);
+    e -= (vf)(m & (vi)((vf){0} + 1.0f));
+    x = x - 1.0f + t;
+    z = x * x;
+
+    y = (vf){0} + 7.0376836292e-2f;
+    y = y * x - 1.1514610310e-1f;
+    y = y * x + 1.1676998740e-1f;
+    y = y * x - 1.2420140846e-1f;
+    y = y * x + 1.4249322787e-1f;
+    y = y * x - 1.6668057665e-1f;
+    y = y * x + 2.0000714765e-1f;
+    y = y * x - 2.4999993993e-1f;
+    y = y * x + 3.3333331174e-1f;
+    y = y * x * z;
+
+    y += e * -2.12194440e-4f;
+    y -= 0.5f * z;
+    x = x + y + e * 0.693359375f;
+
+    return (vf)(invalid | (vi)x); /* NaN for non-positive input */
+}
+
+static inline vf VM_N(vsigmoid)(vf x)
+{
+    x = VM_N(vclip)(x, -50.0f, 50.0f);
+
+    return 1.0f / (1.0f + VM_N(vexp)(-x));
+}
+
+/*
+ * Cephes tanhf: odd polynomial for |x| < 0.625,
+ * and 1 - 2 / (exp(2x) + 1) otherwise.
+ */
+static inline vf VM_N(vtanh)(vf x)
+{
+    vf y, z;
+    vi small;
+
+    x = VM_N(vclip)(x, -25.0f, 25.0f);
+
+    z = x * x;
+    small = (z < 0.390625f);
+    y = (vf){0} - 5.70498872745e-3f;
+    y = y * z + 2.06390887954e-2f;
+    y = y * z - 5.37397155531e-2f;
+    y = y * z + 1.33314422036e-1f;
+    y = y * z - 3.33332819422e-1f;
+    y = y * z * x + x;
+
+    z = 1.0f - 2.0f / (VM_N(vexp)(x + x) + 1.0f);
+
+    return VM_N(vselect)(small, y, z);
+}
+
+#endif // _CONNLM_MATH_
+
+#define VM_DEF_MAP(name, op, fill) \
+static void VM_N(name)(float *vec, int vec_size) \
+{ \
+    int i; \
+ \
+    for (i = 0; i + VM_W <= vec_size; i += VM_W) { \
+        VM_N(vstore)(vec + i, VM_N(op)(VM_N(vload)(vec + i))); \
+    } \
+    if (i < vec_size) { \
+        VM_N(vstore_part)(vec + i, vec_size - i, \
+                VM_N(op)(VM_N(vload_part)(vec + i, vec_size - i, fill))); \
+    } \
+}
+
+VM_DEF_MAP(exp, vexp, 0.0f)
+VM_DEF_MAP(log, vlog, 1.0f)
+VM_DEF_MAP(sigmoid, vsigmoid, 0.0f)
+VM_DEF_MAP(tanh, vtanh, 0.0f)
+
+#undef VM_DEF_MAP
+
+static float VM_N(max)(const float *vec, int vec_size, float init)
+{
+    vf vmax;
+    float max;
+    int i;
+
+    vmax = (vf){0} + init;
+    for (i = 0; i + VM_W <= vec_size; i += VM_W) {
+        vmax = VM_N(vmax)(vmax, VM_N(vload)(vec + i));
+    }
+    if (i < vec_size) {
+        vmax = VM_N(vmax)(vmax,
+                VM_N(vload_part)(vec + i, vec_size - i, init));
+    }
+
+    max = vmax[0];
+    for (i = 1; i < VM_W; i++) {
+        if (vmax[i] > max) {
+            max = vmax[i];
+        }
+    }
+
+    return max;
+}
+
+/* vec = exp(vec - max) and return the sum of vec */
+static double VM_N(exp_sum)(float *vec, int vec_size, float max)
+{
+    vf v, vsum;
+    double sum;
+    int i;
+
+    vsum = (vf){0};
+    for (i = 0; i + VM_W <= vec_size; i += VM_W) {
+        v = VM_N(vexp)(VM_N(vload)(vec + i) - max);
+        VM_N(vstore)(vec + i, v);
+        vsum += v;
+    }
+
+    sum = 0.0;
+    for (i = 0; i < VM_W; i++) {
+        sum += vsum[i];
+    }
+
+    i = vec_size - vec_size % VM_W;
+    if (i < vec_size) {
+        v = VM_N(vexp)(VM_N(vload_part)(vec + i, vec_size - i, max) - max);
+        VM_N(vstore_part)(vec + i, vec_size - i, v);
+        for (; i < vec_size; i++) {
+            sum += vec[i];
+        }
+    }
+
+    return sum;
+}
+
+static void VM_N(scale)(float *vec, int vec_size, float s)
+{
+    int i;
+
+    for (i = 0; i + VM_W <= vec_size; i += VM_W) {
+        VM_N(vstore)(vec + i, VM_N(vload)(vec + i) * s);
+    }
+    for (; i < vec_size; i++) {
+        vec[i] *= s;
+    }
+}
+
+static void VM_N(softmax)(float *vec, int vec_size)
+{
+    double sum;
+    float max;
+
+    if (vec_size <= 0) {
+        return;
+    }
+
+    max = VM_N(max)(vec, vec_size, -FLT_MAX);
+    sum = VM_N(exp_sum)(vec, vec_size, max);
+    VM_N(scale)(vec, vec_size, (float)(1.0 / sum));
+}
+
+static void VM_N(multi_logit)(float *vec, int vec_size)
+{
+    double sum;
+    float max;
+    float z;
+
+    max = VM_N(max)(vec, vec_size, 0.0f);
+    z = -max;
+    VM_N(exp)(&z, 1);
+    sum = z + VM_N(exp_sum)(vec, vec_size, max);
+    VM_N(scale)(vec, vec_size, (float)(1.0 / sum));
+}
+
+static vm_kernels_t VM_N(vm_kernels) = {
+    .isa = VM_STR(VM_SFX),
+    .exp = VM_N(exp),
+    .log = VM_N(log),
+    .sigmoid = VM_N(sigmoid),
+    .tanh = VM_N(tanh),
+    .softmax = VM_N(softmax),
+    .multi_logit = VM_N(multi_logit),
+};
+
+#undef vf
+#undef vi
+#undef VM_N
+#undef VM_CAT
+#undef VM_CAT_
@@ -137,27 +137,17 @@ int vec_load_body(vec_t *vec, int version, FILE *fp, connlm_fmt_t fmt)
             return -1;
         }
 
-        if (fmt == CONN_FMT_BIN) {
+        // vectors are small, just store them flat in mmap format
+        if (connlm_fmt_is_mmap(fmt)) {
             if (fread(VEC_VALP(vec, 0), sizeof(real_t),
                         vec->size, fp) != vec->size) {
                 ST_ERROR("Failed to read vec.");
                 return -1;
             }
-        } else if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
-            if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-                if (load_sq_zc(VEC_VALP(vec, 0), vec->size, fp) < 0) {
-                    ST_ERROR("Failed to load_sq_zc for vec.");
-                    return -1;
-                }
-            } else {
-                if (load_sq(VEC_VALP(vec, 0), vec->size, fp) < 0) {
-                    ST_ERROR("Failed to load_sq for vec.");
-                    return -1;
-                }
-            }
-        } else if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-            if (load_zc(VEC_VALP(vec, 0), vec->size, fp) < 0) {
-                ST_ERROR("Failed to load_zc for vec.");
+        } else {
+            if (load_rows(VEC_VALP(vec, 0), 1, vec->size,
+                        vec->size, fmt, fp) < 0) {
+                ST_ERROR("Failed to load_rows for vec.");
                 return -1;
             }
         }
@@ -266,27 +256,17 @@ int vec_save_body(vec_t *vec, FILE *fp, connlm_fmt_t fmt, char *name)
             return 0;
         }
 
-        if (fmt == CONN_FMT_BIN) {
+        // vectors are small, just store them flat in mmap format
+        if (connlm_fmt_is_mmap(fmt)) {
             if (fwrite(VEC_VALP(vec, 0), sizeof(real_t),
                         vec->size, fp) != vec->size) {
                 ST_ERROR("Failed to write vec.");
                 return -1;
             }
-        } else if (fmt & CONN_FMT_SHORT_QUANTIZATION) {
-            if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-                if (save_sq_zc(VEC_VALP(vec, 0), vec->size, fp) < 0) {
-                    ST_ERROR("Failed to save_sq_zc for vec.");
-                    return -1;
-                }
-            } else {
-                if (save_sq(VEC_VALP(vec, 0), vec->size, fp) < 0) {
-                    ST_ERROR("Failed to save_sq for vec.");
-                    return -1;
-                }
-            }
-        } else if (fmt & CONN_FMT_ZEROS_COMPRESSED) {
-            if (save_zc(VEC_VALP(vec, 0), vec->size, fp) < 0) {
-                ST_ERROR("Failed to save_zc for vec.");
+        } else {
+            if (save_rows(VEC_VALP(vec, 0), 1, vec->size,
+                        vec->size, fmt, fp) < 0) {
+                ST_ERROR("Failed to save_rows for vec.");
                 return -1;
             }
         }
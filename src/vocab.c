@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 #include <sys/time.h>
 
 #include <stutils/st_macro.h>
@@ -678,27 +679,29 @@ int vocab_load_learn_opt(vocab_learn_opt_t *lr_opt, st_opt_t *opt,
         lr_opt->min_count, 0, "Mininum count for a word to be used "
         "in learning vocab. 0 denotes no limit.");
 
+    ST_OPT_SEC_GET_INT(opt, sec_name, "NUM_THREAD",
+        lr_opt->num_thrs, 1, "Number of threads counting words.");
+    if (lr_opt->num_thrs <= 0) {
+        ST_ERROR("NUM_THREAD must be positive.");
+        goto ST_OPT_ERR;
+    }
+
     return 0;
 
 ST_OPT_ERR:
     return -1;
 }
 
-int vocab_learn(vocab_t *vocab, FILE *fp, vocab_learn_opt_t *lr_opt)
+static word_info_t* vocab_alloc_word_infos(vocab_t *vocab)
 {
-    char word[MAX_SYM_LEN];
-
-    word_info_t *word_infos = NULL;
-    count_t words = 0;
+    word_info_t *word_infos;
     int id;
 
-    ST_CHECK_PARAM(vocab == NULL || fp == NULL || lr_opt == NULL, -1);
-
     word_infos = (word_info_t *)st_malloc(sizeof(word_info_t)
             * vocab->vocab_opt.max_alphabet_size);
     if (word_infos == NULL) {
         ST_ERROR("Failed to st_malloc word_infos.");
-        goto ERR;
+        return NULL;
     }
 
     for (id = 0; id < vocab->vocab_opt.max_alphabet_size; id++) {
@@ -706,37 +709,730 @@ int vocab_learn(vocab_t *vocab, FILE *fp, vocab_learn_opt_t *lr_opt)
         word_infos[id].cnt = 0;
     }
 
-    words = 0;
+    return word_infos;
+}
+
+/*
+ * Get id of a word, adding it into vocab if it is new.
+ * Words not in wordlist are mapped to <unk>.
+ */
+static int vocab_learn_word_id(vocab_t *vocab, const char *word)
+{
+    int id;
+
+    id = vocab_get_id(vocab, word);
+    if (id == -1) {
+        if (vocab->vocab_opt.wordlist[0] != '\0') {
+            id = UNK_ID;
+        } else {
+            id = vocab_add_word(vocab, word);
+            if (id < 0) {
+                ST_ERROR("Failed to vocab_add_word.");
+                return -1;
+            }
+        }
+    }
+
+    return id;
+}
+
+/*
+ * Count words in fp into word_infos.
+ * Return 1 if max_word_num reached.
+ */
+static int vocab_learn_fp(vocab_t *vocab, FILE *fp,
+        vocab_learn_opt_t *lr_opt, word_info_t *word_infos, count_t *words)
+{
+    char word[MAX_SYM_LEN];
+    int id;
+
     while (1) {
         if (vocab_read_word(word, MAX_SYM_LEN, fp) < 0) {
             ST_ERROR("Failed to vocab_read_word.");
-            goto ERR;
+            return -1;
         }
 
         if (feof(fp)) {
             break;
         }
 
+        id = vocab_learn_word_id(vocab, word);
+        if (id < 0) {
+            ST_ERROR("Failed to vocab_learn_word_id.");
+            return -1;
+        }
+        word_infos[id].cnt++;
+
+        (*words)++;
+        if (lr_opt->max_word_num > 0 && *words >= lr_opt->max_word_num) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int vocab_learn(vocab_t *vocab, FILE *fp, vocab_learn_opt_t *lr_opt)
+{
+    word_info_t *word_infos = NULL;
+    count_t words = 0;
+
+    ST_CHECK_PARAM(vocab == NULL || fp == NULL || lr_opt == NULL, -1);
+
+    word_infos = vocab_alloc_word_infos(vocab);
+    if (word_infos == NULL) {
+        ST_ERROR("Failed to vocab_alloc_word_infos.");
+        goto ERR;
+    }
+
+    words = 0;
+    if (vocab_learn_fp(vocab, fp, lr_opt, word_infos, &words) < 0) {
+        ST_ERROR("Failed to vocab_learn_fp.");
+        goto ERR;
+    }
+
+    if (vocab_sort(vocab, word_infos, lr_opt) < 0) {
+        ST_ERROR("Failed to vocab_sort.");
+        goto ERR;
+    }
+
+    ST_NOTICE("Words: " COUNT_FMT, words);
+    ST_NOTICE("Vocab Size: %d", vocab->vocab_size);
+
+    safe_st_free(word_infos);
+    return 0;
+ERR:
+    safe_st_free(word_infos);
+    return -1;
+}
+
+#define VOCAB_CHUNK_SIZE (1 << 20) /* bytes read at a time. */
+#define VOCAB_MIN_RANGE (16 << 20) /* min bytes of a range of file. */
+#define VOCAB_REPORT_BYTES (1LL << 30) /* report interval of unknown size. */
+
+/*
+ * Hash table counting words, with open addressing.
+ * Words are stored in a pool, and referred by offset + 1,
+ * zero means the entry is empty.
+ */
+typedef struct _vocab_cnt_entry_t_ {
+    size_t word; /* offset + 1 of word in pool. */
+    uint64_t hash; /* hash value of word. */
+    count_t cnt; /* count of word. */
+} vocab_cnt_entry_t;
+
+typedef struct _vocab_cnt_tbl_t_ {
+    vocab_cnt_entry_t *entries;
+    size_t capacity; /* always power of 2. */
+    size_t num_entries;
+
+    char *pool;
+    size_t pool_size;
+    size_t pool_cap;
+} vocab_cnt_tbl_t;
+
+static void vocab_cnt_tbl_destroy(vocab_cnt_tbl_t *tbl)
+{
+    safe_st_free(tbl->entries);
+    tbl->capacity = 0;
+    tbl->num_entries = 0;
+    safe_st_free(tbl->pool);
+    tbl->pool_size = 0;
+    tbl->pool_cap = 0;
+}
+
+static inline uint64_t vocab_hash_word(const char *word, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)word[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+static int vocab_cnt_tbl_grow(vocab_cnt_tbl_t *tbl)
+{
+    vocab_cnt_entry_t *entries;
+    size_t capacity;
+    size_t i, j;
+
+    capacity = (tbl->capacity == 0) ? 4096 : tbl->capacity * 2;
+    entries = (vocab_cnt_entry_t *)st_malloc(sizeof(vocab_cnt_entry_t)
+            * capacity);
+    if (entries == NULL) {
+        ST_ERROR("Failed to st_malloc entries.");
+        return -1;
+    }
+    memset(entries, 0, sizeof(vocab_cnt_entry_t) * capacity);
+
+    for (i = 0; i < tbl->capacity; i++) {
+        if (tbl->entries[i].word == 0) {
+            continue;
+        }
+        j = tbl->entries[i].hash & (capacity - 1);
+        while (entries[j].word != 0) {
+            j = (j + 1) & (capacity - 1);
+        }
+        entries[j] = tbl->entries[i];
+    }
+
+    safe_st_free(tbl->entries);
+    tbl->entries = entries;
+    tbl->capacity = capacity;
+
+    return 0;
+}
+
+static int vocab_cnt_tbl_add(vocab_cnt_tbl_t *tbl, const char *word,
+        size_t len)
+{
+    vocab_cnt_entry_t *entry;
+    uint64_t h;
+    size_t i;
+
+    if (tbl->num_entries * 2 >= tbl->capacity) {
+        if (vocab_cnt_tbl_grow(tbl) < 0) {
+            ST_ERROR("Failed to vocab_cnt_tbl_grow.");
+            return -1;
+        }
+    }
+
+    h = vocab_hash_word(word, len);
+    i = h & (tbl->capacity - 1);
+    while (true) {
+        entry = tbl->entries + i;
+        if (entry->word == 0) {
+            break;
+        }
+        if (entry->hash == h
+                && strncmp(tbl->pool + entry->word - 1, word, len) == 0
+                && tbl->pool[entry->word - 1 + len] == '\0') {
+            entry->cnt++;
+            return 0;
+        }
+        i = (i + 1) & (tbl->capacity - 1);
+    }
+
+    if (tbl->pool_size + len + 1 > tbl->pool_cap) {
+        tbl->pool_cap = max(tbl->pool_cap * 2, tbl->pool_size + len + 1);
+        tbl->pool_cap = max(tbl->pool_cap, VOCAB_CHUNK_SIZE);
+        tbl->pool = (char *)st_realloc(tbl->pool, tbl->pool_cap);
+        if (tbl->pool == NULL) {
+            ST_ERROR("Failed to st_realloc pool.");
+            return -1;
+        }
+    }
+    memcpy(tbl->pool + tbl->pool_size, word, len);
+    tbl->pool[tbl->pool_size + len] = '\0';
+
+    entry->word = tbl->pool_size + 1;
+    entry->hash = h;
+    entry->cnt = 1;
+    tbl->pool_size += len + 1;
+    tbl->num_entries++;
+
+    return 0;
+}
+
+/* a byte range of a file, lines starting in [start, end) belong to it. */
+typedef struct _vocab_learn_job_t_ {
+    const char *file; /* file name, "-" for stdin. */
+    off_t start;
+    off_t end; /* -1 for the end of file. */
+} vocab_learn_job_t;
+
+struct _vocab_learn_ctx_t_;
+
+typedef struct _vocab_learner_t_ {
+    struct _vocab_learn_ctx_t_ *ctx;
+
+    vocab_cnt_tbl_t tbl; /* counts of words, if no wordlist. */
+    count_t *id_cnts; /* counts of words in wordlist. */
+    count_t num_words;
+
+    char *buf;
+    pthread_t tid;
+} vocab_learner_t;
+
+typedef struct _vocab_learn_ctx_t_ {
+    vocab_t *vocab; /* read-only while counting. */
+
+    vocab_learn_job_t *jobs;
+    int num_jobs;
+    int next_job;
+
+    off_t total_bytes; /* -1 if unknown, e.g. reading stdin. */
+    off_t read_bytes;
+    off_t next_report;
+    count_t num_words;
+    struct timeval tts;
+    pthread_mutex_t lock;
+
+    int err;
+} vocab_learn_ctx_t;
+
+static int vocab_learner_count(vocab_learner_t *learner,
+        const char *word, size_t len)
+{
+    vocab_t *vocab;
+    int id;
+
+    vocab = learner->ctx->vocab;
+
+    learner->num_words++;
+    if (learner->id_cnts != NULL) {
         id = vocab_get_id(vocab, word);
         if (id == -1) {
-            if (vocab->vocab_opt.wordlist[0] != '\0') {
-                id = UNK_ID;
-            } else {
-                id = vocab_add_word(vocab, word);
-                if (id < 0) {
-                    ST_ERROR("Failed to vocab_add_word.");
-                    goto ERR;
+            id = UNK_ID;
+        }
+        learner->id_cnts[id]++;
+        return 0;
+    }
+
+    if (vocab_cnt_tbl_add(&learner->tbl, word, len) < 0) {
+        ST_ERROR("Failed to vocab_cnt_tbl_add.");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void vocab_learner_report(vocab_learner_t *learner, off_t bytes,
+        count_t words)
+{
+    vocab_learn_ctx_t *ctx;
+    struct timeval tte;
+    long ms;
+
+    ctx = learner->ctx;
+
+    (void)pthread_mutex_lock(&ctx->lock);
+    ctx->read_bytes += bytes;
+    ctx->num_words += words;
+    if (ctx->read_bytes >= ctx->next_report) {
+        gettimeofday(&tte, NULL);
+        ms = TIMEDIFF(ctx->tts, tte);
+        if (ctx->total_bytes > 0) {
+            ST_TRACE("Progress: %.2f%%, Words: " COUNT_FMT
+                    ", words/sec: %.1f", ctx->read_bytes
+                    / (ctx->total_bytes / 100.0), ctx->num_words,
+                    ctx->num_words / ((double) ms / 1000.0));
+            ctx->next_report += max(ctx->total_bytes / 100, 1);
+        } else {
+            ST_TRACE("Bytes: %lld, Words: " COUNT_FMT
+                    ", words/sec: %.1f", (long long)ctx->read_bytes,
+                    ctx->num_words, ctx->num_words / ((double) ms / 1000.0));
+            ctx->next_report += VOCAB_REPORT_BYTES;
+        }
+    }
+    (void)pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * Count words in a job, with the same tokenization as vocab_read_word:
+ * words are split by spaces, tabs and newlines, '\r' is dropped,
+ * every newline gives a </s>, and the word right before EOF is dropped.
+ */
+static int vocab_learner_run_job(vocab_learner_t *learner,
+        vocab_learn_job_t *job)
+{
+    FILE *fp = NULL;
+    char word[MAX_SYM_LEN];
+    size_t len, n, i;
+    off_t pos;
+    count_t last_words;
+    int ch;
+    bool line_start;
+
+    if (strcmp(job->file, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = st_fopen(job->file, "rb");
+        if (fp == NULL) {
+            ST_ERROR("Failed to st_fopen[%s].", job->file);
+            goto ERR;
+        }
+    }
+
+    pos = 0;
+    if (job->start > 0) {
+        /* skip to the first line starting at or after job->start. */
+        if (fseeko(fp, job->start - 1, SEEK_SET) != 0) {
+            ST_ERROR("Failed to fseeko to [%lld].", (long long)job->start);
+            goto ERR;
+        }
+        pos = job->start - 1;
+        while ((ch = fgetc(fp)) != EOF) {
+            pos++;
+            if (ch == '\n') {
+                break;
+            }
+        }
+        if (ch == EOF) {
+            goto RET;
+        }
+    }
+
+    len = 0;
+    line_start = true;
+    last_words = learner->num_words;
+    while (true) {
+        if (line_start && job->end >= 0 && pos >= job->end) {
+            break;
+        }
+
+        n = fread(learner->buf, 1, VOCAB_CHUNK_SIZE, fp);
+        if (n == 0) {
+            if (ferror(fp)) {
+                ST_ERROR("Failed to fread[%s].", job->file);
+                goto ERR;
+            }
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (line_start && job->end >= 0 && pos + i >= job->end) {
+                n = i;
+                break;
+            }
+
+            ch = learner->buf[i];
+            line_start = false;
+            if (ch == 13) {
+                continue;
+            }
+
+            if (ch == ' ' || ch == '\t' || ch == '\n') {
+                if (len > 0) {
+                    word[len] = '\0';
+                    if (vocab_learner_count(learner, word, len) < 0) {
+                        ST_ERROR("Failed to vocab_learner_count.");
+                        goto ERR;
+                    }
+                    len = 0;
+                }
+                if (ch == '\n') {
+                    if (vocab_learner_count(learner, SENT_END,
+                                strlen(SENT_END)) < 0) {
+                        ST_ERROR("Failed to vocab_learner_count.");
+                        goto ERR;
+                    }
+                    line_start = true;
                 }
+                continue;
+            }
+
+            if (len < MAX_SYM_LEN - 1) {
+                word[len] = ch;
+                len++;
             }
         }
-        word_infos[id].cnt++;
+        pos += n;
+
+        vocab_learner_report(learner, n, learner->num_words - last_words);
+        last_words = learner->num_words;
+    }
+
+RET:
+    if (fp != stdin) {
+        safe_fclose(fp);
+    }
+    return 0;
+
+ERR:
+    if (fp != stdin) {
+        safe_fclose(fp);
+    }
+    return -1;
+}
+
+static void* vocab_learner_thread(void *args)
+{
+    vocab_learner_t *learner;
+    vocab_learn_ctx_t *ctx;
+    int j;
+
+    learner = (vocab_learner_t *)args;
+    ctx = learner->ctx;
+
+    while (true) {
+        (void)pthread_mutex_lock(&ctx->lock);
+        if (ctx->err != 0 || ctx->next_job >= ctx->num_jobs) {
+            (void)pthread_mutex_unlock(&ctx->lock);
+            break;
+        }
+        j = ctx->next_job++;
+        (void)pthread_mutex_unlock(&ctx->lock);
+
+        if (vocab_learner_run_job(learner, ctx->jobs + j) < 0) {
+            ST_ERROR("Failed to vocab_learner_run_job[%s].",
+                    ctx->jobs[j].file);
+            (void)pthread_mutex_lock(&ctx->lock);
+            ctx->err = -1;
+            (void)pthread_mutex_unlock(&ctx->lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int vocab_learn_split_jobs(vocab_learn_ctx_t *ctx,
+        const char **files, int num_files, int num_thrs)
+{
+    off_t sz;
+    int num_ranges;
+    int f, r;
+
+    ctx->total_bytes = 0;
+    for (f = 0; f < num_files; f++) {
+        if (strcmp(files[f], "-") == 0) {
+            sz = -1;
+        } else {
+            sz = st_fsize(files[f]);
+        }
+
+        if (sz > 0) {
+            num_ranges = (int)min((off_t)num_thrs,
+                    max(sz / VOCAB_MIN_RANGE, (off_t)1));
+            if (ctx->total_bytes >= 0) {
+                ctx->total_bytes += sz;
+            }
+        } else {
+            // size unknown, e.g. stdin or pipe, read it as a stream
+            num_ranges = 1;
+            ctx->total_bytes = -1;
+        }
+
+        ctx->jobs = (vocab_learn_job_t *)st_realloc(ctx->jobs,
+                sizeof(vocab_learn_job_t) * (ctx->num_jobs + num_ranges));
+        if (ctx->jobs == NULL) {
+            ST_ERROR("Failed to st_realloc jobs.");
+            return -1;
+        }
+
+        for (r = 0; r < num_ranges; r++) {
+            ctx->jobs[ctx->num_jobs].file = files[f];
+            if (sz > 0) {
+                ctx->jobs[ctx->num_jobs].start = sz / num_ranges * r;
+                if (r == num_ranges - 1) {
+                    ctx->jobs[ctx->num_jobs].end = -1;
+                } else {
+                    ctx->jobs[ctx->num_jobs].end = sz / num_ranges * (r + 1);
+                }
+            } else {
+                ctx->jobs[ctx->num_jobs].start = 0;
+                ctx->jobs[ctx->num_jobs].end = -1;
+            }
+            ctx->num_jobs++;
+        }
+    }
+
+    return 0;
+}
+
+static int vocab_learn_merge(vocab_t *vocab, vocab_learner_t *learner,
+        word_info_t *word_infos)
+{
+    vocab_cnt_entry_t *entry;
+    size_t i;
+    int id;
+
+    if (learner->id_cnts != NULL) {
+        for (id = 0; id < st_alphabet_get_label_num(vocab->alphabet); id++) {
+            word_infos[id].cnt += learner->id_cnts[id];
+        }
+        return 0;
+    }
+
+    for (i = 0; i < learner->tbl.capacity; i++) {
+        entry = learner->tbl.entries + i;
+        if (entry->word == 0) {
+            continue;
+        }
+
+        id = vocab_learn_word_id(vocab, learner->tbl.pool + entry->word - 1);
+        if (id < 0) {
+            ST_ERROR("Failed to vocab_learn_word_id.");
+            return -1;
+        }
+        word_infos[id].cnt += entry->cnt;
+    }
+
+    return 0;
+}
+
+static int vocab_learn_parallel(vocab_t *vocab, const char **files,
+        int num_files, vocab_learn_opt_t *lr_opt, word_info_t *word_infos,
+        count_t *words)
+{
+    vocab_learn_ctx_t ctx;
+    vocab_learner_t *learners = NULL;
+    int num_learners = 0;
+    int num_thrs;
+    int i;
+
+    memset(&ctx, 0, sizeof(vocab_learn_ctx_t));
+    ctx.vocab = vocab;
+    if (pthread_mutex_init(&ctx.lock, NULL) != 0) {
+        ST_ERROR("Failed to pthread_mutex_init lock.");
+        return -1;
+    }
+
+    if (vocab_learn_split_jobs(&ctx, files, num_files,
+                lr_opt->num_thrs) < 0) {
+        ST_ERROR("Failed to vocab_learn_split_jobs.");
+        goto ERR;
+    }
+
+    num_thrs = min(lr_opt->num_thrs, ctx.num_jobs);
+    learners = (vocab_learner_t *)st_malloc(sizeof(vocab_learner_t)
+            * num_thrs);
+    if (learners == NULL) {
+        ST_ERROR("Failed to st_malloc learners.");
+        goto ERR;
+    }
+    memset(learners, 0, sizeof(vocab_learner_t) * num_thrs);
+    num_learners = num_thrs;
+
+    for (i = 0; i < num_thrs; i++) {
+        learners[i].ctx = &ctx;
+        learners[i].buf = (char *)st_malloc(VOCAB_CHUNK_SIZE);
+        if (learners[i].buf == NULL) {
+            ST_ERROR("Failed to st_malloc buf.");
+            goto ERR;
+        }
+        if (vocab->vocab_opt.wordlist[0] != '\0') {
+            learners[i].id_cnts = (count_t *)st_malloc(sizeof(count_t)
+                    * st_alphabet_get_label_num(vocab->alphabet));
+            if (learners[i].id_cnts == NULL) {
+                ST_ERROR("Failed to st_malloc id_cnts.");
+                goto ERR;
+            }
+            memset(learners[i].id_cnts, 0, sizeof(count_t)
+                    * st_alphabet_get_label_num(vocab->alphabet));
+        }
+    }
 
-        words++;
-        if (lr_opt->max_word_num > 0 && words >= lr_opt->max_word_num) {
+    gettimeofday(&ctx.tts, NULL);
+    ctx.next_report = (ctx.total_bytes > 0) ? ctx.total_bytes / 100
+                                            : VOCAB_REPORT_BYTES;
+    for (i = 0; i < num_thrs; i++) {
+        if (pthread_create(&learners[i].tid, NULL, vocab_learner_thread,
+                    (void *)(learners + i)) != 0) {
+            ST_ERROR("Failed to pthread_create vocab_learner_thread.");
+            (void)pthread_mutex_lock(&ctx.lock);
+            ctx.err = -1;
+            (void)pthread_mutex_unlock(&ctx.lock);
+            num_thrs = i;
             break;
         }
     }
 
+    for (i = 0; i < num_thrs; i++) {
+        if (pthread_join(learners[i].tid, NULL) != 0) {
+            ST_ERROR("Failed to pthread_join.");
+            ctx.err = -1;
+        }
+    }
+
+    if (ctx.err != 0) {
+        goto ERR;
+    }
+
+    for (i = 0; i < num_thrs; i++) {
+        if (vocab_learn_merge(vocab, learners + i, word_infos) < 0) {
+            ST_ERROR("Failed to vocab_learn_merge.");
+            goto ERR;
+        }
+        *words += learners[i].num_words;
+    }
+
+    if (learners != NULL) {
+        for (i = 0; i < num_learners; i++) {
+            vocab_cnt_tbl_destroy(&learners[i].tbl);
+            safe_st_free(learners[i].id_cnts);
+            safe_st_free(learners[i].buf);
+        }
+        safe_st_free(learners);
+    }
+    safe_st_free(ctx.jobs);
+    (void)pthread_mutex_destroy(&ctx.lock);
+
+    return 0;
+
+ERR:
+    if (learners != NULL) {
+        for (i = 0; i < num_learners; i++) {
+            vocab_cnt_tbl_destroy(&learners[i].tbl);
+            safe_st_free(learners[i].id_cnts);
+            safe_st_free(learners[i].buf);
+        }
+        safe_st_free(learners);
+    }
+    safe_st_free(ctx.jobs);
+    (void)pthread_mutex_destroy(&ctx.lock);
+
+    return -1;
+}
+
+int vocab_learn_files(vocab_t *vocab, const char **files, int num_files,
+        vocab_learn_opt_t *lr_opt)
+{
+    FILE *fp = NULL;
+    word_info_t *word_infos = NULL;
+    count_t words = 0;
+    int f, ret;
+
+    ST_CHECK_PARAM(vocab == NULL || files == NULL || num_files <= 0
+            || lr_opt == NULL, -1);
+
+    word_infos = vocab_alloc_word_infos(vocab);
+    if (word_infos == NULL) {
+        ST_ERROR("Failed to vocab_alloc_word_infos.");
+        goto ERR;
+    }
+
+    words = 0;
+    if (lr_opt->max_word_num > 0) {
+        // only the first max_word_num words are counted
+        for (f = 0; f < num_files; f++) {
+            if (strcmp(files[f], "-") == 0) {
+                fp = stdin;
+            } else {
+                fp = st_fopen(files[f], "rb");
+                if (fp == NULL) {
+                    ST_ERROR("Failed to st_fopen[%s].", files[f]);
+                    goto ERR;
+                }
+            }
+
+            ret = vocab_learn_fp(vocab, fp, lr_opt, word_infos, &words);
+            if (ret < 0) {
+                ST_ERROR("Failed to vocab_learn_fp[%s].", files[f]);
+                goto ERR;
+            }
+            if (fp != stdin) {
+                safe_fclose(fp);
+            }
+            fp = NULL;
+
+            if (ret == 1) {
+                break;
+            }
+        }
+    } else {
+        if (vocab_learn_parallel(vocab, files, num_files, lr_opt,
+                    word_infos, &words) < 0) {
+            ST_ERROR("Failed to vocab_learn_parallel.");
+            goto ERR;
+        }
+    }
+
     if (vocab_sort(vocab, word_infos, lr_opt) < 0) {
         ST_ERROR("Failed to vocab_sort.");
         goto ERR;
@@ -748,6 +1444,9 @@ int vocab_learn(vocab_t *vocab, FILE *fp, vocab_learn_opt_t *lr_opt)
     safe_st_free(word_infos);
     return 0;
 ERR:
+    if (fp != NULL && fp != stdin) {
+        safe_fclose(fp);
+    }
     safe_st_free(word_infos);
     return -1;
 }
@@ -30,6 +30,7 @@ extern "C" {
 #endif
 
 #include <string.h>
+#include <pthread.h>
 
 #include <stutils/st_opt.h>
 #include <stutils/st_alphabet.h>
@@ -165,6 +166,7 @@ typedef struct _vocab_learn_opt_t_ {
     int max_vocab_size; /**< max number of words in vocab. */
     count_t max_word_num; /**< max number of words used to learn vocab. */
     int min_count; /**< min count for a word to be used in learning vocab. */
+    int num_thrs; /**< number of threads counting words. */
 } vocab_learn_opt_t;
 
 /**
@@ -188,6 +190,24 @@ int vocab_load_learn_opt(vocab_learn_opt_t *lr_opt, st_opt_t *opt,
  */
 int vocab_learn(vocab_t *vocab, FILE *fp, vocab_learn_opt_t *lr_opt);
 
+/**
+ * Learn vocab from corpus in several files.
+ * Regular files are split into byte ranges at line boundaries, which
+ * are counted by lr_opt->num_thrs threads with their own hash tables,
+ * and merged at the end. A file named "-" is read from stdin. The
+ * result is the same as vocab_learn on the concatenated text.
+ * Files are read one by one with vocab_learn, if lr_opt->max_word_num
+ * is set, since the words must be counted in order then.
+ * @ingroup g_vocab
+ * @param[in] vocab vocab to be learned.
+ * @param[in] files names of corpus files.
+ * @param[in] num_files number of files.
+ * @param[in] lr_opt option for learning vocab.
+ * @return non-zero value if any error.
+ */
+int vocab_learn_files(vocab_t *vocab, const char **files, int num_files,
+        vocab_learn_opt_t *lr_opt);
+
 /**
  * Get id of a word.
  * @ingroup g_vocab
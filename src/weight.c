@@ -70,6 +70,7 @@ void wt_destroy(weight_t *wt)
 
     mat_destroy(&wt->w);
     vec_destroy(&wt->bias);
+    qmat_destroy(&wt->qw);
 }
 
 static int wt_resize(weight_t *wt, size_t row, size_t col)
@@ -97,6 +98,11 @@ weight_t* wt_dup(weight_t *src)
 
     ST_CHECK_PARAM(src == NULL, NULL);
 
+    if (wt_is_quantized(src)) {
+        ST_ERROR("Can not dup a quantized weight.");
+        return NULL;
+    }
+
     dst = (weight_t *)st_malloc(sizeof(weight_t));
     if (dst == NULL) {
         ST_ERROR("Failed to st_malloc weight_t.");
@@ -516,6 +522,11 @@ int wt_save_body(weight_t *wt, FILE *fp, connlm_fmt_t fmt, char *name)
 
     ST_CHECK_PARAM(fp == NULL, -1);
 
+    if (wt_is_quantized(wt)) {
+        ST_ERROR("Can not save a quantized weight.");
+        return -1;
+    }
+
     if (connlm_fmt_is_bin(fmt)) {
         n = -WT_MAGIC_NUM;
         if (fwrite(&n, sizeof(int), 1, fp) != 1) {
@@ -612,6 +623,10 @@ void wt_sanity_check(weight_t *wt, const char *name)
 
     ST_CHECK_PARAM_VOID(wt == NULL);
 
+    if (wt_is_quantized(wt)) {
+        return;
+    }
+
     n = 0;
     for (i = 0; i < wt->w.num_rows; i++) {
         for (j = 0; j < wt->w.num_cols; j++) {
@@ -641,3 +656,33 @@ void wt_sanity_check(weight_t *wt, const char *name)
         }
     }
 }
+
+int wt_quantize(weight_t *wt)
+{
+    size_t num_rows, num_cols, stride;
+
+    ST_CHECK_PARAM(wt == NULL, -1);
+
+    if (wt_is_quantized(wt) || wt->w.num_rows == 0 || wt->w.num_cols == 0) {
+        return 0;
+    }
+
+    if (qmat_quantize(&wt->qw, &wt->w) < 0) {
+        ST_ERROR("Failed to qmat_quantize.");
+        return -1;
+    }
+
+    // keep the shape, which is used to setup the updaters
+    num_rows = wt->w.num_rows;
+    num_cols = wt->w.num_cols;
+    stride = wt->w.stride;
+    mat_destroy(&wt->w);
+    wt->w.vals = NULL;
+    wt->w.num_rows = num_rows;
+    wt->w.num_cols = num_cols;
+    wt->w.stride = stride;
+    wt->w.capacity = 0;
+    wt->w.is_const = true;
+
+    return 0;
+}
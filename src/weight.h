@@ -59,6 +59,8 @@ typedef enum _weight_init_type_t {
 typedef struct _weight_t_ {
     mat_t w; /**< weight matrix. */
     vec_t bias; /**< bias vector. */
+    qmat_t qw; /**< quantized weight matrix. If set, w only keeps the
+                    shape, its values are released. */
 
     wt_init_type_t init_type; /**< weight init type. */
     real_t init_param; /**< parameter of init type. */
@@ -173,6 +175,17 @@ int wt_init(weight_t *wt, size_t row, size_t col);
  */
 void wt_sanity_check(weight_t *wt, const char *name);
 
+#define wt_is_quantized(wt) ((wt)->qw.vals != NULL)
+
+/**
+ * Quantize weight matrix for inference, and release the real-valued one.
+ * Bias is kept as it is. A quantized weight can not be trained or saved.
+ * @ingroup g_weight
+ * @param[in] wt the weight
+ * @return non-zero value if any error.
+ */
+int wt_quantize(weight_t *wt);
+
 #ifdef __cplusplus
 }
 #endif